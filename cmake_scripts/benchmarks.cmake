@@ -0,0 +1,30 @@
+set(bench_sources src/bench/bench.cpp
+				  src/bench/bench_fdfd.cpp
+				  src/bench/bench_fdtd.cpp
+				  src/bench/bench_optics.cpp
+				  src/bench/bench_selene.cpp
+				  src/bench/bench_structure.cpp)
+
+set(bench_headers src/bench/bench.h)
+
+add_executable(Aether_bench ${bench_sources} ${bench_headers})
+
+target_include_directories(Aether_bench PUBLIC ${CMAKE_SOURCE_DIR}/src/bench)
+
+add_dependencies(Aether_bench Aether_core)
+target_link_libraries(Aether_bench Aether_core)
+
+target_link_libraries(Aether_bench ${LUA_LIBRARIES})
+target_link_libraries(Aether_bench ${FFTW_LIB})
+target_link_libraries(Aether_bench ${PNG_LIBRARY_RELEASE})
+target_link_libraries(Aether_bench ${ZLIB_LIBRARY_RELEASE})
+
+if(WIN32)
+	target_link_libraries(Aether_bench userenv)
+endif()
+
+if(UNIX)
+	target_link_libraries(Aether_bench dl pthread)
+endif()
+
+set_target_properties(Aether_bench PROPERTIES FOLDER "Aether")
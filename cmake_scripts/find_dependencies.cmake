@@ -37,6 +37,14 @@ if(NOT WIN32)
 	find_package(Threads)
 endif()
 
+##########
+#   MPI
+##########
+
+# Optional, enables the z-slab decomposition of the FDTD
+
+find_package(MPI COMPONENTS CXX)
+
 ##########
 #   GUI
 ##########
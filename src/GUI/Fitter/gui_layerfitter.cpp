@@ -449,31 +449,40 @@ void LayerFitter::compute_response(bool silent)
     double h_sub=sub_th_ctrl->get_value()*1e-3;
     double sub_scatt=sub_scatt_ctrl->get_value();
 
-    double R_TE,R_TM;
-    double T_TE,T_TM;
-    double A_TE,A_TM;
+    Multilayer_TMM_Batch ml_12(1,N_data),ml_21(1,N_data);
     
-    Multilayer_TMM lm(1);
+    ml_12.set_layer(0,h);
+    ml_21.set_layer(0,h);
     
     for(int l=0;l<N_data;l++)
     {
         n_sup=std::sqrt(env_eps[l]);
         n_sub=std::sqrt(sub_eps[l]);
         
-        lm.set_environment(n_sup,n_sub);
-        lm.set_lambda(lambda[l]);
-        lm.set_layer(0,h,std::sqrt(layer_eps[l]));
+        Imdouble n_layer=std::sqrt(layer_eps[l]);
         
-        lm.compute_power(R_TE,T_TE,A_TE,R_TM,T_TM,A_TM);
+        ml_12.set_point(l,lambda[l],0);
+        ml_12.set_environment(l,n_sup,n_sub);
+        ml_12.set_index(0,l,n_layer);
         
-//        double R_12=R_TE;
-        double T_12=T_TE;
+        ml_21.set_point(l,lambda[l],0);
+        ml_21.set_environment(l,n_sub,n_sup);
+        ml_21.set_index(0,l,n_layer);
+    }
+    
+    ml_12.compute();
+    ml_21.compute();
+    
+    for(int l=0;l<N_data;l++)
+    {
+        n_sup=std::sqrt(env_eps[l]);
+        n_sub=std::sqrt(sub_eps[l]);
         
-        lm.set_environment(n_sub,n_sup);
-        lm.compute_power(R_TE,T_TE,A_TE,R_TM,T_TM,A_TM);
+//        double R_12=ml_12.R_TE[l];
+        double T_12=ml_12.T_TE[l];
         
-        double R_21=R_TE;
-//        double T_21=T_TE;
+        double R_21=ml_21.R_TE[l];
+//        double T_21=ml_21.T_TE[l];
         
         double R_23=std::norm((n_sub-n_sup)/(n_sub+n_sup));
         double T_23=1.0-R_23;
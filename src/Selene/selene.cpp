@@ -183,6 +183,8 @@ void Selene::fetch_ray_lost(SelRay const &ray)
     }
 }
 
+std::filesystem::path Selene::get_output_directory() const { return output_directory; }
+
 void Selene::render()
 {
     Timer timer;
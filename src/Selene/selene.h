@@ -629,6 +629,7 @@ class Selene
         void add_object(Object *obj);
         void fetch_ray(SelRay const &ray);
         void fetch_ray_lost(SelRay const &ray);
+        std::filesystem::path get_output_directory() const;
         void render();
         void render(int Nr_disp,int Nr_tot);
         void request_raytrace(RayPath &ray_path);
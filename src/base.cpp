@@ -99,6 +99,7 @@ int mode_choice(lua_State *L)
         
         p_mode=&fdtd;
     }
+    else if(mode=="fdtd_sweep") p_mode=lua_allocate_metapointer<FDTD_Sweep_Mode>(L,"metatable_fdtd_sweep");
     else if(mode=="fdfd")
     {
         FDFD_Mode *p_fdfd=lua_allocate_metapointer<FDFD_Mode>(L,"metatable_fdfd");
@@ -266,6 +267,7 @@ int mode_choice(lua_State *L)
     metatable_add_func(L,"structure",FD_mode_set_structure);
     
     FDTD_Mode_create_metatable(L);
+    FDTD_Sweep_Mode_create_metatable(L);
     Sensor_generator_create_metatable(L);
     Source_generator_create_metatable(L);
     
@@ -0,0 +1,358 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <bench.h>
+#include <thread_utils.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+//###############
+//   BenchCase
+//###############
+
+BenchCase::BenchCase(std::string const &name_,std::string const &unit_)
+    :name(name_), unit(unit_), work(0)
+{
+}
+
+BenchCase::~BenchCase()
+{
+}
+
+void BenchCase::teardown()
+{
+}
+
+//#################
+//   BenchResult
+//#################
+
+BenchResult::BenchResult()
+    :scale(1), work(0),
+     t_min(0), t_median(0), t_mean(0), t_stddev(0)
+{
+}
+
+void BenchResult::compute_stats()
+{
+    std::size_t N=times.size();
+    if(N==0) return;
+    
+    std::vector<double> sorted=times;
+    std::sort(sorted.begin(),sorted.end());
+    
+    t_min=sorted[0];
+    
+    if(N%2==1) t_median=sorted[N/2];
+    else t_median=0.5*(sorted[N/2-1]+sorted[N/2]);
+    
+    t_mean=0;
+    for(std::size_t i=0;i<N;i++) t_mean+=times[i];
+    t_mean/=N;
+    
+    t_stddev=0;
+    for(std::size_t i=0;i<N;i++) t_stddev+=(times[i]-t_mean)*(times[i]-t_mean);
+    t_stddev=std::sqrt(t_stddev/N);
+}
+
+double BenchResult::rate_best() const
+{
+    return t_min>0 ? work/t_min : 0;
+}
+
+double BenchResult::rate_median() const
+{
+    return t_median>0 ? work/t_median : 0;
+}
+
+//###########
+//   Tools
+//###########
+
+static double bench_run_time(BenchCase &bench_case)
+{
+    std::chrono::steady_clock::time_point a=std::chrono::steady_clock::now();
+    
+    bench_case.run();
+    
+    std::chrono::steady_clock::time_point b=std::chrono::steady_clock::now();
+    
+    return std::chrono::duration<double>(b-a).count();
+}
+
+// Only reads back what write_json produces: one case per line, name first
+
+static void read_reference(std::filesystem::path const &fname,std::map<std::string,double> &ref_rates)
+{
+    std::ifstream file(fname,std::ios::in);
+    
+    if(!file.is_open())
+    {
+        std::cerr<<"Could not read "<<fname.generic_string()<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    std::string line;
+    std::string name_key="\"name\": \"";
+    std::string rate_key="\"rate_median\": ";
+    
+    while(std::getline(file,line))
+    {
+        std::size_t p_name=line.find(name_key);
+        std::size_t p_rate=line.find(rate_key);
+        
+        if(p_name==std::string::npos || p_rate==std::string::npos) continue;
+        
+        p_name+=name_key.size();
+        std::string name=line.substr(p_name,line.find('"',p_name)-p_name);
+        
+        ref_rates[name]=std::stod(line.substr(p_rate+rate_key.size()));
+    }
+}
+
+static void write_json(std::filesystem::path const &fname,std::string const &tag,
+                       int warmup,int repetitions,std::vector<BenchResult> const &results)
+{
+    std::ofstream file(fname,std::ios::out|std::ios::trunc);
+    
+    if(!file.is_open())
+    {
+        std::cerr<<"Could not write "<<fname.generic_string()<<std::endl;
+        return;
+    }
+    
+    file<<std::setprecision(10);
+    
+    file<<"{\n";
+    file<<"    \"tag\": \""<<tag<<"\",\n";
+    file<<"    \"threads\": "<<max_threads_number()<<",\n";
+    file<<"    \"warmup\": "<<warmup<<",\n";
+    file<<"    \"repetitions\": "<<repetitions<<",\n";
+    file<<"    \"cases\": [\n";
+    
+    for(std::size_t i=0;i<results.size();i++)
+    {
+        BenchResult const &res=results[i];
+        
+        file<<"        { "
+            <<"\"name\": \""<<res.name<<"\", "
+            <<"\"unit\": \""<<res.unit<<"\", "
+            <<"\"scale\": "<<res.scale<<", "
+            <<"\"work\": "<<res.work<<", "
+            <<"\"rate_median\": "<<res.rate_median()<<", "
+            <<"\"rate_best\": "<<res.rate_best()<<", "
+            <<"\"time_min\": "<<res.t_min<<", "
+            <<"\"time_median\": "<<res.t_median<<", "
+            <<"\"time_mean\": "<<res.t_mean<<", "
+            <<"\"time_stddev\": "<<res.t_stddev<<", "
+            <<"\"times\": [";
+        
+        for(std::size_t j=0;j<res.times.size();j++)
+        {
+            file<<res.times[j];
+            if(j+1<res.times.size()) file<<", ";
+        }
+        
+        file<<"] }";
+        if(i+1<results.size()) file<<",";
+        file<<"\n";
+    }
+    
+    file<<"    ]\n";
+    file<<"}\n";
+}
+
+static int parse_int(std::vector<std::string> const &args,int &curr_arg,int min_value)
+{
+    if(curr_arg+1>=static_cast<int>(args.size()))
+    {
+        std::cerr<<"Missing argument for '"<<args[curr_arg]<<"'."<<std::endl;
+        std::cerr<<"Try '"<<args[0]<<" --help' for more information."<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    curr_arg++;
+    int value=std::atoi(args[curr_arg].c_str());
+    
+    if(value<min_value)
+    {
+        std::cerr<<"Invalid value '"<<args[curr_arg]<<"' for '"<<args[curr_arg-1]<<"'."<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    return value;
+}
+
+static std::string parse_string(std::vector<std::string> const &args,int &curr_arg)
+{
+    if(curr_arg+1>=static_cast<int>(args.size()))
+    {
+        std::cerr<<"Missing argument for '"<<args[curr_arg]<<"'."<<std::endl;
+        std::cerr<<"Try '"<<args[0]<<" --help' for more information."<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    curr_arg++;
+    
+    return args[curr_arg];
+}
+
+//##########
+//   Main
+//##########
+
+int main(int n_args,char **argv)
+{
+    int scale=1;
+    int warmup=1;
+    int repetitions=5;
+    double tolerance=10.0;
+    bool list_only=false;
+    
+    std::string filter,tag;
+    std::filesystem::path json_fname="aether_bench.json",
+                          ref_fname;
+    
+    std::vector<std::string> args(n_args);
+    for(int i=0;i<n_args;i++) args[i]=argv[i];
+    
+    int curr_arg=1;
+    
+    while(curr_arg<n_args)
+    {
+             if(args[curr_arg]=="-s") scale=parse_int(args,curr_arg,1);
+        else if(args[curr_arg]=="-w") warmup=parse_int(args,curr_arg,0);
+        else if(args[curr_arg]=="-r") repetitions=parse_int(args,curr_arg,1);
+        else if(args[curr_arg]=="-f") filter=parse_string(args,curr_arg);
+        else if(args[curr_arg]=="-o") json_fname=parse_string(args,curr_arg);
+        else if(args[curr_arg]=="-c") ref_fname=parse_string(args,curr_arg);
+        else if(args[curr_arg]=="-t") tolerance=parse_int(args,curr_arg,0);
+        else if(args[curr_arg]=="--tag") tag=parse_string(args,curr_arg);
+        else if(args[curr_arg]=="-l") list_only=true;
+        else if(args[curr_arg]=="-h" || args[curr_arg]=="--help")
+        {
+            std::cout<<"Usage: "<<args[0]<<" [-s SCALE] [-w WARMUP] [-r REPETITIONS] [-f FILTER] [-o OUTPUT]"
+                     <<" [-c REFERENCE] [-t TOLERANCE] [--tag TAG] [-l]"<<std::endl;
+            std::cout<<"  -s  linear size factor of the workloads (default 1)"<<std::endl;
+            std::cout<<"  -w  untimed runs before the measurements (default 1)"<<std::endl;
+            std::cout<<"  -r  timed runs, the median being reported (default 5)"<<std::endl;
+            std::cout<<"  -f  only run the cases whose name contains FILTER"<<std::endl;
+            std::cout<<"  -o  JSON output file (default aether_bench.json)"<<std::endl;
+            std::cout<<"  -c  compare against a previous JSON output, failing on regressions"<<std::endl;
+            std::cout<<"  -t  allowed slowdown against the reference, in percents (default 10)"<<std::endl;
+            std::cout<<"  -l  list the cases and exit"<<std::endl;
+            std::exit(EXIT_SUCCESS);
+        }
+        else
+        {
+            std::cerr<<"Invalid option '"<<args[curr_arg]<<"'."<<std::endl;
+            std::cerr<<"Try '"<<args[0]<<" --help' for more information."<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        
+        curr_arg++;
+    }
+    
+    std::vector<BenchCase*> cases;
+    
+    bench_fdtd_cases(cases);
+    bench_fdfd_cases(cases);
+    bench_selene_cases(cases);
+    bench_optics_cases(cases);
+    bench_structure_cases(cases);
+    
+    if(list_only)
+    {
+        for(std::size_t i=0;i<cases.size();i++)
+            std::cout<<cases[i]->name<<" ("<<cases[i]->unit<<")"<<std::endl;
+        
+        for(std::size_t i=0;i<cases.size();i++) delete cases[i];
+        
+        return EXIT_SUCCESS;
+    }
+    
+    std::map<std::string,double> ref_rates;
+    if(!ref_fname.empty()) read_reference(ref_fname,ref_rates);
+    
+    std::vector<BenchResult> results;
+    int N_regressions=0;
+    
+    for(std::size_t i=0;i<cases.size();i++)
+    {
+        BenchCase &bench_case=*cases[i];
+        
+        if(!filter.empty() && bench_case.name.find(filter)==std::string::npos) continue;
+        
+        std::cout<<bench_case.name<<": "<<std::flush;
+        
+        BenchResult res;
+        res.name=bench_case.name;
+        res.unit=bench_case.unit;
+        res.scale=scale;
+        
+        bench_case.setup(scale);
+        
+        for(int r=0;r<warmup;r++) bench_run_time(bench_case);
+        for(int r=0;r<repetitions;r++) res.times.push_back(bench_run_time(bench_case));
+        
+        bench_case.teardown();
+        
+        res.work=bench_case.work;
+        res.compute_stats();
+        
+        std::cout<<res.rate_median()<<" "<<res.unit
+                 <<" (best "<<res.rate_best()<<", "
+                 <<"median "<<res.t_median<<" s, "
+                 <<"spread "<<(res.t_mean>0 ? 100.0*res.t_stddev/res.t_mean : 0)<<"%)";
+        
+        if(ref_rates.count(res.name)>0 && ref_rates[res.name]>0)
+        {
+            double ratio=res.rate_median()/ref_rates[res.name];
+            
+            std::cout<<", "<<ratio<<"x reference";
+            
+            if(ratio<1.0-tolerance/100.0)
+            {
+                std::cout<<" REGRESSION";
+                N_regressions++;
+            }
+        }
+        
+        std::cout<<std::endl;
+        
+        results.push_back(res);
+    }
+    
+    write_json(json_fname,tag,warmup,repetitions,results);
+    
+    for(std::size_t i=0;i<cases.size();i++) delete cases[i];
+    
+    if(N_regressions>0)
+    {
+        std::cerr<<N_regressions<<" case(s) slower than the reference beyond "<<tolerance<<"%"<<std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
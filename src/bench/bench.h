@@ -0,0 +1,62 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+
+// A canonical workload of the benchmark harness
+// setup() builds the problem for a given scale and sets work to the amount of work,
+// expressed in unit, performed by a single call to run(), which is the only timed part
+
+class BenchCase
+{
+    public:
+        std::string name,unit;
+        double work;
+        
+        BenchCase(std::string const &name,std::string const &unit);
+        virtual ~BenchCase();
+        
+        virtual void run()=0;
+        virtual void setup(int scale)=0;
+        virtual void teardown();
+};
+
+class BenchResult
+{
+    public:
+        std::string name,unit;
+        int scale;
+        double work;
+        std::vector<double> times;
+        
+        double t_min,t_median,t_mean,t_stddev;
+        
+        BenchResult();
+        
+        void compute_stats();
+        double rate_best() const;
+        double rate_median() const;
+};
+
+void bench_fdfd_cases(std::vector<BenchCase*> &cases);
+void bench_fdtd_cases(std::vector<BenchCase*> &cases);
+void bench_optics_cases(std::vector<BenchCase*> &cases);
+void bench_selene_cases(std::vector<BenchCase*> &cases);
+void bench_structure_cases(std::vector<BenchCase*> &cases);
+
+#endif // BENCH_H
@@ -0,0 +1,99 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <bench.h>
+#include <fdfd.h>
+#include <material.h>
+
+//###################
+//   FDFD_BenchCase
+//###################
+
+// Periodic 2D grating under normal incidence, swept over a few wavelengths
+// Each wavelength is a full assembly and LU factorization of the system
+
+class FDFD_BenchCase: public BenchCase
+{
+    public:
+        int Nl;
+        FDFD *fdfd;
+        
+        FDFD_BenchCase()
+            :BenchCase("fdfd_2D_sweep","solves/s"),
+             Nl(4), fdfd(nullptr)
+        {
+        }
+        
+        ~FDFD_BenchCase()
+        {
+            teardown();
+        }
+        
+        void run()
+        {
+            for(int l=0;l<Nl;l++)
+            {
+                double lambda=500e-9+l*200e-9/(Nl-1.0);
+                
+                fdfd->solve_prop_2D(lambda,Degree(0),Degree(0),Degree(0));
+            }
+        }
+        
+        void setup(int scale)
+        {
+            int Nx=40*scale;
+            int Nz=60*scale;
+            double D=10e-9;
+            
+            fdfd=new FDFD(D,D,D);
+            
+            fdfd->set_padding(0,0,0,0,10,10);
+            fdfd->set_pml_zm(20,25.0,1.0,0.2);
+            fdfd->set_pml_zp(20,25.0,1.0,0.2);
+            
+            // Substrate on the lower half, topped by a grating line
+            
+            Grid3<unsigned int> matsgrid(Nx,1,Nz,0);
+            
+            for(int i=0;i<Nx;i++) for(int k=0;k<Nz;k++)
+            {
+                if(k<Nz/2) matsgrid(i,0,k)=1;
+                else if(k<3*Nz/4 && i>=Nx/4 && i<3*Nx/4) matsgrid(i,0,k)=1;
+            }
+            
+            fdfd->set_matsgrid(matsgrid);
+            
+            Material air,glass;
+            air.set_const_n(1.0);
+            glass.set_const_n(1.5);
+            
+            fdfd->set_material(0,air);
+            fdfd->set_material(1,glass);
+            
+            fdfd->set_injection_plane_z(fdfd->zs_e+1);
+            
+            work=Nl;
+        }
+        
+        void teardown()
+        {
+            delete fdfd;
+            fdfd=nullptr;
+        }
+};
+
+void bench_fdfd_cases(std::vector<BenchCase*> &cases)
+{
+    cases.push_back(new FDFD_BenchCase);
+}
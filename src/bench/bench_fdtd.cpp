@@ -0,0 +1,145 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <bench.h>
+#include <fdtd_core.h>
+#include <material.h>
+#include <mathUT.h>
+#include <phys_constants.h>
+
+//###################
+//   FDTD_BenchCase
+//###################
+
+// Cubic domains of N^3 cells, N growing linearly with the scale
+// The fields are seeded with noise so that every cell carries a non trivial value
+
+class FDTD_BenchCase: public BenchCase
+{
+    public:
+        enum
+        {
+            VACUUM,
+            DIELECTRIC,
+            DRUDE
+        };
+        
+        int filling,N_pml,Nt;
+        FDTD *fdtd;
+        
+        FDTD_BenchCase(std::string const &name,int filling_,int N_pml_)
+            :BenchCase(name,"Mcell-updates/s"),
+             filling(filling_), N_pml(N_pml_), Nt(10),
+             fdtd(nullptr)
+        {
+        }
+        
+        ~FDTD_BenchCase()
+        {
+            teardown();
+        }
+        
+        void run()
+        {
+            for(int t=0;t<Nt;t++)
+            {
+                fdtd->update_E();
+                fdtd->update_H();
+            }
+        }
+        
+        void setup(int scale)
+        {
+            int N=48*scale;
+            double D=10e-9;
+            
+            fdtd=new FDTD(N,N,N,Nt,D,D,D,D/(2.0*c_light),"CUSTOM",
+                          N_pml,N_pml,N_pml,N_pml,N_pml,N_pml);
+            
+            fdtd->set_pml_xm(25.0,1.0,0.2); fdtd->set_pml_xp(25.0,1.0,0.2);
+            fdtd->set_pml_ym(25.0,1.0,0.2); fdtd->set_pml_yp(25.0,1.0,0.2);
+            fdtd->set_pml_zm(25.0,1.0,0.2); fdtd->set_pml_zp(25.0,1.0,0.2);
+            
+            int i,j,k;
+            
+            Grid3<unsigned int> matsgrid(fdtd->Nx_s,fdtd->Ny_s,fdtd->Nz_s,0);
+            
+            if(filling!=VACUUM)
+            {
+                // Centered sphere of radius N/3
+                
+                double r2=(N/3.0)*(N/3.0);
+                
+                for(i=0;i<fdtd->Nx_s;i++){ for(j=0;j<fdtd->Ny_s;j++){ for(k=0;k<fdtd->Nz_s;k++)
+                {
+                    double x=i-fdtd->Nx_s/2.0;
+                    double y=j-fdtd->Ny_s/2.0;
+                    double z=k-fdtd->Nz_s/2.0;
+                    
+                    if(x*x+y*y+z*z<=r2) matsgrid(i,j,k)=1;
+                }}}
+            }
+            
+            fdtd->set_matsgrid(matsgrid);
+            
+            Material vacuum;
+            fdtd->set_material(0,vacuum);
+            
+            if(filling==DIELECTRIC)
+            {
+                Material glass;
+                glass.set_const_n(1.5);
+                
+                fdtd->set_material(1,glass);
+            }
+            else if(filling==DRUDE)
+            {
+                Material metal;
+                metal.eps_inf=1.0;
+                metal.drude.resize(1);
+                metal.drude[0].set(1.37e16,1.07e14);
+                
+                fdtd->set_material(1,metal);
+            }
+            
+            fdtd->set_kx(0);
+            fdtd->set_ky(0);
+            fdtd->bootstrap();
+            
+            seedp(0);
+            
+            for(i=0;i<fdtd->Nx;i++){ for(j=0;j<fdtd->Ny;j++){ for(k=0;k<fdtd->Nz;k++)
+            {
+                fdtd->Ex(i,j,k)=randp(-1.0,1.0);
+                fdtd->Ey(i,j,k)=randp(-1.0,1.0);
+                fdtd->Ez(i,j,k)=randp(-1.0,1.0);
+            }}}
+            
+            work=Nt*static_cast<double>(fdtd->Nx)*fdtd->Ny*fdtd->Nz/1e6;
+        }
+        
+        void teardown()
+        {
+            delete fdtd;
+            fdtd=nullptr;
+        }
+};
+
+void bench_fdtd_cases(std::vector<BenchCase*> &cases)
+{
+    cases.push_back(new FDTD_BenchCase("fdtd_vacuum",FDTD_BenchCase::VACUUM,0));
+    cases.push_back(new FDTD_BenchCase("fdtd_dielectric",FDTD_BenchCase::DIELECTRIC,0));
+    cases.push_back(new FDTD_BenchCase("fdtd_drude",FDTD_BenchCase::DRUDE,0));
+    cases.push_back(new FDTD_BenchCase("fdtd_pml",FDTD_BenchCase::VACUUM,16));
+}
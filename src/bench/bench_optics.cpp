@@ -0,0 +1,192 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <bench.h>
+#include <berreman_strat.h>
+#include <mie.h>
+#include <multilayers.h>
+
+// The results are accumulated in checksum so that the computations can't be optimized away
+
+//##################
+//   TMM_BenchCase
+//##################
+
+// Quarter-wave Bragg mirror, with as many periods as 10 times the scale, over a dense spectrum
+
+class TMM_BenchCase: public BenchCase
+{
+    public:
+        int Nl;
+        double checksum;
+        Multilayer *ml;
+        
+        TMM_BenchCase()
+            :BenchCase("multilayer_tmm","solves/s"),
+             Nl(5000), checksum(0), ml(nullptr)
+        {
+        }
+        
+        ~TMM_BenchCase()
+        {
+            teardown();
+        }
+        
+        void run()
+        {
+            double R_TE,T_TE,A_TE,R_TM,T_TM,A_TM;
+            
+            for(int l=0;l<Nl;l++)
+            {
+                ml->set_lambda(400e-9+l*400e-9/(Nl-1.0));
+                ml->set_angle(Degree(30));
+                ml->compute_power(R_TE,T_TE,A_TE,R_TM,T_TM,A_TM);
+                
+                checksum+=R_TE+R_TM;
+            }
+        }
+        
+        void setup(int scale)
+        {
+            int Nlayers=20*scale;
+            
+            ml=new Multilayer(Nlayers);
+            ml->set_environment(1.0,1.5);
+            
+            for(int i=0;i<Nlayers;i++)
+            {
+                if(i%2==0) ml->set_layer(i,600e-9/(4.0*2.4),2.4);
+                else ml->set_layer(i,600e-9/(4.0*1.45),1.45);
+            }
+            
+            work=Nl;
+        }
+        
+        void teardown()
+        {
+            delete ml;
+            ml=nullptr;
+        }
+};
+
+//########################
+//   Berreman_BenchCase
+//########################
+
+// Same stack through the 4x4 formalism
+
+class Berreman_BenchCase: public BenchCase
+{
+    public:
+        int Nl;
+        double checksum;
+        B_strat *strat;
+        
+        Berreman_BenchCase()
+            :BenchCase("multilayer_berreman","solves/s"),
+             Nl(2000), checksum(0), strat(nullptr)
+        {
+        }
+        
+        ~Berreman_BenchCase()
+        {
+            teardown();
+        }
+        
+        void run()
+        {
+            Imdouble r_TE,r_TM,t_TE,t_TM;
+            
+            for(int l=0;l<Nl;l++)
+            {
+                strat->compute(400e-9+l*400e-9/(Nl-1.0),Degree(30),r_TE,r_TM,t_TE,t_TM);
+                
+                checksum+=std::norm(r_TE)+std::norm(r_TM);
+            }
+        }
+        
+        void setup(int scale)
+        {
+            int Nlayers=20*scale;
+            
+            strat=new B_strat(Nlayers,1.0,1.5);
+            
+            for(int i=0;i<Nlayers;i++)
+            {
+                if(i%2==0) strat->set_iso(i,600e-9/(4.0*2.4),2.4*2.4,1.0);
+                else strat->set_iso(i,600e-9/(4.0*1.45),1.45*1.45,1.0);
+            }
+            
+            work=Nl;
+        }
+        
+        void teardown()
+        {
+            delete strat;
+            strat=nullptr;
+        }
+};
+
+//##################
+//   Mie_BenchCase
+//##################
+
+// Absorbing sphere swept over its radius and the wavelength
+// The largest size parameter, and thus the number of terms of the series, grows with the scale
+
+class Mie_BenchCase: public BenchCase
+{
+    public:
+        int Nl,Nr;
+        double r_max,checksum;
+        Mie mie;
+        
+        Mie_BenchCase()
+            :BenchCase("mie_sweep","solves/s"),
+             Nl(50), Nr(20), r_max(0), checksum(0)
+        {
+        }
+        
+        void run()
+        {
+            for(int r=0;r<Nr;r++)
+            {
+                mie.set_radius(r_max*(r+1.0)/Nr);
+                
+                for(int l=0;l<Nl;l++)
+                {
+                    mie.set_lambda(400e-9+l*400e-9/(Nl-1.0));
+                    
+                    checksum+=mie.get_Qext()+mie.get_Qabs();
+                }
+            }
+        }
+        
+        void setup(int scale)
+        {
+            r_max=500e-9*scale;
+            
+            mie.set_NRec(50*scale);
+            mie.set_index(Imdouble(1.5,0.1),1.0);
+            
+            work=Nl*Nr;
+        }
+};
+
+void bench_optics_cases(std::vector<BenchCase*> &cases)
+{
+    cases.push_back(new TMM_BenchCase);
+    cases.push_back(new Berreman_BenchCase);
+    cases.push_back(new Mie_BenchCase);
+}
@@ -0,0 +1,194 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <bench.h>
+#include <material.h>
+#include <selene.h>
+
+#include <filesystem>
+
+//#####################
+//   Selene_BenchCase
+//#####################
+
+// Collimated beam through a pair of lenses, as in the dual_lens sample, or through a tessellated ball lens
+// The number of rays grows with the scale, and so does the number of facets of the ball
+
+class Selene_BenchCase: public BenchCase
+{
+    public:
+        bool mesh_scene;
+        int Nr_tot;
+        Material air,glass;
+        Sel::IRF fresnel;
+        Sel::Light light;
+        std::vector<Sel::Object*> objects;
+        Sel::Selene *selene;
+        
+        Selene_BenchCase(std::string const &name,bool mesh_scene_)
+            :BenchCase(name,"rays/s"),
+             mesh_scene(mesh_scene_), Nr_tot(0),
+             selene(nullptr)
+        {
+        }
+        
+        ~Selene_BenchCase()
+        {
+            teardown();
+        }
+        
+        void run()
+        {
+            selene->render();
+        }
+        
+        void setup(int scale)
+        {
+            air.set_const_n(1.0);
+            glass.set_const_n(1.5);
+            fresnel.set_type_fresnel();
+            
+            if(mesh_scene)
+            {
+                std::vector<Sel::Vertex> V_arr;
+                std::vector<Sel::SelFace> F_arr;
+                
+                ball_mesh(V_arr,F_arr,0.05,32*scale);
+                
+                Sel::Object *ball=new Sel::Object;
+                ball->set_mesh(V_arr,F_arr);
+                objects.push_back(ball);
+            }
+            else
+            {
+                Sel::Object *lens_1=new Sel::Object;
+                Sel::Object *lens_2=new Sel::Object;
+                
+                lens_1->set_lens(0.01,0.1,0.3,-0.3);
+                lens_2->set_lens(0.01,0.1,0.1,-0.1);
+                lens_2->set_displacement(0.4,0,0);
+                
+                objects.push_back(lens_1);
+                objects.push_back(lens_2);
+            }
+            
+            light.set_type(Sel::SRC_PERFECT_BEAM);
+            light.set_displacement(-0.2,0,0);
+            light.amb_mat=&air;
+            light.spectrum_type=Sel::SPECTRUM_MONO;
+            light.lambda_mono=550e-9;
+            light.extent=Sel::EXTENT_CIRCLE;
+            light.extent_d=0.05;
+            
+            Nr_tot=20000*scale;
+            
+            selene=new Sel::Selene;
+            selene->set_max_ray_bounces(200);
+            selene->set_N_rays_total(Nr_tot);
+            selene->set_N_rays_disp(0);
+            selene->set_output_directory(std::filesystem::temp_directory_path() / "aether_bench");
+            
+            for(std::size_t i=0;i<objects.size();i++)
+            {
+                objects[i]->set_default_in_mat(&glass);
+                objects[i]->set_default_out_mat(&air);
+                objects[i]->set_default_irf(&fresnel);
+                
+                selene->add_object(objects[i]);
+            }
+            
+            selene->add_light(&light);
+            
+            work=Nr_tot;
+        }
+        
+        void teardown()
+        {
+            delete selene;
+            selene=nullptr;
+            
+            for(std::size_t i=0;i<objects.size();i++)
+                delete objects[i];
+            
+            objects.clear();
+        }
+        
+        // Latitude-longitude sphere, with outward facing normals
+        
+        static void ball_mesh(std::vector<Sel::Vertex> &V_arr,std::vector<Sel::SelFace> &F_arr,
+                              double radius,int Nphi)
+        {
+            int i,j;
+            int Nth=Nphi/2;
+            
+            V_arr.clear();
+            F_arr.clear();
+            
+            V_arr.push_back(Sel::Vertex(0,0,radius));
+            
+            for(i=1;i<Nth;i++)
+            {
+                double th=i*Pi/Nth;
+                
+                for(j=0;j<Nphi;j++)
+                {
+                    double phi=j*2.0*Pi/Nphi;
+                    
+                    V_arr.push_back(Sel::Vertex(radius*std::sin(th)*std::cos(phi),
+                                                radius*std::sin(th)*std::sin(phi),
+                                                radius*std::cos(th)));
+                }
+            }
+            
+            V_arr.push_back(Sel::Vertex(0,0,-radius));
+            
+            int south=V_arr.size()-1;
+            
+            for(j=0;j<Nphi;j++)
+            {
+                int j2=(j+1)%Nphi;
+                
+                F_arr.push_back(Sel::SelFace(0,1+j,1+j2));
+                F_arr.push_back(Sel::SelFace(south,1+(Nth-2)*Nphi+j2,1+(Nth-2)*Nphi+j));
+                
+                for(i=0;i<Nth-2;i++)
+                {
+                    int a=1+i*Nphi+j;
+                    int b=1+i*Nphi+j2;
+                    
+                    F_arr.push_back(Sel::SelFace(a,a+Nphi,b+Nphi));
+                    F_arr.push_back(Sel::SelFace(a,b+Nphi,b));
+                }
+            }
+            
+            for(std::size_t f=0;f<F_arr.size();f++)
+            {
+                Sel::SelFace &face=F_arr[f];
+                
+                face.comp_norm(V_arr);
+                
+                if(scalar_prod(face.norm,V_arr[face.V1].loc)<0)
+                {
+                    std::swap(face.V2,face.V3);
+                    face.comp_norm(V_arr);
+                }
+            }
+        }
+};
+
+void bench_selene_cases(std::vector<BenchCase*> &cases)
+{
+    cases.push_back(new Selene_BenchCase("selene_lens",false));
+    cases.push_back(new Selene_BenchCase("selene_mesh",true));
+}
@@ -0,0 +1,77 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <bench.h>
+#include <structure.h>
+
+//########################
+//   Structure_BenchCase
+//########################
+
+// Substrate with a lattice of spheres and crossed rods, discretized on N^3 cells
+
+class Structure_BenchCase: public BenchCase
+{
+    public:
+        int N;
+        double D;
+        Grid3<unsigned int> matsgrid;
+        Structure structure;
+        
+        Structure_BenchCase()
+            :BenchCase("structure_voxelize","Mcells/s"),
+             N(0), D(0)
+        {
+        }
+        
+        ~Structure_BenchCase()
+        {
+            structure.finalize();
+        }
+        
+        void run()
+        {
+            structure.discretize(matsgrid,N,N,N,D,D,D);
+        }
+        
+        void setup(int scale)
+        {
+            N=128*scale;
+            D=300e-9/N;
+            
+            structure.finalize();
+            
+            structure.add_operation(new Add_Block(0,300e-9,0,300e-9,0,100e-9,1));
+            
+            for(int i=0;i<3;i++) for(int j=0;j<3;j++)
+            {
+                double x=(i+0.5)*100e-9;
+                double y=(j+0.5)*100e-9;
+                
+                structure.add_operation(new Add_Ellipsoid(x,y,150e-9,40e-9,40e-9,40e-9,2));
+            }
+            
+            structure.add_operation(new Add_Cylinder(0,150e-9,250e-9,300e-9,150e-9,250e-9,20e-9,3));
+            structure.add_operation(new Add_Cylinder(150e-9,0,250e-9,150e-9,300e-9,250e-9,20e-9,3));
+            
+            matsgrid.init(N,N,N,0);
+            
+            work=static_cast<double>(N)*N*N/1e6;
+        }
+};
+
+void bench_structure_cases(std::vector<BenchCase*> &cases)
+{
+    cases.push_back(new Structure_BenchCase);
+}
@@ -32,6 +32,13 @@ limitations under the License.*/
 
 std::ofstream plog;
 
+std::mutex& plog_mutex()
+{
+    static std::mutex mtx;
+    
+    return mtx;
+}
+
 
 AsciiDataLoader::AsciiDataLoader()
     :file_ok(false)
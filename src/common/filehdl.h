@@ -20,6 +20,7 @@ limitations under the License.*/
 
 #include <filesystem>
 #include <fstream>
+#include <mutex>
 
 class AsciiDataLoader
 {
@@ -70,4 +71,8 @@ class PathManager
 std::filesystem::path to_relative_file(std::filesystem::path file,
                                        std::filesystem::path base);
 
+// The global log may be written from several simultaneous solvers, each
+// write has to hold this lock
+std::mutex& plog_mutex();
+
 #endif // FILEHDL_H
@@ -43,9 +43,12 @@ double exp_dec(double x)
 //}
 
 
-std::mt19937 mte(std::time(0));
+// One generator per thread, so that concurrent optimization contexts can
+// draw numbers without racing on a shared state
+
+thread_local std::mt19937 mte(std::time(0)+std::hash<std::thread::id>()(std::this_thread::get_id()));
 //std::mt19937 mte(1986);
-std::normal_distribution<> rdn_gen(0,1);
+thread_local std::normal_distribution<> rdn_gen(0,1);
 
 unsigned long int randi()
 {
@@ -72,6 +75,9 @@ double randp_norm(double mean,double std_dev)
     return std_dev*rdn_gen(mte)+mean;
 }
 
+// Seeds the generator of the calling thread only, the other threads
+// keeping their own sequence
+
 void seedp(int i)
 {
     mte.seed(i);
@@ -13,7 +13,10 @@ See the License for the specific language governing permissions and
 limitations under the License.*/
 
 #include <algorithm>
+#include <iostream>
+#include <limits>
 #include <math_optim.h>
+#include <thread_utils.h>
 
 OptimRule::OptimRule()
     :lock(false), 
@@ -23,10 +26,97 @@ OptimRule::OptimRule()
 {
 }
 
+//#####################
+//   OptimPopulation
+//#####################
+
+// One generation of candidates, each pool chunk owning one context and
+// evaluating every Nchunks-th candidate on it
+
+class OptimPopulation: public PoolTask
+{
+    public:
+        std::vector<OptimContext*> const &contexts;
+        std::vector<std::vector<double>> const &candidates;
+        std::vector<double> &scores;
+        
+        OptimPopulation(std::vector<OptimContext*> const &contexts,
+                        std::vector<std::vector<double>> const &candidates,
+                        std::vector<double> &scores);
+        
+        void evaluate();
+        void pool_run(int chunk,int Nchunks);
+};
+
+OptimPopulation::OptimPopulation(std::vector<OptimContext*> const &contexts_,
+                                 std::vector<std::vector<double>> const &candidates_,
+                                 std::vector<double> &scores_)
+    :contexts(contexts_),
+     candidates(candidates_),
+     scores(scores_)
+{
+}
+
+void OptimPopulation::evaluate()
+{
+    int Nchunks=std::min(contexts.size(),candidates.size());
+    
+    if(Nchunks<=1) pool_run(0,1);
+    else
+    {
+        PoolGroup group;
+        
+        shared_pool().submit(this,Nchunks,group);
+        shared_pool().wait(group);
+    }
+}
+
+void OptimPopulation::pool_run(int chunk,int Nchunks)
+{
+    OptimContext &context=*contexts[chunk];
+    
+    for(std::size_t n=chunk;n<candidates.size();n+=Nchunks)
+    {
+        for(std::size_t i=0;i<context.variables.size();i++)
+            *(context.variables[i])=candidates[n][i];
+        
+        scores[n]=context.evaluate();
+    }
+}
+
+// Search coordinates of the population mode, GROW variables being taken
+// relative to their starting value x0
+
+static double optim_to_search(OptimRule const &rule,double x,double x0)
+{
+    if(rule.operation_type==OptimRule::Operation::ADD) return x/rule.delta_add;
+    else return std::log(x/x0)/rule.delta_grow;
+}
+
+static double optim_from_search(OptimRule const &rule,double z,double x0)
+{
+    double x;
+    
+    if(rule.operation_type==OptimRule::Operation::ADD) x=z*rule.delta_add;
+    else x=x0*std::exp(z*rule.delta_grow);
+    
+    if(rule.limit_type==OptimRule::Limit::UP) x=std::min(rule.limit_up,x);
+    else if(rule.limit_type==OptimRule::Limit::DOWN) x=std::max(rule.limit_down,x);
+    else if(rule.limit_type==OptimRule::Limit::BOTH) x=std::clamp(x,rule.limit_down,rule.limit_up);
+    
+    return x;
+}
+
 //#################
 //   OptimEngine
 //#################
 
+void OptimEngine::add_context(OptimContext *context)
+{
+    contexts.push_back(context);
+}
+
+
 void OptimEngine::add_target(OptimTarget *target)
 {
     targets.push_back(target);
@@ -120,6 +210,173 @@ int OptimEngine::locate_variable(double *target) const
 }
 
 
+// DE/rand/1/bin. The first member is the current state, the others are
+// drawn within the limits when both are set and one rule step around the
+// current state otherwise. Stops after max_generations, or after max_fails
+// generations without improvement of the best score, and leaves the
+// variables at the best candidate
+
+double OptimEngine::optimize_population(std::vector<OptimContext*> const &contexts)
+{
+    std::size_t i;
+    int n;
+    
+    int Nv=variables.size();
+    int Np=std::max(4,population_size);
+    
+    if(contexts.empty())
+    {
+        std::cerr<<"Error: population optimization without any context"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    for(OptimContext *context : contexts)
+    {
+        if(static_cast<int>(context->variables.size())!=Nv)
+        {
+            std::cerr<<"Error: optimization context with "<<context->variables.size()
+                     <<" variables instead of "<<Nv<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    
+    double F=0.7,CR=0.9;
+    
+    // Variables that cannot move: locked, null step, or GROW from zero
+    
+    std::vector<double> x0(Nv);
+    std::vector<bool> fixed(Nv);
+    
+    for(n=0;n<Nv;n++)
+    {
+        OptimRule const &rule=rules[n];
+        
+        x0[n]=*(variables[n]);
+        
+        if(rule.operation_type==OptimRule::Operation::ADD) fixed[n]=rule.lock || rule.delta_add==0;
+        else fixed[n]=rule.lock || rule.delta_grow==0 || x0[n]==0;
+    }
+    
+    std::vector<int> free_vars;
+    
+    for(n=0;n<Nv;n++)
+        if(!fixed[n]) free_vars.push_back(n);
+    
+    // Nothing to evolve: the current state is the only candidate
+    
+    if(free_vars.empty())
+    {
+        std::vector<std::vector<double>> x_cur(1,x0);
+        std::vector<double> score_cur(1);
+        
+        OptimPopulation current(contexts,x_cur,score_cur);
+        current.evaluate();
+        
+        for(i=0;i<variables.size();i++) previous_values[i]=x0[i];
+        
+        return score_cur[0];
+    }
+    
+    std::vector<std::vector<double>> z(Np,std::vector<double>(Nv,0)),
+                                     x(Np,x0),
+                                     z_trial(Np,std::vector<double>(Nv,0)),
+                                     x_trial(Np,x0);
+    std::vector<double> score(Np),score_trial(Np);
+    
+    for(n=0;n<Nv;n++)
+    {
+        if(fixed[n]) continue;
+        
+        OptimRule const &rule=rules[n];
+        
+        double z_cur=optim_to_search(rule,x0[n],x0[n]);
+        double z_min=z_cur-1.0,z_max=z_cur+1.0;
+        
+        if(rule.limit_type==OptimRule::Limit::BOTH &&
+           (rule.operation_type==OptimRule::Operation::ADD || (rule.limit_down/x0[n]>0 && rule.limit_up/x0[n]>0)))
+        {
+            z_min=optim_to_search(rule,rule.limit_down,x0[n]);
+            z_max=optim_to_search(rule,rule.limit_up,x0[n]);
+        }
+        
+        z[0][n]=z_cur;
+        
+        for(int p=1;p<Np;p++)
+        {
+            z[p][n]=randp(z_min,z_max);
+            x[p][n]=optim_from_search(rule,z[p][n],x0[n]);
+        }
+    }
+    
+    OptimPopulation population(contexts,x,score);
+    population.evaluate();
+    
+    int best=std::min_element(score.begin(),score.end())-score.begin();
+    int Nstall=0;
+    
+    for(int g=0;g<max_generations && Nstall<max_fails;g++)
+    {
+        for(int p=0;p<Np;p++)
+        {
+            int r1,r2,r3;
+            
+            do { r1=randi()%Np; } while(r1==p);
+            do { r2=randi()%Np; } while(r2==p || r2==r1);
+            do { r3=randi()%Np; } while(r3==p || r3==r1 || r3==r2);
+            
+            int n_forced=free_vars[randi()%free_vars.size()];
+            
+            for(n=0;n<Nv;n++)
+            {
+                z_trial[p][n]=z[p][n];
+                x_trial[p][n]=x[p][n];
+                
+                if(fixed[n]) continue;
+                
+                if(n==n_forced || randp()<CR)
+                {
+                    z_trial[p][n]=z[r1][n]+F*(z[r2][n]-z[r3][n]);
+                    x_trial[p][n]=optim_from_search(rules[n],z_trial[p][n],x0[n]);
+                    
+                    // Keeps the search coordinate consistent with the limits
+                    z_trial[p][n]=optim_to_search(rules[n],x_trial[p][n],x0[n]);
+                }
+            }
+        }
+        
+        OptimPopulation trials(contexts,x_trial,score_trial);
+        trials.evaluate();
+        
+        double best_score=score[best];
+        
+        for(int p=0;p<Np;p++)
+        {
+            if(score_trial[p]<=score[p])
+            {
+                z[p]=z_trial[p];
+                x[p]=x_trial[p];
+                score[p]=score_trial[p];
+            }
+        }
+        
+        best=std::min_element(score.begin(),score.end())-score.begin();
+        
+        if(score[best]<best_score) Nstall=0;
+        else Nstall++;
+        
+        std::cout<<"Generation "<<g<<", best score: "<<score[best]<<std::endl;
+    }
+    
+    for(i=0;i<variables.size();i++)
+    {
+        previous_values[i]=*(variables[i]);
+        *(variables[i])=x[best][i];
+    }
+    
+    return score[best];
+}
+
+
 void OptimEngine::register_variable(double *target,OptimRule const &rule)
 {
     int target_index=locate_variable(target);
@@ -146,9 +403,318 @@ void OptimEngine::revert_variables()
 }
 
 
+void OptimEngine::set_max_generations(int max_generations_)
+{
+    max_generations=std::max(1,max_generations_);
+}
+
+
+void OptimEngine::set_population(int population_size_)
+{
+    population_size=std::max(0,population_size_);
+}
+
+
 void OptimEngine::set_rule(double *target,OptimRule const &rule)
 {
     int i=locate_variable(target);
     
     if(i!=-1) rules[i]=rule;
 }
+
+//################
+//   OptimLBFGS
+//################
+
+// Dot product over the variables that are not held at a bound
+
+static double lbfgs_dot(std::vector<double> const &a,std::vector<double> const &b,
+                        std::vector<bool> const &active)
+{
+    double r=0;
+    
+    for(unsigned int i=0;i<a.size();i++)
+        if(!active[i]) r+=a[i]*b[i];
+    
+    return r;
+}
+
+OptimLBFGS::OptimLBFGS()
+    :max_iterations(100),
+     memory(8),
+     tolerance(1e-10)
+{
+}
+
+
+double OptimLBFGS::evaluate(OptimGradientTarget &target,std::vector<double> const &u,std::vector<double> &g)
+{
+    unsigned int i,N=variables.size();
+    
+    for(i=0;i<N;i++) *(variables[i])=u[i]*scale[i];
+    
+    gradient_raw.assign(N,0);
+    
+    double score=target.evaluate(variables,gradient_raw);
+    
+    g.resize(N);
+    
+    for(i=0;i<N;i++)
+    {
+        if(rules[i].lock) g[i]=0;
+        else g[i]=gradient_raw[i]*scale[i];
+    }
+    
+    return score;
+}
+
+
+void OptimLBFGS::forget_variable(double *target)
+{
+    int i=locate_variable(target);
+    
+    if(i==-1) return;
+    
+    variables.erase(variables.begin()+i);
+    rules.erase(rules.begin()+i);
+}
+
+
+int OptimLBFGS::locate_variable(double *target) const
+{
+    for(int i=0;i<static_cast<int>(variables.size());i++)
+        if(target==variables[i]) return i;
+    
+    return -1;
+}
+
+// Projected L-BFGS: the quasi-Newton direction is computed over the
+// variables that are not held at a bound, followed by a projected
+// backtracking line search. Returns the final score, the variables being
+// left at the corresponding point
+
+double OptimLBFGS::optimize(OptimGradientTarget &target)
+{
+    int i,k;
+    int N=variables.size();
+    
+    double inf=std::numeric_limits<double>::infinity();
+    
+    scale.resize(N);
+    lower.resize(N);
+    upper.resize(N);
+    
+    std::vector<double> u(N);
+    
+    for(i=0;i<N;i++)
+    {
+        OptimRule const &rule=rules[i];
+        double x=*(variables[i]);
+        
+        if(rule.operation_type==OptimRule::Operation::ADD) scale[i]=std::abs(rule.delta_add);
+        else scale[i]=std::abs(rule.delta_grow*x);
+        
+        if(scale[i]==0) scale[i]=1.0;
+        
+        double x_min=-inf,x_max=inf;
+        
+        if(rule.limit_type==OptimRule::Limit::UP || rule.limit_type==OptimRule::Limit::BOTH) x_max=rule.limit_up;
+        if(rule.limit_type==OptimRule::Limit::DOWN || rule.limit_type==OptimRule::Limit::BOTH) x_min=rule.limit_down;
+        
+        if(x_min>x_max)
+        {
+            std::cerr<<"Error: optimization variable with a lower limit "<<x_min
+                     <<" above its upper limit "<<x_max<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        
+        if(rule.lock) x_min=x_max=x;
+        
+        lower[i]=x_min/scale[i];
+        upper[i]=x_max/scale[i];
+        u[i]=x/scale[i];
+    }
+    
+    project(u);
+    
+    std::vector<double> g,g_new,u_new(N),q(N);
+    std::vector<bool> active(N);
+    
+    std::vector<std::vector<double>> s_mem,y_mem;
+    std::vector<double> rho_mem,alpha;
+    
+    double f=evaluate(target,u,g);
+    
+    for(int it=0;it<max_iterations;it++)
+    {
+        // Variables held at a bound by the gradient are frozen
+        
+        double g_max=0;
+        
+        for(i=0;i<N;i++)
+        {
+            active[i]=rules[i].lock || (u[i]<=lower[i] && g[i]>0) || (u[i]>=upper[i] && g[i]<0);
+            
+            if(!active[i]) g_max=std::max(g_max,std::abs(g[i]));
+        }
+        
+        if(g_max<=tolerance*(1.0+std::abs(f))) break;
+        
+        // Two-loop recursion
+        
+        int M=s_mem.size();
+        alpha.resize(M);
+        
+        for(i=0;i<N;i++) q[i]=active[i] ? 0 : g[i];
+        
+        for(k=M-1;k>=0;k--)
+        {
+            alpha[k]=rho_mem[k]*lbfgs_dot(s_mem[k],q,active);
+            
+            for(i=0;i<N;i++) if(!active[i]) q[i]-=alpha[k]*y_mem[k][i];
+        }
+        
+        if(M>0)
+        {
+            double gamma=lbfgs_dot(s_mem[M-1],y_mem[M-1],active)/lbfgs_dot(y_mem[M-1],y_mem[M-1],active);
+            
+            if(gamma>0) for(i=0;i<N;i++) q[i]*=gamma;
+        }
+        
+        for(k=0;k<M;k++)
+        {
+            double beta=rho_mem[k]*lbfgs_dot(y_mem[k],q,active);
+            
+            for(i=0;i<N;i++) if(!active[i]) q[i]+=(alpha[k]-beta)*s_mem[k][i];
+        }
+        
+        for(i=0;i<N;i++) q[i]=-q[i];
+        
+        // Fallback on the steepest descent
+        
+        if(lbfgs_dot(g,q,active)>=0)
+        {
+            for(i=0;i<N;i++) q[i]=active[i] ? 0 : -g[i];
+            
+            s_mem.clear();
+            y_mem.clear();
+            rho_mem.clear();
+            M=0;
+        }
+        
+        // Without curvature information, the first step is one rule step
+        
+        double step=1.0;
+        
+        if(M==0)
+        {
+            double d_max=0;
+            for(i=0;i<N;i++) d_max=std::max(d_max,std::abs(q[i]));
+            
+            if(d_max>1.0) step=1.0/d_max;
+        }
+        
+        bool accepted=false;
+        double f_new=f;
+        
+        for(k=0;k<40;k++)
+        {
+            for(i=0;i<N;i++) u_new[i]=u[i]+step*q[i];
+            
+            project(u_new);
+            
+            double decrease=0;
+            for(i=0;i<N;i++) decrease+=g[i]*(u_new[i]-u[i]);
+            
+            f_new=evaluate(target,u_new,g_new);
+            
+            if(f_new<=f+1e-4*decrease)
+            {
+                accepted=true;
+                break;
+            }
+            
+            step*=0.5;
+        }
+        
+        if(!accepted)
+        {
+            for(i=0;i<N;i++) *(variables[i])=u[i]*scale[i];
+            
+            if(M==0) break;
+            
+            s_mem.clear();
+            y_mem.clear();
+            rho_mem.clear();
+            
+            continue;
+        }
+        
+        // Curvature pair
+        
+        std::vector<double> s(N),y(N);
+        
+        for(i=0;i<N;i++)
+        {
+            s[i]=u_new[i]-u[i];
+            y[i]=g_new[i]-g[i];
+        }
+        
+        std::vector<bool> none(N,false);
+        
+        double sy=lbfgs_dot(s,y,none);
+        double yy=lbfgs_dot(y,y,none);
+        
+        if(sy>std::numeric_limits<double>::epsilon()*yy)
+        {
+            s_mem.push_back(s);
+            y_mem.push_back(y);
+            rho_mem.push_back(1.0/sy);
+            
+            if(static_cast<int>(s_mem.size())>memory)
+            {
+                s_mem.erase(s_mem.begin());
+                y_mem.erase(y_mem.begin());
+                rho_mem.erase(rho_mem.begin());
+            }
+        }
+        
+        double f_old=f;
+        
+        u.swap(u_new);
+        g.swap(g_new);
+        f=f_new;
+        
+        if(f_old-f<=tolerance*std::max(std::abs(f_old),std::abs(f))) break;
+    }
+    
+    for(i=0;i<N;i++) *(variables[i])=u[i]*scale[i];
+    
+    return f;
+}
+
+
+void OptimLBFGS::project(std::vector<double> &u) const
+{
+    for(unsigned int i=0;i<u.size();i++)
+        u[i]=std::clamp(u[i],lower[i],upper[i]);
+}
+
+
+void OptimLBFGS::register_variable(double *target,OptimRule const &rule)
+{
+    int i=locate_variable(target);
+    
+    if(i!=-1) rules[i]=rule;
+    else
+    {
+        variables.push_back(target);
+        rules.push_back(rule);
+    }
+}
+
+
+void OptimLBFGS::set_max_iterations(int max_iterations_)
+{
+    max_iterations=std::max(1,max_iterations_);
+}
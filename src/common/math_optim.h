@@ -25,6 +25,28 @@ class OptimTarget
         virtual double evaluate() const=0;
 };
 
+// Target providing the derivatives of its score with respect to each of the
+// given variables
+
+class OptimGradientTarget
+{
+    public:
+        virtual double evaluate(std::vector<double*> const &variables,
+                                std::vector<double> &gradient)=0;
+};
+
+// Independent copy of whatever the targets are evaluated on, for the
+// population mode. Its variables mirror the ones of the engine, in the same
+// order, and evaluate() may only touch data owned by the context
+
+class OptimContext
+{
+    public:
+        std::vector<double*> variables;
+        
+        virtual double evaluate()=0;
+};
+
 class OptimRule
 {
     public:
@@ -42,16 +64,26 @@ class OptimRule
         OptimRule& operator = (OptimRule const &rule) = default;
 };
 
+// Either a mutate-and-revert search on a single context, or, if
+// population_size is set, a differential evolution whose candidates are
+// evaluated concurrently on independent contexts. ADD variables then evolve
+// linearly in units of delta_add, GROW ones geometrically in units of
+// delta_grow. All the random draws of the population mode are made on the
+// calling thread, so that seedp() on that thread makes a run reproducible
+
 class OptimEngine
 {
     public:
         int max_fails=100;
+        int population_size=0,max_generations=100;
         
         std::vector<double*> variables;
         std::vector<double> previous_values;
         std::vector<OptimRule> rules;
         std::vector<OptimTarget*> targets;
+        std::vector<OptimContext*> contexts;
         
+        void add_context(OptimContext *context);
         void add_target(OptimTarget *target);
         void clear_targets();
         double evaluate_targets();
@@ -59,10 +91,43 @@ class OptimEngine
         void forget_variable(double *target);
         bool get_rule(double *target,OptimRule &rule) const;
         int locate_variable(double *target) const;
+        double optimize_population(std::vector<OptimContext*> const &contexts);
         void register_variable(double *target,OptimRule const &rule);
         void revert_variables();
         void set_rule(double *target,OptimRule const &rule);
         void set_max_fails(int max_fails);
+        void set_max_generations(int max_generations);
+        void set_population(int population_size);
+};
+
+// Bound-constrained quasi-Newton minimizer, the bounds being given by the
+// OptimRule limits and the locked variables being left untouched. Every
+// variable is scaled by its rule step, delta_add or delta_grow times its
+// starting value, so that a unit step moves it by one rule step
+
+class OptimLBFGS
+{
+    public:
+        int max_iterations,memory;
+        double tolerance;
+        
+        std::vector<double*> variables;
+        std::vector<OptimRule> rules;
+        
+        OptimLBFGS();
+        
+        void forget_variable(double *target);
+        int locate_variable(double *target) const;
+        double optimize(OptimGradientTarget &target);
+        void register_variable(double *target,OptimRule const &rule);
+        void set_max_iterations(int max_iterations);
+        
+    private:
+        std::vector<double> scale,lower,upper;
+        std::vector<double> gradient_raw;
+        
+        double evaluate(OptimGradientTarget &target,std::vector<double> const &u,std::vector<double> &g);
+        void project(std::vector<double> &u) const;
 };
 
 #endif // MATH_OPTIM_H_INCLUDED
@@ -15,6 +15,8 @@ limitations under the License.*/
 #include <enum_tools.h>
 #include <math_sym.h>
 
+#include <algorithm>
+
 bool is_add(char c)
 {
     if(c=='+') return true;
@@ -106,6 +108,17 @@ void SymLib::add(std::string const &var,SymNode *node,bool persistent_)
     persistent.push_back(persistent_);
 }
 
+bool SymLib::contains(std::string const &var)
+{
+    bool known_special=false;
+    evaluate_specials(known_special,var);
+    
+    if(known_special) return true;
+    
+    return std::find(keys.begin(),keys.end(),var)!=keys.end();
+}
+
+
 double SymLib::evaluate(std::string const &var)
 {
     bool known_special=false;
@@ -219,6 +232,69 @@ void SymLib::forget(SymNode *node,bool force)
     persistent.erase(it_lock);
 }
 
+//###################
+//    SymProgram
+//###################
+
+SymInstruction::SymInstruction(SymInstr type_,double val_,int var_,SymFunc func_)
+    :type(type_), func(func_), var(var_), val(val_)
+{
+}
+
+SymProgram::SymProgram()
+    :stack_size(0)
+{
+}
+
+double SymProgram::evaluate(double const *vars) const
+{
+    std::vector<double> stack(stack_size);
+    
+    return evaluate(vars,stack);
+}
+
+double SymProgram::evaluate(double const *vars,std::vector<double> &stack) const
+{
+    if(code.empty()) return 0;
+    
+    if(static_cast<int>(stack.size())<stack_size) stack.resize(stack_size);
+    
+    int p=0;
+    double *S=stack.data();
+    
+    for(unsigned int i=0;i<code.size();i++)
+    {
+        SymInstruction const &instr=code[i];
+        
+        switch(instr.type)
+        {
+            case SymInstr::NUM: S[p]=instr.val; p++; break;
+            case SymInstr::VAR: S[p]=vars[instr.var]; p++; break;
+            case SymInstr::NEG: S[p-1]=-S[p-1]; break;
+            case SymInstr::ADD: p--; S[p-1]=S[p-1]+S[p]; break;
+            case SymInstr::SUBS: p--; S[p-1]=S[p-1]-S[p]; break;
+            case SymInstr::MULT: p--; S[p-1]=S[p-1]*S[p]; break;
+            case SymInstr::DIV: p--; S[p-1]=S[p-1]/S[p]; break;
+            case SymInstr::POW: p--; S[p-1]=std::pow(S[p-1],S[p]); break;
+            case SymInstr::FUNC:
+                switch(instr.func)
+                {
+                    case SymFunc::ACOS: S[p-1]=std::acos(S[p-1]); break;
+                    case SymFunc::ASIN: S[p-1]=std::asin(S[p-1]); break;
+                    case SymFunc::ATAN: S[p-1]=std::atan(S[p-1]); break;
+                    case SymFunc::COS: S[p-1]=std::cos(S[p-1]); break;
+                    case SymFunc::EXP: S[p-1]=std::exp(S[p-1]); break;
+                    case SymFunc::ID: S[p-1]=0; break;
+                    case SymFunc::SIN: S[p-1]=std::sin(S[p-1]); break;
+                    case SymFunc::TAN: S[p-1]=std::tan(S[p-1]); break;
+                }
+                break;
+        }
+    }
+    
+    return S[0];
+}
+
 //###############
 //    SymNode
 //###############
@@ -285,6 +361,127 @@ void SymNode::clean()
     if(lib!=nullptr) lib->forget(this);
 }
 
+// Flattens the tree into a stack program, variables listed in vars are read from
+// the array given to SymProgram::evaluate, any other variable is resolved once
+// through the library and stored as a constant
+void SymNode::compile(SymProgram &program,std::vector<std::string> const &vars)
+{
+    std::vector<std::string> unknowns;
+    
+    compile(program,vars,unknowns);
+}
+
+// Same, the variables that are neither in vars nor in the library being
+// listed in unknowns, they are compiled as zeros
+void SymNode::compile(SymProgram &program,std::vector<std::string> const &vars,
+                      std::vector<std::string> &unknowns)
+{
+    unknowns.clear();
+    
+    program.code.clear();
+    compile_code(program.code,vars,unknowns);
+    
+    int depth=0;
+    program.stack_size=0;
+    
+    for(unsigned int i=0;i<program.code.size();i++)
+    {
+        SymInstr type=program.code[i].type;
+        
+             if(type==AnyOf(SymInstr::NUM,SymInstr::VAR)) depth++;
+        else if(type==AnyOf(SymInstr::ADD,SymInstr::DIV,SymInstr::MULT,
+                            SymInstr::POW,SymInstr::SUBS)) depth--;
+        
+        program.stack_size=std::max(program.stack_size,depth);
+    }
+}
+
+// Same operators priority as evaluate(), the blocks being replaced by their code
+void SymNode::compile_code(std::vector<SymInstruction> &code,std::vector<std::string> const &vars,
+                           std::vector<std::string> &unknowns)
+{
+         if(type==SymType::NUM) code.push_back(SymInstruction(SymInstr::NUM,val));
+    else if(type==SymType::VAR)
+    {
+        for(unsigned int i=0;i<vars.size();i++)
+        {
+            if(vars[i]==var)
+            {
+                code.push_back(SymInstruction(SymInstr::VAR,0,i));
+                if(sign<0) code.push_back(SymInstruction(SymInstr::NEG));
+                
+                return;
+            }
+        }
+        
+        if(lib==nullptr || !lib->contains(var))
+        {
+            if(std::find(unknowns.begin(),unknowns.end(),var)==unknowns.end())
+                unknowns.push_back(var);
+        }
+        
+        if(lib!=nullptr) code.push_back(SymInstruction(SymInstr::NUM,sign*lib->evaluate(var)));
+        else code.push_back(SymInstruction(SymInstr::NUM,0));
+    }
+    else if(type==AnyOf(SymType::EXPR,SymType::FUNC))
+    {
+        int i;
+        
+        int N_op=op_arr.size();
+        int N_blocks=nodes_arr.size();
+        
+        std::vector<bool> flags(N_blocks,false);
+        std::vector<std::vector<SymInstruction>> blocks(N_blocks);
+        
+        for(i=0;i<N_blocks;i++)
+            nodes_arr[i]->compile_code(blocks[i],vars,unknowns);
+        
+        for(i=0;i<N_op;i++)
+        {
+            if(op_arr[i]==SymOp::POW)
+            {
+                blocks[i].insert(blocks[i].end(),blocks[i+1].begin(),blocks[i+1].end());
+                blocks[i].push_back(SymInstruction(SymInstr::POW));
+                blocks[i+1].swap(blocks[i]);
+                flags[i]=true;
+            }
+        }
+        
+        for(i=0;i<N_op;i++)
+        {
+            if(op_arr[i]==AnyOf(SymOp::MULT,SymOp::DIV))
+            {
+                int p=i+1;
+                while(flags[p]) p++;
+                
+                blocks[i].insert(blocks[i].end(),blocks[p].begin(),blocks[p].end());
+                blocks[i].push_back(SymInstruction(op_arr[i]==SymOp::MULT?SymInstr::MULT:SymInstr::DIV));
+                blocks[p].swap(blocks[i]);
+                flags[i]=true;
+            }
+        }
+        
+        for(i=0;i<N_op;i++)
+        {
+            if(op_arr[i]==AnyOf(SymOp::ADD,SymOp::SUBS))
+            {
+                int p=i+1;
+                while(flags[p]) p++;
+                
+                blocks[i].insert(blocks[i].end(),blocks[p].begin(),blocks[p].end());
+                blocks[i].push_back(SymInstruction(op_arr[i]==SymOp::ADD?SymInstr::ADD:SymInstr::SUBS));
+                blocks[p].swap(blocks[i]);
+            }
+        }
+        
+        code.insert(code.end(),blocks[N_blocks-1].begin(),blocks[N_blocks-1].end());
+        
+        if(sign<0) code.push_back(SymInstruction(SymInstr::NEG));
+        if(type==SymType::FUNC) code.push_back(SymInstruction(SymInstr::FUNC,0,0,func_type));
+    }
+    else code.push_back(SymInstruction(SymInstr::NUM,0));
+}
+
 double SymNode::evaluate()
 {
          if(type==SymType::NUM) return val;
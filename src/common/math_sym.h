@@ -49,6 +49,45 @@ enum class SymFunc
     TAN
 };
 
+enum class SymInstr
+{
+    ADD,
+    DIV,
+    FUNC,
+    MULT,
+    NEG,
+    NUM,
+    POW,
+    SUBS,
+    VAR
+};
+
+class SymInstruction
+{
+    public:
+        SymInstr type;
+        SymFunc func;
+        int var;
+        double val;
+        
+        SymInstruction(SymInstr type,double val=0,int var=0,SymFunc func=SymFunc::ID);
+};
+
+// Flattened version of a SymNode tree, evaluated on a stack
+// The program is never modified by the evaluation, so that a single program can be
+// shared between threads as long as each one provides its own stack
+class SymProgram
+{
+    public:
+        int stack_size;
+        std::vector<SymInstruction> code;
+        
+        SymProgram();
+        
+        double evaluate(double const *vars) const;
+        double evaluate(double const *vars,std::vector<double> &stack) const;
+};
+
 class SymLib
 {
     private:
@@ -60,6 +99,7 @@ class SymLib
         std::vector<bool> persistent;
         
         void add(std::string const &var,SymNode *node,bool persistent=false);
+        bool contains(std::string const &var);
         double evaluate(std::string const &var);
         double evaluate(std::string const &var,std::list<SymNode*> &backtrace);
         void forget(std::string const &key,bool force=false);
@@ -91,6 +131,8 @@ class SymNode
                 SymFunc func);
         
         void clean();
+        void compile_code(std::vector<SymInstruction> &code,std::vector<std::string> const &vars,
+                          std::vector<std::string> &unknowns);
         void parse(std::string const &frm);
         void parse_block(std::string const &frm);
         
@@ -100,6 +142,9 @@ class SymNode
         
         ~SymNode();
         
+        void compile(SymProgram &program,std::vector<std::string> const &vars);
+        void compile(SymProgram &program,std::vector<std::string> const &vars,
+                     std::vector<std::string> &unknowns);
         double evaluate();
         double evaluate(std::list<SymNode*> &backtrace);
         std::string get_expression();
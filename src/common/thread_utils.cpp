@@ -12,6 +12,7 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.*/
 
+#include <algorithm>
 #include <iostream>
 
 #include <thread_utils.h>
@@ -79,7 +80,7 @@ class TAPredicateV
 };
 
 ThreadsAlternator::ThreadsAlternator(int Nthr_)
-    :Nthr(Nthr_),
+    :Nthr(Nthr_), Nact(Nthr_),
      thread_mutex(Nthr),
      #ifdef THR_NOTIFY_SEPARATE
      threads_cv(Nthr),
@@ -100,7 +101,7 @@ bool ThreadsAlternator::all_threads_waiting()
     
     bool r=true;
     
-    for(unsigned int i=0;i<Nthr;i++) r*=threads_waiting_val[i];
+    for(unsigned int i=0;i<Nact;i++) r*=threads_waiting_val[i];
     
     return r;
 }
@@ -116,7 +117,7 @@ void ThreadsAlternator::allow_all_threads_running(bool var)
 {
     std::lock_guard<std::mutex> guard(threads_allow_run_mutex);
     
-    for(unsigned int i=0;i<Nthr;i++) threads_allow_run[i]=var;
+    for(unsigned int i=0;i<Nact;i++) threads_allow_run[i]=var;
 }
 
 std::mutex& ThreadsAlternator::get_main_mutex() { return main_mutex; }
@@ -144,7 +145,16 @@ void ThreadsAlternator::set_all_threads_waiting(bool val)
 {
     std::lock_guard<std::mutex> guard(threads_waiting_mutex);
     
-    for(unsigned int i=0;i<Nthr;i++) threads_waiting_val[i]=val;
+    for(unsigned int i=0;i<Nact;i++) threads_waiting_val[i]=val;
+}
+
+// Only the first N threads are signaled and waited for afterwards, the
+// other ones staying blocked where they are. To be called between two
+// signal_threads/main_wait_threads pairs, when all the threads are waiting
+
+void ThreadsAlternator::set_active_threads(int N)
+{
+    Nact=std::max(1,std::min(N,static_cast<int>(Nthr)));
 }
 
 void ThreadsAlternator::set_thread_waiting(unsigned int ID,bool val)
@@ -187,7 +197,7 @@ void ThreadsAlternator::signal_threads()
     thr_cout(this,"Main signal threads lock Start");
     #endif
     
-    for(unsigned int i=0;i<Nthr;i++) thread_mutex[i].lock();
+    for(unsigned int i=0;i<Nact;i++) thread_mutex[i].lock();
     
     #ifdef THR_DEBUG
     thr_cout(this,"Main signal threads lock End");
@@ -195,12 +205,12 @@ void ThreadsAlternator::signal_threads()
     
     allow_all_threads_running();
     #ifdef THR_NOTIFY_SEPARATE
-    for(unsigned int i=0;i<Nthr;i++) threads_cv[i].notify_one();
+    for(unsigned int i=0;i<Nact;i++) threads_cv[i].notify_one();
     #else
     threads_cv.notify_all();
     #endif
     
-    for(unsigned int i=0;i<Nthr;i++) thread_mutex[i].unlock();
+    for(unsigned int i=0;i<Nact;i++) thread_mutex[i].unlock();
         
     #ifdef THR_DEBUG
     thr_cout(this,"Main signal threads lock Unlock");
@@ -221,7 +231,7 @@ bool ThreadsAlternator::thread_last_running(unsigned int ID)
         r*=threads_waiting_val[i];
     }
     
-    for(unsigned int i=ID+1;i<Nthr;i++)
+    for(unsigned int i=ID+1;i<Nact;i++)
     {
         r*=threads_waiting_val[i];
     }
@@ -319,9 +329,172 @@ void ThreadsPool::resize_pool(int Nthr_)
     }
 }
 
+// Per calling thread, so that concurrent solvers each size themselves
+// to the share of the machine they were granted. 0 means no budget.
+
+static thread_local int thread_budget=0;
+
+//###############
+//   TasksPool
+//###############
+
+PoolTask::~PoolTask()
+{
+}
+
+void PoolTask::pool_run(int chunk,int Nchunks)
+{
+}
+
+PoolGroup::PoolGroup()
+    :Npending(0),
+     Nrunning(0),
+     budget(0)
+{
+}
+
+TasksPool::TasksPool(int Nworkers)
+    :stop(false),
+     threads(Nworkers,nullptr)
+{
+    for(int i=0;i<Nworkers;i++)
+        threads[i]=new std::thread(&TasksPool::process,this);
+}
+
+TasksPool::~TasksPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        stop=true;
+    }
+    
+    work_cv.notify_all();
+    
+    for(unsigned int i=0;i<threads.size();i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+}
+
+int TasksPool::get_N_threads() { return threads.size()+1; }
+
+// First queued chunk whose group is below its budget, restricted to the
+// given group if any
+
+std::deque<TasksPool::Entry>::iterator TasksPool::next(PoolGroup const *group)
+{
+    std::deque<Entry>::iterator it=queue.begin();
+    
+    for(;it!=queue.end();++it)
+    {
+        if(group!=nullptr && it->group!=group) continue;
+        
+        if(it->group->budget<=0 || it->group->Nrunning<it->group->budget) break;
+    }
+    
+    return it;
+}
+
+void TasksPool::process()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    while(true)
+    {
+        std::deque<Entry>::iterator it=next(nullptr);
+        
+        while(it==queue.end() && !(stop && queue.empty()))
+        {
+            work_cv.wait(lock);
+            it=next(nullptr);
+        }
+        
+        if(it==queue.end()) return;
+        
+        Entry entry=*it;
+        queue.erase(it);
+        
+        run(entry,lock);
+    }
+}
+
+// Runs an already dequeued chunk with the lock released, under the budget
+// of its submitter. The end of a budgeted chunk may let another one start
+
+void TasksPool::run(Entry const &entry,std::unique_lock<std::mutex> &lock)
+{
+    PoolGroup &group=*entry.group;
+    int budget_prev=thread_budget;
+    
+    group.Nrunning++;
+    
+    lock.unlock();
+    thread_budget=group.budget;
+    entry.task->pool_run(entry.chunk,entry.Nchunks);
+    thread_budget=budget_prev;
+    lock.lock();
+    
+    group.Nrunning--;
+    group.Npending--;
+    
+    if(group.budget>0)
+    {
+        work_cv.notify_all();
+        done_cv.notify_all();
+    }
+    else if(group.Npending==0) done_cv.notify_all();
+}
+
+void TasksPool::submit(PoolTask *task,int Nchunks,PoolGroup &group)
+{
+    if(Nchunks<=0) return;
+    
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        
+        group.Npending+=Nchunks;
+        group.budget=thread_budget;
+        
+        for(int i=0;i<Nchunks;i++)
+            queue.push_back(Entry{task,i,Nchunks,&group});
+    }
+    
+    work_cv.notify_all();
+}
+
+void TasksPool::wait(PoolGroup &group)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    while(group.Npending>0)
+    {
+        std::deque<Entry>::iterator it=next(&group);
+        
+        if(it!=queue.end())
+        {
+            Entry entry=*it;
+            queue.erase(it);
+            
+            run(entry,lock);
+        }
+        else done_cv.wait(lock);
+    }
+}
+
 //
 
-int max_threads_number()
+// The FFTW planner is not reentrant: plans are created and destroyed under
+// this lock, executing them being safe from any thread
+
+std::mutex& fftw_planner_mutex()
+{
+    static std::mutex mtx;
+    
+    return mtx;
+}
+
+int hardware_threads_number()
 {
     #ifndef MAX_NTHR
         return std::thread::hardware_concurrency();
@@ -329,3 +502,26 @@ int max_threads_number()
         return std::min(std::thread::hardware_concurrency(),static_cast<unsigned int>(MAX_NTHR));
     #endif
 }
+
+int max_threads_number()
+{
+    int N=hardware_threads_number();
+    
+    if(thread_budget>0) N=std::min(N,thread_budget);
+    
+    return N;
+}
+
+void set_thread_budget(int N)
+{
+    thread_budget=std::max(N,0);
+}
+
+// Started on first use, the calling thread being the last worker
+
+TasksPool& shared_pool()
+{
+    static TasksPool pool(std::max(hardware_threads_number()-1,0));
+    
+    return pool;
+}
@@ -16,6 +16,7 @@ limitations under the License.*/
 #define THREAD_UTILS_H
 
 #include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -23,7 +24,7 @@ limitations under the License.*/
 class ThreadsAlternator
 {
     private:
-        unsigned int Nthr;
+        unsigned int Nthr,Nact;
         
         std::mutex main_mutex,
                    threads_allow_run_mutex,
@@ -78,6 +79,7 @@ class ThreadsAlternator
         int get_N_threads();
         std::mutex& get_thread_mutex(unsigned int ID);
         void main_wait_threads(std::unique_lock<std::mutex> &lock);
+        void set_active_threads(int N);
         void signal_main(unsigned int ID);
         void signal_threads();
         void thread_wait_ok(unsigned int ID,std::unique_lock<std::mutex> &lock);
@@ -203,6 +205,70 @@ class ThreadsPool
         }
 };
 
+//###############
+//   TasksPool
+//###############
+
+// Persistent workers shared by independent computations. A task is split
+// in chunks that are queued with submit() under a group, any number of
+// tasks can be queued under the same group before wait(group), which runs
+// the queued chunks of that group on the calling thread too and returns
+// once they are all done. Other submitters are never waited on, so that
+// wait() can also be called from a chunk running on a worker.
+// A group submitted from a thread with a budget never has more chunks
+// running at once than that budget, its chunks running under the same
+// budget, so that a solver given a share of the machine stays within it.
+
+class PoolTask
+{
+    public:
+        virtual ~PoolTask();
+        virtual void pool_run(int chunk,int Nchunks);
+};
+
+class PoolGroup
+{
+    public:
+        int Npending,Nrunning,budget;
+        
+        PoolGroup();
+};
+
+class TasksPool
+{
+    private:
+        class Entry
+        {
+            public:
+                PoolTask *task;
+                int chunk,Nchunks;
+                PoolGroup *group;
+        };
+        
+        bool stop;
+        std::deque<Entry> queue;
+        
+        std::mutex mtx;
+        std::condition_variable work_cv,done_cv;
+        std::vector<std::thread*> threads;
+        
+        std::deque<Entry>::iterator next(PoolGroup const *group);
+        void process();
+        void run(Entry const &entry,std::unique_lock<std::mutex> &lock);
+        
+    public:
+        TasksPool(int Nworkers);
+        ~TasksPool();
+        
+        int get_N_threads();
+        void submit(PoolTask *task,int Nchunks,PoolGroup &group);
+        void wait(PoolGroup &group);
+};
+
+std::mutex& fftw_planner_mutex();
+int hardware_threads_number();
 int max_threads_number();
+void set_thread_budget(int N);
+TasksPool& shared_pool();
 
 #endif // THREAD_UTILS_H
@@ -0,0 +1,218 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_core.h>
+#include <fdtd_profiler.h>
+#include <filehdl.h>
+
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#if defined(unix) || defined(__unix__) || defined(__unix)
+#define UNIX_PLATFORM
+#include <unistd.h>
+#endif
+
+// The decisions are kept in the user profile, one line per machine and problem shape:
+// host Nhardware Nx Ny Nz Nthreads_max Ntwins materials -> Nthreads split_axis
+// the materials being listed as model:poles, so that grids of different costs
+// per cell do not share their timings
+
+static std::mutex autotune_mutex;
+
+static std::filesystem::path autotune_cache_path()
+{
+    return PathManager::to_userprofile_path("fdtd_autotune.txt");
+}
+
+static std::string autotune_host()
+{
+    std::string host;
+    
+    #ifdef UNIX_PLATFORM
+    char buffer[256]={};
+    if(gethostname(buffer,255)==0) host=buffer;
+    #else
+    char const *env=std::getenv("COMPUTERNAME");
+    if(env!=nullptr) host=env;
+    #endif
+    
+    if(host.empty()) host="unknown";
+    
+    for(char &c : host) if(std::isspace(static_cast<unsigned char>(c))) c='_';
+    
+    return host;
+}
+
+class AutotuneKey
+{
+    public:
+        std::string host,mats;
+        int Nhw,Nx,Ny,Nz,Nthr,Ntwins;
+        
+        bool operator == (AutotuneKey const &K) const
+        {
+            return host==K.host && Nhw==K.Nhw &&
+                   Nx==K.Nx && Ny==K.Ny && Nz==K.Nz &&
+                   Nthr==K.Nthr && Ntwins==K.Ntwins && mats==K.mats;
+        }
+};
+
+static bool autotune_cache_read(AutotuneKey const &key,int &Nthr,int &axis)
+{
+    std::unique_lock<std::mutex> lock(autotune_mutex);
+    
+    std::ifstream file(autotune_cache_path(),std::ios::in);
+    if(!file.is_open()) return false;
+    
+    bool found=false;
+    std::string line;
+    
+    // The last matching line wins, later runs appending to the file
+    
+    while(std::getline(file,line))
+    {
+        if(line.empty() || line[0]=='#') continue;
+        
+        std::stringstream strm(line);
+        AutotuneKey K;
+        int N_,axis_;
+        
+        if(!(strm>>K.host>>K.Nhw>>K.Nx>>K.Ny>>K.Nz>>K.Nthr>>K.Ntwins>>K.mats>>N_>>axis_)) continue;
+        
+        if(K==key)
+        {
+            Nthr=N_;
+            axis=axis_;
+            found=true;
+        }
+    }
+    
+    return found;
+}
+
+static void autotune_cache_write(AutotuneKey const &key,int Nthr,int axis)
+{
+    std::unique_lock<std::mutex> lock(autotune_mutex);
+    
+    std::ofstream file(autotune_cache_path(),std::ios::out|std::ios::app);
+    if(!file.is_open()) return;
+    
+    file<<key.host<<" "<<key.Nhw<<" "
+        <<key.Nx<<" "<<key.Ny<<" "<<key.Nz<<" "<<key.Nthr<<" "<<key.Ntwins<<" "
+        <<key.mats<<" "<<Nthr<<" "<<axis<<std::endl;
+}
+
+// Times a few updates of the current grid for each candidate number of
+// workers and split axis, and keeps the fastest. Meant to be called after
+// bootstrap and before the first step: the fields are then still zero and
+// stay so, the time step counter being left untouched
+
+void FDTD::autotune(int Nsteps)
+{
+    if(inline_run || domain!=nullptr || tstep!=0) return;
+    
+    int Nmax=threads_E.size();
+    
+    AutotuneKey key;
+    
+    key.host=autotune_host();
+    key.Nhw=std::thread::hardware_concurrency();
+    key.Nx=Nx; key.Ny=Ny; key.Nz=Nz;
+    key.Nthr=Nmax;
+    key.Ntwins=twins.size();
+    
+    for(int m=0;m<mats.L1();m++)
+    {
+        if(m>0) key.mats+=",";
+        key.mats+=std::to_string(mats[m].m_type)+":"+std::to_string(mats[m].Np);
+    }
+    
+    if(key.mats.empty()) key.mats="none";
+    
+    int best_N=Nmax,best_axis=SPLIT_AUTO;
+    
+    if(autotune_cache_read(key,best_N,best_axis))
+    {
+        std::cout<<"FDTD autotune: cached "<<best_N<<" threads, axis "<<best_axis<<std::endl;
+    }
+    else
+    {
+        // The auxiliary grid of a TFSF box has its own clock, and is left aside
+        
+        FDTD_TFSF *tfsf_tmp=tfsf;
+        tfsf=nullptr;
+        
+        double best_time=-1;
+        
+        for(int N=Nmax;N>=1;N/=2)
+        {
+            for(int axis=SPLIT_X;axis<=SPLIT_Z;axis++)
+            {
+                int extent=Nx;
+                     if(axis==SPLIT_Y) extent=Ny;
+                else if(axis==SPLIT_Z) extent=zo_e-zo_s;
+                
+                // A single worker does not split anything
+                
+                if(N==1 && axis!=SPLIT_Z) continue;
+                if(N>1 && extent<=N) continue;
+                
+                set_N_threads(N);
+                set_split_axis(axis);
+                
+                run_phases_E(PHASE_MATS_ANTE,PHASE_E_END);
+                run_phases_H();
+                
+                std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+                
+                for(int t=0;t<Nsteps;t++)
+                {
+                    run_phases_E(PHASE_MATS_ANTE,PHASE_E_END);
+                    run_phases_H();
+                }
+                
+                double time=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+                
+                if(best_time<0 || time<best_time)
+                {
+                    best_time=time;
+                    best_N=N;
+                    best_axis=(N==1)?SPLIT_AUTO:axis;
+                }
+            }
+        }
+        
+        tfsf=tfsf_tmp;
+        
+        autotune_cache_write(key,best_N,best_axis);
+        
+        std::cout<<"FDTD autotune: "<<best_N<<" threads, axis "<<best_axis<<std::endl;
+    }
+    
+    set_N_threads(best_N);
+    set_split_axis(best_axis);
+    
+    if(best_N==1) set_inline();
+    
+    #ifdef FDTD_PROFILING
+    profiler->reset();
+    #endif
+}
@@ -0,0 +1,287 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_core.h>
+#include <fdtd_subgrid.h>
+
+#include <fstream>
+#include <random>
+
+static char const checkpoint_magic[8]={'A','E','T','H','C','H','K','1'};
+static std::size_t const checkpoint_align=64;
+
+static std::size_t checkpoint_padded(std::size_t N)
+{
+    return ((N+checkpoint_align-1)/checkpoint_align)*checkpoint_align;
+}
+
+//################
+//   Checkpoint
+//################
+
+Checkpoint::Checkpoint()
+    :loading(false), valid(true), offset(0)
+{
+}
+
+bool Checkpoint::load(std::filesystem::path const &fname)
+{
+    loading=true;
+    valid=false;
+    offset=checkpoint_align;
+    
+    std::ifstream file(fname,std::ios::in|std::ios::binary|std::ios::ate);
+    if(!file.is_open()) return false;
+    
+    std::streamsize Nbytes=file.tellg();
+    if(Nbytes<static_cast<std::streamsize>(checkpoint_align)) return false;
+    
+    buffer.resize(Nbytes);
+    
+    file.seekg(0);
+    file.read(buffer.data(),Nbytes);
+    
+    if(!file || std::memcmp(buffer.data(),checkpoint_magic,8)!=0) return false;
+    
+    // Walking the blocks rejects truncated files before anything is restored
+    
+    std::size_t pos=checkpoint_align;
+    
+    while(pos+checkpoint_align<=buffer.size())
+    {
+        std::uint64_t N;
+        std::memcpy(&N,buffer.data()+pos,sizeof(std::uint64_t));
+        
+        if(N>buffer.size()) return false;
+        
+        pos+=checkpoint_align+checkpoint_padded(N);
+    }
+    
+    if(pos!=buffer.size()) return false;
+    
+    valid=true;
+    
+    return true;
+}
+
+// Rewinds a saved image so that it can be restored in place
+
+void Checkpoint::start_loading()
+{
+    loading=true;
+    valid=true;
+    offset=checkpoint_align;
+}
+
+void Checkpoint::start_saving()
+{
+    loading=false;
+    valid=true;
+    offset=checkpoint_align;
+    
+    buffer.assign(checkpoint_align,0);
+    std::memcpy(buffer.data(),checkpoint_magic,8);
+}
+
+void Checkpoint::sync(std::string &str)
+{
+    std::uint64_t N=str.size();
+    
+    sync(N);
+    if(loading && valid) str.resize(N);
+    
+    if(N>0 && str.size()==N) sync_raw(str.data(),N);
+    else sync_raw(nullptr,0);
+}
+
+void Checkpoint::sync_raw(void *data,std::size_t Nbytes)
+{
+    std::uint64_t N=Nbytes;
+    std::size_t block=checkpoint_align+checkpoint_padded(Nbytes);
+    
+    if(loading)
+    {
+        if(!valid) return;
+        
+        std::uint64_t N_stored;
+        
+        if(offset+block>buffer.size())
+        {
+            valid=false;
+            return;
+        }
+        
+        std::memcpy(&N_stored,buffer.data()+offset,sizeof(std::uint64_t));
+        
+        if(N_stored!=N)
+        {
+            valid=false;
+            return;
+        }
+        
+        if(Nbytes>0) std::memcpy(data,buffer.data()+offset+checkpoint_align,Nbytes);
+    }
+    else
+    {
+        buffer.resize(offset+block,0);
+        
+        std::memcpy(buffer.data()+offset,&N,sizeof(std::uint64_t));
+        if(Nbytes>0) std::memcpy(buffer.data()+offset+checkpoint_align,data,Nbytes);
+    }
+    
+    offset+=block;
+}
+
+void Checkpoint::write(std::filesystem::path const &fname) const
+{
+    std::random_device rd;
+    
+    std::filesystem::path tmp_fname=fname;
+    tmp_fname+=".tmp"+std::to_string(rd());
+    
+    std::ofstream file(tmp_fname,std::ios::out|std::ios::binary|std::ios::trunc);
+    
+    file.write(buffer.data(),offset);
+    file.close();
+    
+    if(!file)
+    {
+        std::cerr<<"Could not write checkpoint "<<tmp_fname<<std::endl;
+        std::filesystem::remove(tmp_fname);
+        return;
+    }
+    
+    std::error_code ec;
+    std::filesystem::rename(tmp_fname,fname,ec);
+    
+    if(ec)
+    {
+        std::cerr<<"Could not write checkpoint "<<fname<<": "<<ec.message()<<std::endl;
+        std::filesystem::remove(tmp_fname);
+    }
+}
+
+//#######################
+//   Checkpoint_Writer
+//#######################
+
+Checkpoint_Writer::Checkpoint_Writer()
+    :busy(false), stop(false)
+{
+    thread=new std::thread(&Checkpoint_Writer::process,this);
+}
+
+Checkpoint_Writer::~Checkpoint_Writer()
+{
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        stop=true;
+    }
+    
+    cv.notify_all();
+    
+    thread->join();
+    delete thread;
+}
+
+void Checkpoint_Writer::process()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    while(true)
+    {
+        while(!busy && !stop) cv.wait(lock);
+        
+        if(busy)
+        {
+            lock.unlock();
+            pending.write(fname);
+            lock.lock();
+            
+            busy=false;
+            cv.notify_all();
+        }
+        else if(stop) return;
+    }
+}
+
+void Checkpoint_Writer::submit(Checkpoint &chk,std::filesystem::path const &fname_)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    while(busy) cv.wait(lock);
+    
+    std::swap(pending.buffer,chk.buffer);
+    pending.offset=chk.offset;
+    fname=fname_;
+    
+    busy=true;
+    cv.notify_all();
+}
+
+void Checkpoint_Writer::wait()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    while(busy) cv.wait(lock);
+}
+
+//##########
+//   FDTD
+//##########
+
+void FDTD::checkpoint(Checkpoint &chk)
+{
+    chk.sync(tstep);
+    
+    chk.sync(Ex); chk.sync(Ey); chk.sync(Ez);
+    chk.sync(Hx); chk.sync(Hy); chk.sync(Hz);
+    
+    chk.sync(dt_Dx); chk.sync(dt_Dy); chk.sync(dt_Dz);
+    chk.sync(dt_Bx); chk.sync(dt_By); chk.sync(dt_Bz);
+    
+    chk.sync(PsiExy); chk.sync(PsiExz);
+    chk.sync(PsiEyx); chk.sync(PsiEyz);
+    chk.sync(PsiEzx); chk.sync(PsiEzy);
+    chk.sync(PsiHxy); chk.sync(PsiHxz);
+    chk.sync(PsiHyx); chk.sync(PsiHyz);
+    chk.sync(PsiHzx); chk.sync(PsiHzy);
+    
+    for(int m=0;m<mats.L1();m++) mats[m].checkpoint(chk);
+    
+    for(unsigned int n=0;n<subgrids.size();n++) subgrids[n]->checkpoint(chk);
+    
+    if(chk.loading && chk.valid && tstep>0) pml_coeff_calc();
+}
+
+//###################
+//   FDTD_Material
+//###################
+
+void FDTD_Material::checkpoint(Checkpoint &chk)
+{
+    chk.sync(m_Psi);
+    chk.sync(m_Psi_c);
+    
+    chk.sync(pop_matrix);
+    chk.sync(pop_matrix_np);
+    
+    chk.sync(pol_field_np);
+    chk.sync(pol_field_n);
+    chk.sync(pol_field_nm);
+    
+    chk.sync(Ex_n);
+    chk.sync(Ey_n);
+    chk.sync(Ez_n);
+}
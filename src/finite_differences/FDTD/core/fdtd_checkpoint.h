@@ -0,0 +1,131 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef FDTD_CHECKPOINT_H
+#define FDTD_CHECKPOINT_H
+
+#include <grid.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//################
+//   Checkpoint
+//################
+
+// Flat image of a simulation state. Every block is stored as its byte
+// size followed by the raw data, padded to a 64 bytes boundary, so that
+// the file can be mapped in memory and restored with plain copies.
+// The same sync() calls are used to save and to restore, which keeps
+// both directions in the same order by construction.
+
+class Checkpoint
+{
+    public:
+        bool loading,valid;
+        std::size_t offset;
+        std::vector<char> buffer;
+        
+        Checkpoint();
+        
+        bool load(std::filesystem::path const &fname);
+        void start_loading();
+        void start_saving();
+        void sync(std::string &str);
+        void sync_raw(void *data,std::size_t Nbytes);
+        void write(std::filesystem::path const &fname) const;
+        
+        template<class T>
+        void sync(T &val) { sync_raw(&val,sizeof(T)); }
+        
+        template<class T>
+        void sync(Grid1<T> &G)
+        {
+            if(G.L1()>0) sync_raw(&G[0],G.L1()*sizeof(T));
+            else sync_raw(nullptr,0);
+        }
+        
+        template<class T>
+        void sync(Grid2<T> &G)
+        {
+            std::size_t N=static_cast<std::size_t>(G.L1())*G.L2();
+            
+            if(N>0) sync_raw(&G(0,0),N*sizeof(T));
+            else sync_raw(nullptr,0);
+        }
+        
+        template<class T>
+        void sync(Grid3<T> &G)
+        {
+            std::size_t N=static_cast<std::size_t>(G.L1())*G.L2()*G.L3();
+            
+            if(N>0) sync_raw(&G(0,0,0),N*sizeof(T));
+            else sync_raw(nullptr,0);
+        }
+        
+        template<class T>
+        void sync(Grid4<T> &G)
+        {
+            std::size_t N=static_cast<std::size_t>(G.mem_size()/sizeof(T));
+            
+            if(N>0) sync_raw(&G.agt(0,0),N*sizeof(T));
+            else sync_raw(nullptr,0);
+        }
+        
+        template<class T>
+        void sync(std::vector<T> &V)
+        {
+            std::uint64_t N=V.size();
+            
+            sync(N);
+            if(loading && valid) V.resize(N);
+            
+            if(N>0 && V.size()==N) sync_raw(V.data(),N*sizeof(T));
+            else sync_raw(nullptr,0);
+        }
+};
+
+// Writes checkpoints from a background thread. The state is copied on
+// the calling thread, then written to a temporary file renamed over the
+// previous checkpoint, so that an interrupted job always leaves a
+// complete file behind.
+
+class Checkpoint_Writer
+{
+    private:
+        bool busy,stop;
+        std::filesystem::path fname;
+        Checkpoint pending;
+        
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::thread *thread;
+        
+        void process();
+        
+    public:
+        Checkpoint_Writer();
+        ~Checkpoint_Writer();
+        
+        void submit(Checkpoint &chk,std::filesystem::path const &fname);
+        void wait();
+};
+
+#endif // FDTD_CHECKPOINT_H
@@ -13,6 +13,9 @@ See the License for the specific language governing permissions and
 limitations under the License.*/
 
 #include <fdtd_core.h>
+#include <fdtd_profiler.h>
+#include <fdtd_subgrid.h>
+#include <fdtd_tfsf.h>
 
 
 extern const Imdouble Im;
@@ -44,12 +47,18 @@ FDTD::FDTD(int Nx_,int Ny_,int Nz_,int Nt_,
      pml_alpha_ym(0), pml_alpha_yp(0),
      pml_alpha_zm(0), pml_alpha_zp(0),
      Nthreads(max_threads_number()),
+     profiler(&fdtd_profiler()),
+     inline_run(false),
+     split_axis(SPLIT_AUTO),
      allow_run_E(false),
      alternator_E(Nthreads),
      threads_ready_E(Nthreads), threads_E(Nthreads),
      allow_run_H(false),
      alternator_H(Nthreads),
-     threads_ready_H(Nthreads), threads_H(Nthreads)
+     threads_ready_H(Nthreads), threads_H(Nthreads),
+     reduction_type(REDUCTION_NONE),
+     reduction_part(Nthreads,0),
+     tfsf(nullptr)
 {
     prefix="";
     
@@ -128,6 +137,11 @@ FDTD::FDTD(int Nx_,int Ny_,int Nz_,int Nt_,
     if(mode==M_OBLIQUE) std::cout<<"Oblique incidence requested, extending grid"<<std::endl;
     std::cout<<"New size: ("<<Nx<<","<<Ny<<","<<Nz<<") replacing ("<<Nx_<<","<<Ny_<<","<<Nz_<<")"<<std::endl<<std::endl;
     
+    Nz_glob=Nz; z_offset=0;
+    zo_s=0; zo_e=Nz;
+    domain=nullptr;
+    
+    z_coeffs_calc();
     alloc_DEBH();
     #ifndef SEP_MATS
     matsgrid.init(Nx,Ny,Nz,0);
@@ -166,7 +180,8 @@ FDTD::FDTD(int Nx_,int Ny_,int Nz_,int Nt_,
            int pml_zm_,int pml_zp_,
            int pad_xm_,int pad_xp_,
            int pad_ym_,int pad_yp_,
-           int pad_zm_,int pad_zp_)
+           int pad_zm_,int pad_zp_,
+           FDTD_Domain *domain_)
     :tstep(0), Nx(Nx_), Ny(Ny_), Nz(Nz_), Nt(Nt_), Ntap(0), Nmat(1),
      Dx(Dx_), Dy(Dy_), Dz(Dz_), Dt(Dt_), fact(0),
      kx(0), ky(0),
@@ -188,12 +203,18 @@ FDTD::FDTD(int Nx_,int Ny_,int Nz_,int Nt_,
      pml_alpha_ym(0), pml_alpha_yp(0),
      pml_alpha_zm(0), pml_alpha_zp(0),
      Nthreads(max_threads_number()),
+     profiler(&fdtd_profiler()),
+     inline_run(false),
+     split_axis(SPLIT_AUTO),
      allow_run_E(false),
      alternator_E(Nthreads),
      threads_ready_E(Nthreads), threads_E(Nthreads),
      allow_run_H(false),
      alternator_H(Nthreads),
-     threads_ready_H(Nthreads), threads_H(Nthreads)
+     threads_ready_H(Nthreads), threads_H(Nthreads),
+     reduction_type(REDUCTION_NONE),
+     reduction_part(Nthreads,0),
+     tfsf(nullptr)
 {
     prefix="";
     
@@ -261,6 +282,34 @@ FDTD::FDTD(int Nx_,int Ny_,int Nz_,int Nt_,
     if(mode==M_OBLIQUE) std::cout<<"Oblique incidence requested, extending grid"<<std::endl;
     std::cout<<"New size: ("<<Nx<<","<<Ny<<","<<Nz<<") replacing ("<<Nx_<<","<<Ny_<<","<<Nz_<<")"<<std::endl<<std::endl;
     
+    // Domain decomposition: only a z-slab and its two halo planes are held
+    
+    Nz_glob=Nz; z_offset=0;
+    zo_s=0; zo_e=Nz;
+    domain=nullptr;
+    
+    if(domain_!=nullptr && domain_->Nranks>1)
+    {
+        if(Nz_glob<domain_->Nranks)
+        {
+            std::cerr<<"Not enough z planes for "<<domain_->Nranks<<" processes"<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        
+        int z1,z2;
+        domain_->slab(Nz_glob,z1,z2);
+        
+        domain=domain_;
+        
+        Nz=z2-z1+2;
+        z_offset=z1-1;
+        zo_s=1;
+        zo_e=Nz-1;
+        
+        std::cout<<"Process "<<domain->rank<<": planes "<<z1<<" to "<<z2-1<<std::endl;
+    }
+    
+    z_coeffs_calc();
     alloc_DEBH();
     #ifndef SEP_MATS
     matsgrid.init(Nx,Ny,Nz,0);
@@ -291,20 +340,9 @@ FDTD::FDTD(int Nx_,int Ny_,int Nz_,int Nt_,
 
 FDTD::~FDTD()
 {
-    allow_run_E=false;
-    allow_run_H=false;
-    
-    alternator_E.signal_threads();
-    alternator_H.signal_threads();
+    stop_threads();
     
-    for(int i=0;i<Nthreads;i++)
-    {
-        threads_E[i]->join();
-        threads_H[i]->join();
-        
-        delete threads_E[i];
-        delete threads_H[i];
-    }
+    for(unsigned int n=0;n<subgrids.size();n++) delete subgrids[n];
 }
 
 //void FDTD::advEx(int i1,int i2)
@@ -365,6 +403,34 @@ FDTD::~FDTD()
 //    }
 //}
 
+// Slot in the Psi arrays of the node n along a direction holding the
+// PMLs [0,pml_m) and [N-pml_p,N), -1 if it does not carry a Psi. The
+// first E node and the last H node are left to the PEC walls
+
+static int pml_slot_E(int n,int N,int pml_m,int pml_p)
+{
+    if(n>=1 && n<pml_m) return n;
+    if(n>N-pml_p && n<N) return n-(N-pml_p)+pml_m;
+    
+    return -1;
+}
+
+static int pml_slot_H(int n,int N,int pml_m,int pml_p)
+{
+    if(n>=0 && n<pml_m) return n;
+    if(n>=N-pml_p && n<N-1) return n-(N-pml_p)+pml_m;
+    
+    return -1;
+}
+
+// The Yee kernels apply the convolutional PML correction in the same sweep
+// as the curl. Rows crossing a PML take the PML branch, and the rows along
+// x are split so that only their PML ends do when the PML is along x.
+// The corrections are done in the same order as the curl terms.
+// The linked twins share the geometry, materials and time step of this
+// grid, so they are advanced in the same cell loop: the material and PML
+// coefficients of a cell are looked up once for the whole batch
+
 void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 {
     int i,j,k;
@@ -374,7 +440,15 @@ void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
     double kappa_y,inv_kappa_y;
     double kappa_z,inv_kappa_z;
     int M;
-    double C1,C2y,C2z;
+    double C1,C2y,C2z,C4=0;
+    
+    double inv_Dy=1.0/Dy;
+    double inv_Dz=1.0/Dz;
+    
+    std::vector<FDTD*> batch(1,this);
+    batch.insert(batch.end(),twins.begin(),twins.end());
+    
+    int b,Nb=batch.size();
     
     for(k=k1_;k<k2_;k++)
     {
@@ -385,7 +459,9 @@ void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
         if(pml_zm || pml_zp) kappa_z=kappa_z_E[k];
         else kappa_z=1.0;
         
-        inv_kappa_z=1.0/kappa_z;
+        inv_kappa_z=z_coeff_E[k]/kappa_z;
+        
+        int nz=pml_slot_E(k+z_offset,Nz_glob,pml_zm,pml_zp);
         
         for(j=j1_;j<j2_;j++)
         {
@@ -406,6 +482,9 @@ void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
             
             inv_kappa_y=1.0/kappa_y;
             
+            int ny=pml_slot_E(j,Ny,pml_ym,pml_yp);
+            bool pml=(ny>=0 || nz>=0);
+            
             for(i=i1_;i<i2_;i++) //0 - Nx
             {
                 #ifndef SEP_MATS
@@ -415,9 +494,30 @@ void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
                 #endif
                 
                 mats[M].coeffsX(C1,C2y,C2z);
+                if(pml) C4=mats[M].pml_coeff();
                 
-                Ex(i,j,k)=C1*Ex(i,j,k)+C2y*inv_kappa_y*(Hz(i,j2,k)-Hz(i,j1,k))
-                                      -C2z*inv_kappa_z*(Hy(i,j,k2)-Hy(i,j,k1));
+                for(b=0;b<Nb;b++)
+                {
+                    FDTD &g=*batch[b];
+                    
+                    g.Ex(i,j,k)=C1*g.Ex(i,j,k)+C2y*inv_kappa_y*(g.Hz(i,j2,k)-g.Hz(i,j1,k))
+                                              -C2z*inv_kappa_z*(g.Hy(i,j,k2)-g.Hy(i,j,k1));
+                    
+                    if(pml)
+                    {
+                        if(ny>=0)
+                        {
+                            g.PsiExy(i,ny,k)=b_y_E[j]*g.PsiExy(i,ny,k)+c_y_E[j]*inv_Dy*(g.Hz(i,j,k)-g.Hz(i,j-1,k));
+                            g.Ex(i,j,k)+=C4*g.PsiExy(i,ny,k);
+                        }
+                        
+                        if(nz>=0)
+                        {
+                            g.PsiExz(i,j,nz)=b_z_E[k]*g.PsiExz(i,j,nz)+c_z_E[k]*inv_Dz*(g.Hy(i,j,k)-g.Hy(i,j,k-1));
+                            g.Ex(i,j,k)-=C4*g.PsiExz(i,j,nz);
+                        }
+                    }
+                }
             }
         }
     }
@@ -482,13 +582,26 @@ void FDTD::advEx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 
 void FDTD::advEy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 {
-    int i,j,k;
+    int i,j,k,s;
     int i1,i2,k1,k2;
-    int M;
+    int M,nx=-1;
     //double x,y,z,tb;
     double kappa_x,inv_kappa_x;
     double kappa_z,inv_kappa_z;
-    double C1,C2x,C2z;
+    double C1,C2x,C2z,C4=0;
+    
+    double inv_Dx=1.0/Dx;
+    double inv_Dz=1.0/Dz;
+    
+    int xa=pml_xm;
+    int xb=std::max(xa,Nx-pml_xp+1);
+    
+    int x_seg[4]={i1_,std::min(std::max(xa,i1_),i2_),std::min(std::max(xb,i1_),i2_),i2_};
+    
+    std::vector<FDTD*> batch(1,this);
+    batch.insert(batch.end(),twins.begin(),twins.end());
+    
+    int b,Nb=batch.size();
     
     for(k=k1_;k<k2_;k++)
     {
@@ -499,39 +612,72 @@ void FDTD::advEy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
         if(pml_zm || pml_zp) kappa_z=kappa_z_E[k];
         else kappa_z=1.0;
         
-        inv_kappa_z=1.0/kappa_z;
-            
+        inv_kappa_z=z_coeff_E[k]/kappa_z;
+        
+        int nz=pml_slot_E(k+z_offset,Nz_glob,pml_zm,pml_zp);
+        
         for(j=j1_;j<j2_;j++) //0 - Ny
         {
-            for(i=i1_;i<i2_;i++)
+            for(s=0;s<3;s++)
             {
-                i2=i;
-                if(mode!=M_OBLIQUE_PHASE)
-                {
-                    if(i==0) i1=Nx-1;
-                    else i1=i-1;
-                }
-                else
+                bool pml=(s!=1 || nz>=0);
+                
+                for(i=x_seg[s];i<x_seg[s+1];i++)
                 {
-                    if(i==0) i1=Nx;
-                    else i1=i-1;
+                    i2=i;
+                    if(mode!=M_OBLIQUE_PHASE)
+                    {
+                        if(i==0) i1=Nx-1;
+                        else i1=i-1;
+                    }
+                    else
+                    {
+                        if(i==0) i1=Nx;
+                        else i1=i-1;
+                    }
+                    
+                    if(pml_xm || pml_xp) kappa_x=kappa_x_E[i];
+                    else kappa_x=1.0;
+                    
+                    inv_kappa_x=1.0/kappa_x;
+                    
+                    #ifndef SEP_MATS
+                    M=matsgrid(i,j,k);
+                    #else
+                    M=matsgrid_y(i,j,k);
+                    #endif
+                    
+                    mats[M].coeffsY(C1,C2x,C2z);
+                    
+                    if(pml)
+                    {
+                        C4=mats[M].pml_coeff();
+                        nx=pml_slot_E(i,Nx,pml_xm,pml_xp);
+                    }
+                    
+                    for(b=0;b<Nb;b++)
+                    {
+                        FDTD &g=*batch[b];
+                        
+                        g.Ey(i,j,k)=C1*g.Ey(i,j,k)+C2z*inv_kappa_z*(g.Hx(i,j,k2)-g.Hx(i,j,k1))
+                                                  -C2x*inv_kappa_x*(g.Hz(i2,j,k)-g.Hz(i1,j,k));
+                        
+                        if(pml)
+                        {
+                            if(nx>=0)
+                            {
+                                g.PsiEyx(nx,j,k)=b_x_E[i]*g.PsiEyx(nx,j,k)+c_x_E[i]*inv_Dx*(g.Hz(i,j,k)-g.Hz(i-1,j,k));
+                                g.Ey(i,j,k)-=C4*g.PsiEyx(nx,j,k);
+                            }
+                            
+                            if(nz>=0)
+                            {
+                                g.PsiEyz(i,j,nz)=b_z_E[k]*g.PsiEyz(i,j,nz)+c_z_E[k]*inv_Dz*(g.Hx(i,j,k)-g.Hx(i,j,k-1));
+                                g.Ey(i,j,k)+=C4*g.PsiEyz(i,j,nz);
+                            }
+                        }
+                    }
                 }
-                
-                if(pml_xm || pml_xp) kappa_x=kappa_x_E[i];
-                else kappa_x=1.0;
-                
-                inv_kappa_x=1.0/kappa_x;
-                
-                #ifndef SEP_MATS
-                M=matsgrid(i,j,k);
-                #else
-                M=matsgrid_y(i,j,k);
-                #endif
-                
-                mats[M].coeffsY(C1,C2x,C2z);
-                
-                Ey(i,j,k)=C1*Ey(i,j,k)+C2z*inv_kappa_z*(Hx(i,j,k2)-Hx(i,j,k1))
-                                      -C2x*inv_kappa_x*(Hz(i2,j,k)-Hz(i1,j,k));
             }
         }
     }
@@ -604,14 +750,27 @@ void FDTD::advEy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 
 void FDTD::advEz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 {
-    int i,j,k;
+    int i,j,k,s;
     int i1,i2;
     int j1,j2;
-    int M;
+    int M,nx=-1;
     double kappa_x,inv_kappa_x;
     double kappa_y,inv_kappa_y;
-    double C1,C2x,C2y;
-        
+    double C1,C2x,C2y,C4=0;
+    
+    double inv_Dx=1.0/Dx;
+    double inv_Dy=1.0/Dy;
+    
+    int xa=pml_xm;
+    int xb=std::max(xa,Nx-pml_xp+1);
+    
+    int x_seg[4]={i1_,std::min(std::max(xa,i1_),i2_),std::min(std::max(xb,i1_),i2_),i2_};
+    
+    std::vector<FDTD*> batch(1,this);
+    batch.insert(batch.end(),twins.begin(),twins.end());
+    
+    int b,Nb=batch.size();
+    
     for(k=k1_;k<k2_;k++) //0 - Nz
     {
         for(j=j1_;j<j2_;j++)
@@ -633,35 +792,68 @@ void FDTD::advEz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
             
             inv_kappa_y=1.0/kappa_y;
             
-            for(i=i1_;i<i2_;i++)
+            int ny=pml_slot_E(j,Ny,pml_ym,pml_yp);
+            
+            for(s=0;s<3;s++)
             {
-                i2=i;
-                if(mode!=M_OBLIQUE_PHASE)
-                {
-                    if(i==0) i1=Nx-1;
-                    else i1=i-1;
-                }
-                else
-                {
-                    if(i==0) i1=Nx;
-                    else i1=i-1;
-                }
-                
-                if(pml_xm || pml_xp) kappa_x=kappa_x_E[i];
-                else kappa_x=1.0;
+                bool pml=(s!=1 || ny>=0);
                 
-                inv_kappa_x=1.0/kappa_x;
-            
-                #ifndef SEP_MATS
-                M=matsgrid(i,j,k);
-                #else
-                M=matsgrid_z(i,j,k);
-                #endif
+                for(i=x_seg[s];i<x_seg[s+1];i++)
+                {
+                    i2=i;
+                    if(mode!=M_OBLIQUE_PHASE)
+                    {
+                        if(i==0) i1=Nx-1;
+                        else i1=i-1;
+                    }
+                    else
+                    {
+                        if(i==0) i1=Nx;
+                        else i1=i-1;
+                    }
+                    
+                    if(pml_xm || pml_xp) kappa_x=kappa_x_E[i];
+                    else kappa_x=1.0;
+                    
+                    inv_kappa_x=1.0/kappa_x;
                 
-                mats[M].coeffsZ(C1,C2x,C2y);
-                                
-                Ez(i,j,k)=C1*Ez(i,j,k)+C2x*inv_kappa_x*(Hy(i2,j,k)-Hy(i1,j,k))
-                                      -C2y*inv_kappa_y*(Hx(i,j2,k)-Hx(i,j1,k));
+                    #ifndef SEP_MATS
+                    M=matsgrid(i,j,k);
+                    #else
+                    M=matsgrid_z(i,j,k);
+                    #endif
+                    
+                    mats[M].coeffsZ(C1,C2x,C2y);
+                    
+                    if(pml)
+                    {
+                        C4=mats[M].pml_coeff();
+                        nx=pml_slot_E(i,Nx,pml_xm,pml_xp);
+                    }
+                    
+                    for(b=0;b<Nb;b++)
+                    {
+                        FDTD &g=*batch[b];
+                        
+                        g.Ez(i,j,k)=C1*g.Ez(i,j,k)+C2x*inv_kappa_x*(g.Hy(i2,j,k)-g.Hy(i1,j,k))
+                                                  -C2y*inv_kappa_y*(g.Hx(i,j2,k)-g.Hx(i,j1,k));
+                        
+                        if(pml)
+                        {
+                            if(nx>=0)
+                            {
+                                g.PsiEzx(nx,j,k)=b_x_E[i]*g.PsiEzx(nx,j,k)+c_x_E[i]*inv_Dx*(g.Hy(i,j,k)-g.Hy(i-1,j,k));
+                                g.Ez(i,j,k)+=C4*g.PsiEzx(nx,j,k);
+                            }
+                            
+                            if(ny>=0)
+                            {
+                                g.PsiEzy(i,ny,k)=b_y_E[j]*g.PsiEzy(i,ny,k)+c_y_E[j]*inv_Dy*(g.Hx(i,j,k)-g.Hx(i,j-1,k));
+                                g.Ez(i,j,k)-=C4*g.PsiEzy(i,ny,k);
+                            }
+                        }
+                    }
+                }
             }
         }
     }
@@ -725,7 +917,15 @@ void FDTD::advHx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
     
     double kappa_y,inv_kappa_y;
     double kappa_z,inv_kappa_z;
-        
+    
+    double inv_Dy=1.0/Dy;
+    double inv_Dz=1.0/Dz;
+    
+    std::vector<FDTD*> batch(1,this);
+    batch.insert(batch.end(),twins.begin(),twins.end());
+    
+    int b,Nb=batch.size();
+    
     for(k=k1_;k<k2_;k++)
     {
         if(k==Nz-1) k2=0;
@@ -735,7 +935,9 @@ void FDTD::advHx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
         if(pml_zm || pml_zp) kappa_z=kappa_z_H[k];
         else kappa_z=1.0;
         
-        inv_kappa_z=1.0/kappa_z;
+        inv_kappa_z=z_coeff_H[k]/kappa_z;
+        
+        int nz=pml_slot_H(k+z_offset,Nz_glob,pml_zm,pml_zp);
     
         for(j=j1_;j<j2_;j++)
         {
@@ -756,10 +958,34 @@ void FDTD::advHx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
             
             inv_kappa_y=1.0/kappa_y;
             
+            int ny=pml_slot_H(j,Ny,pml_ym,pml_yp);
+            
+            bool pml=(ny>=0 || nz>=0);
+            
             for(i=i1_;i<i2_;i++) //0 - Nx
             {
-                Hx(i,j,k)+=dtdmz*inv_kappa_z*(Ey(i,j,k2)-Ey(i,j,k1))
-                          -dtdmy*inv_kappa_y*(Ez(i,j2,k)-Ez(i,j1,k));
+                for(b=0;b<Nb;b++)
+                {
+                    FDTD &g=*batch[b];
+                    
+                    g.Hx(i,j,k)+=dtdmz*inv_kappa_z*(g.Ey(i,j,k2)-g.Ey(i,j,k1))
+                                -dtdmy*inv_kappa_y*(g.Ez(i,j2,k)-g.Ez(i,j1,k));
+                    
+                    if(pml)
+                    {
+                        if(ny>=0)
+                        {
+                            g.PsiHxy(i,ny,k)=b_y_H[j]*g.PsiHxy(i,ny,k)+c_y_H[j]*inv_Dy*(g.Ez(i,j+1,k)-g.Ez(i,j,k));
+                            g.Hx(i,j,k)-=dtm*g.PsiHxy(i,ny,k);
+                        }
+                        
+                        if(nz>=0)
+                        {
+                            g.PsiHxz(i,j,nz)=b_z_H[k]*g.PsiHxz(i,j,nz)+c_z_H[k]*inv_Dz*(g.Ey(i,j,k+1)-g.Ey(i,j,k));
+                            g.Hx(i,j,k)+=dtm*g.PsiHxz(i,j,nz);
+                        }
+                    }
+                }
             }
         }
     }
@@ -815,13 +1041,27 @@ void FDTD::advHx(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 
 void FDTD::advHy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 {
-    int i,j,k;
+    int i,j,k,s;
     int i1,i2;
     int k1,k2;
+    int nx=-1;
     
     double kappa_x,inv_kappa_x;
     double kappa_z,inv_kappa_z;
-        
+    
+    double inv_Dx=1.0/Dx;
+    double inv_Dz=1.0/Dz;
+    
+    int xa=pml_xm;
+    int xb=std::max(xa,Nx-pml_xp);
+    
+    int x_seg[4]={i1_,std::min(std::max(xa,i1_),i2_),std::min(std::max(xb,i1_),i2_),i2_};
+    
+    std::vector<FDTD*> batch(1,this);
+    batch.insert(batch.end(),twins.begin(),twins.end());
+    
+    int b,Nb=batch.size();
+    
     for(k=k1_;k<k2_;k++)
     {
         if(k==Nz-1) k2=0;
@@ -831,31 +1071,60 @@ void FDTD::advHy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
         if(pml_zm || pml_zp) kappa_z=kappa_z_H[k];
         else kappa_z=1.0;
         
-        inv_kappa_z=1.0/kappa_z;
+        inv_kappa_z=z_coeff_H[k]/kappa_z;
+        
+        int nz=pml_slot_H(k+z_offset,Nz_glob,pml_zm,pml_zp);
             
         for(j=j1_;j<j2_;j++)
         {
-            for(i=i1_;i<i2_;i++)
+            for(s=0;s<3;s++)
             {
-                if(mode!=M_OBLIQUE_PHASE)
-                {
-                    if(i==Nx-1) i2=0;
-                    else i2=i+1;
-                }
-                else
+                bool pml=(s!=1 || nz>=0);
+                
+                for(i=x_seg[s];i<x_seg[s+1];i++)
                 {
-                    if(i==Nx-1) i2=Nx;
-                    else i2=i+1;
+                    if(mode!=M_OBLIQUE_PHASE)
+                    {
+                        if(i==Nx-1) i2=0;
+                        else i2=i+1;
+                    }
+                    else
+                    {
+                        if(i==Nx-1) i2=Nx;
+                        else i2=i+1;
+                    }
+                    i1=i;
+                    
+                    if(pml_xm || pml_xp) kappa_x=kappa_x_H[i];
+                    else kappa_x=1.0;
+                    
+                    inv_kappa_x=1.0/kappa_x;
+                    
+                    if(pml) nx=pml_slot_H(i,Nx,pml_xm,pml_xp);
+                    
+                    for(b=0;b<Nb;b++)
+                    {
+                        FDTD &g=*batch[b];
+                        
+                        g.Hy(i,j,k)+=dtdmx*inv_kappa_x*(g.Ez(i2,j,k)-g.Ez(i1,j,k))
+                                    -dtdmz*inv_kappa_z*(g.Ex(i,j,k2)-g.Ex(i,j,k1));
+                        
+                        if(pml)
+                        {
+                            if(nx>=0)
+                            {
+                                g.PsiHyx(nx,j,k)=b_x_H[i]*g.PsiHyx(nx,j,k)+c_x_H[i]*inv_Dx*(g.Ez(i+1,j,k)-g.Ez(i,j,k));
+                                g.Hy(i,j,k)+=dtm*g.PsiHyx(nx,j,k);
+                            }
+                            
+                            if(nz>=0)
+                            {
+                                g.PsiHyz(i,j,nz)=b_z_H[k]*g.PsiHyz(i,j,nz)+c_z_H[k]*inv_Dz*(g.Ex(i,j,k+1)-g.Ex(i,j,k));
+                                g.Hy(i,j,k)-=dtm*g.PsiHyz(i,j,nz);
+                            }
+                        }
+                    }
                 }
-                i1=i;
-                
-                if(pml_xm || pml_xp) kappa_x=kappa_x_H[i];
-                else kappa_x=1.0;
-                
-                inv_kappa_x=1.0/kappa_x;
-                
-                Hy(i,j,k)+=dtdmx*inv_kappa_x*(Ez(i2,j,k)-Ez(i1,j,k))
-                          -dtdmz*inv_kappa_z*(Ex(i,j,k2)-Ex(i,j,k1));
             }
         }
     }
@@ -919,13 +1188,27 @@ void FDTD::advHy(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 
 void FDTD::advHz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
 {
-    int i,j,k;
+    int i,j,k,s;
     int i1,i2;
     int j1,j2;
+    int nx=-1;
     
     double kappa_x,inv_kappa_x;
     double kappa_y,inv_kappa_y;
-            
+    
+    double inv_Dx=1.0/Dx;
+    double inv_Dy=1.0/Dy;
+    
+    int xa=pml_xm;
+    int xb=std::max(xa,Nx-pml_xp);
+    
+    int x_seg[4]={i1_,std::min(std::max(xa,i1_),i2_),std::min(std::max(xb,i1_),i2_),i2_};
+    
+    std::vector<FDTD*> batch(1,this);
+    batch.insert(batch.end(),twins.begin(),twins.end());
+    
+    int b,Nb=batch.size();
+    
     for(k=k1_;k<k2_;k++)
     {
         for(j=j1_;j<j2_;j++)
@@ -947,27 +1230,56 @@ void FDTD::advHz(int i1_,int i2_,int j1_,int j2_,int k1_,int k2_)
             
             inv_kappa_y=1.0/kappa_y;
             
-            for(i=i1_;i<i2_;i++)
+            int ny=pml_slot_H(j,Ny,pml_ym,pml_yp);
+            
+            for(s=0;s<3;s++)
             {
-                if(mode!=M_OBLIQUE_PHASE)
-                {
-                    if(i==Nx-1) i2=0;
-                    else i2=i+1;
-                }
-                else
+                bool pml=(s!=1 || ny>=0);
+                
+                for(i=x_seg[s];i<x_seg[s+1];i++)
                 {
-                    if(i==Nx-1) i2=Nx;
-                    else i2=i+1;
+                    if(mode!=M_OBLIQUE_PHASE)
+                    {
+                        if(i==Nx-1) i2=0;
+                        else i2=i+1;
+                    }
+                    else
+                    {
+                        if(i==Nx-1) i2=Nx;
+                        else i2=i+1;
+                    }
+                    i1=i;
+                    
+                    if(pml_xm || pml_xp) kappa_x=kappa_x_H[i];
+                    else kappa_x=1.0;
+                    
+                    inv_kappa_x=1.0/kappa_x;
+                    
+                    if(pml) nx=pml_slot_H(i,Nx,pml_xm,pml_xp);
+                    
+                    for(b=0;b<Nb;b++)
+                    {
+                        FDTD &g=*batch[b];
+                        
+                        g.Hz(i,j,k)+=dtdmy*inv_kappa_y*(g.Ex(i,j2,k)-g.Ex(i,j1,k))
+                                    -dtdmx*inv_kappa_x*(g.Ey(i2,j,k)-g.Ey(i1,j,k));
+                        
+                        if(pml)
+                        {
+                            if(nx>=0)
+                            {
+                                g.PsiHzx(nx,j,k)=b_x_H[i]*g.PsiHzx(nx,j,k)+c_x_H[i]*inv_Dx*(g.Ey(i+1,j,k)-g.Ey(i,j,k));
+                                g.Hz(i,j,k)-=dtm*g.PsiHzx(nx,j,k);
+                            }
+                            
+                            if(ny>=0)
+                            {
+                                g.PsiHzy(i,ny,k)=b_y_H[j]*g.PsiHzy(i,ny,k)+c_y_H[j]*inv_Dy*(g.Ex(i,j+1,k)-g.Ex(i,j,k));
+                                g.Hz(i,j,k)+=dtm*g.PsiHzy(i,ny,k);
+                            }
+                        }
+                    }
                 }
-                i1=i;
-                
-                if(pml_xm || pml_xp) kappa_x=kappa_x_H[i];
-                else kappa_x=1.0;
-                
-                inv_kappa_x=1.0/kappa_x;
-                
-                Hz(i,j,k)+=dtdmy*inv_kappa_y*(Ex(i,j2,k)-Ex(i,j1,k))
-                          -dtdmx*inv_kappa_x*(Ey(i2,j,k)-Ey(i1,j,k));
             }
         }
     }
@@ -1165,44 +1477,52 @@ void FDTD::disable_fields(std::vector<int> const &fields)
     }
 }
 
-void FDTD::update_E()
+// The twin is advanced by the workers of this grid, its own are released
+// and it follows the splitting of this grid. Its fields are updated in the
+// kernels of this grid with the coefficients of this grid, so it has to be
+// given the same materials and PMLs
+
+void FDTD::link_twin(FDTD &twin_)
 {
-    if(tstep==0) pml_coeff_calc();
-    
-    std::unique_lock<std::mutex> lock(alternator_E.get_main_mutex());
-    
-    allow_run_E=true;
-    
-    // Materials Ante
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
-    
-    // E Field
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
-    // Materials Simp
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
+    if(twin_.Nx!=Nx || twin_.Ny!=Ny || twin_.Nz!=Nz
+       || twin_.Dx!=Dx || twin_.Dy!=Dy || twin_.Dz!=Dz || twin_.Dt!=Dt
+       || twin_.mode!=mode
+       || domain!=nullptr || twin_.domain!=nullptr)
+    {
+        std::cerr<<"Incompatible FDTD twin"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
     
-    // Materials Post
+    twin_.stop_threads();
+    twin_.Nthreads=Nthreads;
+    twin_.split_axis=split_axis;
     
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
+    twins.push_back(&twin_);
+}
+
+// Bounds of the owned local planes matching the global planes [kg,...)
+// and [...,kg)
+
+int FDTD::local_z1(int kg) const { return std::max(kg-z_offset,zo_s); }
+int FDTD::local_z2(int kg) const { return std::min(kg-z_offset,zo_e); }
+
+void FDTD::update_E()
+{
+    if(tstep==0)
+    {
+        pml_coeff_calc();
+        for(unsigned int n=0;n<twins.size();n++) twins[n]->pml_coeff_calc();
+    }
     
-    // Materials Self
+    FDTD_PROF_START(t_update);
     
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
+    run_phases_E(PHASE_MATS_ANTE,PHASE_E_END);
     
-    // PMLS
+    FDTD_PROF_STOP(t_update,FDTD_Profiler::PROF_UPDATE_E);
     
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
+    // The subgrids take the coarse H field before its update
     
-    allow_run_E=false;
+    for(unsigned int n=0;n<subgrids.size();n++) subgrids[n]->advance();
     
 //    update_mats_ante();
 //    
@@ -1226,51 +1546,17 @@ void FDTD::update_E_ante()
 {
     if(tstep==0) pml_coeff_calc();
     
-    std::unique_lock<std::mutex> lock(alternator_E.get_main_mutex());
-    
-    allow_run_E=true;
-    
-    // Materials Ante
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
+    run_phases_E(PHASE_MATS_ANTE,PHASE_E_FIELD);
 }
 
 void FDTD::update_E_self()
 {
-    std::unique_lock<std::mutex> lock(alternator_E.get_main_mutex());
-    
-    // E Field
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
+    run_phases_E(PHASE_E_FIELD,PHASE_MATS_SIMP);
 }
 
 void FDTD::update_E_post()
 {
-    std::unique_lock<std::mutex> lock(alternator_E.get_main_mutex());
-    
-    // Materials Simp
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
-    
-    // Materials Post
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
-    
-    // Materials Self
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
-    
-    // PMLS
-    
-    alternator_E.signal_threads();
-    alternator_E.main_wait_threads(lock);
-    
-    allow_run_E=false;
+    run_phases_E(PHASE_MATS_SIMP,PHASE_E_END);
 }
 
 void FDTD::update_E_ext()
@@ -1320,23 +1606,31 @@ void FDTD::update_E_ext()
 
 void FDTD::update_H()
 {
-    std::unique_lock<std::mutex> lock(alternator_H.get_main_mutex());
+    FDTD_PROF_START(t_update);
     
-    allow_run_H=true;
-        
-    // H Field
+    if(tfsf!=nullptr) tfsf->advance_H();
+    
+    run_phases_H();
     
-    alternator_H.signal_threads();
-    alternator_H.main_wait_threads(lock);
+    FDTD_PROF_STOP(t_update,FDTD_Profiler::PROF_UPDATE_H);
     
-    // PMLS
+    // Sensors and sources rely on up to date H halos
     
-    alternator_H.signal_threads();
-    alternator_H.main_wait_threads(lock);
+    FDTD_PROF_START(t_halos);
+    if(domain!=nullptr) domain->exchange(Hx,Hy,Hz,zo_s,zo_e);
+    FDTD_PROF_STOP(t_halos,FDTD_Profiler::PROF_HALOS);
     
-    allow_run_H=false;
+    for(unsigned int n=0;n<subgrids.size();n++) subgrids[n]->restrict_fields();
+    
+    #ifdef FDTD_PROFILING
+    double cells=static_cast<double>(Nx)*Ny*(zo_e-zo_s);
+    for(unsigned int n=0;n<twins.size();n++) cells+=static_cast<double>(twins[n]->Nx)*twins[n]->Ny*twins[n]->Nz;
+    
+    FDTD_PROF_CELLS(cells);
+    #endif
     
     tstep+=1;
+    for(unsigned int n=0;n<twins.size();n++) twins[n]->tstep+=1;
 }
 
 void FDTD::update_H_ext()
@@ -15,6 +15,7 @@ limitations under the License.*/
 #ifndef FDTD_CORE_H_INCLUDED
 #define FDTD_CORE_H_INCLUDED
 
+#include <fdtd_domain.h>
 #include <fdtd_material.h>
 #include <fdtd_utils.h>
 
@@ -22,6 +23,10 @@ limitations under the License.*/
 //    #define NTHR 4
 //#endif
 
+class FDTD_Profiler;
+class FDTD_Subgrid;
+class FDTD_TFSF;
+
 class FDTD
 {
     public:
@@ -92,7 +97,8 @@ class FDTD
              int pml_zm,int pml_zp,
              int pad_xm,int pad_xp,
              int pad_ym,int pad_yp,
-             int pad_zm,int pad_zp);
+             int pad_zm,int pad_zp,
+             FDTD_Domain *domain=nullptr);
         
         ~FDTD();
         
@@ -102,6 +108,8 @@ class FDTD
         void basic_differentials_compute();
         void bufread(Grid3<double> &,int,std::string);
         void bufwrite(Grid3<double> &,int,std::string);
+        void checkpoint(Checkpoint &chk);
+        double compute_energy_E(int k1,int k2) const;
         double compute_poynting_box(int i1,int i2,int j1,int j2,int k1,int k2) const;
         double compute_poynting_X(int j1,int j2,int k1,int k2,int pos_x,int sgn=1) const;
         double compute_poynting_Y(int i1,int i2,int k1,int k2,int pos_y,int sgn=1) const;
@@ -125,6 +133,8 @@ class FDTD
         //void set_spectrum_dens(int);
         void set_tapering(int Ntap);
         void set_working_dir(std::string);
+        void snapshot(int vmode,int pos_x,int pos_y,int pos_z,
+                      Grid2<double> &Fx,Grid2<double> &Fy,Grid2<double> &Fz) const;
         
         //#########################
         //   Computation update
@@ -157,6 +167,22 @@ class FDTD
         void update_E_self();
         void update_E_post();
         
+        // Phases of the E update, in their running order
+        
+        enum
+        {
+            PHASE_MATS_ANTE=0,
+            PHASE_E_FIELD,
+            PHASE_MATS_SIMP,
+            PHASE_MATS_POST,
+            PHASE_MATS_SELF,
+            PHASE_PML_E,
+            PHASE_E_END
+        };
+        
+        void run_phases_E(int p1,int p2);
+        void run_phases_H();
+        
         void update_E_simp();
         void update_E_ext();
         void update_H_simp();
@@ -209,12 +235,12 @@ class FDTD
         
         void allocate_pml();
         
-        void app_pml_Ex(int,int);
-        void app_pml_Ey(int,int);
-        void app_pml_Ez(int,int);
-        void app_pml_Hx(int,int);
-        void app_pml_Hy(int,int);
-        void app_pml_Hz(int,int);
+        void app_pec_Ex(int,int);
+        void app_pec_Ey(int,int);
+        void app_pec_Ez(int,int);
+        void app_pec_Hx(int,int);
+        void app_pec_Hy(int,int);
+        void app_pec_Hz(int,int);
         
         void app_pml_Ex();
         void app_pml_Ey();
@@ -248,18 +274,133 @@ class FDTD
         
         int Nthreads;
         
+        // Profiler of the thread building the grid, the workers recording
+        // into it too
+        
+        FDTD_Profiler *profiler;
+        
+        // Small grids can be run without workers, on the calling thread
+        
+        bool inline_run;
+        void set_inline();
+        void stop_threads();
+        
+        // The field updates are split along a single axis, chosen by
+        // default as the first of z, y and x long enough for the threads.
+        // Fewer threads than spawned can be used, the others being parked
+        
+        enum
+        {
+            SPLIT_AUTO=0,
+            SPLIT_X,
+            SPLIT_Y,
+            SPLIT_Z
+        };
+        
+        int split_axis;
+        bool split_box(int ID,int k1,int k2,int &x1,int &x2,int &y1,int &y2,int &z1,int &z2) const;
+        void set_N_threads(int N);
+        void set_split_axis(int axis);
+        
+        void autotune(int Nsteps=4);
+        
         bool allow_run_E;
         ThreadsAlternator alternator_E;
         std::vector<bool> threads_ready_E;
         std::vector<std::thread*> threads_E;
+        void threaded_phase_E(int ID,int phase);
         void threaded_process_E(int ID);
         
-        bool allow_run_H;
-        ThreadsAlternator alternator_H;
+        mutable bool allow_run_H;
+        mutable ThreadsAlternator alternator_H;
         std::vector<bool> threads_ready_H;
         std::vector<std::thread*> threads_H;
         void threaded_process_H(int ID);
         
+        // Sums over the grid run by the H workers between two updates, each
+        // one over a chunk along the split direction, the partial sums being
+        // then added pairwise so that the result does not depend on timing.
+        // Only the workers state is modified, hence the mutable members
+        
+        enum
+        {
+            REDUCTION_NONE=0,
+            REDUCTION_ENERGY,
+            REDUCTION_PX,
+            REDUCTION_PY,
+            REDUCTION_PZ
+        };
+        
+        mutable int reduction_type;
+        mutable int red_a1,red_a2,red_b1,red_b2,red_pos;
+        mutable std::vector<double> reduction_part;
+        
+        double reduction_chunk(int type,int n1,int n2) const;
+        double run_reduction(int type,int a1,int a2,int b1,int b2,int pos) const;
+        void threaded_reduction(int ID) const;
+        
+        std::vector<FDTD*> twins;
+        void link_twin(FDTD &twin);
+        
+        void threaded_E_field(int ID,int k1,int k2);
+        void threaded_H_field(int ID,int k1,int k2);
+        void threaded_mats(int ID,void (FDTD::*adv_mats)(int,int));
+        void threaded_pml_E(int ID);
+        void threaded_pml_H(int ID);
+        
+        //###################
+        //   Decomposition
+        //###################
+        
+        // Local plane k is the global plane k+z_offset, the planes
+        // [zo_s,zo_e) are owned and the others are halos
+        
+        int Nz_glob,z_offset,zo_s,zo_e;
+        FDTD_Domain *domain;
+        
+        int local_z1(int kg) const;
+        int local_z2(int kg) const;
+        
+        //##############
+        //   Graded z
+        //##############
+        
+        // Steps between the global planes k and k+1, uniform when empty.
+        // Dz is then the reference step seen by the materials coefficients,
+        // and the z differences are rescaled plane by plane through z_coeff
+        
+        std::vector<double> z_step;
+        Grid1<double> z_coeff_E,z_coeff_H;
+        
+        void set_z_steps(std::vector<double> const &steps);
+        double z_cell(int kg) const;
+        void z_coeffs_calc();
+        double z_dual(int kg) const;
+        double z_position(int kg) const;
+        
+        //##############
+        //   Subgrids
+        //##############
+        
+        // Refined regions, advanced at the end of update_E before the
+        // coarse H field moves on, their fields being copied to the
+        // coarse cells they cover at the end of update_H
+        
+        std::vector<FDTD_Subgrid*> subgrids;
+        
+        FDTD_Subgrid* add_subgrid(int i1,int i2,int j1,int j2,int k1,int k2,int ratio);
+        
+        //##########
+        //   TFSF
+        //##########
+        
+        // Total-field/scattered-field box, whose corrections are applied
+        // within the update phases
+        
+        FDTD_TFSF *tfsf;
+        
+        void link_tfsf(FDTD_TFSF &tfsf);
+        
         //###############
         //  Utilities
         //###############
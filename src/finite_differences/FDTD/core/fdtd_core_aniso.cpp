@@ -46,7 +46,7 @@ void FDTD::adv_dt_Dx(int i1,int i2)
             if(pml_zm || pml_zp) kappa_z=kappa_z_E[k];
             else kappa_z=1.0;
             
-            inv_kappa_z=1.0/(kappa_z*Dz);
+            inv_kappa_z=z_coeff_E[k]/(kappa_z*Dz);
             
             for(i=i1;i<i2;i++) //0 - Nx
             {
@@ -92,7 +92,7 @@ void FDTD::adv_dt_Dy(int j1,int j2)
             if(pml_zm || pml_zp) kappa_z=kappa_z_E[k];
             else kappa_z=1.0;
             
-            inv_kappa_z=1.0/(Dz*kappa_z);
+            inv_kappa_z=z_coeff_E[k]/(Dz*kappa_z);
             
             for(j=j1;j<j2;j++) //0 - Ny
             {
@@ -180,7 +180,7 @@ void FDTD::adv_dt_Bx(int i1,int i2)
             if(pml_zm || pml_zp) kappa_z=kappa_z_H[k];
             else kappa_z=1.0;
             
-            inv_kappa_z=1.0/(Dz*kappa_z);
+            inv_kappa_z=z_coeff_H[k]/(Dz*kappa_z);
             
             for(i=i1;i<i2;i++) //0 - Nx
             {
@@ -228,7 +228,7 @@ void FDTD::adv_dt_By(int j1,int j2)
             if(pml_zm || pml_zp) kappa_z=kappa_z_H[k];
             else kappa_z=1.0;
             
-            inv_kappa_z=1.0/(Dz*kappa_z);
+            inv_kappa_z=z_coeff_H[k]/(Dz*kappa_z);
             
             for(j=j1;j<j2;j++)
             {
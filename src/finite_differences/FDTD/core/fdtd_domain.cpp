@@ -0,0 +1,194 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_domain.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef AETHER_MPI
+
+static void domain_finalize()
+{
+    int finalized=0;
+    MPI_Finalized(&finalized);
+    
+    if(!finalized) MPI_Finalize();
+}
+
+// Reductions are done by chunks so that the counts fit in an int
+
+static const std::size_t domain_chunk=1<<28;
+
+template<class T>
+void domain_allreduce(T *V,std::size_t N,MPI_Datatype type,MPI_Op op)
+{
+    for(std::size_t p=0;p<N;p+=domain_chunk)
+    {
+        std::size_t Np=std::min(domain_chunk,N-p);
+        
+        MPI_Allreduce(MPI_IN_PLACE,V+p,static_cast<int>(Np),type,op,MPI_COMM_WORLD);
+    }
+}
+
+// MPI is initialized by the first domain ever built, which must be on the
+// main thread as the library is only FUNNELED. The rank and size are
+// cached so that later domains, possibly built on other threads, never
+// call into MPI
+
+class Domain_World
+{
+    public:
+        int rank,Nranks;
+        
+        Domain_World()
+            :rank(0), Nranks(1)
+        {
+            int initialized=0;
+            MPI_Initialized(&initialized);
+            
+            if(!initialized)
+            {
+                int provided=0;
+                MPI_Init_thread(nullptr,nullptr,MPI_THREAD_FUNNELED,&provided);
+                std::atexit(domain_finalize);
+            }
+            
+            MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+            MPI_Comm_size(MPI_COMM_WORLD,&Nranks);
+        }
+};
+
+static Domain_World const& domain_world()
+{
+    static Domain_World world;
+    
+    return world;
+}
+
+#endif
+
+FDTD_Domain::FDTD_Domain()
+    :rank(0), Nranks(1)
+{
+    #ifdef AETHER_MPI
+    rank=domain_world().rank;
+    Nranks=domain_world().Nranks;
+    #endif
+}
+
+bool FDTD_Domain::any(bool val)
+{
+    int tmp=val;
+    
+    #ifdef AETHER_MPI
+    if(Nranks>1) MPI_Allreduce(MPI_IN_PLACE,&tmp,1,MPI_INT,MPI_LOR,MPI_COMM_WORLD);
+    #endif
+    
+    return tmp!=0;
+}
+
+void FDTD_Domain::barrier()
+{
+    #ifdef AETHER_MPI
+    if(Nranks>1) MPI_Barrier(MPI_COMM_WORLD);
+    #endif
+}
+
+void FDTD_Domain::exchange(Grid3<double> &F1,Grid3<double> &F2,Grid3<double> &F3,int zo_s,int zo_e)
+{
+    exchange_start(F1,F2,F3,zo_s,zo_e);
+    exchange_finish();
+}
+
+void FDTD_Domain::exchange_finish()
+{
+    #ifdef AETHER_MPI
+    if(!requests.empty())
+    {
+        MPI_Waitall(static_cast<int>(requests.size()),requests.data(),MPI_STATUSES_IGNORE);
+        requests.clear();
+    }
+    #endif
+}
+
+void FDTD_Domain::exchange_start(Grid3<double> &F1,Grid3<double> &F2,Grid3<double> &F3,int zo_s,int zo_e)
+{
+    exchange_start(F1,zo_s,zo_e,0);
+    exchange_start(F2,zo_s,zo_e,1);
+    exchange_start(F3,zo_s,zo_e,2);
+}
+
+void FDTD_Domain::exchange_start(Grid3<double> &F,int zo_s,int zo_e,int tag)
+{
+    #ifdef AETHER_MPI
+    if(Nranks<2) return;
+    
+    int prev=(rank+Nranks-1)%Nranks;
+    int next=(rank+1)%Nranks;
+    int N=F.L1()*F.L2();
+    
+    MPI_Request req[4];
+    
+    // Planes going up the ring use even tags, planes going down odd ones
+    
+    MPI_Irecv(&F(0,0,zo_s-1),N,MPI_DOUBLE,prev,2*tag,MPI_COMM_WORLD,&req[0]);
+    MPI_Irecv(&F(0,0,zo_e),N,MPI_DOUBLE,next,2*tag+1,MPI_COMM_WORLD,&req[1]);
+    MPI_Isend(&F(0,0,zo_e-1),N,MPI_DOUBLE,next,2*tag,MPI_COMM_WORLD,&req[2]);
+    MPI_Isend(&F(0,0,zo_s),N,MPI_DOUBLE,prev,2*tag+1,MPI_COMM_WORLD,&req[3]);
+    
+    requests.insert(requests.end(),req,req+4);
+    #endif
+}
+
+bool FDTD_Domain::master() const { return rank==0; }
+
+void FDTD_Domain::max(double &val)
+{
+    #ifdef AETHER_MPI
+    if(Nranks>1) MPI_Allreduce(MPI_IN_PLACE,&val,1,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+    #endif
+}
+
+void FDTD_Domain::slab(int Nz,int &z1,int &z2) const
+{
+    z1=(rank*Nz)/Nranks;
+    z2=((rank+1)*Nz)/Nranks;
+}
+
+void FDTD_Domain::sum_raw(double *V,std::size_t N)
+{
+    #ifdef AETHER_MPI
+    if(Nranks>1) domain_allreduce(V,N,MPI_DOUBLE,MPI_SUM);
+    #endif
+}
+
+void FDTD_Domain::sum_raw(int *V,std::size_t N)
+{
+    #ifdef AETHER_MPI
+    if(Nranks>1) domain_allreduce(V,N,MPI_INT,MPI_SUM);
+    #endif
+}
+
+void FDTD_Domain::sum_raw(unsigned int *V,std::size_t N)
+{
+    #ifdef AETHER_MPI
+    if(Nranks>1) domain_allreduce(V,N,MPI_UNSIGNED,MPI_SUM);
+    #endif
+}
+
+void FDTD_Domain::sum_raw(std::complex<double> *V,std::size_t N)
+{
+    sum_raw(reinterpret_cast<double*>(V),2*N);
+}
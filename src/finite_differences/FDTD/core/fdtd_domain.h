@@ -0,0 +1,101 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef FDTD_DOMAIN_H
+#define FDTD_DOMAIN_H
+
+#include <grid.h>
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+#ifdef AETHER_MPI
+#include <mpi.h>
+#endif
+
+//##################
+//   FDTD_Domain
+//##################
+
+// Splitting of the grid into z-slabs, one per process. Each slab holds
+// its own planes plus one halo plane on each side, filled from the
+// neighbouring slabs. The neighbours form a ring, so that the last slab
+// wraps onto the first one exactly like the periodic z boundary of a
+// single grid. Without MPI support the domain is a single process and
+// every call is a no-op.
+// Only the thread owning the FDTD object is allowed to call the
+// communication methods, and the first domain must be built on the main
+// thread since it initializes MPI.
+
+class FDTD_Domain
+{
+    private:
+        #ifdef AETHER_MPI
+        std::vector<MPI_Request> requests;
+        #endif
+        
+        void exchange_start(Grid3<double> &F,int zo_s,int zo_e,int tag);
+        void sum_raw(double *V,std::size_t N);
+        void sum_raw(int *V,std::size_t N);
+        void sum_raw(unsigned int *V,std::size_t N);
+        void sum_raw(std::complex<double> *V,std::size_t N);
+        
+    public:
+        int rank,Nranks;
+        
+        FDTD_Domain();
+        
+        bool any(bool val);
+        void barrier();
+        void exchange(Grid3<double> &F1,Grid3<double> &F2,Grid3<double> &F3,int zo_s,int zo_e);
+        void exchange_finish();
+        void exchange_start(Grid3<double> &F1,Grid3<double> &F2,Grid3<double> &F3,int zo_s,int zo_e);
+        bool master() const;
+        void max(double &val);
+        void slab(int Nz,int &z1,int &z2) const;
+        
+        template<class T>
+        void sum(T &val) { sum_raw(&val,1); }
+        
+        template<class T>
+        void sum(Grid1<T> &G)
+        {
+            if(G.L1()>0) sum_raw(&G[0],G.L1());
+        }
+        
+        template<class T>
+        void sum(Grid2<T> &G)
+        {
+            std::size_t N=static_cast<std::size_t>(G.L1())*G.L2();
+            
+            if(N>0) sum_raw(&G(0,0),N);
+        }
+        
+        template<class T>
+        void sum(Grid3<T> &G)
+        {
+            std::size_t N=static_cast<std::size_t>(G.L1())*G.L2()*G.L3();
+            
+            if(N>0) sum_raw(&G(0,0,0),N);
+        }
+        
+        template<class T>
+        void sum(std::vector<T> &V)
+        {
+            if(!V.empty()) sum_raw(V.data(),V.size());
+        }
+};
+
+#endif // FDTD_DOMAIN_H
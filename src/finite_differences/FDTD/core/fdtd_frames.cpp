@@ -0,0 +1,187 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_frames.h>
+
+#include <cmath>
+
+//###########
+//   Frame
+//###########
+
+Frame::Frame()
+    :type(FRAME_RENDER),
+     exposure(1.0)
+{
+}
+
+// Absolute and normalized views of each component, stacked as Ez, Ey and Ex
+void draw_fields(Bitmap &im,Grid2<double> const &Fx,Grid2<double> const &Fy,Grid2<double> const &Fz)
+{
+    int i,j;
+    
+    using std::abs;
+    using std::exp;
+    using std::max;
+    
+    int span1=Fx.L1();
+    int span2=Fx.L2();
+    
+    double max_Ex=1e-80,max_Ey=1e-80,max_Ez=1e-80,max_E=1e-80;
+    
+    im.set_size(2*span1+4,3*span2+8);
+    
+    for(i=0;i<span1;i++) for(j=0;j<span2;j++)
+    {
+        max_Ex=max(max_Ex,abs(Fx(i,j)));
+        max_Ey=max(max_Ey,abs(Fy(i,j)));
+        max_Ez=max(max_Ez,abs(Fz(i,j)));
+    }
+    max_E=max(max_Ex,max(max_Ey,max_Ez));
+    
+    for(i=0;i<span1;i++) for(j=0;j<span2;j++)
+    {
+        im.degra(i,j,1.0-exp(-1.0*abs(Fz(i,j))),0,1.0);
+        im.degra(i+span1+4,j,1.0-exp(-1.0*abs(Fz(i,j))/max_E),0,1.0);
+        
+        im.degra(i,j+span2+4,1.0-exp(-1.0*abs(Fy(i,j))),0,1.0);
+        im.degra(i+span1+4,j+span2+4,1.0-exp(-1.0*abs(Fy(i,j))/max_E),0,1.0);
+        
+        im.degra(i,j+2*span2+8,1.0-exp(-1.0*abs(Fx(i,j))),0,1.0);
+        im.degra(i+span1+4,j+2*span2+8,1.0-exp(-1.0*abs(Fx(i,j))/max_E),0,1.0);
+    }
+}
+
+//##################
+//   Frame_Writer
+//##################
+
+Frame_Writer::Frame_Writer(int N_frames)
+    :busy(false), stop(false),
+     frames(N_frames)
+{
+    for(int n=N_frames-1;n>=0;n--) free_frames.push_back(n);
+    
+    thread=new std::thread(&Frame_Writer::process,this);
+}
+
+Frame_Writer::~Frame_Writer()
+{
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        stop=true;
+    }
+    
+    cv.notify_all();
+    
+    thread->join();
+    delete thread;
+}
+
+Frame& Frame_Writer::acquire()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    while(free_frames.empty()) cv.wait(lock);
+    
+    int n=free_frames.back();
+    free_frames.pop_back();
+    
+    return frames[n];
+}
+
+void Frame_Writer::process()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    while(true)
+    {
+        while(queued_frames.empty() && !stop) cv.wait(lock);
+        
+        if(!queued_frames.empty())
+        {
+            int n=queued_frames.front();
+            queued_frames.pop_front();
+            busy=true;
+            
+            lock.unlock();
+            render(frames[n]);
+            lock.lock();
+            
+            free_frames.push_back(n);
+            busy=false;
+            cv.notify_all();
+        }
+        else if(stop) return;
+    }
+}
+
+void Frame_Writer::render(Frame const &frame)
+{
+    if(frame.type==Frame::FRAME_RENDER)
+    {
+        draw_fields(image,frame.Fx,frame.Fy,frame.Fz);
+        image.write(frame.fname.generic_string());
+        
+        return;
+    }
+    
+    int i,j;
+    
+    using std::abs;
+    using std::exp;
+    
+    int span1=frame.Fx.L1();
+    int span2=frame.Fx.L2();
+    
+    Grid2<double> const *F[3]={&frame.Fx,&frame.Fy,&frame.Fz};
+    char const *sfx[3]={"_Ex.png","_Ey.png","_Ez.png"};
+    
+    image.set_size(span1,span2);
+    
+    for(int m=0;m<3;m++)
+    {
+        for(i=0;i<span1;i++) for(j=0;j<span2;j++)
+            image.degra(i,j,1.0-exp(-frame.exposure*abs((*F[m])(i,j))),0,1.0);
+        
+        image.write(frame.fname.generic_string()+sfx[m]);
+    }
+    
+    for(i=0;i<span1;i++) for(j=0;j<span2;j++)
+    {
+        double tmp_x=abs(frame.Fx(i,j));
+        double tmp_y=abs(frame.Fy(i,j));
+        double tmp_z=abs(frame.Fz(i,j));
+        double tmp=std::sqrt(tmp_x*tmp_x+tmp_y*tmp_y+tmp_z*tmp_z);
+        
+        image.degra(i,j,1.0-exp(-frame.exposure*tmp),0,1.0);
+    }
+    
+    image.write(frame.fname.generic_string()+"_E.png");
+}
+
+void Frame_Writer::submit(Frame &frame)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    queued_frames.push_back(&frame-frames.data());
+    cv.notify_all();
+}
+
+void Frame_Writer::wait()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    while(busy || !queued_frames.empty()) cv.wait(lock);
+}
@@ -0,0 +1,91 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef FDTD_FRAMES_H
+#define FDTD_FRAMES_H
+
+#include <bitmap3.h>
+#include <grid.h>
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//###########
+//   Frame
+//###########
+
+// Field slices waiting to be rendered. A render frame is the three panels
+// layout of FDTD::draw, written to fname. A movie frame is written as four
+// images named after fname with the _Ex, _Ey, _Ez and _E suffixes, one per
+// component and one for the norm, the colors saturating as set by exposure.
+
+class Frame
+{
+    public:
+        enum
+        {
+            FRAME_RENDER=0,
+            FRAME_MOVIE
+        };
+        
+        int type;
+        double exposure;
+        std::filesystem::path fname;
+        Grid2<double> Fx,Fy,Fz;
+        
+        Frame();
+};
+
+void draw_fields(Bitmap &im,Grid2<double> const &Fx,Grid2<double> const &Fy,Grid2<double> const &Fz);
+
+//##################
+//   Frame_Writer
+//##################
+
+// Renders and writes frames from a background thread, so that the PNG
+// encoding does not hold the time loop. The frames come from a fixed pool
+// and acquire() blocks while all of them are queued, which bounds the
+// memory and only stalls the loop when the disk cannot keep up.
+// The queued frames are all written before the destructor returns.
+
+class Frame_Writer
+{
+    private:
+        bool busy,stop;
+        std::vector<Frame> frames;
+        std::vector<int> free_frames;
+        std::deque<int> queued_frames;
+        Bitmap image;
+        
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::thread *thread;
+        
+        void process();
+        void render(Frame const &frame);
+        
+    public:
+        Frame_Writer(int N_frames=4);
+        ~Frame_Writer();
+        
+        Frame& acquire();
+        void submit(Frame &frame);
+        void wait();
+};
+
+#endif // FDTD_FRAMES_H
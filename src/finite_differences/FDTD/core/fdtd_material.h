@@ -15,6 +15,7 @@ limitations under the License.*/
 #ifndef FDTD_MATERIAL_H_INCLUDED
 #define FDTD_MATERIAL_H_INCLUDED
 
+#include <fdtd_checkpoint.h>
 #include <material.h>
 
 
@@ -106,6 +107,7 @@ class FDTD_Material
         //void recalc();
         void show();
         
+        void checkpoint(Checkpoint &chk);
         bool needs_D_field();
         void link_fdtd(double Dx,double Dy,double Dz,double Dt);
         void link_grid(Grid3<unsigned int> const &mat_grid,unsigned int ID);
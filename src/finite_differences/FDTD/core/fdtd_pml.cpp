@@ -65,8 +65,15 @@ void FDTD::allocate_pml()
         
     // PML Z
     
+    // Only held by the processes owning some of its planes
+    
+    int zg_s=zo_s+z_offset;
+    int zg_e=zo_e+z_offset;
+    
+    bool own_z=(zg_s<pml_zm || zg_e>Nz_glob-pml_zp);
+    
     tNx=tNy=tNz=1;
-    if(pml_zm!=0 || pml_zp!=0) { tNx=Nx; tNy=Ny; tNz=pml_zm+pml_zp; }
+    if((pml_zm!=0 || pml_zp!=0) && own_z) { tNx=Nx; tNy=Ny; tNz=pml_zm+pml_zp; }
     
     PsiExz.init(tNx,tNy,tNz,0);
     PsiEyz.init(tNx,tNy,tNz,0);
@@ -333,10 +340,19 @@ void FDTD::pml_coeff_calc()
     }
     if(pml_zm || pml_zp)
     {
+        // Halo planes of a decomposed grid wrap around like the periodic boundary
+        
         for(k=0;k<Nz;k++)
         {
-            pml_z_coeffs(k,kappa_z_E[k],b_z_E[k],c_z_E[k]);
-            pml_z_coeffs(k+0.5,kappa_z_H[k],b_z_H[k],c_z_H[k]);
+            int kg=(k+z_offset+Nz_glob)%Nz_glob;
+            
+            pml_z_coeffs(kg,kappa_z_E[k],b_z_E[k],c_z_E[k]);
+            pml_z_coeffs(kg+0.5,kappa_z_H[k],b_z_H[k],c_z_H[k]);
+            
+            // The Psi updates use Dz as the step
+            
+            c_z_E[k]*=z_coeff_E[k];
+            c_z_H[k]*=z_coeff_H[k];
         }
     }
 }
@@ -411,19 +427,19 @@ void FDTD::pml_z_coeffs(double ind,double &kappa_z,double &b_z,double &c_z)
         
         kappa_z=1.0+(pml_kappa_zm-1.0)*std::pow(z,pml_m);
         
-        double sig=pml_sigma_zm*std::pow(z,pml_m);
+        double sig=pml_sigma_zm*(Dz/z_cell(0))*std::pow(z,pml_m);
         double alp=pml_alpha_zm*std::pow(1.0-z,pml_ma);
         
         b_z=std::exp(-(sig/kappa_z+alp)*Dt/e0);
         c_z=sig/(sig*kappa_z+kappa_z*kappa_z*alp)*(b_z-1.0);
     }
-    if(ind>Nz-pml_zp)
+    if(ind>Nz_glob-pml_zp)
     {
-        double z=(ind-(Nz-pml_zp))/static_cast<double>(pml_zp);
+        double z=(ind-(Nz_glob-pml_zp))/static_cast<double>(pml_zp);
         
         kappa_z=1.0+(pml_kappa_zp-1.0)*std::pow(z,pml_m);
         
-        double sig=pml_sigma_zp*std::pow(z,pml_m);
+        double sig=pml_sigma_zp*(Dz/z_cell(Nz_glob-1))*std::pow(z,pml_m);
         double alp=pml_alpha_zp*std::pow(1.0-z,pml_ma);
         
         b_z=std::exp(-(sig/kappa_z+alp)*Dt/e0);
@@ -500,42 +516,16 @@ void FDTD::set_pml_zp(double kap,double sig,double alp)
 
 //#############################
 
-void FDTD::app_pml_Ex(int i1,int i2)
+// The Psi updates are done by the Yee kernels, only the PEC walls closing
+// the PMLs are left to the PMLs phases
+
+void FDTD::app_pec_Ex(int i1,int i2)
 {
-    int i,j,k,n;
-    
-    int M;
-    double C4;
-    
-    double inv_Dy=1.0/Dy;
-    double inv_Dz=1.0/Dz;
+    int i,j,k;
     
     if(pml_ym || pml_yp)
     {
-        for(i=i1;i<i2;i++){ for(k=0;k<Nz;k++)
-        {
-            for(j=1;j<pml_ym;j++)
-            {
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiExy(i,j,k)=b_y_E[j]*PsiExy(i,j,k)+c_y_E[j]*inv_Dy*(Hz(i,j,k)-Hz(i,j-1,k));
-                Ex(i,j,k)+=C4*PsiExy(i,j,k);
-            }
-            
-            for(j=Ny-pml_yp+1;j<Ny;j++)
-            {
-                n=j-(Ny-pml_yp)+pml_ym;
-                
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiExy(i,n,k)=b_y_E[j]*PsiExy(i,n,k)+c_y_E[j]*inv_Dy*(Hz(i,j,k)-Hz(i,j-1,k));
-                Ex(i,j,k)+=C4*PsiExy(i,n,k);
-            }
-        }}
-        
-        for(i=i1;i<i2;i++){ for(k=0;k<Nz;k++)
+        for(k=0;k<Nz;k++){ for(i=i1;i<i2;i++)
         {
             Ex(i,0,k)=0;
         }}
@@ -543,78 +533,27 @@ void FDTD::app_pml_Ex(int i1,int i2)
     
     if(pml_zm || pml_zp)
     {
-        for(k=1;k<pml_zm;k++)
-        {
-            for(j=0;j<Ny;j++){ for(i=i1;i<i2;i++)
-            {
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiExz(i,j,k)=b_z_E[k]*PsiExz(i,j,k)+c_z_E[k]*inv_Dz*(Hy(i,j,k)-Hy(i,j,k-1));
-                Ex(i,j,k)-=C4*PsiExz(i,j,k);
-            }}
-        }
+        //Bottom PEC
         
-        for(k=Nz-pml_zp+1;k<Nz;k++)
+        if(zo_s+z_offset==0)
         {
             for(j=0;j<Ny;j++){ for(i=i1;i<i2;i++)
             {
-                n=k-(Nz-pml_zp)+pml_zm;
-                
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiExz(i,j,n)=b_z_E[k]*PsiExz(i,j,n)+c_z_E[k]*inv_Dz*(Hy(i,j,k)-Hy(i,j,k-1));
-                Ex(i,j,k)-=C4*PsiExz(i,j,n);
+                Ex(i,j,zo_s)=0;
             }}
         }
-        
-        //Bottom PEC
-        
-        for(i=i1;i<i2;i++){ for(j=0;j<Ny;j++)
-        {
-            Ex(i,j,0)=0;
-        }}
     }
 }
 
-void FDTD::app_pml_Ey(int j1,int j2)
+void FDTD::app_pec_Ey(int j1,int j2)
 {
-    int i,j,k,n;
-    int M;
-    double C4;
-    
-    double inv_Dx=1.0/Dx;
-    double inv_Dz=1.0/Dz;
+    int i,j,k;
     
     if(pml_xm || pml_xp)
     {
-        for(j=j1;j<j2;j++){ for(k=0;k<Nz;k++)
-        {
-            for(i=1;i<pml_xm;i++)
-            {
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiEyx(i,j,k)=b_x_E[i]*PsiEyx(i,j,k)+c_x_E[i]*inv_Dx*(Hz(i,j,k)-Hz(i-1,j,k));
-                Ey(i,j,k)-=C4*PsiEyx(i,j,k);
-            }
-            
-            for(i=Nx-pml_xp+1;i<Nx;i++)
-            {
-                n=i-(Nx-pml_xp)+pml_xm;
-                
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                                
-                PsiEyx(n,j,k)=b_x_E[i]*PsiEyx(n,j,k)+c_x_E[i]*inv_Dx*(Hz(i,j,k)-Hz(i-1,j,k));
-                Ey(i,j,k)-=C4*PsiEyx(n,j,k);
-            }
-        }}
-        
         //Bottom PEC
         
-        for(j=j1;j<j2;j++){ for(k=0;k<Nz;k++)
+        for(k=0;k<Nz;k++){ for(j=j1;j<j2;j++)
         {
             Ey(0,j,k)=0;
         }}
@@ -622,78 +561,27 @@ void FDTD::app_pml_Ey(int j1,int j2)
     
     if(pml_zm || pml_zp)
     {
-        for(k=1;k<pml_zm;k++)
-        {
-            for(j=j1;j<j2;j++){ for(i=0;i<Nx;i++)
-            {
-            M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiEyz(i,j,k)=b_z_E[k]*PsiEyz(i,j,k)+c_z_E[k]*inv_Dz*(Hx(i,j,k)-Hx(i,j,k-1));
-                Ey(i,j,k)+=C4*PsiEyz(i,j,k);
-            }
-        }}
+        //Bottom PEC
         
-        for(k=Nz-pml_zp+1;k<Nz;k++)
+        if(zo_s+z_offset==0)
         {
             for(j=j1;j<j2;j++){ for(i=0;i<Nx;i++)
             {
-                n=k-(Nz-pml_zp)+pml_zm;
-                
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiEyz(i,j,n)=b_z_E[k]*PsiEyz(i,j,n)+c_z_E[k]*inv_Dz*(Hx(i,j,k)-Hx(i,j,k-1));
-                Ey(i,j,k)+=C4*PsiEyz(i,j,n);
-            }
-        }}
-        
-        //Bottom PEC
-        
-        for(i=0;i<Nx;i++){ for(j=j1;j<j2;j++)
-        {
-            Ey(i,j,0)=0;
-        }}
+                Ey(i,j,zo_s)=0;
+            }}
+        }
     }
 }
 
-void FDTD::app_pml_Ez(int k1,int k2)
+void FDTD::app_pec_Ez(int k1,int k2)
 {
-    int i,j,k,n;
-    int M;
-    double C4;
-    
-    double inv_Dx=1.0/Dx;
-    double inv_Dy=1.0/Dy;
+    int i,j,k;
     
     if(pml_xm || pml_xp)
     {
-        for(j=0;j<Ny;j++){ for(k=k1;k<k2;k++)
-        {
-            for(i=1;i<pml_xm;i++)
-            {
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiEzx(i,j,k)=b_x_E[i]*PsiEzx(i,j,k)+c_x_E[i]*inv_Dx*(Hy(i,j,k)-Hy(i-1,j,k));
-                Ez(i,j,k)+=C4*PsiEzx(i,j,k);
-            }
-            
-            for(i=Nx-pml_xp+1;i<Nx;i++)
-            {
-                n=i-(Nx-pml_xp)+pml_xm;
-                
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiEzx(n,j,k)=b_x_E[i]*PsiEzx(n,j,k)+c_x_E[i]*inv_Dx*(Hy(i,j,k)-Hy(i-1,j,k));
-                Ez(i,j,k)+=C4*PsiEzx(n,j,k);
-            }
-        }}
-        
         //Bottom PEC
         
-        for(j=0;j<Ny;j++){ for(k=k1;k<k2;k++)
+        for(k=k1;k<k2;k++){ for(j=0;j<Ny;j++)
         {
             Ez(0,j,k)=0;
         }}
@@ -701,69 +589,24 @@ void FDTD::app_pml_Ez(int k1,int k2)
     
     if(pml_ym || pml_yp)
     {
-        for(i=0;i<Nx;i++){ for(k=k1;k<k2;k++)
-        {
-            for(j=1;j<pml_ym;j++)
-            {
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiEzy(i,j,k)=b_y_E[j]*PsiEzy(i,j,k)+c_y_E[j]*inv_Dy*(Hx(i,j,k)-Hx(i,j-1,k));
-                Ez(i,j,k)-=C4*PsiEzy(i,j,k);
-            }
-            
-            for(j=Ny-pml_yp+1;j<Ny;j++)
-            {
-                n=j-(Ny-pml_yp)+pml_ym;
-                
-                M=matsgrid(i,j,k);
-                C4=mats[M].pml_coeff();
-                
-                PsiEzy(i,n,k)=b_y_E[j]*PsiEzy(i,n,k)+c_y_E[j]*inv_Dy*(Hx(i,j,k)-Hx(i,j-1,k));
-                Ez(i,j,k)-=C4*PsiEzy(i,n,k);
-            }
-        }}
-        
         //Bottom PEC
         
-        for(i=0;i<Nx;i++){ for(k=k1;k<k2;k++)
+        for(k=k1;k<k2;k++){ for(i=0;i<Nx;i++)
         {
             Ez(i,0,k)=0;
         }}
     }
 }
 
-void FDTD::app_pml_Hx(int i1,int i2)
+void FDTD::app_pec_Hx(int i1,int i2)
 {
-    int i,j,k,n;
-    
-    double inv_Dy=1.0/Dy;
-    double inv_Dz=1.0/Dz;
+    int i,j,k;
     
     if(pml_ym || pml_yp)
     {
-        //Bottom layer
-        
-        for(i=i1;i<i2;i++){ for(k=0;k<Nz;k++)
-        {
-            for(j=0;j<pml_ym;j++)
-            {
-                PsiHxy(i,j,k)=b_y_H[j]*PsiHxy(i,j,k)+c_y_H[j]*inv_Dy*(Ez(i,j+1,k)-Ez(i,j,k));
-                Hx(i,j,k)-=dtm*PsiHxy(i,j,k);
-            }
-            
-            for(j=Ny-pml_yp;j<Ny-1;j++)
-            {
-                n=j-(Ny-pml_yp)+pml_ym;
-                
-                PsiHxy(i,n,k)=b_y_H[j]*PsiHxy(i,n,k)+c_y_H[j]*inv_Dy*(Ez(i,j+1,k)-Ez(i,j,k));
-                Hx(i,j,k)-=dtm*PsiHxy(i,n,k);
-            }
-        }}
-        
         //Top PEC
         
-        for(i=i1;i<i2;i++){ for(k=0;k<Nz;k++)
+        for(k=0;k<Nz;k++){ for(i=i1;i<i2;i++)
         {
             Hx(i,Ny-1,k)=0;
         }}
@@ -771,64 +614,27 @@ void FDTD::app_pml_Hx(int i1,int i2)
     
     if(pml_zm || pml_zp)
     {
-        for(k=0;k<pml_zm;k++){ for(j=0;j<Ny;j++)
-        {
-            for(i=i1;i<i2;i++)
-            {
-                PsiHxz(i,j,k)=b_z_H[k]*PsiHxz(i,j,k)+c_z_H[k]*inv_Dz*(Ey(i,j,k+1)-Ey(i,j,k));
-                Hx(i,j,k)+=dtm*PsiHxz(i,j,k);
-            }
-        }}
-            
-        for(k=Nz-pml_zp;k<Nz-1;k++){ for(j=0;j<Ny;j++)
-        {
-            for(i=i1;i<i2;i++)
-            {
-                n=k-(Nz-pml_zp)+pml_zm;
-                
-                PsiHxz(i,j,n)=b_z_H[k]*PsiHxz(i,j,n)+c_z_H[k]*inv_Dz*(Ey(i,j,k+1)-Ey(i,j,k));
-                Hx(i,j,k)+=dtm*PsiHxz(i,j,n);
-            }
-        }}
-        
         //Top PEC
         
-        for(i=i1;i<i2;i++){ for(j=0;j<Ny;j++)
+        if(zo_e+z_offset==Nz_glob)
         {
-            Hx(i,j,Nz-1)=Hy(i,j,Nz-1)=0;
-        }}
+            for(j=0;j<Ny;j++){ for(i=i1;i<i2;i++)
+            {
+                Hx(i,j,zo_e-1)=Hy(i,j,zo_e-1)=0;
+            }}
+        }
     }
 }
 
-void FDTD::app_pml_Hy(int j1,int j2)
+void FDTD::app_pec_Hy(int j1,int j2)
 {
-    int i,j,k,n;
-    
-    double inv_Dx=1.0/Dx;
-    double inv_Dz=1.0/Dz;
+    int i,j,k;
     
     if(pml_xm || pml_xp)
     {
-        for(j=j1;j<j2;j++){ for(k=0;k<Nz;k++)
-        {
-            for(i=0;i<pml_xm;i++)
-            {
-                PsiHyx(i,j,k)=b_x_H[i]*PsiHyx(i,j,k)+c_x_H[i]*inv_Dx*(Ez(i+1,j,k)-Ez(i,j,k));
-                Hy(i,j,k)+=dtm*PsiHyx(i,j,k);
-            }
-            
-            for(i=Nx-pml_xp;i<Nx-1;i++)
-            {
-                n=i-(Nx-pml_xp)+pml_xm;
-                
-                PsiHyx(n,j,k)=b_x_H[i]*PsiHyx(n,j,k)+c_x_H[i]*inv_Dx*(Ez(i+1,j,k)-Ez(i,j,k));
-                Hy(i,j,k)+=dtm*PsiHyx(n,j,k);
-            }
-        }}
-        
         //Top PEC
         
-        for(j=j1;j<j2;j++){ for(k=0;k<Nz;k++)
+        for(k=0;k<Nz;k++){ for(j=j1;j<j2;j++)
         {
             Hy(Nx-1,j,k)=0;
         }}
@@ -836,64 +642,27 @@ void FDTD::app_pml_Hy(int j1,int j2)
     
     if(pml_zm || pml_zp)
     {
-        for(k=0;k<pml_zm;k++)
-        {
-            for(j=j1;j<j2;j++){ for(i=0;i<Nx;i++)
-            {
-                PsiHyz(i,j,k)=b_z_H[k]*PsiHyz(i,j,k)+c_z_H[k]*inv_Dz*(Ex(i,j,k+1)-Ex(i,j,k));
-                Hy(i,j,k)-=dtm*PsiHyz(i,j,k);
-            }}
-        }
+        //Top PEC
         
-        for(k=Nz-pml_zp;k<Nz-1;k++)
+        if(zo_e+z_offset==Nz_glob)
         {
             for(j=j1;j<j2;j++){ for(i=0;i<Nx;i++)
             {
-                n=k-(Nz-pml_zp)+pml_zm;
-                
-                PsiHyz(i,j,n)=b_z_H[k]*PsiHyz(i,j,n)+c_z_H[k]*inv_Dz*(Ex(i,j,k+1)-Ex(i,j,k));
-                Hy(i,j,k)-=dtm*PsiHyz(i,j,n);
+                Hy(i,j,zo_e-1)=0;
             }}
         }
-        
-        //Top PEC
-        
-        for(i=0;i<Nx;i++){ for(j=j1;j<j2;j++)
-        {
-            Hy(i,j,Nz-1)=0;
-        }}
     }
 }
 
-void FDTD::app_pml_Hz(int k1,int k2)
+void FDTD::app_pec_Hz(int k1,int k2)
 {
-    int i,j,k,n;
-    
-    double inv_Dx=1.0/Dx;
-    double inv_Dy=1.0/Dy;
+    int i,j,k;
     
     if(pml_xm || pml_xp)
     {
-        for(j=0;j<Ny;j++){ for(k=k1;k<k2;k++)
-        {
-            for(i=0;i<pml_xm;i++)
-            {
-                PsiHzx(i,j,k)=b_x_H[i]*PsiHzx(i,j,k)+c_x_H[i]*inv_Dx*(Ey(i+1,j,k)-Ey(i,j,k));
-                Hz(i,j,k)-=dtm*PsiHzx(i,j,k);
-            }
-            
-            for(i=Nx-pml_xp;i<Nx-1;i++)
-            {
-                n=i-(Nx-pml_xp)+pml_xm;
-                
-                PsiHzx(n,j,k)=b_x_H[i]*PsiHzx(n,j,k)+c_x_H[i]*inv_Dx*(Ey(i+1,j,k)-Ey(i,j,k));
-                Hz(i,j,k)-=dtm*PsiHzx(n,j,k);
-            }
-        }}
-        
         //Top PEC
         
-        for(j=0;j<Ny;j++){ for(k=k1;k<k2;k++)
+        for(k=k1;k<k2;k++){ for(j=0;j<Ny;j++)
         {
             Hz(Nx-1,j,k)=0;
         }}
@@ -901,29 +670,11 @@ void FDTD::app_pml_Hz(int k1,int k2)
     
     if(pml_ym || pml_yp)
     {
-        for(i=0;i<Nx;i++){ for(k=k1;k<k2;k++)
-        {
-            for(j=0;j<pml_ym;j++)
-            {
-                PsiHzy(i,j,k)=b_y_H[j]*PsiHzy(i,j,k)+c_y_H[j]*inv_Dy*(Ex(i,j+1,k)-Ex(i,j,k));
-                Hz(i,j,k)+=dtm*PsiHzy(i,j,k);
-            }
-            
-            for(j=Ny-pml_yp;j<Ny-1;j++)
-            {
-                n=j-(Ny-pml_yp)+pml_ym;
-                
-                PsiHzy(i,n,k)=b_y_H[j]*PsiHzy(i,n,k)+c_y_H[j]*inv_Dy*(Ex(i,j+1,k)-Ex(i,j,k));
-                Hz(i,j,k)+=dtm*PsiHzy(i,n,k);
-            }
-        }}
-        
         //Top PEC
         
-        for(i=0;i<Nx;i++){ for(k=k1;k<k2;k++)
+        for(k=k1;k<k2;k++){ for(i=0;i<Nx;i++)
         {
             Hz(i,Ny-1,k)=0;
         }}
     }
 }
-
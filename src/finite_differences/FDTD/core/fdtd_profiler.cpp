@@ -0,0 +1,297 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_profiler.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+// Profilers are told apart by an ID rather than by their address, which
+// may be reused by a later one
+
+static std::atomic<std::uint64_t> prof_ID_next(1);
+
+static thread_local FDTD_Profiler *prof_current=nullptr;
+static thread_local FDTD_ProfilerSlot *prof_slot=nullptr;
+static thread_local std::uint64_t prof_owner=0;
+static thread_local int prof_generation=-1;
+
+static double prof_seconds(std::int64_t ns) { return ns*1e-9; }
+
+//#########################
+//   FDTD_ProfilerSlot
+//#########################
+
+FDTD_ProfilerSlot::FDTD_ProfilerSlot(int Nphases)
+    :time(Nphases,0),
+     calls(Nphases,0),
+     cells(0)
+{
+}
+
+//#####################
+//   FDTD_Profiler
+//#####################
+
+FDTD_Profiler::FDTD_Profiler()
+    :ID(prof_ID_next++),
+     generation(0),
+     t_start(std::chrono::steady_clock::now()),
+     t_end(t_start)
+{
+}
+
+FDTD_Profiler::FDTD_Profiler(FDTD_Profiler const &profiler)
+    :FDTD_Profiler()
+{
+}
+
+FDTD_Profiler::~FDTD_Profiler()
+{
+    for(unsigned int i=0;i<slots.size();i++) delete slots[i];
+}
+
+void FDTD_Profiler::add(int phase,std::chrono::steady_clock::time_point const &start)
+{
+    FDTD_ProfilerSlot *slot=local_slot();
+    
+    slot->time[phase]+=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+    slot->calls[phase]+=1;
+}
+
+void FDTD_Profiler::add_cells(double N)
+{
+    local_slot()->cells+=N;
+}
+
+double FDTD_Profiler::get_cells() const
+{
+    double N=0;
+    
+    for(unsigned int i=0;i<slots.size();i++) N+=slots[i]->cells;
+    
+    return N;
+}
+
+std::int64_t FDTD_Profiler::get_calls(int phase) const
+{
+    std::int64_t N=0;
+    
+    for(unsigned int i=0;i<slots.size();i++) N+=slots[i]->calls[phase];
+    
+    return N;
+}
+
+double FDTD_Profiler::get_max_time(int phase) const
+{
+    std::int64_t T=0;
+    
+    for(unsigned int i=0;i<slots.size();i++) T=std::max(T,slots[i]->time[phase]);
+    
+    return prof_seconds(T);
+}
+
+std::string FDTD_Profiler::get_name(int phase)
+{
+         if(phase==PROF_MATS_ANTE) return "mats_ante";
+    else if(phase==PROF_E_FIELD) return "E_field";
+    else if(phase==PROF_MATS_SIMP) return "mats_simp";
+    else if(phase==PROF_MATS_POST) return "mats_post";
+    else if(phase==PROF_MATS_SELF) return "mats_self";
+    else if(phase==PROF_PML_E) return "pml_E";
+    else if(phase==PROF_H_FIELD) return "H_field";
+    else if(phase==PROF_PML_H) return "pml_H";
+    else if(phase==PROF_REDUCTION) return "reduction";
+    else if(phase==PROF_WAIT) return "barrier_wait";
+    else if(phase==PROF_UPDATE_E) return "update_E";
+    else if(phase==PROF_UPDATE_H) return "update_H";
+    else if(phase==PROF_HALOS) return "halos";
+    else if(phase==PROF_SOURCES) return "sources";
+    else if(phase==PROF_SENSORS) return "sensors";
+    
+    return "unknown";
+}
+
+int FDTD_Profiler::get_N_threads() const { return slots.size(); }
+
+double FDTD_Profiler::get_time(int phase) const
+{
+    std::int64_t T=0;
+    
+    for(unsigned int i=0;i<slots.size();i++) T+=slots[i]->time[phase];
+    
+    return prof_seconds(T);
+}
+
+double FDTD_Profiler::get_time(int thread,int phase) const
+{
+    return prof_seconds(slots[thread]->time[phase]);
+}
+
+double FDTD_Profiler::get_wall_time() const
+{
+    return std::chrono::duration<double>(t_end-t_start).count();
+}
+
+// Slot of the calling thread, created on its first record after a reset.
+// Only the last slot used is cached, a thread going back to a profiler
+// finding its previous slot again
+
+FDTD_ProfilerSlot* FDTD_Profiler::local_slot()
+{
+    if(prof_slot==nullptr || prof_owner!=ID || prof_generation!=generation)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        
+        std::thread::id owner=std::this_thread::get_id();
+        
+        prof_slot=nullptr;
+        prof_owner=ID;
+        prof_generation=generation;
+        
+        for(unsigned int i=0;i<slots.size();i++)
+        {
+            if(slots[i]->owner==owner)
+            {
+                prof_slot=slots[i];
+                break;
+            }
+        }
+        
+        if(prof_slot==nullptr)
+        {
+            prof_slot=new FDTD_ProfilerSlot(PROF_NPHASES);
+            prof_slot->owner=owner;
+            
+            slots.push_back(prof_slot);
+        }
+    }
+    
+    return prof_slot;
+}
+
+// Not to be called while a grid of this profiler is being updated
+
+void FDTD_Profiler::reset()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    
+    for(unsigned int i=0;i<slots.size();i++) delete slots[i];
+    slots.clear();
+    
+    generation++;
+    
+    t_start=t_end=std::chrono::steady_clock::now();
+}
+
+void FDTD_Profiler::stop()
+{
+    t_end=std::chrono::steady_clock::now();
+}
+
+void FDTD_Profiler::write_csv(std::filesystem::path const &fname) const
+{
+    std::ofstream file(fname,std::ios::out|std::ios::trunc);
+    
+    if(!file.is_open())
+    {
+        std::cerr<<"Could not write "<<fname.generic_string()<<std::endl;
+        return;
+    }
+    
+    file<<"thread,phase,time,calls\n";
+    
+    for(unsigned int i=0;i<slots.size();i++) for(int p=0;p<PROF_NPHASES;p++)
+    {
+        if(slots[i]->calls[p]==0) continue;
+        
+        file<<i<<","<<get_name(p)<<","<<prof_seconds(slots[i]->time[p])<<","<<slots[i]->calls[p]<<"\n";
+    }
+}
+
+void FDTD_Profiler::write_json(std::filesystem::path const &fname) const
+{
+    std::ofstream file(fname,std::ios::out|std::ios::trunc);
+    
+    if(!file.is_open())
+    {
+        std::cerr<<"Could not write "<<fname.generic_string()<<std::endl;
+        return;
+    }
+    
+    double wall=get_wall_time();
+    double cells=get_cells();
+    
+    file<<"{\n";
+    file<<"    \"wall_time\": "<<wall<<",\n";
+    file<<"    \"cell_updates\": "<<cells<<",\n";
+    file<<"    \"cells_per_second\": "<<(wall>0 ? cells/wall : 0)<<",\n";
+    file<<"    \"threads\": "<<slots.size()<<",\n";
+    file<<"    \"phases\": {\n";
+    
+    for(int p=0;p<PROF_NPHASES;p++)
+    {
+        file<<"        \""<<get_name(p)<<"\": { "
+            <<"\"time\": "<<get_time(p)<<", "
+            <<"\"max_thread_time\": "<<get_max_time(p)<<", "
+            <<"\"calls\": "<<get_calls(p)<<" }";
+        
+        if(p+1<PROF_NPHASES) file<<",";
+        file<<"\n";
+    }
+    
+    file<<"    },\n";
+    file<<"    \"per_thread\": [\n";
+    
+    for(unsigned int i=0;i<slots.size();i++)
+    {
+        file<<"        { ";
+        
+        for(int p=0;p<PROF_NPHASES;p++)
+        {
+            file<<"\""<<get_name(p)<<"\": "<<prof_seconds(slots[i]->time[p]);
+            if(p+1<PROF_NPHASES) file<<", ";
+        }
+        
+        file<<" }";
+        if(i+1<slots.size()) file<<",";
+        file<<"\n";
+    }
+    
+    file<<"    ]\n";
+    file<<"}\n";
+}
+
+// Profiler of the calling thread, a process-wide one if it was never bound
+
+FDTD_Profiler& fdtd_profiler()
+{
+    static FDTD_Profiler profiler;
+    
+    if(prof_current!=nullptr) return *prof_current;
+    
+    return profiler;
+}
+
+// Returns the previous binding, so that it can be restored
+
+FDTD_Profiler* fdtd_profiler_bind(FDTD_Profiler *profiler)
+{
+    FDTD_Profiler *previous=prof_current;
+    
+    prof_current=profiler;
+    
+    return previous;
+}
@@ -0,0 +1,121 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef FDTD_PROFILER_H
+#define FDTD_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//#####################
+//   FDTD_Profiler
+//#####################
+
+// Time spent in each phase of the FDTD loop, accumulated per thread in
+// slots only touched by their owner so that recording needs no lock.
+// The workers record the phases they run and the time they spend waiting
+// at the barriers, which includes the time the main thread spends on the
+// sources and sensors. The main thread records the wall time of the E and
+// H updates, the halo exchanges, the injections and the sensor feeds.
+// Each solver has its own profiler, to which the threads working for it
+// are bound, fdtd_profiler() returning the one of the calling thread so
+// that concurrent solvers never share slots. Copying a profiler gives an
+// empty one.
+// The timers are only compiled in with FDTD_PROFILING, the macros below
+// expanding to nothing otherwise.
+
+#ifdef FDTD_PROFILING
+    #define FDTD_PROF_START(t) std::chrono::steady_clock::time_point t=std::chrono::steady_clock::now()
+    #define FDTD_PROF_STOP(t,phase) fdtd_profiler().add(phase,t)
+    #define FDTD_PROF_CELLS(N) fdtd_profiler().add_cells(N)
+#else
+    #define FDTD_PROF_START(t)
+    #define FDTD_PROF_STOP(t,phase)
+    #define FDTD_PROF_CELLS(N)
+#endif
+
+class FDTD_ProfilerSlot
+{
+    public:
+        std::thread::id owner;
+        std::vector<std::int64_t> time,calls;
+        double cells;
+        
+        FDTD_ProfilerSlot(int Nphases);
+};
+
+class FDTD_Profiler
+{
+    private:
+        std::mutex mtx;
+        std::uint64_t ID;
+        std::atomic<int> generation;
+        std::vector<FDTD_ProfilerSlot*> slots;
+        std::chrono::steady_clock::time_point t_start,t_end;
+        
+        FDTD_ProfilerSlot* local_slot();
+        
+    public:
+        enum
+        {
+            PROF_MATS_ANTE=0,
+            PROF_E_FIELD,
+            PROF_MATS_SIMP,
+            PROF_MATS_POST,
+            PROF_MATS_SELF,
+            PROF_PML_E,
+            PROF_H_FIELD,
+            PROF_PML_H,
+            PROF_REDUCTION,
+            PROF_WAIT,
+            PROF_UPDATE_E,
+            PROF_UPDATE_H,
+            PROF_HALOS,
+            PROF_SOURCES,
+            PROF_SENSORS,
+            PROF_NPHASES
+        };
+        
+        FDTD_Profiler();
+        FDTD_Profiler(FDTD_Profiler const &profiler);
+        ~FDTD_Profiler();
+        
+        FDTD_Profiler& operator = (FDTD_Profiler const &profiler)=delete;
+        
+        void add(int phase,std::chrono::steady_clock::time_point const &start);
+        void add_cells(double N);
+        double get_cells() const;
+        std::int64_t get_calls(int phase) const;
+        double get_max_time(int phase) const;
+        static std::string get_name(int phase);
+        int get_N_threads() const;
+        double get_time(int phase) const;
+        double get_time(int thread,int phase) const;
+        double get_wall_time() const;
+        void reset();
+        void stop();
+        void write_csv(std::filesystem::path const &fname) const;
+        void write_json(std::filesystem::path const &fname) const;
+};
+
+FDTD_Profiler& fdtd_profiler();
+FDTD_Profiler* fdtd_profiler_bind(FDTD_Profiler *profiler);
+
+#endif // FDTD_PROFILER_H
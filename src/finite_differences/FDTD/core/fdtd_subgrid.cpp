@@ -0,0 +1,668 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_subgrid.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+//#######################
+//   Subgrid_Interface
+//#######################
+
+static Grid3<double>& E_field(FDTD &fdtd,int c)
+{
+         if(c==0) return fdtd.Ex;
+    else if(c==1) return fdtd.Ey;
+    
+    return fdtd.Ez;
+}
+
+static Grid3<double>& H_field(FDTD &fdtd,int c)
+{
+         if(c==0) return fdtd.Hx;
+    else if(c==1) return fdtd.Hy;
+    
+    return fdtd.Hz;
+}
+
+static double spacing(FDTD const &fdtd,int axis)
+{
+         if(axis==0) return fdtd.Dx;
+    else if(axis==1) return fdtd.Dy;
+    
+    return fdtd.Dz;
+}
+
+static FDTD_Material& node_material(FDTD &fdtd,int c,int const *n)
+{
+    #ifndef SEP_MATS
+    return fdtd.mats[fdtd.matsgrid(n[0],n[1],n[2])];
+    #else
+         if(c==0) return fdtd.mats[fdtd.matsgrid_x(n[0],n[1],n[2])];
+    else if(c==1) return fdtd.mats[fdtd.matsgrid_y(n[0],n[1],n[2])];
+    
+    return fdtd.mats[fdtd.matsgrid_z(n[0],n[1],n[2])];
+    #endif
+}
+
+// E node of the component c on the faces of the box [n1,n2], which spans
+// [n1,n2) along c and the closed range along the other axes
+
+static bool on_faces(int c,int const *n,int const *n1,int const *n2)
+{
+    if(n[c]<n1[c] || n[c]>=n2[c]) return false;
+    
+    bool face=false;
+    
+    for(int a=0;a<3;a++) if(a!=c)
+    {
+        if(n[a]<n1[a] || n[a]>n2[a]) return false;
+        if(n[a]==n1[a] || n[a]==n2[a]) face=true;
+    }
+    
+    return face;
+}
+
+// E and H nodes strictly inside the box [n1,n2]
+
+static bool inside_E(int c,int const *n,int const *n1,int const *n2)
+{
+    if(n[c]<n1[c] || n[c]>=n2[c]) return false;
+    
+    for(int a=0;a<3;a++) if(a!=c && (n[a]<=n1[a] || n[a]>=n2[a])) return false;
+    
+    return true;
+}
+
+static bool inside_H(int c,int const *n,int const *n1,int const *n2)
+{
+    if(n[c]<=n1[c] || n[c]>=n2[c]) return false;
+    
+    for(int a=0;a<3;a++) if(a!=c && (n[a]<n1[a] || n[a]>=n2[a])) return false;
+    
+    return true;
+}
+
+// Curl of H at the E node n of the component c, volume integrated over the
+// quarters of the dual cell inside the box [n1,n2] if inside is true, and
+// outside it otherwise. Each H node is weighted by the part of its dual edge
+// bordering these quarters, Nq being the number of quarters
+
+static double partial_curl(FDTD &fdtd,int c,int const *n,int const *n1,int const *n2,bool inside,int &Nq)
+{
+    int a=(c+1)%3;
+    int b=(c+2)%3;
+    
+    // Quarter [sa][sb], lying below the node along a if sa is 0 and above
+    // it otherwise, and likewise along b
+    
+    int q[2][2];
+    
+    Nq=0;
+    
+    for(int sa=0;sa<2;sa++) for(int sb=0;sb<2;sb++)
+    {
+        bool in_a=(sa==0)?n[a]>n1[a]:n[a]<n2[a];
+        bool in_b=(sb==0)?n[b]>n1[b]:n[b]<n2[b];
+        
+        q[sa][sb]=((in_a && in_b)==inside);
+        Nq+=q[sa][sb];
+    }
+    
+    Grid3<double> &Ha=H_field(fdtd,a);
+    Grid3<double> &Hb=H_field(fdtd,b);
+    
+    double area_a=spacing(fdtd,a)*spacing(fdtd,c);
+    double area_b=spacing(fdtd,b)*spacing(fdtd,c);
+    
+    int m[3]={n[0],n[1],n[2]};
+    
+    double R=0;
+    
+    if(q[1][0]+q[1][1]>0) R+=0.5*(q[1][0]+q[1][1])*area_b*Hb(n[0],n[1],n[2]);
+    if(q[0][1]+q[1][1]>0) R-=0.5*(q[0][1]+q[1][1])*area_a*Ha(n[0],n[1],n[2]);
+    
+    m[a]-=1;
+    if(q[0][0]+q[0][1]>0) R-=0.5*(q[0][0]+q[0][1])*area_b*Hb(m[0],m[1],m[2]);
+    m[a]+=1;
+    
+    m[b]-=1;
+    if(q[0][0]+q[1][0]>0) R+=0.5*(q[0][0]+q[1][0])*area_a*Ha(m[0],m[1],m[2]);
+    
+    return R;
+}
+
+// E node of the child grid on the faces of its box, linearly interpolated
+// from up to four interface nodes
+
+class Subgrid_Node
+{
+    public:
+        int c;
+        int n[3];
+        int Nl;
+        int I[4],J[4],K[4];
+        double w[4];
+};
+
+// Tangential E field on the faces of the box [lo,hi] of the parent grid,
+// which the child grid spans with its spacing divided by ratio.
+// The child E nodes on the faces are interpolated from these nodes, which
+// are updated with the transposed weights from the child H field inside
+// the box, and from the parent H field outside. Each update takes the time
+// step of the child, the parent H field being held over its own step, so
+// that the parent sees the nodes at the end of the step only.
+
+class Subgrid_Interface
+{
+    public:
+        FDTD &parent,&child;
+        int ratio;
+        int lo[3],hi[3];
+        
+        Subgrid_Interface(FDTD &parent,FDTD &child,int i1,int i2,int j1,int j2,int k1,int k2,int ratio);
+        
+        void begin_step();
+        void bootstrap();
+        void checkpoint(Checkpoint &chk);
+        void sub_step();
+        
+    private:
+        int child_lo[3],child_hi[3];
+        
+        Grid3<double> E_I[3],flux[3],curl[3],inv_mass[3];
+        std::vector<Subgrid_Node> nodes;
+        
+        void interpolate();
+};
+
+Subgrid_Interface::Subgrid_Interface(FDTD &parent_,FDTD &child_,int i1,int i2,int j1,int j2,int k1,int k2,int ratio_)
+    :parent(parent_), child(child_),
+     ratio(ratio_)
+{
+    lo[0]=i1; lo[1]=j1; lo[2]=k1;
+    hi[0]=i2; hi[1]=j2; hi[2]=k2;
+    
+    for(int a=0;a<3;a++)
+    {
+        child_lo[a]=0;
+        child_hi[a]=(hi[a]-lo[a])*ratio;
+    }
+    
+    for(int c=0;c<3;c++)
+    {
+        E_I[c].init(i2-i1+1,j2-j1+1,k2-k1+1,0);
+        flux[c].init(i2-i1+1,j2-j1+1,k2-k1+1,0);
+        curl[c].init(i2-i1+1,j2-j1+1,k2-k1+1,0);
+        inv_mass[c].init(i2-i1+1,j2-j1+1,k2-k1+1,0);
+    }
+}
+
+// Holds the parent H field of the current step, and restores the nodes
+// that the parent update overwrote
+
+void Subgrid_Interface::begin_step()
+{
+    int c,Nq,n[3];
+    
+    for(c=0;c<3;c++)
+    {
+        Grid3<double> &E=E_field(parent,c);
+        
+        for(n[2]=lo[2];n[2]<=hi[2];n[2]++)
+         for(n[1]=lo[1];n[1]<=hi[1];n[1]++)
+          for(n[0]=lo[0];n[0]<=hi[0];n[0]++)
+        {
+            if(!on_faces(c,n,lo,hi)) continue;
+            
+            int I=n[0]-lo[0],J=n[1]-lo[1],K=n[2]-lo[2];
+            
+            E(n[0],n[1],n[2])=E_I[c](I,J,K);
+            flux[c](I,J,K)=partial_curl(parent,c,n,lo,hi,false,Nq);
+        }
+    }
+}
+
+// Interpolation weights and lumped masses of the nodes, matching the
+// transposed weights so that the coupling conserves a discrete energy
+
+void Subgrid_Interface::bootstrap()
+{
+    int a,c,l,Nq,n[3];
+    
+    nodes.clear();
+    
+    for(c=0;c<3;c++)
+    {
+        for(n[2]=0;n[2]<=child_hi[2];n[2]++)
+         for(n[1]=0;n[1]<=child_hi[1];n[1]++)
+          for(n[0]=0;n[0]<=child_hi[0];n[0]++)
+        {
+            if(!on_faces(c,n,child_lo,child_hi)) continue;
+            
+            // Position in parent nodes of the component, from the box corner,
+            // the ends along c being extended by the nearest node
+            
+            int base[3];
+            double t[3];
+            
+            for(a=0;a<3;a++)
+            {
+                double p;
+                
+                if(a==c)
+                {
+                    p=(n[a]+0.5)/ratio-0.5;
+                    p=std::max(0.0,std::min(p,hi[a]-lo[a]-1.0));
+                }
+                else p=n[a]/static_cast<double>(ratio);
+                
+                base[a]=static_cast<int>(std::floor(p));
+                t[a]=p-base[a];
+                
+                if(t[a]==0 && base[a]>0) { base[a]-=1; t[a]=1.0; }
+            }
+            
+            Subgrid_Node node;
+            
+            node.c=c;
+            node.n[0]=n[0]; node.n[1]=n[1]; node.n[2]=n[2];
+            node.Nl=0;
+            
+            for(l=0;l<8;l++)
+            {
+                double w=1.0;
+                int m[3];
+                
+                for(a=0;a<3;a++)
+                {
+                    int s=(l>>a)&1;
+                    
+                    w*=s?t[a]:1.0-t[a];
+                    m[a]=base[a]+s;
+                }
+                
+                if(w==0) continue;
+                
+                node.I[node.Nl]=m[0];
+                node.J[node.Nl]=m[1];
+                node.K[node.Nl]=m[2];
+                node.w[node.Nl]=w;
+                node.Nl++;
+            }
+            
+            nodes.push_back(node);
+        }
+    }
+    
+    // Masses, the permittivity of each side weighting its own quarters
+    
+    Grid3<double> mass[3];
+    
+    for(c=0;c<3;c++) mass[c].init(hi[0]-lo[0]+1,hi[1]-lo[1]+1,hi[2]-lo[2]+1,0);
+    
+    double V_parent=parent.Dx*parent.Dy*parent.Dz/4.0;
+    double V_child=child.Dx*child.Dy*child.Dz/4.0;
+    
+    for(c=0;c<3;c++)
+    {
+        for(n[2]=lo[2];n[2]<=hi[2];n[2]++)
+         for(n[1]=lo[1];n[1]<=hi[1];n[1]++)
+          for(n[0]=lo[0];n[0]<=hi[0];n[0]++)
+        {
+            if(!on_faces(c,n,lo,hi)) continue;
+            
+            FDTD_Material &mat=node_material(parent,c,n);
+            
+            if(mat.m_type!=MAT_CONST)
+            {
+                std::cerr<<"Error: the faces of a subgrid must lie in non-dispersive lossless materials"<<std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            
+            partial_curl(parent,c,n,lo,hi,false,Nq);
+            
+            mass[c](n[0]-lo[0],n[1]-lo[1],n[2]-lo[2])+=mat.ei*Nq*V_parent;
+            E_I[c](n[0]-lo[0],n[1]-lo[1],n[2]-lo[2])=E_field(parent,c)(n[0],n[1],n[2]);
+        }
+    }
+    
+    for(unsigned int p=0;p<nodes.size();p++)
+    {
+        Subgrid_Node const &node=nodes[p];
+        
+        FDTD_Material &mat=node_material(child,node.c,node.n);
+        
+        if(mat.m_type!=MAT_CONST)
+        {
+            std::cerr<<"Error: the faces of a subgrid must lie in non-dispersive lossless materials"<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        
+        partial_curl(child,node.c,node.n,child_lo,child_hi,true,Nq);
+        
+        for(l=0;l<node.Nl;l++)
+            mass[node.c](node.I[l],node.J[l],node.K[l])+=node.w[l]*mat.ei*Nq*V_child;
+    }
+    
+    for(c=0;c<3;c++)
+    {
+        for(n[2]=0;n[2]<mass[c].L3();n[2]++)
+         for(n[1]=0;n[1]<mass[c].L2();n[1]++)
+          for(n[0]=0;n[0]<mass[c].L1();n[0]++)
+        {
+            double m=mass[c](n[0],n[1],n[2]);
+            
+            if(m>0) inv_mass[c](n[0],n[1],n[2])=1.0/m;
+        }
+    }
+    
+    interpolate();
+}
+
+void Subgrid_Interface::checkpoint(Checkpoint &chk)
+{
+    for(int c=0;c<3;c++) chk.sync(E_I[c]);
+}
+
+// Child E nodes on the faces, from the interface nodes
+
+void Subgrid_Interface::interpolate()
+{
+    for(unsigned int p=0;p<nodes.size();p++)
+    {
+        Subgrid_Node const &node=nodes[p];
+        
+        double E=0;
+        
+        for(int l=0;l<node.Nl;l++)
+            E+=node.w[l]*E_I[node.c](node.I[l],node.J[l],node.K[l]);
+        
+        E_field(child,node.c)(node.n[0],node.n[1],node.n[2])=E;
+    }
+}
+
+// Called once the child E field is updated, and before its H field is
+
+void Subgrid_Interface::sub_step()
+{
+    int c,Nq,n[3];
+    
+    for(c=0;c<3;c++) curl[c]=flux[c];
+    
+    for(unsigned int p=0;p<nodes.size();p++)
+    {
+        Subgrid_Node const &node=nodes[p];
+        
+        double R=partial_curl(child,node.c,node.n,child_lo,child_hi,true,Nq);
+        
+        for(int l=0;l<node.Nl;l++)
+            curl[node.c](node.I[l],node.J[l],node.K[l])+=node.w[l]*R;
+    }
+    
+    double C=child.Dt/e0;
+    
+    for(c=0;c<3;c++)
+    {
+        Grid3<double> &E=E_field(parent,c);
+        
+        for(n[2]=lo[2];n[2]<=hi[2];n[2]++)
+         for(n[1]=lo[1];n[1]<=hi[1];n[1]++)
+          for(n[0]=lo[0];n[0]<=hi[0];n[0]++)
+        {
+            if(!on_faces(c,n,lo,hi)) continue;
+            
+            int I=n[0]-lo[0],J=n[1]-lo[1],K=n[2]-lo[2];
+            
+            E_I[c](I,J,K)+=C*inv_mass[c](I,J,K)*curl[c](I,J,K);
+            E(n[0],n[1],n[2])=E_I[c](I,J,K);
+        }
+    }
+    
+    interpolate();
+}
+
+//##################
+//   FDTD_Subgrid
+//##################
+
+FDTD_Subgrid::FDTD_Subgrid(FDTD &coarse_,int i1_,int i2_,int j1_,int j2_,int k1_,int k2_,int ratio_)
+    :ratio(ratio_),
+     i1(i1_), i2(i2_),
+     j1(j1_), j2(j2_),
+     k1(k1_), k2(k2_),
+     coarse(coarse_),
+     buffer(nullptr), fine(nullptr),
+     outer(nullptr), inner(nullptr)
+{
+    if(ratio<3 || ratio%2==0)
+    {
+        std::cerr<<"Error: the subgrid refinement ratio must be odd and larger than 1, got "<<ratio<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    // The buffer grid takes one more cell on each side
+    
+    if(   i1<2 || i2>coarse.Nx-2 || i2<=i1
+       || j1<2 || j2>coarse.Ny-2 || j2<=j1
+       || k1<2 || k2>coarse.Nz-2 || k2<=k1
+       || i1-1<coarse.pml_xm || i2+1>coarse.Nx-coarse.pml_xp
+       || j1-1<coarse.pml_ym || j2+1>coarse.Ny-coarse.pml_yp
+       || k1-1<coarse.pml_zm || k2+1>coarse.Nz-coarse.pml_zp)
+    {
+        std::cerr<<"Error: invalid subgrid box ("<<i1<<","<<i2<<")x("<<j1<<","<<j2<<")x("<<k1<<","<<k2<<")"
+                 <<" in a ("<<coarse.Nx<<","<<coarse.Ny<<","<<coarse.Nz<<") grid"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    if(coarse.domain!=nullptr || !coarse.z_step.empty())
+    {
+        std::cerr<<"Error: subgrids require a single process and a uniform z mesh"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    double r=ratio;
+    
+    buffer=new FDTD(i2-i1+3,j2-j1+3,k2-k1+3,coarse.Nt*ratio,
+                    coarse.Dx,coarse.Dy,coarse.Dz,coarse.Dt/r,"CUSTOM",
+                    0,0,0,0,0,0);
+    
+    fine=new FDTD((i2-i1)*ratio+1,(j2-j1)*ratio+1,(k2-k1)*ratio+1,coarse.Nt*ratio,
+                  coarse.Dx/r,coarse.Dy/r,coarse.Dz/r,coarse.Dt/r,"CUSTOM",
+                  0,0,0,0,0,0);
+    
+    FDTD *grids[2]={buffer,fine};
+    
+    for(int n=0;n<2;n++)
+    {
+        grids[n]->set_inline();
+        grids[n]->set_kx(0);
+        grids[n]->set_ky(0);
+        grids[n]->set_prefix(coarse.prefix);
+    }
+    
+    outer=new Subgrid_Interface(coarse,*buffer,i1-1,i2+1,j1-1,j2+1,k1-1,k2+1,1);
+    inner=new Subgrid_Interface(*buffer,*fine,1,i2-i1+1,1,j2-j1+1,1,k2-k1+1,ratio);
+}
+
+FDTD_Subgrid::~FDTD_Subgrid()
+{
+    delete outer;
+    delete inner;
+    delete buffer;
+    delete fine;
+}
+
+// Called at the end of the coarse E update, the coarse E field being at
+// n+1 and the coarse H field at n+1/2. The buffer and fine grids are
+// brought to the same times through ratio sub-steps
+
+void FDTD_Subgrid::advance()
+{
+    outer->begin_step();
+    
+    for(int m=0;m<ratio;m++)
+    {
+        buffer->update_E();
+        inner->begin_step();
+        
+        fine->update_E();
+        inner->sub_step();
+        outer->sub_step();
+        
+        fine->update_H();
+        buffer->update_H();
+    }
+}
+
+// To be called once the materials of the fine grid are set, the buffer
+// taking those of the coarse grid
+
+void FDTD_Subgrid::bootstrap()
+{
+    int i,j,k;
+    
+    #ifndef SEP_MATS
+    Grid3<unsigned int> buffer_grid(buffer->Nx,buffer->Ny,buffer->Nz,0);
+    
+    for(k=0;k<buffer->Nz;k++) for(j=0;j<buffer->Ny;j++) for(i=0;i<buffer->Nx;i++)
+        buffer_grid(i,j,k)=coarse.matsgrid(i+i1-1,j+j1-1,k+k1-1);
+    
+    buffer->set_matsgrid(buffer_grid);
+    #else
+    Grid3<unsigned int> buffer_x(buffer->Nx,buffer->Ny,buffer->Nz,0),
+                        buffer_y(buffer->Nx,buffer->Ny,buffer->Nz,0),
+                        buffer_z(buffer->Nx,buffer->Ny,buffer->Nz,0);
+    
+    for(k=0;k<buffer->Nz;k++) for(j=0;j<buffer->Ny;j++) for(i=0;i<buffer->Nx;i++)
+    {
+        buffer_x(i,j,k)=coarse.matsgrid_x(i+i1-1,j+j1-1,k+k1-1);
+        buffer_y(i,j,k)=coarse.matsgrid_y(i+i1-1,j+j1-1,k+k1-1);
+        buffer_z(i,j,k)=coarse.matsgrid_z(i+i1-1,j+j1-1,k+k1-1);
+    }
+    
+    buffer->set_matsgrid(buffer_x,buffer_y,buffer_z);
+    #endif
+    
+    for(unsigned int m=0;m<coarse.Nmat;m++)
+        buffer->set_material(m,coarse.mats[m].base_mat);
+    
+    buffer->bootstrap();
+    fine->bootstrap();
+    
+    outer->bootstrap();
+    inner->bootstrap();
+}
+
+void FDTD_Subgrid::checkpoint(Checkpoint &chk)
+{
+    buffer->checkpoint(chk);
+    fine->checkpoint(chk);
+    
+    outer->checkpoint(chk);
+    inner->checkpoint(chk);
+}
+
+// Coarse fields inside the box, which only serve the sensors: the fine
+// fields are averaged over the buffer cells, and the buffer fields then
+// copied to the coarse grid
+
+void FDTD_Subgrid::restrict_fields()
+{
+    int a,b,c,n[3];
+    
+    int in_lo[3]={1,1,1};
+    int in_hi[3]={i2-i1+1,j2-j1+1,k2-k1+1};
+    int out_lo[3]={0,0,0};
+    int out_hi[3]={i2-i1+2,j2-j1+2,k2-k1+2};
+    
+    double r=ratio;
+    
+    for(c=0;c<3;c++)
+    {
+        int u=(c+1)%3;
+        int v=(c+2)%3;
+        
+        Grid3<double> &E_b=E_field(*buffer,c);
+        Grid3<double> &H_b=H_field(*buffer,c);
+        Grid3<double> &E_f=E_field(*fine,c);
+        Grid3<double> &H_f=H_field(*fine,c);
+        
+        for(n[2]=in_lo[2];n[2]<=in_hi[2];n[2]++)
+         for(n[1]=in_lo[1];n[1]<=in_hi[1];n[1]++)
+          for(n[0]=in_lo[0];n[0]<=in_hi[0];n[0]++)
+        {
+            int m[3];
+            
+            for(a=0;a<3;a++) m[a]=(n[a]-in_lo[a])*ratio;
+            
+            if(inside_E(c,n,in_lo,in_hi))
+            {
+                double sum=0;
+                
+                for(a=0;a<ratio;a++)
+                {
+                    m[c]+=a;
+                    sum+=E_f(m[0],m[1],m[2]);
+                    m[c]-=a;
+                }
+                
+                E_b(n[0],n[1],n[2])=sum/r;
+            }
+            
+            if(inside_H(c,n,in_lo,in_hi))
+            {
+                double sum=0;
+                
+                for(a=0;a<ratio;a++) for(b=0;b<ratio;b++)
+                {
+                    m[u]+=a; m[v]+=b;
+                    sum+=H_f(m[0],m[1],m[2]);
+                    m[u]-=a; m[v]-=b;
+                }
+                
+                H_b(n[0],n[1],n[2])=sum/(r*r);
+            }
+        }
+        
+        Grid3<double> &E_c=E_field(coarse,c);
+        Grid3<double> &H_c=H_field(coarse,c);
+        
+        for(n[2]=out_lo[2];n[2]<=out_hi[2];n[2]++)
+         for(n[1]=out_lo[1];n[1]<=out_hi[1];n[1]++)
+          for(n[0]=out_lo[0];n[0]<=out_hi[0];n[0]++)
+        {
+            int I=n[0]+i1-1,J=n[1]+j1-1,K=n[2]+k1-1;
+            
+            if(inside_E(c,n,out_lo,out_hi)) E_c(I,J,K)=E_b(n[0],n[1],n[2]);
+            if(inside_H(c,n,out_lo,out_hi)) H_c(I,J,K)=H_b(n[0],n[1],n[2]);
+        }
+    }
+}
+
+//####################
+//   FDTD subgrids
+//####################
+
+// The box is given in cells of the whole grid, padding and PMLs included
+FDTD_Subgrid* FDTD::add_subgrid(int i1,int i2,int j1,int j2,int k1,int k2,int ratio)
+{
+    FDTD_Subgrid *subgrid=new FDTD_Subgrid(*this,i1,i2,j1,j2,k1,k2,ratio);
+    
+    subgrids.push_back(subgrid);
+    
+    return subgrid;
+}
@@ -0,0 +1,62 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef FDTD_SUBGRID_H
+#define FDTD_SUBGRID_H
+
+#include <fdtd_core.h>
+
+//##################
+//   FDTD_Subgrid
+//##################
+
+class Subgrid_Interface;
+
+// Refined region of a grid, the coarse cells [i1,i2)x[j1,j2)x[k1,k2)
+// being simulated with the steps divided by an odd ratio.
+// The time and space refinements are split over two interfaces: a buffer
+// grid one coarse cell wider than the box keeps the coarse spacing but
+// takes the fine time steps, and holds the fine grid, which shares its
+// time steps. Each interface owns the tangential E field on its faces,
+// updated from the H fields of both sides with matching weights, the
+// outer one holding the coarse H field over the coarse step. The coupling
+// thus conserves a discrete energy and the scheme stays stable up to the
+// usual Courant limit.
+// The faces must lie in non-dispersive lossless materials, at least two
+// cells away from the edges of the coarse grid and away from the PMLs and
+// sources. The buffer and fine grids are run on the thread driving the
+// coarse grid.
+
+class FDTD_Subgrid
+{
+    public:
+        int ratio;
+        int i1,i2,j1,j2,k1,k2;
+        
+        FDTD &coarse;
+        FDTD *buffer,*fine;
+        
+        FDTD_Subgrid(FDTD &coarse,int i1,int i2,int j1,int j2,int k1,int k2,int ratio);
+        ~FDTD_Subgrid();
+        
+        void advance();
+        void bootstrap();
+        void checkpoint(Checkpoint &chk);
+        void restrict_fields();
+        
+    private:
+        Subgrid_Interface *outer,*inner;
+};
+
+#endif // FDTD_SUBGRID_H
@@ -0,0 +1,289 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_tfsf.h>
+
+#include <cstdlib>
+
+//###############
+//   FDTD_TFSF
+//###############
+
+FDTD_TFSF::FDTD_TFSF(FDTD &fdtd_,FDTD &aux_,ChpIn &chp_,double eps_inj_,int k_inj_,
+                     int i1_,int i2_,int j1_,int j2_,int k1_,int k2_,
+                     bool periodic_x_,bool periodic_y_)
+    :i1(i1_), i2(i2_),
+     j1(j1_), j2(j2_),
+     k1(k1_), k2(k2_),
+     k_inj(k_inj_),
+     periodic_x(periodic_x_), periodic_y(periodic_y_),
+     fdtd(fdtd_), aux(aux_),
+     chp(chp_), eps_inj(eps_inj_)
+{
+    // The box spans the whole periodic directions
+    
+    int i_min=1,i_max=fdtd.Nx-1;
+    int j_min=1,j_max=fdtd.Ny-1;
+    
+    if(periodic_x) { i_min=0; i_max=fdtd.Nx; }
+    if(periodic_y) { j_min=0; j_max=fdtd.Ny; }
+    
+    if(   aux.Nx!=1 || aux.Ny!=1 || aux.Nz!=fdtd.Nz
+       || i1<i_min || i2>i_max || i2<=i1
+       || j1<j_min || j2>j_max || j2<=j1
+       || k1<1 || k2>=fdtd.Nz || k2<=k1
+       || k_inj<0 || k_inj>=fdtd.Nz-1
+       || fdtd.domain!=nullptr)
+    {
+        std::cerr<<"Error: invalid total-field/scattered-field box ("<<i1<<","<<i2<<")x("<<j1<<","<<j2<<")x("<<k1<<","<<k2<<")"
+                 <<" in a ("<<fdtd.Nx<<","<<fdtd.Ny<<","<<fdtd.Nz<<") grid"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    aux.set_inline();
+    
+    int i,j,k,t;
+    double tmp1,tmp2;
+    
+    // Incident waveform
+    
+    int Nt=fdtd.Nt;
+    
+    inj_Ex.init(Nt,0); inj_Ey.init(Nt,0);
+    inj_Hx.init(Nt,0); inj_Hy.init(Nt,0);
+    
+    for(t=0;t<Nt;t++)
+    {
+        inj_Hx(t)=chp.Hx(0,0,(k_inj+0.5)*fdtd.Dz,t*fdtd.Dt);
+        inj_Hy(t)=chp.Hy(0,0,(k_inj+0.5)*fdtd.Dz,t*fdtd.Dt);
+        
+        inj_Ex(t)=chp.Ex(0,0,k_inj*fdtd.Dz,(t+0.5)*fdtd.Dt);
+        inj_Ey(t)=chp.Ey(0,0,k_inj*fdtd.Dz,(t+0.5)*fdtd.Dt);
+    }
+    
+    // Faces coefficients
+    
+    Ex_z1.init(i2-i1,j2-j1,0); Ex_z2.init(i2-i1,j2-j1,0);
+    Ey_z1.init(i2-i1,j2-j1,0); Ey_z2.init(i2-i1,j2-j1,0);
+    
+    for(i=i1;i<i2;i++) for(j=j1;j<j2;j++)
+    {
+        fdtd.mats[fdtd.matsgrid(i,j,k1)].coeffsX(tmp1,tmp2,Ex_z1(i-i1,j-j1));
+        fdtd.mats[fdtd.matsgrid(i,j,k2)].coeffsX(tmp1,tmp2,Ex_z2(i-i1,j-j1));
+        fdtd.mats[fdtd.matsgrid(i,j,k1)].coeffsY(tmp1,tmp2,Ey_z1(i-i1,j-j1));
+        fdtd.mats[fdtd.matsgrid(i,j,k2)].coeffsY(tmp1,tmp2,Ey_z2(i-i1,j-j1));
+    }
+    
+    if(!periodic_y)
+    {
+        Ex_y1.init(i2-i1,k2-k1,0); Ex_y2.init(i2-i1,k2-k1,0);
+        Ez_y1.init(i2-i1,k2-k1,0); Ez_y2.init(i2-i1,k2-k1,0);
+        
+        for(i=i1;i<i2;i++) for(k=k1;k<k2;k++)
+        {
+            fdtd.mats[fdtd.matsgrid(i,j1,k)].coeffsX(tmp1,Ex_y1(i-i1,k-k1),tmp2);
+            fdtd.mats[fdtd.matsgrid(i,j2,k)].coeffsX(tmp1,Ex_y2(i-i1,k-k1),tmp2);
+            fdtd.mats[fdtd.matsgrid(i,j1,k)].coeffsZ(tmp1,tmp2,Ez_y1(i-i1,k-k1));
+            fdtd.mats[fdtd.matsgrid(i,j2,k)].coeffsZ(tmp1,tmp2,Ez_y2(i-i1,k-k1));
+        }
+    }
+    
+    if(!periodic_x)
+    {
+        Ey_x1.init(j2-j1,k2-k1,0); Ey_x2.init(j2-j1,k2-k1,0);
+        Ez_x1.init(j2-j1,k2-k1,0); Ez_x2.init(j2-j1,k2-k1,0);
+        
+        for(j=j1;j<j2;j++) for(k=k1;k<k2;k++)
+        {
+            fdtd.mats[fdtd.matsgrid(i1,j,k)].coeffsY(tmp1,Ey_x1(j-j1,k-k1),tmp2);
+            fdtd.mats[fdtd.matsgrid(i2,j,k)].coeffsY(tmp1,Ey_x2(j-j1,k-k1),tmp2);
+            fdtd.mats[fdtd.matsgrid(i1,j,k)].coeffsZ(tmp1,Ez_x1(j-j1,k-k1),tmp2);
+            fdtd.mats[fdtd.matsgrid(i2,j,k)].coeffsZ(tmp1,Ez_x2(j-j1,k-k1),tmp2);
+        }
+    }
+}
+
+// Auxiliary E update, the injection coming before its PMLs. Called by the
+// main grid before its own E update, which only needs the auxiliary H field
+
+void FDTD_TFSF::advance_E()
+{
+    int t=fdtd.tstep;
+    
+    double Hx_inj,Hy_inj;
+    
+    if(t<inj_Hx.L1())
+    {
+        Hx_inj=inj_Hx(t);
+        Hy_inj=inj_Hy(t);
+    }
+    else
+    {
+        Hx_inj=chp.Hx(0,0,(k_inj+0.5)*fdtd.Dz,t*fdtd.Dt);
+        Hy_inj=chp.Hy(0,0,(k_inj+0.5)*fdtd.Dz,t*fdtd.Dt);
+    }
+    
+    aux.update_E_ante();
+    aux.update_E_self();
+    
+    aux.Ex(0,0,k_inj)-=fdtd.dtdez*Hy_inj/eps_inj;
+    aux.Ey(0,0,k_inj)+=fdtd.dtdez*Hx_inj/eps_inj;
+    
+    aux.update_E_post();
+}
+
+void FDTD_TFSF::advance_H()
+{
+    int t=fdtd.tstep;
+    
+    double Ex_inj,Ey_inj;
+    
+    if(t<inj_Ex.L1())
+    {
+        Ex_inj=inj_Ex(t);
+        Ey_inj=inj_Ey(t);
+    }
+    else
+    {
+        Ex_inj=chp.Ex(0,0,k_inj*fdtd.Dz,(t+0.5)*fdtd.Dt);
+        Ey_inj=chp.Ey(0,0,k_inj*fdtd.Dz,(t+0.5)*fdtd.Dt);
+    }
+    
+    aux.update_H();
+    
+    aux.Hx(0,0,k_inj)+=fdtd.dtdmz*Ey_inj;
+    aux.Hy(0,0,k_inj)-=fdtd.dtdmz*Ex_inj;
+}
+
+void FDTD_TFSF::correct_E_X(int i,Grid2<double> const &C_Ey,Grid2<double> const &C_Ez,double sgn)
+{
+    for(int k=k1;k<k2;k++) for(int j=j1;j<j2;j++)
+    {
+        fdtd.Ey(i,j,k)+=sgn*C_Ey(j-j1,k-k1)*aux.Hz(0,0,k);
+        fdtd.Ez(i,j,k)-=sgn*C_Ez(j-j1,k-k1)*aux.Hy(0,0,k);
+    }
+}
+
+void FDTD_TFSF::correct_H_X(int i,double sgn)
+{
+    for(int k=k1;k<k2;k++) for(int j=j1;j<j2;j++)
+    {
+        fdtd.Hy(i,j,k)-=sgn*fdtd.dtdmx*aux.Ez(0,0,k);
+        fdtd.Hz(i,j,k)+=sgn*fdtd.dtdmx*aux.Ey(0,0,k);
+    }
+}
+
+// Same x chunks as FDTD::threaded_mats, the E corrections having to be
+// done on a cell before its materials update
+
+void FDTD_TFSF::x_chunk(int ID,int &x1,int &x2) const
+{
+    x1=x2=0;
+    
+    if(fdtd.Nx>fdtd.Nthreads)
+    {
+        x1=(ID*fdtd.Nx)/fdtd.Nthreads;
+        x2=((ID+1)*fdtd.Nx)/fdtd.Nthreads;
+    }
+    else if(ID==0) x2=fdtd.Nx;
+}
+
+void FDTD_TFSF::threaded_E(int ID)
+{
+    int i,j,k,x1,x2;
+    
+    x_chunk(ID,x1,x2);
+    
+    for(i=std::max(x1,i1);i<std::min(x2,i2);i++)
+    {
+        // Z
+        
+        for(j=j1;j<j2;j++)
+        {
+            fdtd.Ex(i,j,k1)+=Ex_z1(i-i1,j-j1)*aux.Hy(0,0,k1-1);
+            fdtd.Ex(i,j,k2)-=Ex_z2(i-i1,j-j1)*aux.Hy(0,0,k2-1);
+            
+            fdtd.Ey(i,j,k1)-=Ey_z1(i-i1,j-j1)*aux.Hx(0,0,k1-1);
+            fdtd.Ey(i,j,k2)+=Ey_z2(i-i1,j-j1)*aux.Hx(0,0,k2-1);
+        }
+        
+        // Y
+        
+        if(!periodic_y) for(k=k1;k<k2;k++)
+        {
+            fdtd.Ex(i,j1,k)-=Ex_y1(i-i1,k-k1)*aux.Hz(0,0,k);
+            fdtd.Ex(i,j2,k)+=Ex_y2(i-i1,k-k1)*aux.Hz(0,0,k);
+            
+            fdtd.Ez(i,j1,k)+=Ez_y1(i-i1,k-k1)*aux.Hx(0,0,k);
+            fdtd.Ez(i,j2,k)-=Ez_y2(i-i1,k-k1)*aux.Hx(0,0,k);
+        }
+    }
+    
+    // X
+    
+    if(!periodic_x)
+    {
+        if(i1>=x1 && i1<x2) correct_E_X(i1,Ey_x1,Ez_x1,1.0);
+        if(i2>=x1 && i2<x2) correct_E_X(i2,Ey_x2,Ez_x2,-1.0);
+    }
+}
+
+void FDTD_TFSF::threaded_H(int ID)
+{
+    int i,j,k,x1,x2;
+    
+    x_chunk(ID,x1,x2);
+    
+    for(i=std::max(x1,i1);i<std::min(x2,i2);i++)
+    {
+        // Z
+        
+        for(j=j1;j<j2;j++)
+        {
+            fdtd.Hx(i,j,k1-1)-=fdtd.dtdmz*aux.Ey(0,0,k1);
+            fdtd.Hx(i,j,k2-1)+=fdtd.dtdmz*aux.Ey(0,0,k2);
+            
+            fdtd.Hy(i,j,k1-1)+=fdtd.dtdmz*aux.Ex(0,0,k1);
+            fdtd.Hy(i,j,k2-1)-=fdtd.dtdmz*aux.Ex(0,0,k2);
+        }
+        
+        // Y
+        
+        if(!periodic_y) for(k=k1;k<k2;k++)
+        {
+            fdtd.Hx(i,j1-1,k)+=fdtd.dtdmy*aux.Ez(0,0,k);
+            fdtd.Hx(i,j2-1,k)-=fdtd.dtdmy*aux.Ez(0,0,k);
+            
+            fdtd.Hz(i,j1-1,k)-=fdtd.dtdmy*aux.Ex(0,0,k);
+            fdtd.Hz(i,j2-1,k)+=fdtd.dtdmy*aux.Ex(0,0,k);
+        }
+    }
+    
+    // X
+    
+    if(!periodic_x)
+    {
+        if(i1-1>=x1 && i1-1<x2) correct_H_X(i1-1,1.0);
+        if(i2-1>=x1 && i2-1<x2) correct_H_X(i2-1,-1.0);
+    }
+}
+
+//################
+//   FDTD TFSF
+//################
+
+void FDTD::link_tfsf(FDTD_TFSF &tfsf_)
+{
+    tfsf=&tfsf_;
+}
@@ -0,0 +1,68 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef FDTD_TFSF_H
+#define FDTD_TFSF_H
+
+#include <fdtd_core.h>
+
+//###############
+//   FDTD_TFSF
+//###############
+
+// Total-field/scattered-field box [i1,i2]x[j1,j2]x[k1,k2] of a grid, fed
+// by a plane wave propagating along z on a 1x1xNz auxiliary grid sharing
+// the z mesh. The auxiliary grid runs inline on the calling thread, the
+// wave being injected on its plane k_inj, while the corrections on the
+// box faces are done by the workers of the main grid, the E ones during
+// the Materials Simp phase on the same x chunks as the materials, the H
+// ones during the PMLs H phase. The faces coefficients and the incident
+// waveform are tabulated once at construction.
+
+class FDTD_TFSF
+{
+    public:
+        int i1,i2,j1,j2,k1,k2,k_inj;
+        bool periodic_x,periodic_y;
+        
+        FDTD &fdtd;
+        FDTD &aux;
+        
+        FDTD_TFSF(FDTD &fdtd,FDTD &aux,ChpIn &chp,double eps_inj,int k_inj,
+                  int i1,int i2,int j1,int j2,int k1,int k2,
+                  bool periodic_x,bool periodic_y);
+        
+        void advance_E();
+        void advance_H();
+        void threaded_E(int ID);
+        void threaded_H(int ID);
+        
+    private:
+        ChpIn &chp;
+        double eps_inj;
+        
+        // Injected auxiliary fields, at t*Dt for H and (t+0.5)*Dt for E
+        Grid1<double> inj_Ex,inj_Ey,inj_Hx,inj_Hy;
+        
+        // E coefficients on the faces, indexed from the box corner
+        Grid2<double> Ex_z1,Ex_z2,Ey_z1,Ey_z2;
+        Grid2<double> Ex_y1,Ex_y2,Ez_y1,Ez_y2;
+        Grid2<double> Ey_x1,Ey_x2,Ez_x1,Ez_x2;
+        
+        void correct_E_X(int i,Grid2<double> const &C_Ey,Grid2<double> const &C_Ez,double sgn);
+        void correct_H_X(int i,double sgn);
+        void x_chunk(int ID,int &x1,int &x2) const;
+};
+
+#endif // FDTD_TFSF_H
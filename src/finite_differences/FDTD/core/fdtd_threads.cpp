@@ -13,6 +13,8 @@ See the License for the specific language governing permissions and
 limitations under the License.*/
 
 #include <fdtd_core.h>
+#include <fdtd_profiler.h>
+#include <fdtd_tfsf.h>
 
 std::mutex cout_mutex;
 
@@ -29,8 +31,171 @@ void FDTD::update_E_simp()
     allow_run_E=false;
 }
 
+// Chunk of the box [0,Nx)x[0,Ny)x[k1,k2) updated by the thread ID, false
+// if it has nothing to do. A forced axis too short for the threads falls
+// back to the default choice
+
+bool FDTD::split_box(int ID,int k1,int k2,int &x1,int &x2,int &y1,int &y2,int &z1,int &z2) const
+{
+    x1=0; x2=Nx;
+    y1=0; y2=Ny;
+    z1=k1; z2=k2;
+    
+    int axis=split_axis;
+    
+         if(axis==SPLIT_X && Nx<=Nthreads) axis=SPLIT_AUTO;
+    else if(axis==SPLIT_Y && Ny<=Nthreads) axis=SPLIT_AUTO;
+    else if(axis==SPLIT_Z && k2-k1<=Nthreads) axis=SPLIT_AUTO;
+    
+    if(axis==SPLIT_AUTO)
+    {
+             if(k2-k1>Nthreads) axis=SPLIT_Z;
+        else if(Ny>Nthreads) axis=SPLIT_Y;
+        else if(Nx>Nthreads) axis=SPLIT_X;
+        else return ID==0;
+    }
+    
+         if(axis==SPLIT_X) { x1=(ID*Nx)/Nthreads; x2=((ID+1)*Nx)/Nthreads; }
+    else if(axis==SPLIT_Y) { y1=(ID*Ny)/Nthreads; y2=((ID+1)*Ny)/Nthreads; }
+    else if(axis==SPLIT_Z) { z1=k1+(ID*(k2-k1))/Nthreads; z2=k1+((ID+1)*(k2-k1))/Nthreads; }
+    
+    return true;
+}
+
+void FDTD::threaded_E_field(int ID,int k1,int k2)
+{
+    int x1,x2,y1,y2,z1,z2;
+    
+    if(!split_box(ID,k1,k2,x1,x2,y1,y2,z1,z2)) return;
+    
+    if(enable_Ex) advEx(x1,x2,y1,y2,z1,z2);
+    if(enable_Ey) advEy(x1,x2,y1,y2,z1,z2);
+    if(enable_Ez) advEz(x1,x2,y1,y2,z1,z2);
+}
+
+void FDTD::threaded_H_field(int ID,int k1,int k2)
+{
+    int x1,x2,y1,y2,z1,z2;
+    
+    if(!split_box(ID,k1,k2,x1,x2,y1,y2,z1,z2)) return;
+    
+    if(enable_Hx) advHx(x1,x2,y1,y2,z1,z2);
+    if(enable_Hy) advHy(x1,x2,y1,y2,z1,z2);
+    if(enable_Hz) advHz(x1,x2,y1,y2,z1,z2);
+}
+
+void FDTD::threaded_mats(int ID,void (FDTD::*adv_mats)(int,int))
+{
+    if(Nx>Nthreads)
+    {
+        (this->*adv_mats)((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
+    }
+    else if(ID==0) (this->*adv_mats)(0,Nx);
+}
+
+void FDTD::threaded_pml_E(int ID)
+{
+    if(enable_Ex)
+    {
+        if(Nx>Nthreads) app_pec_Ex((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
+        else if(ID==0) app_pec_Ex(0,Nx);
+    }
+    
+    if(enable_Ey)
+    {
+        if(Ny>Nthreads) app_pec_Ey((ID*Ny)/Nthreads,((ID+1)*Ny)/Nthreads);
+        else if(ID==0) app_pec_Ey(0,Ny);
+    }
+    
+    if(enable_Ez)
+    {
+        if(Nz>Nthreads) app_pec_Ez((ID*Nz)/Nthreads,((ID+1)*Nz)/Nthreads);
+        else if(ID==0) app_pec_Ez(0,Nz);
+    }
+}
+
+void FDTD::threaded_pml_H(int ID)
+{
+    if(enable_Hx)
+    {
+        if(Nx>Nthreads) app_pec_Hx((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
+        else if(ID==0) app_pec_Hx(0,Nx);
+    }
+    
+    if(enable_Hy)
+    {
+        if(Ny>Nthreads) app_pec_Hy((ID*Ny)/Nthreads,((ID+1)*Ny)/Nthreads);
+        else if(ID==0) app_pec_Hy(0,Ny);
+    }
+    
+    if(enable_Hz)
+    {
+        if(Nz>Nthreads) app_pec_Hz((ID*Nz)/Nthreads,((ID+1)*Nz)/Nthreads);
+        else if(ID==0) app_pec_Hz(0,Nz);
+    }
+}
+
+// Profiler counters of the E phases, in the order of the phases
+
+#ifdef FDTD_PROFILING
+static const int prof_phase_E[]={FDTD_Profiler::PROF_MATS_ANTE,
+                                 FDTD_Profiler::PROF_E_FIELD,
+                                 FDTD_Profiler::PROF_MATS_SIMP,
+                                 FDTD_Profiler::PROF_MATS_POST,
+                                 FDTD_Profiler::PROF_MATS_SELF,
+                                 FDTD_Profiler::PROF_PML_E};
+#endif
+
+// Each phase is also run on the linked twins in the same sweep, so that
+// grids sharing a time step (real and imaginary parts of a complex field,
+// batched wavevectors) advance behind a single set of barriers. The field
+// kernels advance the twins themselves, in their own cell loop
+
+void FDTD::threaded_phase_E(int ID,int phase)
+{
+    FDTD_PROF_START(t_phase);
+    
+    if(phase==PHASE_MATS_ANTE)
+    {
+        threaded_mats(ID,&FDTD::advMats_ante);
+        for(unsigned int n=0;n<twins.size();n++) twins[n]->threaded_mats(ID,&FDTD::advMats_ante);
+    }
+    else if(phase==PHASE_E_FIELD)
+    {
+        threaded_E_field(ID,zo_s,zo_e);
+    }
+    else if(phase==PHASE_MATS_SIMP)
+    {
+        if(tfsf!=nullptr) tfsf->threaded_E(ID);
+        
+        threaded_mats(ID,&FDTD::advMats_simp);
+        for(unsigned int n=0;n<twins.size();n++) twins[n]->threaded_mats(ID,&FDTD::advMats_simp);
+    }
+    else if(phase==PHASE_MATS_POST)
+    {
+        threaded_mats(ID,&FDTD::advMats_post);
+        for(unsigned int n=0;n<twins.size();n++) twins[n]->threaded_mats(ID,&FDTD::advMats_post);
+    }
+    else if(phase==PHASE_MATS_SELF)
+    {
+        threaded_mats(ID,&FDTD::advMats_self);
+        for(unsigned int n=0;n<twins.size();n++) twins[n]->threaded_mats(ID,&FDTD::advMats_self);
+    }
+    else if(phase==PHASE_PML_E)
+    {
+        threaded_pml_E(ID);
+        for(unsigned int n=0;n<twins.size();n++) twins[n]->threaded_pml_E(ID);
+    }
+    
+    FDTD_PROF_STOP(t_phase,prof_phase_E[phase]);
+}
+
 void FDTD::threaded_process_E(int ID)
 {
+    #ifdef FDTD_PROFILING
+    fdtd_profiler_bind(profiler);
+    #endif
+    
     std::unique_lock<std::mutex> lock(alternator_E.get_thread_mutex(ID));
     
     threads_ready_E[ID]=true;
@@ -39,131 +204,157 @@ void FDTD::threaded_process_E(int ID)
     
     while(allow_run_E)
     {
-        // Materials Ante
-        
-        if(Nx>Nthreads)
-        {
-            advMats_ante((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
-        }
-        else if(ID==0) advMats_ante(0,Nx);
-        
-        alternator_E.signal_main(ID);
-        
-        // E Field
-        
-        alternator_E.thread_wait_ok(ID,lock);
-        
-        int x1=(ID*Nx)/Nthreads; int x2=((ID+1)*Nx)/Nthreads;
-        int y1=(ID*Ny)/Nthreads; int y2=((ID+1)*Ny)/Nthreads;
-        int z1=(ID*Nz)/Nthreads; int z2=((ID+1)*Nz)/Nthreads;
-        
-        if(enable_Ex)
-        {
-                 if(Nz>Nthreads) advEx(0,Nx,0,Ny,z1,z2);
-            else if(Ny>Nthreads) advEx(0,Nx,y1,y2,0,Nz);
-            else if(Nx>Nthreads) advEx(x1,x2,0,Ny,0,Nz);
-            else if(ID==0) advEx(0,Nx,0,Ny,0,Nz);
-        }
-        
-        if(enable_Ey)
-        {
-                 if(Nz>Nthreads) advEy(0,Nx,0,Ny,z1,z2);
-            else if(Ny>Nthreads) advEy(0,Nx,y1,y2,0,Nz);
-            else if(Nx>Nthreads) advEy(x1,x2,0,Ny,0,Nz);
-            else if(ID==0) advEy(0,Nx,0,Ny,0,Nz);
-        }
-        
-        if(enable_Ez)
-        {
-                 if(Nz>Nthreads) advEz(0,Nx,0,Ny,z1,z2);
-            else if(Ny>Nthreads) advEz(0,Nx,y1,y2,0,Nz);
-            else if(Nx>Nthreads) advEz(x1,x2,0,Ny,0,Nz);
-            else if(ID==0) advEz(0,Nx,0,Ny,0,Nz);
-        }
-        
-        alternator_E.signal_main(ID);
-        
-        // Materials Simp
-        
-        alternator_E.thread_wait_ok(ID,lock);
-        
-        if(Nx>Nthreads)
-        {
-            advMats_simp((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
-        }
-        else if(ID==0) advMats_simp(0,Nx);
-        
-        alternator_E.signal_main(ID);
-        
-        // Materials Post
+        // The wait after the last phase is the one of the next loop
         
-        alternator_E.thread_wait_ok(ID,lock);
-        
-        if(Nx>Nthreads)
-        {
-            advMats_post((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
-        }
-        else if(ID==0) advMats_post(0,Nx);
-        
-        alternator_E.signal_main(ID);
-        
-        // Materials Post
-        
-        alternator_E.thread_wait_ok(ID,lock);
-        
-        if(Nx>Nthreads)
-        {
-            advMats_self((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
-        }
-        else if(ID==0) advMats_self(0,Nx);
-        
-        alternator_E.signal_main(ID);
-        
-        // PMLs E
-        
-        alternator_E.thread_wait_ok(ID,lock);
-        
-        if(enable_Ex)
+        for(int phase=PHASE_MATS_ANTE;phase<PHASE_E_END;phase++)
         {
-            if(Nx>Nthreads) app_pml_Ex((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
-            else if(ID==0) app_pml_Ex(0,Nx);
+            threaded_phase_E(ID,phase);
+            
+            alternator_E.signal_main(ID);
+            
+            FDTD_PROF_START(t_wait);
+            alternator_E.thread_wait_ok(ID,lock);
+            FDTD_PROF_STOP(t_wait,FDTD_Profiler::PROF_WAIT);
         }
-        
-        if(enable_Ey)
+    }
+}
+
+// Runs the E phases [p1,p2), the auxiliary grid of the TFSF box being
+// advanced beforehand
+
+void FDTD::run_phases_E(int p1,int p2)
+{
+    if(p1==PHASE_MATS_ANTE && tfsf!=nullptr) tfsf->advance_E();
+    
+    if(inline_run)
+    {
+        for(int phase=p1;phase<p2;phase++) threaded_phase_E(0,phase);
+        return;
+    }
+    
+    std::unique_lock<std::mutex> lock(alternator_E.get_main_mutex());
+    
+    if(p1==PHASE_MATS_ANTE) allow_run_E=true;
+    
+    for(int phase=p1;phase<p2;phase++)
+    {
+        alternator_E.signal_threads();
+        alternator_E.main_wait_threads(lock);
+    }
+    
+    if(p2==PHASE_E_END) allow_run_E=false;
+}
+
+void FDTD::update_H_simp()
+{
+    std::unique_lock<std::mutex> lock(alternator_H.get_main_mutex());
+    
+    allow_run_H=true;
+    
+    alternator_H.signal_threads();
+    
+    alternator_H.main_wait_threads(lock);
+    
+    allow_run_H=false;
+}
+
+// Below this number of cells the sums are done on the calling thread
+static const int reduction_min_cells=16384;
+
+// Serial sum over [n1,n2) along the split direction, which is z
+// for the energy and the x and y planes, and x for the z planes
+double FDTD::reduction_chunk(int type,int n1,int n2) const
+{
+    int i,j,k;
+    
+    double R=0;
+    
+    if(type==REDUCTION_ENERGY)
+    {
+        for(k=n1;k<n2;k++) for(j=0;j<Ny;j++) for(i=0;i<Nx;i++)
+            R+=Ex(i,j,k)*Ex(i,j,k)+Ey(i,j,k)*Ey(i,j,k)+Ez(i,j,k)*Ez(i,j,k);
+    }
+    else if(type==REDUCTION_PX)
+    {
+        for(k=n1;k<n2;k++)
         {
-            if(Ny>Nthreads) app_pml_Ey((ID*Ny)/Nthreads,((ID+1)*Ny)/Nthreads);
-            else if(ID==0) app_pml_Ey(0,Ny);
+            double Rk=0;
+            
+            for(j=red_a1;j<red_a2;j++) Rk+=local_Px(red_pos,j,k);
+            
+            R+=Rk*z_dual(k+z_offset);
         }
-        
-        if(enable_Ez)
+    }
+    else if(type==REDUCTION_PY)
+    {
+        for(k=n1;k<n2;k++)
         {
-            if(Nz>Nthreads) app_pml_Ez((ID*Nz)/Nthreads,((ID+1)*Nz)/Nthreads);
-            else if(ID==0) app_pml_Ez(0,Nz);
+            double Rk=0;
+            
+            for(i=red_a1;i<red_a2;i++) Rk+=local_Py(i,red_pos,k);
+            
+            R+=Rk*z_dual(k+z_offset);
         }
-        
-        alternator_E.signal_main(ID);
-        
-        // Next Loop - Materials Ante
-        
-        alternator_E.thread_wait_ok(ID,lock);
     }
+    else if(type==REDUCTION_PZ)
+    {
+        for(i=n1;i<n2;i++) for(j=red_b1;j<red_b2;j++)
+            R+=local_Pz(i,j,red_pos);
+    }
+    
+    return R;
 }
 
-void FDTD::update_H_simp()
+double FDTD::run_reduction(int type,int a1,int a2,int b1,int b2,int pos) const
 {
+    red_a1=a1; red_a2=a2;
+    red_b1=b1; red_b2=b2;
+    red_pos=pos;
+    
+    int n1=b1,n2=b2;
+    if(type==REDUCTION_PZ) { n1=a1; n2=a2; }
+    
+    int N_cells=(a2-a1)*(b2-b1);
+    if(type==REDUCTION_ENERGY) N_cells*=Ny;
+    
+    // Twins have no workers of their own
+    
+    if(Nthreads<2 || n2-n1<2 || N_cells<reduction_min_cells || threads_H.empty())
+        return reduction_chunk(type,n1,n2);
+    
     std::unique_lock<std::mutex> lock(alternator_H.get_main_mutex());
     
+    reduction_type=type;
     allow_run_H=true;
     
     alternator_H.signal_threads();
-    
     alternator_H.main_wait_threads(lock);
     
     allow_run_H=false;
+    reduction_type=REDUCTION_NONE;
+    
+    for(int step=1;step<Nthreads;step*=2)
+        for(int i=0;i+step<Nthreads;i+=2*step)
+            reduction_part[i]+=reduction_part[i+step];
+    
+    return reduction_part[0];
+}
+
+void FDTD::threaded_reduction(int ID) const
+{
+    int n1=red_b1,n2=red_b2;
+    if(reduction_type==REDUCTION_PZ) { n1=red_a1; n2=red_a2; }
+    
+    reduction_part[ID]=reduction_chunk(reduction_type,n1+(ID*(n2-n1))/Nthreads,
+                                                      n1+((ID+1)*(n2-n1))/Nthreads);
 }
 
 void FDTD::threaded_process_H(int ID)
 {
+    #ifdef FDTD_PROFILING
+    fdtd_profiler_bind(profiler);
+    #endif
+    
     std::unique_lock<std::mutex> lock(alternator_H.get_thread_mutex(ID));
     
     threads_ready_H[ID]=true;
@@ -172,64 +363,199 @@ void FDTD::threaded_process_H(int ID)
     
     while(allow_run_H)
     {
+        if(reduction_type!=REDUCTION_NONE)
+        {
+            FDTD_PROF_START(t_reduction);
+            threaded_reduction(ID);
+            FDTD_PROF_STOP(t_reduction,FDTD_Profiler::PROF_REDUCTION);
+            
+            alternator_H.signal_main(ID);
+            
+            FDTD_PROF_START(t_wait);
+            alternator_H.thread_wait_ok(ID,lock);
+            FDTD_PROF_STOP(t_wait,FDTD_Profiler::PROF_WAIT);
+            
+            continue;
+        }
+        
         // H Field
         
-        int x1=(ID*Nx)/Nthreads; int x2=((ID+1)*Nx)/Nthreads;
-        int y1=(ID*Ny)/Nthreads; int y2=((ID+1)*Ny)/Nthreads;
-        int z1=(ID*Nz)/Nthreads; int z2=((ID+1)*Nz)/Nthreads;
+        FDTD_PROF_START(t_field);
         
-        if(enable_Hx)
+        if(domain==nullptr)
         {
-                 if(Nz>Nthreads) advHx(0,Nx,0,Ny,z1,z2);
-            else if(Ny>Nthreads) advHx(0,Nx,y1,y2,0,Nz);
-            else if(Nx>Nthreads) advHx(x1,x2,0,Ny,0,Nz);
-            else if(ID==0) advHx(0,Nx,0,Ny,0,Nz);
+            threaded_H_field(ID,zo_s,zo_e);
         }
-        
-        if(enable_Hy)
+        else
         {
-                 if(Nz>Nthreads) advHy(0,Nx,0,Ny,z1,z2);
-            else if(Ny>Nthreads) advHy(0,Nx,y1,y2,0,Nz);
-            else if(Nx>Nthreads) advHy(x1,x2,0,Ny,0,Nz);
-            else if(ID==0) advHy(0,Nx,0,Ny,0,Nz);
+            // Planes not depending on the E halos, then the last one
+            
+            threaded_H_field(ID,zo_s,zo_e-1);
+            
+            alternator_H.signal_main(ID);
+            
+            FDTD_PROF_START(t_wait_halos);
+            alternator_H.thread_wait_ok(ID,lock);
+            FDTD_PROF_STOP(t_wait_halos,FDTD_Profiler::PROF_WAIT);
+            
+            threaded_H_field(ID,zo_e-1,zo_e);
         }
         
-        if(enable_Hz)
-        {
-                 if(Nz>Nthreads) advHz(0,Nx,0,Ny,z1,z2);
-            else if(Ny>Nthreads) advHz(0,Nx,y1,y2,0,Nz);
-            else if(Nx>Nthreads) advHz(x1,x2,0,Ny,0,Nz);
-            else if(ID==0) advHz(0,Nx,0,Ny,0,Nz);
-        }
+        FDTD_PROF_STOP(t_field,FDTD_Profiler::PROF_H_FIELD);
         
         alternator_H.signal_main(ID);
         
         // PMLs H
         
+        FDTD_PROF_START(t_wait_pml);
         alternator_H.thread_wait_ok(ID,lock);
+        FDTD_PROF_STOP(t_wait_pml,FDTD_Profiler::PROF_WAIT);
         
-        if(enable_Hx)
-        {
-            if(Nx>Nthreads) app_pml_Hx((ID*Nx)/Nthreads,((ID+1)*Nx)/Nthreads);
-            else if(ID==0) app_pml_Hx(0,Nx);
-        }
+        FDTD_PROF_START(t_pml);
         
-        if(enable_Hy)
-        {
-            if(Ny>Nthreads) app_pml_Hy((ID*Ny)/Nthreads,((ID+1)*Ny)/Nthreads);
-            else if(ID==0) app_pml_Hy(0,Ny);
-        }
+        threaded_pml_H(ID);
+        for(unsigned int n=0;n<twins.size();n++) twins[n]->threaded_pml_H(ID);
         
-        if(enable_Hz)
-        {
-            if(Nz>Nthreads) app_pml_Hz((ID*Nz)/Nthreads,((ID+1)*Nz)/Nthreads);
-            else if(ID==0) app_pml_Hz(0,Nz);
-        }
+        if(tfsf!=nullptr) tfsf->threaded_H(ID);
+        
+        FDTD_PROF_STOP(t_pml,FDTD_Profiler::PROF_PML_H);
         
         alternator_H.signal_main(ID);
         
         // Next Loop - H Field
-                
+        
+        FDTD_PROF_START(t_wait);
         alternator_H.thread_wait_ok(ID,lock);
+        FDTD_PROF_STOP(t_wait,FDTD_Profiler::PROF_WAIT);
     }
 }
+
+void FDTD::run_phases_H()
+{
+    if(inline_run)
+    {
+        FDTD_PROF_START(t_field);
+        
+        threaded_H_field(0,zo_s,zo_e);
+        
+        FDTD_PROF_STOP(t_field,FDTD_Profiler::PROF_H_FIELD);
+        FDTD_PROF_START(t_pml);
+        
+        threaded_pml_H(0);
+        for(unsigned int n=0;n<twins.size();n++) twins[n]->threaded_pml_H(0);
+        
+        if(tfsf!=nullptr) tfsf->threaded_H(0);
+        
+        FDTD_PROF_STOP(t_pml,FDTD_Profiler::PROF_PML_H);
+        
+        return;
+    }
+    
+    std::unique_lock<std::mutex> lock(alternator_H.get_main_mutex());
+    
+    allow_run_H=true;
+        
+    // H Field
+    
+    if(domain==nullptr)
+    {
+        alternator_H.signal_threads();
+        alternator_H.main_wait_threads(lock);
+    }
+    else
+    {
+        // The E halos are in transit while the planes that do not
+        // depend on them are computed, then the last plane follows
+        
+        domain->exchange_start(Ex,Ey,Ez,zo_s,zo_e);
+        
+        alternator_H.signal_threads();
+        
+        lock.unlock();
+        
+        FDTD_PROF_START(t_halos);
+        domain->exchange_finish();
+        FDTD_PROF_STOP(t_halos,FDTD_Profiler::PROF_HALOS);
+        
+        lock.lock();
+        
+        alternator_H.main_wait_threads(lock);
+        
+        alternator_H.signal_threads();
+        alternator_H.main_wait_threads(lock);
+    }
+    
+    // PMLS
+    
+    alternator_H.signal_threads();
+    alternator_H.main_wait_threads(lock);
+    
+    allow_run_H=false;
+}
+
+// Joins the workers for good, the grid being then updated on the calling
+// thread. Meant for grids too small to benefit from them
+
+void FDTD::set_inline()
+{
+    if(domain!=nullptr)
+    {
+        std::cerr<<"Error: decomposed grids cannot be run inline"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    stop_threads();
+    
+    Nthreads=1;
+    inline_run=true;
+}
+
+// Number of workers taking part in the updates, at most the number of
+// spawned ones. The twins are run by the same workers and follow
+
+void FDTD::set_N_threads(int N)
+{
+    if(inline_run) return;
+    
+    N=std::max(1,std::min(N,static_cast<int>(threads_E.size())));
+    
+    alternator_E.set_active_threads(N);
+    alternator_H.set_active_threads(N);
+    
+    Nthreads=N;
+    for(unsigned int n=0;n<twins.size();n++) twins[n]->Nthreads=N;
+}
+
+void FDTD::set_split_axis(int axis)
+{
+    split_axis=axis;
+    for(unsigned int n=0;n<twins.size();n++) twins[n]->split_axis=axis;
+}
+
+void FDTD::stop_threads()
+{
+    if(inline_run) return;
+    
+    allow_run_E=false;
+    allow_run_H=false;
+    
+    // Parked workers have to be woken up too
+    
+    alternator_E.set_active_threads(threads_E.size());
+    alternator_H.set_active_threads(threads_H.size());
+    
+    alternator_E.signal_threads();
+    alternator_H.signal_threads();
+    
+    for(unsigned int i=0;i<threads_E.size();i++)
+    {
+        threads_E[i]->join();
+        threads_H[i]->join();
+        
+        delete threads_E[i];
+        delete threads_H[i];
+    }
+    
+    threads_E.clear();
+    threads_H.clear();
+}
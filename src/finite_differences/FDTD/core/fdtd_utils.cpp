@@ -14,6 +14,7 @@ limitations under the License.*/
 
 #include <bitmap3.h>
 #include <fdtd_core.h>
+#include <fdtd_frames.h>
 #include <filehdl.h>
 #include <string_tools.h>
 
@@ -21,6 +22,28 @@ limitations under the License.*/
 extern const Imdouble Im;
 extern std::ofstream plog;
 
+// Index of the plane nearest to z on a graded mesh, extrapolated with the edge steps
+// outside of it, or on the uniform Dz mesh if there are no steps
+
+int nearest_z_plane(double z,double Dz,std::vector<double> const &z_steps)
+{
+    if(z_steps.empty()) return nearest_integer(z/Dz);
+    
+    int Nz=z_steps.size();
+    
+    if(z<0) return nearest_integer(z/z_steps[0]);
+    
+    double z_acc=0;
+    
+    for(int k=0;k<Nz;k++)
+    {
+        if(z<z_acc+0.5*z_steps[k]) return k;
+        z_acc+=z_steps[k];
+    }
+    
+    return Nz+nearest_integer((z-z_acc)/z_steps[Nz-1]);
+}
+
 //###############
 //     FDTD
 //###############
@@ -116,6 +139,12 @@ void FDTD::bufwrite(Grid3<double> &G,int Nmem,std::string fs)
     file.close();
 }
 
+// Squared E field over the local planes [k1,k2), PMLs included
+double FDTD::compute_energy_E(int k1,int k2) const
+{
+    return run_reduction(REDUCTION_ENERGY,0,Nx,k1,k2,0);
+}
+
 double FDTD::compute_poynting_box(int i1,int i2,int j1,int j2,int k1,int k2) const
 {
     double R=0;
@@ -134,62 +163,17 @@ double FDTD::compute_poynting_box(int i1,int i2,int j1,int j2,int k1,int k2) con
 
 double FDTD::compute_poynting_X(int j1,int j2,int k1,int k2,int pos_x,int sgn) const
 {
-    int i,j,k;
-        
-    double R=0;
-    
-    i=pos_x;
-    
-    for(j=j1;j<j2;j++)
-    {
-        for(k=k1;k<k2;k++)
-        {
-            R+=local_Px(i,j,k);
-        }
-    }
-    
-    R*=sgn*Dy*Dz;
-    return R;
+    return sgn*Dy*run_reduction(REDUCTION_PX,j1,j2,k1,k2,pos_x);
 }
 
 double FDTD::compute_poynting_Y(int i1,int i2,int k1,int k2,int pos_y,int sgn) const
 {
-    int i,j,k;
-    
-    double R=0;
-    
-    j=pos_y;
-    
-    for(i=i1;i<i2;i++)
-    {
-        for(k=k1;k<k2;k++)
-        {
-            R+=local_Py(i,j,k);
-        }
-    }
-    
-    R*=sgn*Dx*Dz;
-    return R;
+    return sgn*Dx*run_reduction(REDUCTION_PY,i1,i2,k1,k2,pos_y);
 }
 
 double FDTD::compute_poynting_Z(int i1,int i2,int j1,int j2,int pos_z,int sgn) const
 {
-    int i,j,k;
-    
-    double R=0;
-    
-    k=pos_z;
-    
-    for(i=i1;i<i2;i++)
-    {
-        for(j=j1;j<j2;j++)
-        {
-            R+=local_Pz(i,j,k);
-        }
-    }
-    
-    R*=sgn*Dx*Dy;
-    return R;
+    return sgn*Dx*Dy*run_reduction(REDUCTION_PZ,i1,i2,j1,j2,pos_z);
 }
 
 void FDTD::draw(int t,int vmode,int pos_x,int pos_y,int pos_z)
@@ -302,88 +286,56 @@ void FDTD::draw(int t,int vmode,int pos_x,int pos_y,int pos_z)
 void FDTD::draw(int t,int vmode,int pos_x,int pos_y,int pos_z,Bitmap *im)
 {
 //    std::unique_lock<std::mutex> lock(im->get_mutex());
-    int i,j,k;
+    Grid2<double> Fx,Fy,Fz;
     
-    using std::abs;
-    using std::exp;
-    using std::max;
+    snapshot(vmode,pos_x,pos_y,pos_z,Fx,Fy,Fz);
+    draw_fields(*im,Fx,Fy,Fz);
+}
+
+// E field on the plane y=pos_y for vmode 0, x=pos_x for vmode 1 and z=pos_z for vmode 2,
+// the slices being resized only when needed so that the frames buffers can be reused
+void FDTD::snapshot(int vmode,int pos_x,int pos_y,int pos_z,
+                    Grid2<double> &Fx,Grid2<double> &Fy,Grid2<double> &Fz) const
+{
+    int i,j,k;
     
-    double max_Ex=1e-80,max_Ey=1e-80,max_Ez=1e-80,max_E=1e-80;
-        
     int span1=Nx,span2=Nz;
     
     if(vmode==1) { span1=Ny; span2=Nz; }
     if(vmode==2) { span1=Nx; span2=Ny; }
     
-    span1=2*span1+4;
-    span2=3*span2+8;
+    if(Fx.L1()!=span1 || Fx.L2()!=span2)
+    {
+        Fx.init(span1,span2,0);
+        Fy.init(span1,span2,0);
+        Fz.init(span1,span2,0);
+    }
     
-    im->set_size(span1,span2);
-        
     if(vmode==0)
     {
         for(i=0;i<Nx;i++) for(k=0;k<Nz;k++)
         {
-            max_Ex=max(max_Ex,abs(Ex(i,pos_y,k)));
-            max_Ey=max(max_Ey,abs(Ey(i,pos_y,k)));
-            max_Ez=max(max_Ez,abs(Ez(i,pos_y,k)));
-        }
-        max_E=max(max_Ex,max(max_Ey,max_Ez));
-        
-        for(i=0;i<Nx;i++) for(k=0;k<Nz;k++)
-        {
-            im->degra(i,k,1.0-exp(-1.0*abs(Ez(i,pos_y,k))),0,1.0);
-            im->degra(i+Nx+4,k,1.0-exp(-1.0*abs(Ez(i,pos_y,k))/max_E),0,1.0);
-            
-            im->degra(i,k+Nz+4,1.0-exp(-1.0*abs(Ey(i,pos_y,k))),0,1.0);
-            im->degra(i+Nx+4,k+Nz+4,1.0-exp(-1.0*abs(Ey(i,pos_y,k))/max_E),0,1.0);
-            
-            im->degra(i,k+2*Nz+8,1.0-exp(-1.0*abs(Ex(i,pos_y,k))),0,1.0);
-            im->degra(i+Nx+4,k+2*Nz+8,1.0-exp(-1.0*abs(Ex(i,pos_y,k))/max_E),0,1.0);
+            Fx(i,k)=Ex(i,pos_y,k);
+            Fy(i,k)=Ey(i,pos_y,k);
+            Fz(i,k)=Ez(i,pos_y,k);
         }
     }
-    if(vmode==1)
+    else if(vmode==1)
     {
         for(j=0;j<Ny;j++) for(k=0;k<Nz;k++)
         {
-            max_Ex=max(max_Ex,abs(Ex(pos_x,j,k)));
-            max_Ey=max(max_Ey,abs(Ey(pos_x,j,k)));
-            max_Ez=max(max_Ez,abs(Ez(pos_x,j,k)));
-        }
-        max_E=max(max_Ex,max(max_Ey,max_Ez));
-        
-        for(j=0;j<Ny;j++) for(k=0;k<Nz;k++)
-        {
-            im->degra(j,k,1.0-exp(-1.0*abs(Ez(pos_x,j,k))),0,1.0);
-            im->degra(j+Ny+4,k,1.0-exp(-1.0*abs(Ez(pos_x,j,k))/max_E),0,1.0);
-            
-            im->degra(j,k+Nz+4,1.0-exp(-1.0*abs(Ey(pos_x,j,k))),0,1.0);
-            im->degra(j+Ny+4,k+Nz+4,1.0-exp(-1.0*abs(Ey(pos_x,j,k))/max_E),0,1.0);
-            
-            im->degra(j,k+2*Nz+8,1.0-exp(-1.0*abs(Ex(pos_x,j,k))),0,1.0);
-            im->degra(j+Ny+4,k+2*Nz+8,1.0-exp(-1.0*abs(Ex(pos_x,j,k))/max_E),0,1.0);
+            Fx(j,k)=Ex(pos_x,j,k);
+            Fy(j,k)=Ey(pos_x,j,k);
+            Fz(j,k)=Ez(pos_x,j,k);
         }
     }
-    if(vmode==2)
+    else if(vmode==2)
     {
         for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
         {
-            max_Ex=max(max_Ex,abs(Ex(i,j,pos_z)));
-            max_Ey=max(max_Ey,abs(Ey(i,j,pos_z)));
-            max_Ez=max(max_Ez,abs(Ez(i,j,pos_z)));
-        }
-        max_E=max(max_Ex,max(max_Ey,max_Ez));
-        
-        for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
-        {
-            im->degra(i,j,1.0-exp(-1.0*abs(Ez(i,j,pos_z))),0,1.0);
-            im->degra(i+Nx+4,j,1.0-exp(-1.0*abs(Ez(i,j,pos_z))/max_E),0,1.0);
-            
-            im->degra(i,j+Ny+4,1.0-exp(-1.0*abs(Ey(i,j,pos_z))),0,1.0);
-            im->degra(i+Nx+4,j+Ny+4,1.0-exp(-1.0*abs(Ey(i,j,pos_z))/max_E),0,1.0);
-            
-            im->degra(i,j+2*Ny+8,1.0-exp(-1.0*abs(Ex(i,j,pos_z))),0,1.0);
-            im->degra(i+Nx+4,j+2*Ny+8,1.0-exp(-1.0*abs(Ex(i,j,pos_z))/max_E),0,1.0);
+            Fx(i,j)=Ex(i,j,pos_z);
+            Fy(i,j)=Ey(i,j,pos_z);
+            Fz(i,j)=Ez(i,j,pos_z);
         }
     }
 }
@@ -435,9 +387,76 @@ void FDTD::find_slab(int sub_ref,int sup_ref,double &hsub,double &hstruc,double
     std::cout<<hsup<<" "<<hsub<<" "<<hstruc<<std::endl;
 }
 
+// Steps of the structure planes, the padding and PMLs keep the edge steps
+
+void FDTD::set_z_steps(std::vector<double> const &steps)
+{
+    if(static_cast<int>(steps.size())!=Nz_s)
+    {
+        std::cerr<<"Error: "<<steps.size()<<" z steps given for "<<Nz_s<<" planes"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    z_step.resize(Nz_glob);
+    
+    for(int k=0;k<Nz_glob;k++)
+    {
+        int n=std::clamp(k-zs_s,0,Nz_s-1);
+        z_step[k]=steps[n];
+    }
+    
+    z_coeffs_calc();
+}
+
+double FDTD::z_cell(int kg) const
+{
+    if(z_step.empty()) return Dz;
+    
+    return z_step[(kg%Nz_glob+Nz_glob)%Nz_glob];
+}
+
+void FDTD::z_coeffs_calc()
+{
+    z_coeff_E.init(Nz,1.0);
+    z_coeff_H.init(Nz,1.0);
+    
+    if(z_step.empty()) return;
+    
+    for(int k=0;k<Nz;k++)
+    {
+        z_coeff_E[k]=Dz/z_dual(k+z_offset);
+        z_coeff_H[k]=Dz/z_cell(k+z_offset);
+    }
+}
+
+// Height of the cell centered on the global plane kg
+
+double FDTD::z_dual(int kg) const
+{
+    return 0.5*(z_cell(kg-1)+z_cell(kg));
+}
+
+double FDTD::z_position(int kg) const
+{
+    if(z_step.empty()) return kg*Dz;
+    
+    double z=0;
+    for(int k=0;k<kg;k++) z+=z_step[k];
+    
+    return z;
+}
+
+// k is a global plane index, and the call is collective on a decomposed grid
+
 double FDTD::get_index(int i,int j,int k) const
 {
-    double eps=mats[matsgrid(i,j,k)].ei;
+    unsigned int M=0;
+    int kl=k-z_offset;
+    
+    if(kl>=zo_s && kl<zo_e) M=matsgrid(i,j,kl);
+    if(domain!=nullptr) domain->sum(M);
+    
+    double eps=mats[M].ei;
     return std::sqrt(eps);
 }
 
@@ -620,6 +639,36 @@ void FDTD::set_matsgrid(Grid3<unsigned int> &GMi_x,Grid3<unsigned int> &GMi_y,Gr
 {
     int i,j,k;
     
+    #ifndef SEP_MATS
+    if(domain!=nullptr)
+    {
+        // Same extension as below, restricted to the local planes
+        
+        for(k=0;k<Nz;k++)
+        {
+            int kg=(k+z_offset+Nz_glob)%Nz_glob;
+            int kc=std::clamp(kg-zs_s,0,Nz_s-1);
+            
+            for(j=0;j<Ny;j++){ for(i=0;i<Nx;i++)
+            {
+                matsgrid(i,j,k)=GMi(std::clamp(i-xs_s,0,Nx_s-1),std::clamp(j-ys_s,0,Ny_s-1),kc);
+            }}
+        }
+        
+        // Material indices are global, whatever the slab holds
+        
+        for(i=0;i<Nx_s;i++){ for(j=0;j<Ny_s;j++){ for(k=0;k<Nz_s;k++)
+        {
+            Nmat=std::max(Nmat,GMi(i,j,k)+1);
+        }}}
+        
+        mats.init(Nmat,FDTD_Material());
+        if(domain->master()) std::cout<<"Number of materials: "<<Nmat<<std::endl;
+        
+        return;
+    }
+    #endif
+    
     if(mode==M_NORMAL || mode==M_EXTRAC || mode==M_OBLIQUE_PHASE || mode==M_PLANAR_GUIDED || mode==M_CUSTOM)
     {
         for(i=xs_s;i<xs_e;i++){ for(j=ys_s;j<ys_e;j++){ for(k=zs_s;k<zs_e;k++)
@@ -853,7 +902,13 @@ bool FDTD::mats_in_grid(unsigned int ind)
 
 void FDTD::set_material(unsigned int ind,Material const &material_)
 {
-    if(mats_in_grid(ind))
+    bool in_grid=mats_in_grid(ind);
+    
+    // Every slab needs the same materials list
+    
+    if(domain!=nullptr) in_grid=domain->any(in_grid);
+    
+    if(in_grid)
     {
         mats[ind].link_fdtd(Dx,Dy,Dz,Dt);
         mats[ind].link_grid(matsgrid,ind);
@@ -33,6 +33,7 @@ limitations under the License.*/
 
 void testlab();
 void scinti();
+int nearest_z_plane(double z,double Dz,std::vector<double> const &z_steps);
 
 template<typename T>
 void grid_extend(Grid3<T> &G,int &Nx,int &Ny,int &Nz,
@@ -15,6 +15,7 @@ limitations under the License.*/
 #include <bitmap3.h>
 #include <fdtd_material.h>
 #include <fdtd_utils.h>
+#include <filehdl.h>
 
 
 extern const Imdouble Im;
@@ -317,6 +318,8 @@ void FDTD_Material::compute_self(int i,int j,int k,
         
         if(i==0 && j==0 && k==100)
         {
+            std::unique_lock<std::mutex> lock(plog_mutex());
+            
 //            plog<<step<<" "<<cN1<<" "<<cN2<<" "<<cN3<<std::endl;
             plog<<step<<" "<<std::log10(cN1)<<" "<<std::log10(cN2)<<" "<<std::log10(cN3)<<std::endl;
 //            plog<<step<<" "<<cN1<<" "<<cN2<<" "<<cN3<<std::endl;
@@ -415,6 +418,18 @@ void FDTD_Material::link_grid(Grid3<unsigned int> const &mat_grid,unsigned int I
     y1=0; y2=Ny-1;
     z1=0; z2=Nz-1;
     
+    // The material can be absent from a slab of a decomposed grid
+    
+    bool found=false;
+    for(k=0;k<Nz;k++) found=found || z_chk[k];
+    
+    if(!found)
+    {
+        x_span=y_span=z_span=0;
+        mat_present.init(1,1,1,false);
+        return;
+    }
+    
     i=0; while(!x_chk[i]) i++; x1=i;
     i=Nx-1; while(!x_chk[i]) i--; x2=i;
     
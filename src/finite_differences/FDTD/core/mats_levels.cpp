@@ -14,6 +14,7 @@ limitations under the License.*/
 
 #include <fdtd_material.h>
 #include <fdtd_utils.h>
+#include <filehdl.h>
 
 
 extern const Imdouble Im;
@@ -434,6 +435,8 @@ void FDTD_Material::AL_post(int i,int j,int k,
     
     if(i==Nx/2+10)
     {
+        std::unique_lock<std::mutex> lock(plog_mutex());
+        
         static int st=0;
         
         static double dnsum=0;
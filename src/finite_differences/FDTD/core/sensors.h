@@ -21,6 +21,9 @@ limitations under the License.*/
 #include <planar_wgd.h>
 #include <bitmap3.h>
 #include <fdtd_core.h>
+#include <fdtd_frames.h>
+
+#include <atomic>
 
 class Source;
 
@@ -61,6 +64,7 @@ class Sensor_generator
         double lambda_min,lambda_max;
         
         int skip;
+        int compression;
         
         bool disable_xm,disable_xp,
              disable_ym,disable_yp,
@@ -71,20 +75,26 @@ class Sensor_generator
         
         void disable_plane(std::string dir);
         void operator = (Sensor_generator const &sens);
+        void set_compression(std::string method);
         void set_name(std::string name);
         void set_orientation(std::string orient_str);
         void set_resolution(int Nfx,int Nfy);
         void set_skip(int skip);
         void set_spectrum(double lambda_min,double lambda_max,int Nl);
         void set_wavelength(double lambda);
-        void to_discrete(double Dx,double Dy,double Dz);
+        void to_discrete(double Dx,double Dy,double Dz,std::vector<double> const &z_steps);
 };
 
 //############
 //   Sensor   
 //############
 
-class Sensor
+// The per-step transforms are queued on the shared pool by deep_feed under
+// the group of the sensor, so that the work of all the sensors runs
+// concurrently, and advance() moves the time step once the groups have been
+// waited on.
+
+class Sensor: public PoolTask
 {
     public:
         int Nx,Ny,Nz,Nt;
@@ -112,27 +122,42 @@ class Sensor
         std::string name;
         
         int sensor_ID;
-        static int sensor_ID_next;
+        static std::atomic<int> sensor_ID_next;
         
         bool disable_xm,disable_xp;
         bool disable_ym,disable_yp;
         bool disable_zm,disable_zp;
         
-        // Threading
+        // Decomposition: the global planes [zd_s,zd_e) are held by this
+        // process, plane k being stored at k-z_offset in the FDTD grids
+        
+        FDTD_Domain *domain;
+        int z_offset,zd_s,zd_e;
+        
+        // Graded z: heights of the cells centered on the global planes
+        // and positions of the planes, both empty on a uniform mesh
+        
+        std::vector<double> z_height,z_coord;
+        
+        // Number of chunks the transforms are split in
         
-        bool process_threads;
         unsigned int Nthreads;
-        ThreadsAlternator alternator;
-        std::vector<std::thread*> threads;
-        std::vector<bool> threads_ready;
+        PoolGroup pool_group;
         
         Sensor();
         virtual ~Sensor();
         
+        virtual void advance();
+        virtual void checkpoint(Checkpoint &chk);
         void feed(FDTD const &fdtd);
         virtual void deep_feed(FDTD const &fdtd);
+        virtual void deep_reduce();
+        int held_z1() const;
+        int held_z2() const;
         virtual void initialize();
         virtual void link(FDTD const &fdtd);
+        bool owns(int k) const;
+        void reduce();
         void set_reference_source(Source *reference_src);
         void set_loc(int x1,int x2,int y1,int y2,int z1,int z2);
         void set_silent(bool silent);
@@ -158,13 +183,14 @@ class SensorFieldHolder: public Sensor
                           int y1,int y2,
                           int z1,int z2,
                           bool interpolate);
-        ~SensorFieldHolder();
         
+        virtual void checkpoint(Checkpoint &chk);
         virtual void deep_feed(FDTD const &fdtd);
+        virtual void deep_reduce();
         void FT_comp(int l1,int l2);
         virtual void initialize();
         virtual void link(FDTD const &fdtd);
-        void threaded_computation(unsigned int ID);
+        void pool_run(int chunk,int Nchunks);
         virtual void treat();
         void update_t(FDTD const &fdtd);
         void update_t_interp(FDTD const &fdtd);
@@ -199,6 +225,7 @@ class CompletionSensor: public Sensor
         CompletionSensor(double coeff);
         CompletionSensor(double lambda_min,double lambda_max,double coeff,int Np,std::string const &layout);
         
+        void checkpoint(Checkpoint &chk);
         bool completion_check();
         void deep_feed(FDTD const &fdtd);
         int estimate();
@@ -260,6 +287,8 @@ class FarFieldSensor: public SensorFieldHolder
         void treat();
 };
 
+class FieldBlockWriter;
+
 class FieldBlock: public Sensor
 {
     public:
@@ -267,11 +296,15 @@ class FieldBlock: public Sensor
         Grid3<unsigned int> mats;
         Grid3<Imdouble> Ex,Ey,Ez,Hx,Hy,Hz;
         
-        FieldBlock(int x1,int x2,int y1,int y2,int z1,int z2);
+        int compression;
+        FieldBlockWriter *writer;
         
+        FieldBlock(int x1,int x2,int y1,int y2,int z1,int z2,int compression=0);
         ~FieldBlock();
         
+        void checkpoint(Checkpoint &chk);
         void deep_feed(FDTD const &fdtd);
+        void deep_reduce();
         void FT_Ex(int i1,int i2,Imdouble const &tcoeff);
         void FT_Ey(int i1,int i2,Imdouble const &tcoeff);
         void FT_Ez(int i1,int i2,Imdouble const &tcoeff);
@@ -279,7 +312,7 @@ class FieldBlock: public Sensor
         void FT_Hy(int i1,int i2,Imdouble const &tcoeff);
         void FT_Hz(int i1,int i2,Imdouble const &tcoeff);
         void initialize();
-        void threaded_computation(unsigned int ID);
+        void pool_run(int chunk,int Nchunks);
         void treat();
 };
 
@@ -297,14 +330,14 @@ class FieldMap: public Sensor
                  int y1,int y2,
                  int z1,int z2);
         
-        ~FieldMap();
-        
+        void checkpoint(Checkpoint &chk);
         void deep_feed(FDTD const &fdtd);
+        void deep_reduce();
         void initialize();
         void FT_compute(int j1,int j2);
+        void pool_run(int chunk,int Nchunks);
         void set_cumulative(bool c=true);
         void set_mag_map(bool c=true);
-        void threaded_computation(unsigned int ID);
         void treat();
 };
 
@@ -345,7 +378,9 @@ class MovieSensor: public Sensor
         int skip;
         
         Grid2<double> f_x,f_y,f_z;
-        Bitmap image;
+        Frame_Writer writer;
+        
+        double held_value(Grid3<double> const &F,int i,int j,int k) const;
         
     public:
         MovieSensor(int type,
@@ -424,11 +459,15 @@ class Box_Spect_Poynting: public Sensor
                            int y1,int y2,
                            int z1,int z2);
                            
+        void advance();
+        void checkpoint(Checkpoint &chk);
         void deep_feed(FDTD const &fdtd);
+        void deep_reduce();
         void link(FDTD const &fdtd);
         void treat();
 };
 
+void feed_sensors(std::vector<Sensor*> const &sensors,FDTD const &fdtd);
 Sensor* generate_fdtd_sensor(Sensor_generator const &gen,FDTD const &fdtd);
 
 #endif // SENSORS_H
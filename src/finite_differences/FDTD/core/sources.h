@@ -52,7 +52,7 @@ class Source_generator
         Source_generator(Source_generator const &src);
         
         void operator = (Source_generator const &src);
-        void to_discrete(double Dx,double Dy,double Dz);
+        void to_discrete(double Dx,double Dy,double Dz,std::vector<double> const &z_steps);
         void set_guided_target(double lambda_target,double nr_target,double ni_target);
         void set_polarization(std::string polarization);
         void set_spectrum(double lambda_min,double lambda_max);
@@ -75,6 +75,10 @@ class Source
         int x1,x2,y1,y2,z1,z2;
         int span1,span2,span3;
         
+        // Decomposition: planes [zl_s,zl_e) are held locally
+        
+        int z_offset,zl_s,zl_e;
+        
         int Nl;
         double lambda_min,lambda_max;
         std::vector<double> lambda,w,Sp;
@@ -93,6 +97,7 @@ class Source
                int z1,int z2);
         virtual ~Source();
         
+        virtual void checkpoint(Checkpoint &chk);
         void inject_E(FDTD &fdtd);
         void inject_H(FDTD &fdtd);
         
@@ -102,6 +107,8 @@ class Source
         
         virtual void initialize();
         void link(FDTD const &fdtd);
+        int local_z1() const;
+        int local_z2() const;
         
         void expand_spectrum_gaussian(double pw_edge,double threshold,int Nl=0);
         void expand_spectrum_S(double factor,int Nl=0);
@@ -120,14 +127,24 @@ class AFP_TFSF: public Source
         Grid3<unsigned int> matsgrid;
         Grid2<Imdouble> Ex,Ey,Ez,Hx,Hy,Hz;
         
+        // Injected waveforms for each step: Hx and Hy below the upper
+        // then the lower plane in wave_H, Ex and Ey on them in wave_E,
+        // and the spectral weights they are summed with
+        
+        Grid2<double> wave_E,wave_H;
+        std::vector<double> amp,amp_H1;
+        
         AFP_TFSF();
         ~AFP_TFSF();
         
+        void checkpoint(Checkpoint &chk);
         void deep_inject_E(FDTD &fdtd);
         void deep_inject_H(FDTD &fdtd);
         void deep_link(FDTD const &fdtd);
         void initialize();
         void set_matsgrid(Grid3<unsigned int> const &G);
+        void tabulate();
+        void wave_at(int t,double *inj_E,double *inj_H) const;
 };
 
 class Bloch_Monochromatic: public Source
@@ -148,10 +165,16 @@ class Bloch_Wideband: public Source
         Grid1<double> kn,kz,Sp;
         Grid1<Vector3> E_base,H_base;
         
+        // Injected waveforms for each step and in-plane Bloch phases
+        
+        std::vector<Imdouble> wave_Ex,wave_Ey,wave_Hx,wave_Hy;
+        Grid2<Imdouble> phase_x,phase_y;
+        
         Bloch_Wideband(int x1,int x2,int y1,int y2,int z1,int z2,
                        double kx,double ky,AngleRad polar);
         ~Bloch_Wideband();
         
+        void checkpoint(Checkpoint &chk);
         void deep_link(FDTD const &fdtd);
         void get_E(Grid2<double> &Ex,
                    Grid2<double> &Ey,
@@ -161,6 +184,10 @@ class Bloch_Wideband: public Source
         void inject_E(FDTD &real_fdtd,FDTD &imag_fdtd);
         void inject_H(FDTD &real_fdtd,FDTD &imag_fdtd);
         void set_cut_angle(AngleRad const &safe_angle,AngleRad const &cut_angle);
+        void tabulate(std::vector<Imdouble> &wave_x,std::vector<Imdouble> &wave_y,
+                      Grid1<Vector3> const &base,double z,double t_shift);
+        void wave_at(Imdouble &wave_x,Imdouble &wave_y,
+                     Grid1<Vector3> const &base,double z,double t_shift,int n) const;
 };
 
 class Electric_Dipole: public Source
@@ -209,6 +236,7 @@ class Guided_planar: public Source
                       int polar,double lambda_target,double nr_target,double ni_target);
         ~Guided_planar();
         
+        void checkpoint(Checkpoint &chk);
         void deep_inject_E(FDTD &fdtd);
         void deep_inject_H(FDTD &fdtd);
         void deep_link(FDTD const &fdtd);
@@ -229,6 +257,7 @@ class Oscillator: public Source
                    int z1,int z2);
         ~Oscillator();
         
+        void checkpoint(Checkpoint &chk);
         void deep_inject_E(FDTD &fdtd);
         void initialize();
 };
@@ -247,6 +276,7 @@ class MR_Oscillator: public Source
                       std::string generator_fname);
         ~MR_Oscillator();
         
+        void checkpoint(Checkpoint &chk);
         void deep_inject_E(FDTD &fdtd);
         void initialize();
 };
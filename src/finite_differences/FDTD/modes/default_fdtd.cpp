@@ -15,12 +15,94 @@ limitations under the License.*/
 #include <bitmap3.h>
 #include <data_hdl.h>
 #include <fdtd_core.h>
+#include <fdtd_frames.h>
+#include <fdtd_profiler.h>
 #include <lua_fdtd.h>
+#include <string_tools.h>
+
+#include <sstream>
+#include <typeinfo>
 
 extern const Imdouble Im;
 
 extern std::ofstream plog;
 
+// Description of everything a checkpoint depends on: grid, material
+// models, subgrids, and the kind of every sensor and source
+
+static std::string default_fdtd_layout(FDTD const &fdtd,
+                                       std::vector<Sensor*> const &sensors,
+                                       std::vector<Source*> const &sources)
+{
+    std::stringstream strm;
+    
+    strm<<fdtd.Nx<<" "<<fdtd.Ny<<" "<<fdtd.Nz<<" "<<fdtd.subgrids.size()<<"\n";
+    
+    for(int m=0;m<fdtd.mats.L1();m++)
+    {
+        FDTD_Material const &mat=fdtd.mats[m];
+        
+        strm<<"mat "<<mat.m_type<<" "<<mat.Np<<" "<<mat.Np_r<<" "<<mat.Np_c<<"\n";
+    }
+    
+    for(unsigned int i=0;i<sensors.size();i++)
+        strm<<"sens "<<typeid(*sensors[i]).name()<<" "<<sensors[i]->type<<"\n";
+    
+    for(unsigned int i=0;i<sources.size();i++)
+        strm<<"src "<<typeid(*sources[i]).name()<<" "<<sources[i]->type<<"\n";
+    
+    return strm.str();
+}
+
+// Whole simulation state, preceded by a layout header that is checked
+// before anything gets overwritten on restore
+
+bool default_fdtd_checkpoint(Checkpoint &chk,FDTD &fdtd,
+                             std::vector<Sensor*> &sensors,std::vector<Source*> &sources)
+{
+    std::string layout=default_fdtd_layout(fdtd,sensors,sources);
+    std::string const layout_ref=layout;
+    
+    chk.sync(layout);
+    
+    if(!chk.valid || layout!=layout_ref)
+    {
+        chk.valid=false;
+        return false;
+    }
+    
+    fdtd.checkpoint(chk);
+    
+    for(unsigned int i=0;i<sources.size();i++) sources[i]->checkpoint(chk);
+    for(unsigned int i=0;i<sensors.size();i++) sensors[i]->checkpoint(chk);
+    
+    return chk.valid;
+}
+
+// Restores the state saved in fname. The fresh state is kept aside first,
+// so that a file failing halfway through leaves the simulation as if
+// nothing had been loaded
+
+bool default_fdtd_resume(std::filesystem::path const &fname,FDTD &fdtd,
+                         std::vector<Sensor*> &sensors,std::vector<Source*> &sources)
+{
+    Checkpoint chk;
+    
+    if(!chk.load(fname)) return false;
+    
+    Checkpoint backup;
+    
+    backup.start_saving();
+    default_fdtd_checkpoint(backup,fdtd,sensors,sources);
+    
+    if(default_fdtd_checkpoint(chk,fdtd,sensors,sources)) return true;
+    
+    backup.start_loading();
+    default_fdtd_checkpoint(backup,fdtd,sensors,sources);
+    
+    return false;
+}
+
 void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computation,ProgTimeDisp *dsp_,Bitmap *bitmap_)
 {
     int t;
@@ -39,12 +121,35 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     fdtd_mode.structure->retrieve_nominal_size(lx,ly,lz);
     fdtd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
+    // Graded z mesh, Dz staying the reference step of the coefficients
+    
+    std::vector<double> z_steps;
+    fdtd_mode.compute_z_steps(z_steps,lz);
+    
+    double Dz_min=Dz;
+    
+    if(!z_steps.empty())
+    {
+        Nz=z_steps.size();
+        Dz_min=*std::min_element(z_steps.begin(),z_steps.end());
+        
+        std::cout<<"Graded z mesh: "<<Nz<<" planes, steps from "<<add_unit_u(Dz_min)
+                 <<" to "<<add_unit_u(*std::max_element(z_steps.begin(),z_steps.end()))<<std::endl;
+    }
+    
     Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdtd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    std::vector<Material> grid_materials;
+    
+    if(z_steps.empty()) fdtd_mode.discretize(matsgrid,grid_materials,Nx,Ny,Nz);
+    else fdtd_mode.discretize(matsgrid,grid_materials,Nx,Ny,z_steps);
     
     
     std::cout<<"B"<<std::endl;
-    double Dt=std::min(std::min(Dx,Dy),Dz)/(std::sqrt(3.0)*c_light)*0.99*fdtd_mode.time_mod;
+    double Dt=std::min(std::min(Dx,Dy),Dz_min)/(std::sqrt(3.0)*c_light)*0.99*fdtd_mode.time_mod;
+    
+    // Split into z-slabs when launched on several processes
+    
+    FDTD_Domain domain;
     
     FDTD fdtd(Nx,Ny,Nz,Nt,Dx,Dy,Dz,Dt,"CUSTOM",
               fdtd_mode.pml_xm,fdtd_mode.pml_xp,
@@ -52,7 +157,12 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
               fdtd_mode.pml_zm,fdtd_mode.pml_zp,
               fdtd_mode.pad_xm,fdtd_mode.pad_xp,
               fdtd_mode.pad_ym,fdtd_mode.pad_yp,
-              fdtd_mode.pad_zm,fdtd_mode.pad_zp);
+              fdtd_mode.pad_zm,fdtd_mode.pad_zp,
+              domain.Nranks>1 ? &domain : nullptr);
+    
+    bool master=domain.master();
+    
+    if(!z_steps.empty()) fdtd.set_z_steps(z_steps);
     
     // PML
     
@@ -63,6 +173,7 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     fdtd.set_pml_zm(fdtd_mode.kappa_zm,fdtd_mode.sigma_zm,fdtd_mode.alpha_zm);
     fdtd.set_pml_zp(fdtd_mode.kappa_zp,fdtd_mode.sigma_zp,fdtd_mode.alpha_zp);
     
+    fdtd.set_directory(fdtd_mode.directory);
     fdtd.set_prefix(fdtd_mode.prefix);
     fdtd.set_tapering(fdtd_mode.tapering);
     
@@ -78,8 +189,8 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     for(unsigned int m=0;m<fdtd_mode.materials_str.size();m++)
         fdtd.set_material(fdtd_mode.materials_index[m],fdtd_mode.materials_str[m]);
     #endif
-    for(unsigned int m=0;m<fdtd_mode.materials.size();m++)
-        fdtd.set_material(m,fdtd_mode.materials[m]);
+    for(unsigned int m=0;m<grid_materials.size();m++)
+        fdtd.set_material(m,grid_materials[m]);
     
     // Disabling fields
     
@@ -90,6 +201,7 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     std::cout<<"Computing"<<std::endl;
     
     fdtd.bootstrap();
+    if(fdtd_mode.autotune_steps>0) fdtd.autotune(fdtd_mode.autotune_steps);
     
     std::vector<Sensor*> sensors;
     std::vector<Source*> sources;
@@ -135,6 +247,7 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
     
     ProgTimeDisp *dspt=nullptr;
     Bitmap *bitmap=nullptr;
+    Frame_Writer *frame_writer=nullptr;
     
     if(dsp_!=nullptr)
     {
@@ -152,45 +265,98 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
         if(fdtd_mode.display_step>0) N_disp=fdtd_mode.display_step;
         else N_disp=100;
     }
-    else bitmap=new Bitmap(512,512);
+    else if(master) frame_writer=new Frame_Writer;
+    
+    // Checkpoints
+    
+    int t_start=0;
+    
+    Checkpoint chk_state;
+    Checkpoint_Writer *chk_writer=nullptr;
+    
+    std::string checkpoint_fname=fdtd_mode.checkpoint_fname,
+                resume_fname=fdtd_mode.resume_fname;
+    
+    if(fdtd.domain!=nullptr)
+    {
+        std::string rank_sfx="_"+std::to_string(domain.rank);
+        
+        if(!checkpoint_fname.empty()) checkpoint_fname+=rank_sfx;
+        if(!resume_fname.empty()) resume_fname+=rank_sfx;
+    }
+    
+    if(!resume_fname.empty())
+    {
+        if(default_fdtd_resume(resume_fname,fdtd,sensors,sources))
+        {
+            t_start=fdtd.tstep;
+            std::cout<<"Resuming from time step "<<t_start<<std::endl;
+        }
+        else std::cout<<"Could not resume from "<<resume_fname<<", starting from scratch"<<std::endl;
+    }
+    
+    if(fdtd.domain!=nullptr)
+    {
+        double t_max=t_start,t_min=-t_start;
+        
+        domain.max(t_max);
+        domain.max(t_min);
+        
+        if(t_max!=-t_min)
+        {
+            std::cerr<<"Error: the slabs could not all resume from the same time step"<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    
+    if(fdtd_mode.checkpoint_step>0 && !checkpoint_fname.empty())
+        chk_writer=new Checkpoint_Writer;
     
     // Main Loop
     
-    for(t=0;t<Nt;t++)
+    for(t=t_start;t<Nt;t++)
     {
         // E-field
         fdtd.update_E();
         
         // E-field injection
         
+        FDTD_PROF_START(t_inj_E);
+        
         for(unsigned int i=0;i<sources.size();i++)
             sources[i]->inject_E(fdtd);
         
+        FDTD_PROF_STOP(t_inj_E,FDTD_Profiler::PROF_SOURCES);
+        
         // H-field
         fdtd.update_H();
         
-        for(unsigned int i=0;i<sensors.size();i++)
-            sensors[i]->feed(fdtd);
+        feed_sensors(sensors,fdtd);
         
         // H-field injection
         
+        FDTD_PROF_START(t_inj_H);
+        
         for(unsigned int i=0;i<sources.size();i++)
             sources[i]->inject_H(fdtd);
         
-        if(t%N_disp==0)
+        FDTD_PROF_STOP(t_inj_H,FDTD_Profiler::PROF_SOURCES);
+        
+        if(master && t%N_disp==0)
         {
             int vmode=0;
-            fdtd.draw(t,vmode,Nx/2,Ny/2,Nz/2,bitmap);
             
-            if(bitmap_==nullptr)
-            {                
-                std::stringstream K;
-                K<<"render/render";
-                K<<t;
-                K<<".png";
+            if(frame_writer!=nullptr)
+            {
+                Frame &frame=frame_writer->acquire();
+                
+                frame.type=Frame::FRAME_RENDER;
+                frame.fname="render/render"+std::to_string(t)+".png";
+                fdtd.snapshot(vmode,Nx/2,Ny/2,Nz/2,frame.Fx,frame.Fy,frame.Fz);
                 
-                bitmap->write(K.str());
+                frame_writer->submit(frame);
             }
+            else fdtd.draw(t,vmode,Nx/2,Ny/2,Nz/2,bitmap);
         }
         
         if(time_type!=TIME_FIXED && t%cc_step==0)
@@ -201,12 +367,27 @@ void mode_default_fdtd(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computa
             dspt->set_end(Nt_est);
         }
         
+        if(chk_writer!=nullptr && (t+1)%fdtd_mode.checkpoint_step==0)
+        {
+            chk_state.start_saving();
+            default_fdtd_checkpoint(chk_state,fdtd,sensors,sources);
+            chk_writer->submit(chk_state,checkpoint_fname);
+        }
+        
         if(end_computation!=nullptr && *end_computation) break;
         
         ++(*dspt);
     }
     
-    for(unsigned int i=0;i<sensors.size();i++) sensors[i]->treat();
+    delete chk_writer;
+    delete frame_writer;
+    
+    // Partial results are gathered on the master, which writes them
+    
+    for(unsigned int i=0;i<sensors.size();i++) sensors[i]->reduce();
+    
+    if(master)
+        for(unsigned int i=0;i<sensors.size();i++) sensors[i]->treat();
     
     for(unsigned int i=0;i<sensors.size();i++) delete sensors[i];
     for(unsigned int i=0;i<sources.size();i++) delete sources[i];
@@ -0,0 +1,375 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <lua_fdtd.h>
+#include <mathUT.h>
+#include <thread_utils.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+//#########################
+//     FDTD Sweep Mode
+//#########################
+
+// Each point of the parameter grid is an independent FDTD run. The runs are
+// prepared serially, as they may call Lua, and then executed concurrently,
+// each with a number of threads proportional to its size
+
+FDTD_Sweep_Mode::FDTD_Sweep_Mode()
+    :cells_per_thread(50000), max_jobs(0),
+     directory("sweep"),
+     fdtd_template(nullptr),
+     Nthr_free(0), Njobs_running(0)
+{
+}
+
+void FDTD_Sweep_Mode::add_parameter(std::string const &name,std::vector<double> const &values)
+{
+    bool found=false;
+    std::size_t k=vector_locate(found,parameter_name,name);
+    
+    if(found) parameter_values[k]=values;
+    else
+    {
+        parameter_name.push_back(name);
+        parameter_values.push_back(values);
+    }
+}
+
+void FDTD_Sweep_Mode::clear_jobs()
+{
+    // The structures coming from the script go back to their own state,
+    // which also drops the discretization they kept for the jobs
+    
+    std::map<Structure*,bool>::iterator it_flag;
+    
+    for(it_flag=shared_flags.begin();it_flag!=shared_flags.end();++it_flag)
+        it_flag->first->set_shared(it_flag->second);
+    
+    for(std::size_t n=0;n<jobs.size();n++)
+        delete jobs[n].mode;
+    
+    std::map<std::vector<double>,Structure*>::iterator it;
+    
+    for(it=structures.begin();it!=structures.end();++it)
+        delete it->second;
+    
+    jobs.clear();
+    structures.clear();
+    shared_flags.clear();
+}
+
+void FDTD_Sweep_Mode::share_structure(Structure *structure)
+{
+    if(shared_flags.find(structure)==shared_flags.end())
+        shared_flags[structure]=structure->get_shared();
+    
+    structure->set_shared(true);
+}
+
+// Jobs sharing the same geometry parameters share the same structure,
+// which is then only rasterized once
+
+void FDTD_Sweep_Mode::prepare(lua_State *L,int setup_index)
+{
+    if(fdtd_template==nullptr || fdtd_template->structure==nullptr)
+    {
+        std::cerr<<"Error: the sweep requires an FDTD mode with a structure"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    clear_jobs();
+    
+    std::size_t p,Np=parameter_name.size();
+    
+    Structure *base_structure=fdtd_template->structure;
+    
+    share_structure(base_structure);
+    
+    std::vector<std::size_t> geometry;
+    
+    for(p=0;p<Np;p++)
+    {
+        bool found=false;
+        vector_locate(found,base_structure->parameter_name,parameter_name[p]);
+        
+        if(found) geometry.push_back(p);
+    }
+    
+    int Njobs=1;
+    for(p=0;p<Np;p++) Njobs*=parameter_values[p].size();
+    
+    int Nthr_max=max_threads_number();
+    
+    jobs.resize(Njobs);
+    
+    for(int n=0;n<Njobs;n++)
+    {
+        FDTD_Sweep_Job &job=jobs[n];
+        
+        job.ID=n;
+        job.time=0;
+        job.values.resize(Np);
+        
+        // The first parameter varies the fastest
+        
+        int r=n;
+        
+        for(p=0;p<Np;p++)
+        {
+            int Nv=parameter_values[p].size();
+            
+            job.values[p]=parameter_values[p][r%Nv];
+            r/=Nv;
+        }
+        
+        job.mode=new FDTD_Mode(*fdtd_template);
+        job.mode->directory=directory/("job_"+std::to_string(n));
+        
+        if(!geometry.empty())
+        {
+            std::vector<double> key(geometry.size());
+            for(std::size_t g=0;g<geometry.size();g++) key[g]=job.values[geometry[g]];
+            
+            if(structures.find(key)==structures.end())
+            {
+                Structure *structure=new Structure(base_structure->get_script_path());
+                
+                structure->parameter_name=base_structure->parameter_name;
+                structure->parameter_value=base_structure->parameter_value;
+                
+                for(std::size_t g=0;g<geometry.size();g++)
+                {
+                    std::size_t k=vector_locate(structure->parameter_name,parameter_name[geometry[g]]);
+                    structure->parameter_value[k]=key[g];
+                }
+                
+                structure->set_cache_directory(base_structure->get_cache_directory());
+                structure->set_shared(true);
+                structure->finalize();
+                
+                structures[key]=structure;
+            }
+            
+            job.mode->structure=structures[key];
+        }
+        
+        if(setup_index>0)
+        {
+            lua_pushvalue(L,setup_index);
+            lua_set_metapointer<FDTD_Mode>(L,"metatable_fdtd",job.mode);
+            
+            lua_newtable(L);
+            
+            for(p=0;p<Np;p++)
+            {
+                lua_pushnumber(L,job.values[p]);
+                lua_setfield(L,-2,parameter_name[p].c_str());
+            }
+            
+            lua_pushinteger(L,n);
+            lua_call(L,3,0);
+            
+            // In case the setup function assigned a structure of its own
+            share_structure(job.mode->structure);
+        }
+        
+        int Nx,Ny,Nz;
+        double lx,ly,lz;
+        
+        FDTD_Mode const &mode=*job.mode;
+        
+        mode.structure->retrieve_nominal_size(lx,ly,lz);
+        mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
+        
+        job.cells= static_cast<double>(Nx+mode.pad_xm+mode.pad_xp+mode.pml_xm+mode.pml_xp)
+                  *(Ny+mode.pad_ym+mode.pad_yp+mode.pml_ym+mode.pml_yp)
+                  *(Nz+mode.pad_zm+mode.pad_zp+mode.pml_zm+mode.pml_zp);
+        
+        job.Nthr=static_cast<int>(std::ceil(job.cells/std::max(cells_per_thread,1)));
+        job.Nthr=std::clamp(job.Nthr,1,Nthr_max);
+    }
+}
+
+// Largest jobs first, smaller ones filling the remaining threads
+
+void FDTD_Sweep_Mode::process()
+{
+    int Njobs=jobs.size();
+    
+    if(Njobs==0) return;
+    
+    // The concurrent runs each build their own domain, so MPI has to be
+    // brought up here on the main thread, and the z-slab splitting cannot
+    // be shared between simultaneous runs
+    
+    FDTD_Domain world;
+    
+    if(world.Nranks>1)
+    {
+        std::cerr<<"Error: FDTD sweeps cannot be distributed over several MPI processes"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    std::vector<int> pending(Njobs);
+    for(int n=0;n<Njobs;n++) pending[n]=n;
+    
+    for(int n=1;n<Njobs;n++)
+        for(int m=n;m>0 && jobs[pending[m]].cells>jobs[pending[m-1]].cells;m--)
+            std::swap(pending[m],pending[m-1]);
+    
+    std::error_code err;
+    std::filesystem::create_directories(directory,err);
+    
+    results.open(directory/"sweep.txt",std::ios::out|std::ios::trunc);
+    
+    results<<"# job threads cells time";
+    for(std::size_t p=0;p<parameter_name.size();p++) results<<" "<<parameter_name[p];
+    results<<std::endl;
+    
+    Nthr_free=max_threads_number();
+    Njobs_running=0;
+    
+    int Njobs_max=max_jobs>0 ? max_jobs : Nthr_free;
+    
+    std::cout<<"Sweeping "<<Njobs<<" FDTD runs on "<<Nthr_free<<" threads"<<std::endl;
+    
+    std::vector<std::thread*> threads;
+    std::unique_lock<std::mutex> lock(sweep_mutex);
+    
+    while(!pending.empty())
+    {
+        std::size_t k=0;
+        
+        while(k<pending.size() && jobs[pending[k]].Nthr>Nthr_free) k++;
+        
+        if(k==pending.size() || Njobs_running>=Njobs_max)
+        {
+            sweep_cv.wait(lock);
+            continue;
+        }
+        
+        int n=pending[k];
+        pending.erase(pending.begin()+k);
+        
+        Nthr_free-=jobs[n].Nthr;
+        Njobs_running++;
+        
+        threads.push_back(new std::thread(&FDTD_Sweep_Mode::run_job,this,n));
+    }
+    
+    lock.unlock();
+    
+    for(std::size_t t=0;t<threads.size();t++)
+    {
+        threads[t]->join();
+        delete threads[t];
+    }
+    
+    results.close();
+    clear_jobs();
+    
+    std::cout<<"Sweep results written to "<<(directory/"sweep.txt").generic_string()<<std::endl;
+}
+
+void FDTD_Sweep_Mode::run_job(int n)
+{
+    FDTD_Sweep_Job &job=jobs[n];
+    
+    set_thread_budget(job.Nthr);
+    
+    std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+    
+    job.mode->process();
+    
+    job.time=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    
+    std::unique_lock<std::mutex> lock(sweep_mutex);
+    
+    results<<job.ID<<" "<<job.Nthr<<" "<<job.cells<<" "<<job.time;
+    for(std::size_t p=0;p<job.values.size();p++) results<<" "<<job.values[p];
+    results<<std::endl;
+    
+    std::cout<<"Sweep job "<<job.ID<<" done in "<<job.time<<" s on "<<job.Nthr<<" threads"<<std::endl;
+    
+    Nthr_free+=job.Nthr;
+    Njobs_running--;
+    
+    lock.unlock();
+    sweep_cv.notify_all();
+}
+
+void FDTD_Sweep_Mode::set_cells_per_thread(int N) { cells_per_thread=std::max(N,1); }
+void FDTD_Sweep_Mode::set_max_jobs(int N) { max_jobs=std::max(N,0); }
+void FDTD_Sweep_Mode::set_output_directory(std::string dir) { directory=dir; }
+
+//##################
+//     Bindings
+//##################
+
+void FDTD_Sweep_Mode_create_metatable(lua_State *L)
+{
+    create_obj_metatable(L,"metatable_fdtd_sweep");
+    
+    lua_wrapper<1,FDTD_Sweep_Mode,int>::bind(L,"cells_per_thread",&FDTD_Sweep_Mode::set_cells_per_thread);
+    metatable_add_func(L,"compute",FDTD_sweep_compute);
+    metatable_add_func(L,"fdtd",FDTD_sweep_set_fdtd);
+    lua_wrapper<2,FDTD_Sweep_Mode,int>::bind(L,"max_jobs",&FDTD_Sweep_Mode::set_max_jobs);
+    lua_wrapper<3,FDTD_Sweep_Mode,std::string>::bind(L,"output_directory",&FDTD_Sweep_Mode::set_output_directory);
+    metatable_add_func(L,"parameter",FDTD_sweep_set_parameter);
+}
+
+// Optional setup function, called as setup(fdtd,parameters,job_index)
+// before the runs start
+
+int FDTD_sweep_compute(lua_State *L)
+{
+    FDTD_Sweep_Mode *p_sweep=lua_get_metapointer<FDTD_Sweep_Mode>(L,1);
+    
+    int setup_index=0;
+    if(lua_gettop(L)>=2 && lua_isfunction(L,2)) setup_index=2;
+    
+    p_sweep->prepare(L,setup_index);
+    p_sweep->process();
+    
+    return 0;
+}
+
+int FDTD_sweep_set_fdtd(lua_State *L)
+{
+    FDTD_Sweep_Mode *p_sweep=lua_get_metapointer<FDTD_Sweep_Mode>(L,1);
+    
+    p_sweep->fdtd_template=lua_get_metapointer<FDTD_Mode>(L,2);
+    
+    return 0;
+}
+
+int FDTD_sweep_set_parameter(lua_State *L)
+{
+    FDTD_Sweep_Mode *p_sweep=lua_get_metapointer<FDTD_Sweep_Mode>(L,1);
+    
+    std::string name=lua_tostring(L,2);
+    
+    std::vector<double> values;
+    lua_tools::extract_vector(values,L,3);
+    
+    p_sweep->add_parameter(name,values);
+    
+    std::cout<<"Sweeping "<<name<<" over "<<values.size()<<" values"<<std::endl;
+    
+    return 0;
+}
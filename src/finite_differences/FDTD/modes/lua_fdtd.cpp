@@ -12,6 +12,7 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.*/
 
+#include <fdtd_profiler.h>
 #include <fieldblock_holder.h>
 #include <lua_fdtd.h>
 #include <string_tools.h>
@@ -23,7 +24,10 @@ limitations under the License.*/
 FDTD_Mode::FDTD_Mode()
     :FD_Mode(),
      Nt(5000), tapering(0),
+     autotune_steps(0),
      display_step(-1),
+     checkpoint_step(0),
+     subcell_sampling(1),
      time_type(TIME_FIXED), 
      time_mod(1.0),
      cc_step(500),
@@ -31,7 +35,9 @@ FDTD_Mode::FDTD_Mode()
      cc_coeff(1e-3), cc_quant(500),
      cc_layout("nnb"),
      Nl(481), lambda_min(370e-9), lambda_max(850e-9),
+     z_grading(1.2),
      obl_phase_type(0), obl_phase_Nkp(1), obl_phase_skip(0),
+     obl_phase_batch(1),
      obl_phase_kp_ic(0), obl_phase_kp_fc(1.0),
      obl_phase_phi(0),
      obl_phase_amin(0), obl_phase_amax(0),
@@ -52,6 +58,54 @@ void FDTD_Mode::add_source(Source_generator const &src)
     sources.push_back(src);
 }
 
+// Refined box in the structure coordinates, simulated with the steps divided by ratio
+void FDTD_Mode::add_subgrid(double x1,double x2,double y1,double y2,double z1,double z2,int ratio)
+{
+    if(x2<x1) std::swap(x1,x2);
+    if(y2<y1) std::swap(y1,y2);
+    if(z2<z1) std::swap(z1,z2);
+    
+    sub_x1.push_back(x1); sub_x2.push_back(x2);
+    sub_y1.push_back(y1); sub_y2.push_back(y2);
+    sub_z1.push_back(z1); sub_z2.push_back(z2);
+    sub_ratio.push_back(ratio);
+}
+
+// Refined z zone, between z1 and z2 in the structure coordinates
+void FDTD_Mode::add_z_zone(double z1,double z2,double Dz_)
+{
+    if(z2<z1) std::swap(z1,z2);
+    
+    z_zone_1.push_back(z1);
+    z_zone_2.push_back(z2);
+    z_zone_D.push_back(Dz_);
+}
+
+// Graded z mesh of the structure, empty without zones: the step is Dz away from the zones,
+// their own step inside them, and grows at most by z_grading from one cell to the next in between.
+// The steps are shrunk at the end so that they add up to lz
+void FDTD_Mode::compute_z_steps(std::vector<double> &z_steps,double lz) const
+{
+    z_steps.clear();
+    
+    if(z_zone_D.empty()) return;
+    
+    double z=0;
+    
+    while(z<lz)
+    {
+        double h=z_target_step(z);
+        
+        // Smallest target at both ends of the cell
+        for(int n=0;n<8;n++) h=std::min(z_target_step(z),z_target_step(z+h));
+        
+        z_steps.push_back(h);
+        z+=h;
+    }
+    
+    for(std::size_t k=0;k<z_steps.size();k++) z_steps[k]*=lz/z;
+}
+
 void FDTD_Mode::delete_sensor(unsigned int ID)
 {
     if(ID>=sensors.size()) return;
@@ -70,6 +124,52 @@ void FDTD_Mode::delete_source(unsigned int ID)
     sources.erase(it);
 }
 
+// Structure discretization, along with the materials to use for each index of the grid
+// With sub-cell sampling, the cells on interfaces get linear mixes of their two main materials
+void FDTD_Mode::discretize(Grid3<unsigned int> &matsgrid,std::vector<Material> &grid_materials,
+                           int Nx,int Ny,int Nz) const
+{
+    std::vector<Structure_Mix> mixes;
+    
+    structure->discretize_subcell(matsgrid,mixes,Nx,Ny,Nz,Dx,Dy,Dz,subcell_sampling,materials.size());
+    
+    mix_materials(grid_materials,mixes);
+}
+
+void FDTD_Mode::discretize(Grid3<unsigned int> &matsgrid,std::vector<Material> &grid_materials,
+                           int Nx,int Ny,std::vector<double> const &z_steps) const
+{
+    std::vector<Structure_Mix> mixes;
+    
+    structure->discretize_subcell(matsgrid,mixes,Nx,Ny,Dx,Dy,z_steps,subcell_sampling,materials.size());
+    
+    mix_materials(grid_materials,mixes);
+}
+
+void FDTD_Mode::mix_materials(std::vector<Material> &grid_materials,std::vector<Structure_Mix> const &mixes) const
+{
+    grid_materials=materials;
+    
+    if(mixes.empty()) return;
+    
+    grid_materials.resize(mixes.back().index+1);
+    
+    for(std::size_t l=0;l<mixes.size();l++)
+    {
+        Material const &mat_1=grid_materials[mixes[l].mat_1];
+        Material const &mat_2=grid_materials[mixes[l].mat_2];
+        Material &mat_mix=grid_materials[mixes[l].index];
+        
+        if(!mat_mix.set_linear_mix(mat_1,mat_2,mixes[l].weight))
+        {
+            std::cout<<"Warning, the materials "<<mixes[l].mat_1<<" and "<<mixes[l].mat_2
+                     <<" cannot be mixed, using the dominant one instead"<<std::endl;
+            
+            mat_mix=(mixes[l].weight>=0.5)?mat_1:mat_2;
+        }
+    }
+}
+
 void FDTD_Mode::finalize()
 {
     unsigned int i;
@@ -80,11 +180,21 @@ void FDTD_Mode::finalize()
     structure->retrieve_nominal_size(lx,ly,lz);
     compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
+    // Only the custom mode supports graded z meshes
+    if(type!=FDTD_CUSTOM && !z_zone_D.empty())
+    {
+        std::cerr<<"Error: Dz_zone is only supported by the custom FDTD mode"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    std::vector<double> z_steps;
+    compute_z_steps(z_steps,lz);
+    
     for(i=0;i<sensors.size();i++)
-        sensors[i].to_discrete(Dx,Dy,Dz);
+        sensors[i].to_discrete(Dx,Dy,Dz,z_steps);
     
     for(i=0;i<sources.size();i++)
-        sources[i].to_discrete(Dx,Dy,Dz);
+        sources[i].to_discrete(Dx,Dy,Dz,z_steps);
     
     if(type==FDTD_NORMAL || type==FDTD_OBLIQUE_ARS)
     {
@@ -247,7 +357,12 @@ void FDTD_Mode::reset()
     FD_Mode::reset();
     
     Nt=5000; tapering=0;
+    autotune_steps=0;
     display_step=-1;
+    checkpoint_step=0;
+    checkpoint_fname="";
+    resume_fname="";
+    subcell_sampling=1;
     time_type=TIME_FIXED; 
     time_mod=1.0;
     cc_step=500;
@@ -256,6 +371,7 @@ void FDTD_Mode::reset()
     cc_layout="nnb";
     Nl=481; lambda_min=370e-9; lambda_max=850e-9;
     obl_phase_type=0; obl_phase_Nkp=1; obl_phase_skip=0;
+    obl_phase_batch=1;
     obl_phase_kp_ic=0; obl_phase_kp_fc=1.0;
     obl_phase_phi=0;
     obl_phase_amin=0; obl_phase_amax=0;
@@ -265,6 +381,16 @@ void FDTD_Mode::reset()
 
     sensors.clear();
     sources.clear();
+    
+    z_zone_1.clear();
+    z_zone_2.clear();
+    z_zone_D.clear();
+    z_grading=1.2;
+    
+    sub_x1.clear(); sub_x2.clear();
+    sub_y1.clear(); sub_y2.clear();
+    sub_z1.clear(); sub_z2.clear();
+    sub_ratio.clear();
 }
 
 void FDTD_Mode::set_auto_tsteps(int Nt_,int cc_step_,double cc_coeff_)
@@ -296,6 +422,14 @@ void FDTD_Mode::process()
 {
     finalize();
     
+    // The grids built below, and their workers, record into this mode's
+    // profiler
+    
+    #ifdef FDTD_PROFILING
+    FDTD_Profiler *profiler_prev=fdtd_profiler_bind(&profiler);
+    profiler.reset();
+    #endif
+    
     if(type==FDTD_NORMAL)
     {
         FDTD_normal_incidence(*this);
@@ -316,6 +450,21 @@ void FDTD_Mode::process()
     {
         mode_fdtd_lab(*this);
     }
+    
+    #ifdef FDTD_PROFILING
+    fdtd_profiler_bind(profiler_prev);
+    profiler.stop();
+    
+    FDTD_Domain domain;
+    std::string fname="fdtd_profile";
+    if(domain.Nranks>1) fname.append("_"+std::to_string(domain.rank));
+    
+    profiler.write_json(directory/(fname+".json"));
+    profiler.write_csv(directory/(fname+".csv"));
+    
+    std::cout<<"FDTD profile: "<<profiler.get_cells()/std::max(profiler.get_wall_time(),1e-9)/1e6
+             <<" Mcells/s over "<<profiler.get_wall_time()<<" s"<<std::endl;
+    #endif
 }
 
 void FDTD_Mode::set_N_tsteps(int Nt_)
@@ -326,11 +475,28 @@ void FDTD_Mode::set_N_tsteps(int Nt_)
     std::cout<<"Setting the number of time steps to "<<Nt<<std::endl;
 }
 
+// Number of timed steps per trial configuration of the workers, 0 to
+// keep the default ones
+
+void FDTD_Mode::set_autotune(int Nsteps)
+{
+    autotune_steps=std::max(0,Nsteps);
+}
+
+void FDTD_Mode::set_checkpoint(int N,std::string fname)
+{
+    checkpoint_step=std::max(0,N);
+    checkpoint_fname=fname;
+}
+
 void FDTD_Mode::set_display_step(int N)
 {
     display_step=N;
 }
 
+void FDTD_Mode::set_kp_batch(int N) { obl_phase_batch=std::max(1,N); }
+void FDTD_Mode::set_resume(std::string fname) { resume_fname=fname; }
+
 void FDTD_Mode::set_spectrum(double lambda_min_,double lambda_max_,int Nl_)
 {
     lambda_min=lambda_min_;
@@ -338,7 +504,9 @@ void FDTD_Mode::set_spectrum(double lambda_min_,double lambda_max_,int Nl_)
     Nl=Nl_;
 }
 
+void FDTD_Mode::set_subcell_sampling(int N) { subcell_sampling=std::max(1,N); }
 void FDTD_Mode::set_time_mod(double md) { time_mod=md; }
+void FDTD_Mode::set_z_grading(double ratio) { z_grading=std::max(1.0,ratio); }
 
 void FDTD_Mode::show() const
 {
@@ -347,6 +515,8 @@ void FDTD_Mode::show() const
     std::cout<<"FDTD Mode"<<std::endl;
     chk_msg_sc(Nt);
     chk_msg_sc(display_step);
+    chk_msg_sc(checkpoint_step);
+    chk_msg_sc(subcell_sampling);
     chk_msg_sc(time_type);
     chk_msg_sc(time_mod);
     chk_msg_sc(cc_step);
@@ -357,6 +527,25 @@ void FDTD_Mode::show() const
     chk_msg_sc(Nl);
     chk_msg_sc(lambda_min);
     chk_msg_sc(lambda_max);
+    chk_msg_sc(obl_phase_batch);
+    chk_msg_sc(z_zone_D.size());
+    chk_msg_sc(z_grading);
+    chk_msg_sc(sub_ratio.size());
+}
+
+// Largest step allowed at z by the zones and the grading
+double FDTD_Mode::z_target_step(double z) const
+{
+    double h=Dz;
+    
+    for(std::size_t n=0;n<z_zone_D.size();n++)
+    {
+        double d=std::max(0.0,std::max(z_zone_1[n]-z,z-z_zone_2[n]));
+        
+        h=std::min(h,z_zone_D[n]+(z_grading-1.0)*d);
+    }
+    
+    return h;
 }
 
 void FDTD_Mode_create_metatable(lua_State *L)
@@ -364,12 +553,16 @@ void FDTD_Mode_create_metatable(lua_State *L)
     create_obj_metatable(L,"metatable_fdtd");
     
     metatable_add_func(L,"auto_tsteps",FDTD_mode_set_auto_tsteps);
+    lua_wrapper<20,FDTD_Mode,int>::bind(L,"autotune",&FDTD_Mode::set_autotune);
+    lua_wrapper<15,FDTD_Mode,int,std::string>::bind(L,"checkpoint",&FDTD_Mode::set_checkpoint);
     metatable_add_func(L,"compute",FDTD_mode_compute);
     metatable_add_func(L,"display_step",FDTD_mode_set_display_step);
     lua_wrapper<1,FDTD_Mode,double>::bind(L,"Dx",&FDTD_Mode::set_discretization_x);
     lua_wrapper<2,FDTD_Mode,double>::bind(L,"Dxyz",&FDTD_Mode::set_discretization);
     lua_wrapper<3,FDTD_Mode,double>::bind(L,"Dy",&FDTD_Mode::set_discretization_y);
     lua_wrapper<4,FDTD_Mode,double>::bind(L,"Dz",&FDTD_Mode::set_discretization_z);
+    lua_wrapper<18,FDTD_Mode,double>::bind(L,"Dz_grading",&FDTD_Mode::set_z_grading);
+    lua_wrapper<17,FDTD_Mode,double,double,double>::bind(L,"Dz_zone",&FDTD_Mode::add_z_zone);
     metatable_add_func(L,"Lx",FD_mode_get_lx);
     metatable_add_func(L,"Ly",FD_mode_get_ly);
     metatable_add_func(L,"Lz",FD_mode_get_lz);
@@ -388,12 +581,17 @@ void FDTD_Mode_create_metatable(lua_State *L)
     lua_wrapper<12,FDTD_Mode,int,double,double,double>::bind(L,"pml_zp",&FDTD_Mode::set_pml_zp);
     metatable_add_func(L,"polarization",FD_mode_set_polarization);
     metatable_add_func(L,"prefix",FD_mode_set_prefix);
+    metatable_add_func(L,"profile",FDTD_mode_get_profile);
+    lua_wrapper<16,FDTD_Mode,std::string>::bind(L,"resume",&FDTD_Mode::set_resume);
     metatable_add_func(L,"structure",FD_mode_set_structure);
+    lua_wrapper<13,FDTD_Mode,int>::bind(L,"subcell_sampling",&FDTD_Mode::set_subcell_sampling);
+    lua_wrapper<19,FDTD_Mode,double,double,double,double,double,double,int>::bind(L,"subgrid",&FDTD_Mode::add_subgrid);
     metatable_add_func(L,"tapering",FDTD_mode_set_tapering);
     metatable_add_func(L,"time_mod",FDTD_mode_set_time_mod);
     
     metatable_add_func(L,"cut_angle",FDTD_mode_obph_set_cut_angle);
     metatable_add_func(L,"kp_auto",FDTD_mode_obph_set_kp_auto);
+    lua_wrapper<14,FDTD_Mode,int>::bind(L,"kp_batch",&FDTD_Mode::set_kp_batch);
     metatable_add_func(L,"kp_fixed_angle",FDTD_mode_obph_set_kp_fixed_angle);
     metatable_add_func(L,"kp_fixed_lambda",FDTD_mode_obph_set_kp_fixed_lambda);
     metatable_add_func(L,"kp_full",FDTD_mode_obph_set_kp_full);
@@ -418,6 +616,42 @@ int FDTD_mode_compute(lua_State *L)
     return 0;
 }
 
+// Table of the times of the last computation, in seconds and summed over
+// the threads, nil if the profiler was not compiled in
+
+int FDTD_mode_get_profile(lua_State *L)
+{
+    #ifdef FDTD_PROFILING
+    FDTD_Profiler &profiler=lua_get_metapointer<FDTD_Mode>(L,1)->profiler;
+    
+    lua_newtable(L);
+    
+    for(int p=0;p<FDTD_Profiler::PROF_NPHASES;p++)
+    {
+        lua_pushnumber(L,profiler.get_time(p));
+        lua_setfield(L,-2,FDTD_Profiler::get_name(p).c_str());
+    }
+    
+    double wall=profiler.get_wall_time();
+    
+    lua_pushnumber(L,wall);
+    lua_setfield(L,-2,"wall_time");
+    
+    lua_pushnumber(L,profiler.get_cells());
+    lua_setfield(L,-2,"cell_updates");
+    
+    lua_pushnumber(L,wall>0 ? profiler.get_cells()/wall : 0);
+    lua_setfield(L,-2,"cells_per_second");
+    
+    lua_pushinteger(L,profiler.get_N_threads());
+    lua_setfield(L,-2,"threads");
+    #else
+    lua_pushnil(L);
+    #endif
+    
+    return 1;
+}
+
 int FDTD_mode_register_sensor(lua_State *L)
 {
     FDTD_Mode **pp_fdtd=reinterpret_cast<FDTD_Mode**>(lua_touserdata(L,1));
@@ -15,10 +15,16 @@ limitations under the License.*/
 #ifndef LUA_FDTD_H_INCLUDED
 #define LUA_FDTD_H_INCLUDED
 
+#include <fdtd_profiler.h>
 #include <lua_fd.h>
 #include <sensors.h>
 #include <sources.h>
 
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+
 class FDTD_Mode: public FD_Mode
 {
     public:
@@ -32,7 +38,11 @@ class FDTD_Mode: public FD_Mode
         };
     
         int Nt,tapering;
+        int autotune_steps;
         int display_step;
+        int checkpoint_step;
+        std::string checkpoint_fname,resume_fname;
+        int subcell_sampling;
         int time_type;
         double time_mod;
         int cc_step;
@@ -51,41 +61,70 @@ class FDTD_Mode: public FD_Mode
         //Sources
         std::vector<Source_generator> sources;
         
+        //Graded z
+        std::vector<double> z_zone_1,z_zone_2,z_zone_D;
+        double z_grading;
+        
+        //Subgrids
+        std::vector<double> sub_x1,sub_x2,sub_y1,sub_y2,sub_z1,sub_z2;
+        std::vector<int> sub_ratio;
+        
         //Obl phase
         int obl_phase_type,obl_phase_Nkp,obl_phase_skip;
+        int obl_phase_batch;
         double obl_phase_kp_ic,obl_phase_kp_fc;
         AngleRad obl_phase_phi;
         AngleRad obl_phase_amin,obl_phase_amax;
         double obl_phase_lmin,obl_phase_lmax;
         AngleRad obl_phase_cut_angle,obl_phase_safe_angle;
         
+        //Profiling of the last computation
+        FDTD_Profiler profiler;
+        
         FDTD_Mode();
         
         void add_sensor(Sensor_generator const &sens);
         void add_source(Source_generator const &src);
+        void add_subgrid(double x1,double x2,double y1,double y2,double z1,double z2,int ratio);
+        void add_z_zone(double z1,double z2,double Dz);
+        void compute_z_steps(std::vector<double> &z_steps,double lz) const;
         void delete_sensor(unsigned int ID);
         void delete_source(unsigned int ID);
+        void discretize(Grid3<unsigned int> &matsgrid,std::vector<Material> &grid_materials,
+                        int Nx,int Ny,int Nz) const;
+        void discretize(Grid3<unsigned int> &matsgrid,std::vector<Material> &grid_materials,
+                        int Nx,int Ny,std::vector<double> const &z_steps) const;
         void finalize();
         void finalize_thight();
         void reset();
         void set_analysis(double lambda_min,double lambda_max,int Nl);
         void set_auto_tsteps(int Nt,int cc_step,double cc_coeff);
+        void set_autotune(int Nsteps);
         void set_auto_tsteps(int Nt,int cc_step,
                              double cc_lmin,double cc_lmax,
                              double cc_coeff,int cc_quant,
                              std::string const &cc_layout);
+        void set_checkpoint(int N,std::string fname);
         void set_display_step(int N);
         void set_incidence(AngleRad theta,AngleRad phi);
+        void set_kp_batch(int N);
         void set_N_tsteps(int Nt);
+        void set_resume(std::string fname);
         void set_spectrum(double lambda_min,double lambda_max,int Nl=481);
         void set_structure(std::string s_name);
+        void set_subcell_sampling(int N);
         void set_structure_aux(std::string s_name);
         void set_time_mod(double md);
+        void set_z_grading(double ratio);
         void show() const;
         
         //##########
         
         void process();
+        
+    private:
+        void mix_materials(std::vector<Material> &grid_materials,std::vector<Structure_Mix> const &mixes) const;
+        double z_target_step(double z) const;
 };
 
 void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,
@@ -100,6 +139,10 @@ void FDTD_oblique_phase(FDTD_Mode const &fdtd_mode,
 void FDTD_single_particle(FDTD_Mode const &fdtd_mode,
                           std::atomic<bool> *end_computation=nullptr,
                           ProgTimeDisp *dsp=nullptr,Bitmap *bitmap=nullptr);
+bool default_fdtd_checkpoint(Checkpoint &chk,FDTD &fdtd,
+                             std::vector<Sensor*> &sensors,std::vector<Source*> &sources);
+bool default_fdtd_resume(std::filesystem::path const &fname,FDTD &fdtd,
+                         std::vector<Sensor*> &sensors,std::vector<Source*> &sources);
 void mode_default_fdtd(FDTD_Mode const &fdtd_mode,
                        std::atomic<bool> *end_computation=nullptr,
                        ProgTimeDisp *dsp=nullptr,Bitmap *bitmap=nullptr);
@@ -109,6 +152,7 @@ void mode_fdtd_lab(FDTD_Mode const &fdtd_mode,
                    
 void FDTD_Mode_create_metatable(lua_State *L);
 int FDTD_mode_compute(lua_State *L);
+int FDTD_mode_get_profile(lua_State *L);
 int FDTD_mode_register_sensor(lua_State *L);
 int FDTD_mode_register_source(lua_State *L);
 int FDTD_mode_set_auto_tsteps(lua_State *L);
@@ -125,6 +169,57 @@ int FDTD_mode_obph_set_kp_target(lua_State *L);
 int FDTD_mode_obph_set_phi(lua_State *L);
 int FDTD_mode_obph_skip(lua_State *L);
 
+//##############################
+//       Parameter sweep
+//##############################
+
+class FDTD_Sweep_Job
+{
+    public:
+        int ID,Nthr;
+        double cells,time;
+        FDTD_Mode *mode;
+        std::vector<double> values;
+};
+
+class FDTD_Sweep_Mode: public base_mode
+{
+    public:
+        int cells_per_thread,max_jobs;
+        std::filesystem::path directory;
+        FDTD_Mode *fdtd_template;
+        
+        std::vector<std::string> parameter_name;
+        std::vector<std::vector<double>> parameter_values;
+        
+        FDTD_Sweep_Mode();
+        
+        void add_parameter(std::string const &name,std::vector<double> const &values);
+        void prepare(lua_State *L,int setup_index);
+        void process();
+        void set_cells_per_thread(int N);
+        void set_max_jobs(int N);
+        void set_output_directory(std::string dir);
+        
+    private:
+        int Nthr_free,Njobs_running;
+        std::mutex sweep_mutex;
+        std::condition_variable sweep_cv;
+        std::ofstream results;
+        std::vector<FDTD_Sweep_Job> jobs;
+        std::map<std::vector<double>,Structure*> structures;
+        std::map<Structure*,bool> shared_flags;
+        
+        void clear_jobs();
+        void share_structure(Structure *structure);
+        void run_job(int n);
+};
+
+void FDTD_Sweep_Mode_create_metatable(lua_State *L);
+int FDTD_sweep_compute(lua_State *L);
+int FDTD_sweep_set_fdtd(lua_State *L);
+int FDTD_sweep_set_parameter(lua_State *L);
+
 //##############################
 //       Fieldblock Treat
 //##############################
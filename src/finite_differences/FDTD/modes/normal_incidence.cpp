@@ -15,6 +15,7 @@ limitations under the License.*/
 #include <bitmap3.h>
 #include <data_hdl.h>
 #include <fdtd_core.h>
+#include <fdtd_profiler.h>
 #include <lua_fdtd.h>
 
 extern const Imdouble Im;
@@ -176,7 +177,8 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
     fdtd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
     
     Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdtd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    std::vector<Material> grid_materials;
+    fdtd_mode.discretize(matsgrid,grid_materials,Nx,Ny,Nz);
     
     std::string polar_mode=fdtd_mode.polarization;
     
@@ -217,8 +219,8 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
     for(unsigned int m=0;m<fdtd_mode.materials_str.size();m++)
         fdtd.set_material(fdtd_mode.materials_index[m],fdtd_mode.materials_str[m]);
     #endif
-    for(unsigned int m=0;m<fdtd_mode.materials.size();m++)
-        fdtd.set_material(m,fdtd_mode.materials[m]);
+    for(unsigned int m=0;m<grid_materials.size();m++)
+        fdtd.set_material(m,grid_materials[m]);
     
     // Disabling fields
     
@@ -252,6 +254,7 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
     std::cout<<"Computing"<<std::endl;
     
     fdtd.bootstrap();
+    if(fdtd_mode.autotune_steps>0) fdtd.autotune(fdtd_mode.autotune_steps);
     
     Grid1<double> BRsensorX(Nt,0),BRsensorY(Nt,0),BRsensorZ(Nt,0);
     Grid1<double> RsensorX(Nt,0),RsensorY(Nt,0),RsensorZ(Nt,0);
@@ -332,6 +335,8 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
         
         // E-field injection
         
+        FDTD_PROF_START(t_inj_E);
+        
         tb=t*Dt;
         double inj_Hx=inj_chp.Hx(0,0,(zs_e-1+0.5)*Dz,tb);
         double inj_Hy=inj_chp.Hy(0,0,(zs_e-1+0.5)*Dz,tb);
@@ -342,11 +347,15 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
             fdtd.Ey(i,j,zs_e-1)+=fdtd.dtdez*inj_Hx/eps_sup;
         }}
         
+        FDTD_PROF_STOP(t_inj_E,FDTD_Profiler::PROF_SOURCES);
+        
         // H-field
         fdtd.update_H();
         
         // H-field injection
         
+        FDTD_PROF_START(t_inj_H);
+        
         tb=(t+0.5)*Dt;
         double inj_Ex=inj_chp.Ex(0,0,(zs_e-1)*Dz,tb);
         double inj_Ey=inj_chp.Ey(0,0,(zs_e-1)*Dz,tb);
@@ -357,8 +366,9 @@ void FDTD_normal_incidence(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_com
             fdtd.Hy(i,j,zs_e-1)-=fdtd.dtdmz*inj_Ex;
         }}
         
-        for(unsigned int i=0;i<sensors.size();i++)
-            sensors[i]->feed(fdtd);
+        FDTD_PROF_STOP(t_inj_H,FDTD_Profiler::PROF_SOURCES);
+        
+        feed_sensors(sensors,fdtd);
         
         if(t%N_disp==0)
         {
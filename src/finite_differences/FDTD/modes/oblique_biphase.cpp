@@ -15,6 +15,7 @@ limitations under the License.*/
 #include <bitmap3.h>
 #include <data_hdl.h>
 #include <fdtd_core.h>
+#include <fdtd_profiler.h>
 #include <lua_fdtd.h>
 
 extern const Imdouble Im;
@@ -25,126 +26,172 @@ extern std::ofstream plog;
 //   Oblique phase
 //####################
 
-void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky_in,
-                               Spectrum &TE_spectrum_ref_out,Spectrum &TM_spectrum_ref_out,
-                               Spectrum &TE_spectrum_trans_out,Spectrum &TM_spectrum_trans_out,int sim_index)
+// Phase-shifted copy of a complex field sample, with the real and
+// imaginary parts held by the two FDTD twins
+
+inline void bloch_copy(Grid3<double> &F_r,Grid3<double> &F_i,
+                       int i_s,int j_s,int i_d,int j_d,int k,
+                       double dephas_r,double dephas_i)
 {
-    int i,j,k,l,t;
-    
-    int Nx=60;
-    int Ny=60;
-    int Nz=60;
-    int Nt=fdtd_mode.Nt;
+    double a=F_r(i_s,j_s,k);
+    double b=F_i(i_s,j_s,k);
     
-    double Dx=fdtd_mode.Dx;
-    double Dy=fdtd_mode.Dy;
-    double Dz=fdtd_mode.Dz;
+    F_r(i_d,j_d,k)=a*dephas_r-b*dephas_i;
+    F_i(i_d,j_d,k)=a*dephas_i+b*dephas_r;
+}
+
+// Single parallel wavevector of an oblique sweep. The kernels of all the
+// runs of a batch are advanced by the worker threads of the first one, the
+// grids of the other runs being linked to it as soon as they are built so
+// that their own workers are released right away.
+
+class Oblique_Biphase_Run
+{
+    public:
+        FDTD_Mode const &fdtd_mode;
+        int Nx,Ny,Nz,Nt,Nt_est;
+        int sim_index;
+        double Dx,Dy,Dz,Dt;
+        int zs_s,zs_e;
+        double kx,ky,kxy;
+        double index_sub,index_sup;
+        double dEx_r,dEx_i,dEy_r,dEy_i;
+        double dHx_r,dHx_i,dHy_r,dHy_i;
+        bool completed;
+        int pk;
+        
+        FDTD *fdtd_r,*fdtd_i;
+        Bloch_Wideband *inc_field;
+        
+        Grid2<double> inc_Ex,inc_Ey,inc_Ez;
+        Grid2<Imdouble> mk_x,mk_y,mk_z;
+        
+        Grid1<Imdouble> BRsensorX,BRsensorY,BRsensorZ;
+        Grid1<Imdouble> RsensorX,RsensorY,RsensorZ;
+        Grid1<Imdouble> BTsensorX,BTsensorY,BTsensorZ;
+        Grid1<Imdouble> TsensorX,TsensorY,TsensorZ;
+        
+        std::vector<Sensor*> sensors;
+        CompletionSensor *cpl_sensor;
+        
+        Oblique_Biphase_Run(FDTD_Mode const &fdtd_mode,
+                            Grid3<unsigned int> &matsgrid,std::vector<Material> const &grid_materials,
+                            double kx_in,double ky_in,int sim_index,FDTD *lead);
+        ~Oblique_Biphase_Run();
+        
+        void bloch_E(int k1,int k2);
+        void bloch_H(int k1,int k2);
+        void record(int t);
+        void spectra(Spectrum &TE_spectrum_ref_out,Spectrum &TM_spectrum_ref_out,
+                     Spectrum &TE_spectrum_trans_out,Spectrum &TM_spectrum_trans_out);
+};
+
+Oblique_Biphase_Run::Oblique_Biphase_Run(FDTD_Mode const &fdtd_mode_,
+                                         Grid3<unsigned int> &matsgrid,std::vector<Material> const &grid_materials,
+                                         double kx_in,double ky_in,int sim_index_,FDTD *lead)
+    :fdtd_mode(fdtd_mode_),
+     Nx(matsgrid.L1()), Ny(matsgrid.L2()), Nz(matsgrid.L3()),
+     Nt(fdtd_mode.Nt), Nt_est(fdtd_mode.Nt),
+     sim_index(sim_index_),
+     Dx(fdtd_mode.Dx), Dy(fdtd_mode.Dy), Dz(fdtd_mode.Dz),
+     completed(false), pk(0),
+     cpl_sensor(nullptr)
+{
+    int i,j;
     
-    double lx,ly,lz;
+    Dt=std::min(std::min(Dx,Dy),Dz)/(std::sqrt(3.0)*c_light)*0.99*fdtd_mode.time_mod;
     
-    fdtd_mode.structure->retrieve_nominal_size(lx,ly,lz);
-    fdtd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
+    /////////////////////////
     
-    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
-    fdtd_mode.structure->discretize(matsgrid,Nx,Ny,Nz,Dx,Dy,Dz);
+    fdtd_r=new FDTD(Nx,Ny,Nz,Nt,Dx,Dy,Dz,Dt,"OBL_PHASE",
+                    0,0,0,0,fdtd_mode.pml_zm,fdtd_mode.pml_zp,
+                    0,0,0,0,std::max(5,fdtd_mode.pad_zm),std::max(5,fdtd_mode.pad_zp));
     
-    std::string polar_mode=fdtd_mode.polarization;
+    if(lead==nullptr) lead=fdtd_r;
+    else lead->link_twin(*fdtd_r);
     
-    double Dt=std::min(std::min(Dx,Dy),Dz)/(std::sqrt(3.0)*c_light)*0.99*fdtd_mode.time_mod;
+    fdtd_i=new FDTD(Nx,Ny,Nz,Nt,Dx,Dy,Dz,Dt,"OBL_PHASE",
+                    0,0,0,0,fdtd_mode.pml_zm,fdtd_mode.pml_zp,
+                    0,0,0,0,std::max(5,fdtd_mode.pad_zm),std::max(5,fdtd_mode.pad_zp));
     
-    /////////////////////////
-    
-    FDTD fdtd_r(Nx,Ny,Nz,Nt,Dx,Dy,Dz,Dt,"OBL_PHASE",
-                0,0,0,0,fdtd_mode.pml_zm,fdtd_mode.pml_zp,
-                0,0,0,0,std::max(5,fdtd_mode.pad_zm),std::max(5,fdtd_mode.pad_zp));
-    FDTD fdtd_i(Nx,Ny,Nz,Nt,Dx,Dy,Dz,Dt,"OBL_PHASE",
-                0,0,0,0,fdtd_mode.pml_zm,fdtd_mode.pml_zp,
-                0,0,0,0,std::max(5,fdtd_mode.pad_zm),std::max(5,fdtd_mode.pad_zp));
+    lead->link_twin(*fdtd_i);
     
     // PML
     
-    fdtd_r.set_pml_zm(fdtd_mode.kappa_zm,fdtd_mode.sigma_zm,fdtd_mode.alpha_zm);
-    fdtd_r.set_pml_zp(fdtd_mode.kappa_zp,fdtd_mode.sigma_zp,fdtd_mode.alpha_zp);
-    fdtd_i.set_pml_zm(fdtd_mode.kappa_zm,fdtd_mode.sigma_zm,fdtd_mode.alpha_zm);
-    fdtd_i.set_pml_zp(fdtd_mode.kappa_zp,fdtd_mode.sigma_zp,fdtd_mode.alpha_zp);
+    fdtd_r->set_pml_zm(fdtd_mode.kappa_zm,fdtd_mode.sigma_zm,fdtd_mode.alpha_zm);
+    fdtd_r->set_pml_zp(fdtd_mode.kappa_zp,fdtd_mode.sigma_zp,fdtd_mode.alpha_zp);
+    fdtd_i->set_pml_zm(fdtd_mode.kappa_zm,fdtd_mode.sigma_zm,fdtd_mode.alpha_zm);
+    fdtd_i->set_pml_zp(fdtd_mode.kappa_zp,fdtd_mode.sigma_zp,fdtd_mode.alpha_zp);
     
     std::string new_prefix_str=fdtd_mode.prefix;
     
-    fdtd_r.set_prefix(new_prefix_str);
-    fdtd_i.set_prefix(new_prefix_str);
+    fdtd_r->set_directory(fdtd_mode.directory);
+    fdtd_i->set_directory(fdtd_mode.directory);
+    fdtd_r->set_prefix(new_prefix_str);
+    fdtd_i->set_prefix(new_prefix_str);
     
-    fdtd_r.set_tapering(fdtd_mode.tapering);
-    fdtd_i.set_tapering(fdtd_mode.tapering);
+    fdtd_r->set_tapering(fdtd_mode.tapering);
+    fdtd_i->set_tapering(fdtd_mode.tapering);
     
-    fdtd_r.set_matsgrid(matsgrid);
-    fdtd_i.set_matsgrid(matsgrid);
+    fdtd_r->set_matsgrid(matsgrid);
+    fdtd_i->set_matsgrid(matsgrid);
     
     #ifdef OLDMAT
     for(unsigned int m=0;m<fdtd_mode.materials_str.size();m++)
     {
-        fdtd_r.set_material(fdtd_mode.materials_index[m],fdtd_mode.materials_str[m]);
-        fdtd_i.set_material(fdtd_mode.materials_index[m],fdtd_mode.materials_str[m]);
+        fdtd_r->set_material(fdtd_mode.materials_index[m],fdtd_mode.materials_str[m]);
+        fdtd_i->set_material(fdtd_mode.materials_index[m],fdtd_mode.materials_str[m]);
     }
     #endif
-    for(unsigned int m=0;m<fdtd_mode.materials.size();m++)
+    for(unsigned int m=0;m<grid_materials.size();m++)
     {
-        fdtd_r.set_material(m,fdtd_mode.materials[m]);
-        fdtd_i.set_material(m,fdtd_mode.materials[m]);
+        fdtd_r->set_material(m,grid_materials[m]);
+        fdtd_i->set_material(m,grid_materials[m]);
     }
     
     /////////////////////////
     
-    fdtd_r.disable_fields(fdtd_mode.disable_fields);
-    fdtd_i.disable_fields(fdtd_mode.disable_fields);
-    
-    //Spectrum
-    
-    int Nl=fdtd_mode.Nl;
-    double lambda_min=fdtd_mode.lambda_min;
-    double lambda_max=fdtd_mode.lambda_max;
+    fdtd_r->disable_fields(fdtd_mode.disable_fields);
+    fdtd_i->disable_fields(fdtd_mode.disable_fields);
     
-    fdtd_r.bootstrap();
-    fdtd_i.bootstrap();
+    fdtd_r->bootstrap();
+    fdtd_i->bootstrap();
     
     ///###############
     ///  Sim Start
     ///###############
     
-    Nx=fdtd_r.Nx;
-    Ny=fdtd_r.Ny;
-    Nz=fdtd_r.Nz;
-    
-    int zs_s=fdtd_r.zs_s;
-    int zs_e=fdtd_r.zs_e;
+    Nx=fdtd_r->Nx;
+    Ny=fdtd_r->Ny;
+    Nz=fdtd_r->Nz;
     
-    Imdouble i_E,i_H;
+    zs_s=fdtd_r->zs_s;
+    zs_e=fdtd_r->zs_e;
     
-    Grid1<Imdouble> mkx(Nx,0),mkx_s(Nx,0);
-    
-    Grid2<double> inc_Ex(Nx,Ny,0),inc_Ey(Nx,Ny,0),inc_Ez(Nx,Ny,0);
-    Grid2<Imdouble> mk_x(Nx,Ny,0),mk_y(Nx,Ny,0),mk_z(Nx,Ny,0);
+    inc_Ex.init(Nx,Ny,0); inc_Ey.init(Nx,Ny,0); inc_Ez.init(Nx,Ny,0);
+    mk_x.init(Nx,Ny,0); mk_y.init(Nx,Ny,0); mk_z.init(Nx,Ny,0);
         
-    double eps_sub=fdtd_r.mats[fdtd_r.matsgrid(0,0,zs_s)].ei;
-    double eps_sup=fdtd_r.mats[fdtd_r.matsgrid(0,0,zs_e)].ei;
-    double index_sub=std::sqrt(eps_sub);
-    double index_sup=std::sqrt(eps_sup);
+    double eps_sub=fdtd_r->mats[fdtd_r->matsgrid(0,0,zs_s)].ei;
+    double eps_sup=fdtd_r->mats[fdtd_r->matsgrid(0,0,zs_e)].ei;
+    index_sub=std::sqrt(eps_sub);
+    index_sup=std::sqrt(eps_sup);
     
-    double kx=kx_in*index_sup;
-    double ky=ky_in*index_sup;
-    double kxy=std::sqrt(kx*kx+ky*ky);
+    kx=kx_in*index_sup;
+    ky=ky_in*index_sup;
+    kxy=std::sqrt(kx*kx+ky*ky);
     
     std::cout<<"u "<<eps_sup<<"/"<<index_sup<<" d "<<eps_sub<<"/"<<index_sub<<std::endl;
     
     AngleRad pol;
     
     pol.degree(0);
-    if(polar_mode=="TM") pol.degree(90);
+    if(fdtd_mode.polarization=="TM") pol.degree(90);
     
-    Bloch_Wideband inc_field(0,Nx,0,Ny,0,fdtd_r.Nz_s,kx,ky,pol);
+    inc_field=new Bloch_Wideband(0,Nx,0,Ny,0,fdtd_r->Nz_s,kx,ky,pol);
         
-    inc_field.set_spectrum(fdtd_mode.lambda_min,fdtd_mode.lambda_max);
+    inc_field->set_spectrum(fdtd_mode.lambda_min,fdtd_mode.lambda_max);
     
-    inc_field.link(fdtd_r);
+    inc_field->link(*fdtd_r);
     
     Imdouble dephasE_x=std::exp(kx*Nx*Dx*Im);
     Imdouble dephasE_y=std::exp(ky*Ny*Dy*Im);
@@ -152,14 +199,13 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
     Imdouble dephasH_x=std::exp(-kx*Nx*Dx*Im);
     Imdouble dephasH_y=std::exp(-ky*Ny*Dy*Im);
     
-    fdtd_r.set_kx(kx); fdtd_r.set_ky(ky);
-    fdtd_i.set_kx(kx); fdtd_i.set_ky(ky);
+    dEx_r=std::real(dephasE_x); dEx_i=std::imag(dephasE_x);
+    dEy_r=std::real(dephasE_y); dEy_i=std::imag(dephasE_y);
+    dHx_r=std::real(dephasH_x); dHx_i=std::imag(dephasH_x);
+    dHy_r=std::real(dephasH_y); dHy_i=std::imag(dephasH_y);
     
-    for(i=0;i<Nx;i++)
-    {
-        mkx[i]=std::exp(-kx*i*Dx*Im);
-        mkx_s[i]=std::exp(-kx*(i+0.5)*Dx*Im);
-    }
+    fdtd_r->set_kx(kx); fdtd_r->set_ky(ky);
+    fdtd_i->set_kx(kx); fdtd_i->set_ky(ky);
     
     for(i=0;i<Nx;i++){ for(j=0;j<Ny;j++)
     {
@@ -168,27 +214,21 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
         mk_z(i,j)=std::exp(-(kx*i*Dx+ky*j*Dy)*Im);
     }}
     
-    int pk=0;
-    int vmode=0;
+    BRsensorX.init(Nt,0); BRsensorY.init(Nt,0); BRsensorZ.init(Nt,0);
+    RsensorX.init(Nt,0);  RsensorY.init(Nt,0);  RsensorZ.init(Nt,0);
+    BTsensorX.init(Nt,0); BTsensorY.init(Nt,0); BTsensorZ.init(Nt,0);
+    TsensorX.init(Nt,0);  TsensorY.init(Nt,0);  TsensorZ.init(Nt,0);
     
-    Grid1<Imdouble> BRsensorX(Nt,0),BRsensorY(Nt,0),BRsensorZ(Nt,0);
-    Grid1<Imdouble> RsensorX(Nt,0),RsensorY(Nt,0),RsensorZ(Nt,0);
+    fdtd_r->reset_fields();
+    fdtd_i->reset_fields();
     
-    Grid1<Imdouble> BTsensorX(Nt,0),BTsensorY(Nt,0),BTsensorZ(Nt,0);
-    Grid1<Imdouble> TsensorX(Nt,0),TsensorY(Nt,0),TsensorZ(Nt,0);
-    
-    fdtd_r.reset_fields();
-    fdtd_i.reset_fields();
-    
-    fdtd_r.tstep=0;
-    fdtd_i.tstep=0;
+    fdtd_r->tstep=0;
+    fdtd_i->tstep=0;
     
     //Adding sensors
     
-    std::vector<Sensor*> sensors;
-    
     for(unsigned int i=0;i<fdtd_mode.sensors.size();i++)
-        sensors.push_back(generate_fdtd_sensor(fdtd_mode.sensors[i],fdtd_r));
+        sensors.push_back(generate_fdtd_sensor(fdtd_mode.sensors[i],*fdtd_r));
     
     std::stringstream sim_name;
     sim_name<<"_"<<sim_index;
@@ -198,161 +238,128 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
         
     //Completion check
     
-    int time_type=fdtd_mode.time_type;
-    int cc_step=fdtd_mode.cc_step;
-    double cc_lmin=fdtd_mode.cc_lmin,
-           cc_lmax=fdtd_mode.cc_lmax,
-           cc_coeff=fdtd_mode.cc_coeff,
-           cc_quant=fdtd_mode.cc_quant;
-    std::string cc_layout=fdtd_mode.cc_layout;
-    
-    CompletionSensor *cpl_sensor=nullptr;
-    
-    if(time_type==TIME_FT)
+    if(fdtd_mode.time_type==TIME_FT)
     {
-        cpl_sensor=new CompletionSensor(cc_lmin,cc_lmax,cc_coeff,cc_quant,cc_layout);
-        cpl_sensor->link(fdtd_r);
+        cpl_sensor=new CompletionSensor(fdtd_mode.cc_lmin,fdtd_mode.cc_lmax,
+                                        fdtd_mode.cc_coeff,fdtd_mode.cc_quant,fdtd_mode.cc_layout);
+        cpl_sensor->link(*fdtd_r);
         sensors.push_back(cpl_sensor);
     }
+}
+
+Oblique_Biphase_Run::~Oblique_Biphase_Run()
+{
+    for(unsigned int i=0;i<sensors.size();i++) delete sensors[i];
     
-    ProgTimeDisp dspt(Nt);
+    delete inc_field;
+    delete fdtd_r;
+    delete fdtd_i;
+}
+
+void Oblique_Biphase_Run::bloch_E(int k1,int k2)
+{
+    int i,j,k;
     
-    for(t=0;t<Nt;t++)
+    for(k=k1;k<k2;k++)
     {
-        // Bloch Conditions - H
-        
-        for(k=0;k<Nz;k++)
+        for(i=0;i<Nx;i++)
         {
-            for(i=0;i<Nx;i++)
-            {
-                i_H=fdtd_r.Hx(i,Ny-1,k)+fdtd_i.Hx(i,Ny-1,k)*Im;
-                
-                fdtd_r.Hx(i,Ny,k)=std::real(i_H*dephasH_y);
-                fdtd_i.Hx(i,Ny,k)=std::imag(i_H*dephasH_y);
-                
-                i_H=fdtd_r.Hz(i,Ny-1,k)+fdtd_i.Hz(i,Ny-1,k)*Im;
-                
-                fdtd_r.Hz(i,Ny,k)=std::real(i_H*dephasH_y);
-                fdtd_i.Hz(i,Ny,k)=std::imag(i_H*dephasH_y);
-            }
-            
-            for(j=0;j<Ny;j++)
-            {
-                i_H=fdtd_r.Hy(Nx-1,j,k)+fdtd_i.Hy(Nx-1,j,k)*Im;
-                
-                fdtd_r.Hy(Nx,j,k)=std::real(i_H*dephasH_x);
-                fdtd_i.Hy(Nx,j,k)=std::imag(i_H*dephasH_x);
-                
-                i_H=fdtd_r.Hz(Nx-1,j,k)+fdtd_i.Hz(Nx-1,j,k)*Im;
-                
-                fdtd_r.Hz(Nx,j,k)=std::real(i_H*dephasH_x);
-                fdtd_i.Hz(Nx,j,k)=std::imag(i_H*dephasH_x);
-            }
+            bloch_copy(fdtd_r->Ex,fdtd_i->Ex,i,0,i,Ny,k,dEy_r,dEy_i);
+            bloch_copy(fdtd_r->Ez,fdtd_i->Ez,i,0,i,Ny,k,dEy_r,dEy_i);
         }
         
-        // E-field computation
-        
-        fdtd_r.update_E();
-        fdtd_i.update_E();
+        for(j=0;j<Ny;j++)
+        {
+            bloch_copy(fdtd_r->Ey,fdtd_i->Ey,0,j,Nx,j,k,dEx_r,dEx_i);
+            bloch_copy(fdtd_r->Ez,fdtd_i->Ez,0,j,Nx,j,k,dEx_r,dEx_i);
+        }
+    }
+}
+
+void Oblique_Biphase_Run::bloch_H(int k1,int k2)
+{
+    int i,j,k;
     
-        // E-field injection
-        
-        inc_field.inject_E(fdtd_r,fdtd_i);
-        
-        //Bloch Conditions - E
-        
-        for(k=0;k<Nz;k++)
+    for(k=k1;k<k2;k++)
+    {
+        for(i=0;i<Nx;i++)
         {
-            for(i=0;i<Nx;i++)
-            {
-                i_E=fdtd_r.Ex(i,0,k)+fdtd_i.Ex(i,0,k)*Im;
-                
-                fdtd_r.Ex(i,Ny,k)=std::real(i_E*dephasE_y);
-                fdtd_i.Ex(i,Ny,k)=std::imag(i_E*dephasE_y);
-                
-                i_E=fdtd_r.Ez(i,0,k)+fdtd_i.Ez(i,0,k)*Im;
-                
-                fdtd_r.Ez(i,Ny,k)=std::real(i_E*dephasE_y);
-                fdtd_i.Ez(i,Ny,k)=std::imag(i_E*dephasE_y);
-            }
-            
-            for(j=0;j<Ny;j++)
-            {
-                i_E=fdtd_r.Ey(0,j,k)+fdtd_i.Ey(0,j,k)*Im;
-                
-                fdtd_r.Ey(Nx,j,k)=std::real(i_E*dephasE_x);
-                fdtd_i.Ey(Nx,j,k)=std::imag(i_E*dephasE_x);
-                
-                i_E=fdtd_r.Ez(0,j,k)+fdtd_i.Ez(0,j,k)*Im;
-                
-                fdtd_r.Ez(Nx,j,k)=std::real(i_E*dephasE_x);
-                fdtd_i.Ez(Nx,j,k)=std::imag(i_E*dephasE_x);
-            }
+            bloch_copy(fdtd_r->Hx,fdtd_i->Hx,i,Ny-1,i,Ny,k,dHy_r,dHy_i);
+            bloch_copy(fdtd_r->Hz,fdtd_i->Hz,i,Ny-1,i,Ny,k,dHy_r,dHy_i);
         }
         
-        // H-field update
-        
-        fdtd_r.update_H();
-        fdtd_i.update_H();
-        
-        // H-field injection
-        
-        inc_field.inject_H(fdtd_r,fdtd_i);
-        
-        for(unsigned int i=0;i<sensors.size();i++)
-            sensors[i]->feed(fdtd_r);
-        
-        if(t/static_cast<double>(Nt)<=pk/100.0 && (t+1.0)/Nt>pk/100.0)
+        for(j=0;j<Ny;j++)
         {
-            fdtd_r.draw(t,vmode,Nx/2,Ny/2,Nz/2);
-            
-            pk++;
+            bloch_copy(fdtd_r->Hy,fdtd_i->Hy,Nx-1,j,Nx,j,k,dHx_r,dHx_i);
+            bloch_copy(fdtd_r->Hz,fdtd_i->Hz,Nx-1,j,Nx,j,k,dHx_r,dHx_i);
         }
+    }
+}
+
+void Oblique_Biphase_Run::record(int t)
+{
+    int i,j;
+    
+    feed_sensors(sensors,*fdtd_r);
+    
+    if(t/static_cast<double>(Nt)<=pk/100.0 && (t+1.0)/Nt>pk/100.0)
+    {
+        fdtd_r->draw(t,0,Nx/2,Ny/2,Nz/2);
         
-        //###############
-        //   Fourier
-        //###############
-        
-        double tb=(t+0.5)*Dt; //calibration
-        
-        double z=zs_s*Dz;
-        
-        BRsensorX[t]=0; BRsensorY[t]=0; BRsensorZ[t]=0;
-        RsensorX[t]=0;  RsensorY[t]=0;  RsensorZ[t]=0;
-        BTsensorX[t]=0; BTsensorY[t]=0; BTsensorZ[t]=0;
-        TsensorX[t]=0;  TsensorY[t]=0;  TsensorZ[t]=0;
+        pk++;
+    }
+    
+    //###############
+    //   Fourier
+    //###############
+    
+    double tb=(t+0.5)*Dt; //calibration
+    
+    double z=zs_s*Dz;
+    
+    BRsensorX[t]=0; BRsensorY[t]=0; BRsensorZ[t]=0;
+    RsensorX[t]=0;  RsensorY[t]=0;  RsensorZ[t]=0;
+    BTsensorX[t]=0; BTsensorY[t]=0; BTsensorZ[t]=0;
+    TsensorX[t]=0;  TsensorY[t]=0;  TsensorZ[t]=0;
+    
+    inc_field->get_E(inc_Ex,inc_Ey,inc_Ez,z,tb);
+    
+    for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
+    {
+        BRsensorX[t]+=inc_Ex(i,j)*mk_x(i,j);
+        BRsensorY[t]+=inc_Ey(i,j)*mk_y(i,j);
+        BRsensorZ[t]+=inc_Ez(i,j)*mk_z(i,j);
         
-        inc_field.get_E(inc_Ex,inc_Ey,inc_Ez,z,tb);
+        RsensorX[t]+=fdtd_r->Ex(i,j,zs_e+2)*mk_x(i,j);
+        RsensorY[t]+=fdtd_r->Ey(i,j,zs_e+2)*mk_y(i,j);
+        RsensorZ[t]+=0.5*(fdtd_r->Ez(i,j,zs_e+1)+fdtd_r->Ez(i,j,zs_e+2))*mk_z(i,j);
         
-        for(i=0;i<Nx;i++) for(j=0;j<Ny;j++)
-        {
-            BRsensorX[t]+=inc_Ex(i,j)*mk_x(i,j);
-            BRsensorY[t]+=inc_Ey(i,j)*mk_y(i,j);
-            BRsensorZ[t]+=inc_Ez(i,j)*mk_z(i,j);
-            
-            RsensorX[t]+=fdtd_r.Ex(i,j,zs_e+2)*mk_x(i,j);
-            RsensorY[t]+=fdtd_r.Ey(i,j,zs_e+2)*mk_y(i,j);
-            RsensorZ[t]+=0.5*(fdtd_r.Ez(i,j,zs_e+1)+fdtd_r.Ez(i,j,zs_e+2))*mk_z(i,j);
-            
-            BTsensorX[t]+=inc_Ex(i,j)*mk_x(i,j);
-            BTsensorY[t]+=inc_Ey(i,j)*mk_y(i,j);
-            BTsensorZ[t]+=inc_Ez(i,j)*mk_z(i,j);
-            
-            TsensorX[t]+=fdtd_r.Ex(i,j,zs_s)*mk_x(i,j);
-            TsensorY[t]+=fdtd_r.Ey(i,j,zs_s)*mk_y(i,j);
-            TsensorZ[t]+=0.5*(fdtd_r.Ez(i,j,zs_s)+fdtd_r.Ez(i,j,zs_s-1))*mk_z(i,j);
-        }
-                
-        if(time_type==TIME_FT && t%cc_step==0)
-        {
-            if(cpl_sensor->completion_check()) break;
-            
-            int Nt_est=std::min(Nt,cpl_sensor->estimate());
-            dspt.set_end(Nt_est);
-        }
+        BTsensorX[t]+=inc_Ex(i,j)*mk_x(i,j);
+        BTsensorY[t]+=inc_Ey(i,j)*mk_y(i,j);
+        BTsensorZ[t]+=inc_Ez(i,j)*mk_z(i,j);
         
-        ++dspt;
+        TsensorX[t]+=fdtd_r->Ex(i,j,zs_s)*mk_x(i,j);
+        TsensorY[t]+=fdtd_r->Ey(i,j,zs_s)*mk_y(i,j);
+        TsensorZ[t]+=0.5*(fdtd_r->Ez(i,j,zs_s)+fdtd_r->Ez(i,j,zs_s-1))*mk_z(i,j);
+    }
+    
+    if(fdtd_mode.time_type==TIME_FT && t%fdtd_mode.cc_step==0)
+    {
+        if(cpl_sensor->completion_check()) completed=true;
+        else Nt_est=std::min(Nt,cpl_sensor->estimate());
     }
+}
+
+void Oblique_Biphase_Run::spectra(Spectrum &TE_spectrum_ref_out,Spectrum &TM_spectrum_ref_out,
+                                  Spectrum &TE_spectrum_trans_out,Spectrum &TM_spectrum_trans_out)
+{
+    int l,t;
+    
+    std::string polar_mode=fdtd_mode.polarization;
+    
+    int Nl=fdtd_mode.Nl;
+    double lambda_min=fdtd_mode.lambda_min;
+    double lambda_max=fdtd_mode.lambda_max;
     
     // Spectrum resizing
     
@@ -378,7 +385,7 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
     Grid1<Imdouble> TSpX(Nl,0),TSpY(Nl,0),TSpZ(Nl,0);
     
     double hsup,hsub,hstruc;
-    fdtd_r.find_slab(zs_s,zs_e+2,hsub,hstruc,hsup);
+    fdtd_r->find_slab(zs_s,zs_e+2,hsub,hstruc,hsup);
     
     ProgDisp dsp(Nl,"Fourier Transform");
     
@@ -392,7 +399,7 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
     
     std::stringstream fang_name;
     fang_name<<fdtd_mode.prefix<<"angdata_"<<sim_index;
-    std::ofstream fang(fang_name.str(),std::ios::out|std::ios::trunc);
+    std::ofstream fang(fdtd_mode.directory/fang_name.str(),std::ios::out|std::ios::trunc);
         
     AngleRad inc_ang,
           ref_ang,
@@ -524,8 +531,134 @@ void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,double kx_in,double ky
     TM_spectrum_trans_out=TM_spectrum_trans;
     
     for(unsigned int i=0;i<sensors.size();i++) sensors[i]->treat();
+}
+
+//####################
+//   Batch stepping
+//####################
+
+// Bloch copies of all the runs of a batch, split along z on the shared pool
+// while the FDTD workers are parked between two updates
+
+class Oblique_Bloch_Task: public PoolTask
+{
+    public:
+        bool field_E;
+        int Nz,Nchunks;
+        std::vector<Oblique_Biphase_Run*> const &runs;
+        
+        Oblique_Bloch_Task(std::vector<Oblique_Biphase_Run*> const &runs);
+        
+        void apply(bool field_E);
+        void pool_run(int chunk,int Nchunks) override;
+};
+
+Oblique_Bloch_Task::Oblique_Bloch_Task(std::vector<Oblique_Biphase_Run*> const &runs_)
+    :field_E(true),
+     Nz(runs_[0]->Nz),
+     Nchunks(std::min(max_threads_number(),Nz)),
+     runs(runs_)
+{
+}
+
+void Oblique_Bloch_Task::apply(bool field_E_)
+{
+    field_E=field_E_;
     
-    for(unsigned int i=0;i<sensors.size();i++) delete sensors[i];
+    if(Nchunks<=1) pool_run(0,1);
+    else
+    {
+        PoolGroup group;
+        
+        shared_pool().submit(this,Nchunks,group);
+        shared_pool().wait(group);
+    }
+}
+
+void Oblique_Bloch_Task::pool_run(int chunk,int Nchunks_)
+{
+    int k1=(chunk*Nz)/Nchunks_;
+    int k2=((chunk+1)*Nz)/Nchunks_;
+    
+    for(std::size_t r=0;r<runs.size();r++)
+    {
+        if(field_E) runs[r]->bloch_E(k1,k2);
+        else runs[r]->bloch_H(k1,k2);
+    }
+}
+
+void FDTD_oblique_biphase_comp(FDTD_Mode const &fdtd_mode,std::vector<Oblique_Biphase_Run*> &runs)
+{
+    int t;
+    unsigned int r;
+    
+    int Nt=fdtd_mode.Nt;
+    
+    FDTD &lead=*(runs[0]->fdtd_r);
+    
+    Oblique_Bloch_Task bloch(runs);
+    
+    ProgTimeDisp dspt(Nt);
+    
+    for(t=0;t<Nt;t++)
+    {
+        // Bloch Conditions - H
+        
+        bloch.apply(false);
+        
+        // E-field computation, every grid of the batch in the same sweep
+        
+        lead.update_E();
+        
+        // E-field injection and Bloch Conditions - E
+        
+        FDTD_PROF_START(t_inj_E);
+        
+        for(r=0;r<runs.size();r++)
+            runs[r]->inc_field->inject_E(*(runs[r]->fdtd_r),*(runs[r]->fdtd_i));
+        
+        bloch.apply(true);
+        
+        FDTD_PROF_STOP(t_inj_E,FDTD_Profiler::PROF_SOURCES);
+        
+        // H-field update
+        
+        lead.update_H();
+        
+        // H-field injection
+        
+        FDTD_PROF_START(t_inj_H);
+        
+        for(r=0;r<runs.size();r++)
+            runs[r]->inc_field->inject_H(*(runs[r]->fdtd_r),*(runs[r]->fdtd_i));
+        
+        FDTD_PROF_STOP(t_inj_H,FDTD_Profiler::PROF_SOURCES);
+        
+        // Sensors, completed runs keep being stepped but are no longer recorded
+        
+        bool all_completed=true;
+        int Nt_est=0;
+        
+        for(r=0;r<runs.size();r++)
+        {
+            if(runs[r]->completed) continue;
+            
+            runs[r]->record(t);
+            
+            if(!runs[r]->completed)
+            {
+                all_completed=false;
+                Nt_est=std::max(Nt_est,runs[r]->Nt_est);
+            }
+        }
+        
+        if(all_completed) break;
+        
+        if(fdtd_mode.time_type==TIME_FT && t%fdtd_mode.cc_step==0)
+            dspt.set_end(Nt_est);
+        
+        ++dspt;
+    }
 }
 
 void FDTD_oblique_biphase_get_kp(FDTD_Mode const &fdtd_mode,std::vector<double> &kp_arr)
@@ -635,50 +768,87 @@ void FDTD_oblique_biphase(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
         
     SpectrumCollec sp_collec;
         
-    for(m=0;m<static_cast<int>(kp_arr.size());m++)
+    // Shared discretization
+    
+    int Nx=60;
+    int Ny=60;
+    int Nz=60;
+    
+    double lx,ly,lz;
+    
+    fdtd_mode.structure->retrieve_nominal_size(lx,ly,lz);
+    fdtd_mode.compute_discretization(Nx,Ny,Nz,lx,ly,lz);
+    
+    Grid3<unsigned int> matsgrid(Nx,Ny,Nz,0);
+    std::vector<Material> grid_materials;
+    fdtd_mode.discretize(matsgrid,grid_materials,Nx,Ny,Nz);
+    
+    int Nkp=kp_arr.size();
+    int Nbatch=std::max(1,fdtd_mode.obl_phase_batch);
+    
+    for(int m0=0;m0<Nkp;m0+=Nbatch)
     {
-        double kp=kp_arr[m];
-        
-        chk_var(kp);
-        
-        double kx=kp*std::cos(fdtd_mode.obl_phase_phi);
-        double ky=kp*std::sin(fdtd_mode.obl_phase_phi);
-        
-        Spectrum TE_spectrum_ref,TE_spectrum_trans;
-        Spectrum TM_spectrum_ref,TM_spectrum_trans;
-        
-        FDTD_oblique_biphase_comp(fdtd_mode,kx,ky,
-                                  TE_spectrum_ref,TM_spectrum_ref,
-                                  TE_spectrum_trans,TM_spectrum_trans,m);
+        int m1=std::min(Nkp,m0+Nbatch);
         
-        int Nl=TE_spectrum_ref.N;
+        std::vector<Oblique_Biphase_Run*> runs;
+        FDTD *lead=nullptr;
         
-        std::stringstream fname;
-        fname<<fdtd_mode.prefix<<"obl_"<<m;
+        for(m=m0;m<m1;m++)
+        {
+            double kp=kp_arr[m];
+            
+            chk_var(kp);
+            
+            double kx=kp*std::cos(fdtd_mode.obl_phase_phi);
+            double ky=kp*std::sin(fdtd_mode.obl_phase_phi);
+            
+            runs.push_back(new Oblique_Biphase_Run(fdtd_mode,matsgrid,grid_materials,kx,ky,m,lead));
+            lead=runs[0]->fdtd_r;
+        }
         
-        std::ofstream file(fname.str(),std::ios::out|std::ios::trunc);
+        FDTD_oblique_biphase_comp(fdtd_mode,runs);
         
-        for(l=0;l<Nl;l++)
+        for(m=m0;m<m1;m++)
         {
-            using std::abs;
-            using std::arg;
+            Spectrum TE_spectrum_ref,TE_spectrum_trans;
+            Spectrum TM_spectrum_ref,TM_spectrum_trans;
+            
+            runs[m-m0]->spectra(TE_spectrum_ref,TM_spectrum_ref,
+                                TE_spectrum_trans,TM_spectrum_trans);
+            
+            int Nl=TE_spectrum_ref.N;
             
-            double lambda=TE_spectrum_ref.lambda[l];
-            double ang=TE_spectrum_ref.ang[l].degree();
+            std::stringstream fname;
+            fname<<fdtd_mode.prefix<<"obl_"<<m;
             
-            file<<lambda<<" "
-                <<ang<<" "
-                <<abs(TE_spectrum_ref.spect[l])<<" "<<arg(TE_spectrum_ref.spect[l])<<" "
-                <<abs(TM_spectrum_ref.spect[l])<<" "<<arg(TM_spectrum_ref.spect[l])<<" "
-                <<abs(TE_spectrum_trans.spect[l])<<" "<<arg(TE_spectrum_trans.spect[l])<<" "
-                <<abs(TM_spectrum_trans.spect[l])<<" "<<arg(TM_spectrum_trans.spect[l])<<std::endl;
+            std::ofstream file(fdtd_mode.directory/fname.str(),std::ios::out|std::ios::trunc);
+            
+            for(l=0;l<Nl;l++)
+            {
+                using std::abs;
+                using std::arg;
+                
+                double lambda=TE_spectrum_ref.lambda[l];
+                double ang=TE_spectrum_ref.ang[l].degree();
+                
+                file<<lambda<<" "
+                    <<ang<<" "
+                    <<abs(TE_spectrum_ref.spect[l])<<" "<<arg(TE_spectrum_ref.spect[l])<<" "
+                    <<abs(TM_spectrum_ref.spect[l])<<" "<<arg(TM_spectrum_ref.spect[l])<<" "
+                    <<abs(TE_spectrum_trans.spect[l])<<" "<<arg(TE_spectrum_trans.spect[l])<<" "
+                    <<abs(TM_spectrum_trans.spect[l])<<" "<<arg(TM_spectrum_trans.spect[l])<<std::endl;
+            }
+            
+            file.close();
         }
         
-        file.close();
+        // The lead run owns the worker threads of the batch and goes last
+        
+        for(m=m1-1;m>=m0;m--) delete runs[m-m0];
     }
     
     std::string col_fname=fdtd_mode.prefix;
     col_fname.append("obl_fullspec");
     
-    sp_collec.write(col_fname);
+    sp_collec.write((fdtd_mode.directory/col_fname).generic_string());
 }
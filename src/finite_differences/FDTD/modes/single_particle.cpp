@@ -15,6 +15,8 @@ limitations under the License.*/
 #include <bitmap3.h>
 #include <data_hdl.h>
 #include <fdtd_core.h>
+#include <fdtd_subgrid.h>
+#include <fdtd_tfsf.h>
 #include <lua_fdtd.h>
 
 extern const Imdouble Im;
@@ -27,7 +29,7 @@ extern std::ofstream plog;
 
 void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_computation,ProgTimeDisp *dsp_,Bitmap *bitmap_)
 {
-    int i,j,k,l,t;
+    int k,l,t;
     
     int Nx=60;
     int Ny=60;
@@ -119,6 +121,7 @@ void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
     fdtd_aux.set_pml_zm(fdtd_mode.kappa_zm,fdtd_mode.sigma_zm,fdtd_mode.alpha_zm);
     fdtd_aux.set_pml_zp(fdtd_mode.kappa_zp,fdtd_mode.sigma_zp,fdtd_mode.alpha_zp);
     
+    fdtd.set_directory(fdtd_mode.directory);
     fdtd.set_prefix(fdtd_mode.prefix);
     
     // Grid and materials
@@ -196,6 +199,54 @@ void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
     std::cout<<"Computing"<<std::endl;
     
     fdtd.bootstrap();
+    if(fdtd_mode.autotune_steps>0) fdtd.autotune(fdtd_mode.autotune_steps);
+    
+    // Total-field/scattered-field box, fed by the auxiliary grid
+    
+    FDTD_TFSF tfsf(fdtd,fdtd_aux,inj_chp,eps_sup,zs_e-1+5,
+                   xs_s,xs_e,ys_s,ys_e,zs_s,zs_e,
+                   periodic_x,periodic_y);
+    
+    fdtd.link_tfsf(tfsf);
+    
+    // Subgrids, which must lie within the total field region along with
+    // their one cell buffer
+    
+    for(unsigned int n=0;n<fdtd_mode.sub_ratio.size();n++)
+    {
+        int ratio=fdtd_mode.sub_ratio[n];
+        
+        int i1=xs_s+nearest_integer(fdtd_mode.sub_x1[n]/Dx);
+        int i2=xs_s+nearest_integer(fdtd_mode.sub_x2[n]/Dx);
+        int j1=ys_s+nearest_integer(fdtd_mode.sub_y1[n]/Dy);
+        int j2=ys_s+nearest_integer(fdtd_mode.sub_y2[n]/Dy);
+        int k1=zs_s+nearest_integer(fdtd_mode.sub_z1[n]/Dz);
+        int k2=zs_s+nearest_integer(fdtd_mode.sub_z2[n]/Dz);
+        
+        if(   (!periodic_x && (i1-1<=xs_s || i2+1>=xs_e))
+           || (!periodic_y && (j1-1<=ys_s || j2+1>=ys_e))
+           || k1-1<=zs_s || k2+1>=zs_e)
+        {
+            std::cerr<<"Error: subgrid "<<n<<" crosses the injection surface"<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        
+        FDTD_Subgrid *subgrid=fdtd.add_subgrid(i1,i2,j1,j2,k1,k2,ratio);
+        FDTD &fine=*(subgrid->fine);
+        
+        Grid3<unsigned int> fine_grid(fine.Nx,fine.Ny,fine.Nz,0);
+        
+        fdtd_mode.structure->discretize_box(fine_grid,fine.Nx,fine.Ny,fine.Nz,
+                                            (i1-xs_s)*Dx,(j1-ys_s)*Dy,(k1-zs_s)*Dz,
+                                            Dx/ratio,Dy/ratio,Dz/ratio);
+        
+        fine.set_matsgrid(fine_grid);
+        
+        for(unsigned int m=0;m<fdtd_mode.materials.size();m++)
+            fine.set_material(m,fdtd_mode.materials[m]);
+        
+        subgrid->bootstrap();
+    }
     
     //Adding sensors
     
@@ -229,8 +280,6 @@ void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
         sensors.push_back(cpl_sensor);
     }
     
-    double tb=0;
-    
     // Real-time outputs
     
     ProgTimeDisp *dspt=nullptr;
@@ -256,130 +305,12 @@ void FDTD_single_particle(FDTD_Mode const &fdtd_mode,std::atomic<bool> *end_comp
     
     for(t=0;t<Nt;t++)
     {
-        // Fields update
-        
-        // E-field
-//        fdtd.update_E();
-        fdtd.update_E_ante();
-        fdtd.update_E_self();
-//        fdtd_aux.update_E();
-        fdtd_aux.update_E_ante();
-        fdtd_aux.update_E_self();
-        
-        // E-field injection
-        
-        tb=t*Dt;
-        double inj_Hx=inj_chp.Hx(0,0,(zs_e-1+5.5)*Dz,tb);
-        double inj_Hy=inj_chp.Hy(0,0,(zs_e-1+5.5)*Dz,tb);
-        
-        fdtd_aux.Ex(0,0,zs_e-1+5)-=fdtd.dtdez*inj_Hy/eps_sup;
-        fdtd_aux.Ey(0,0,zs_e-1+5)+=fdtd.dtdez*inj_Hx/eps_sup;
-        
-        int i1=xs_s; int i2=xs_e;
-        int j1=ys_s; int j2=ys_e;
-        int k1=zs_s; int k2=zs_e;
-        
-        double tmp1,tmp2;
-        double C2x1,C2x2;
-        double C2y1,C2y2;
-        double C2z1,C2z2;
-        
-        // Z
-        for(i=i1;i<i2;i++) for(j=j1;j<j2;j++)
-        {
-            fdtd.mats[fdtd.matsgrid(i,j,k1)].coeffsX(tmp1,tmp2,C2z1);
-            fdtd.mats[fdtd.matsgrid(i,j,k2)].coeffsX(tmp1,tmp2,C2z2);
-            
-            fdtd.Ex(i,j,k1)+=C2z1*fdtd_aux.Hy(0,0,k1-1);
-            fdtd.Ex(i,j,k2)-=C2z2*fdtd_aux.Hy(0,0,k2-1);
-            
-            fdtd.mats[fdtd.matsgrid(i,j,k1)].coeffsY(tmp1,tmp2,C2z1);
-            fdtd.mats[fdtd.matsgrid(i,j,k2)].coeffsY(tmp1,tmp2,C2z2);
-            
-            fdtd.Ey(i,j,k1)-=C2z1*fdtd_aux.Hx(0,0,k1-1);
-            fdtd.Ey(i,j,k2)+=C2z2*fdtd_aux.Hx(0,0,k2-1);
-        }
-        
-        // Y
-        if(!periodic_y) for(i=i1;i<i2;i++) for(k=k1;k<k2;k++)
-        {
-            fdtd.mats[fdtd.matsgrid(i,j1,k)].coeffsX(tmp1,C2y1,tmp2);
-            fdtd.mats[fdtd.matsgrid(i,j2,k)].coeffsX(tmp1,C2y2,tmp2);
-            
-            fdtd.Ex(i,j1,k)-=C2y1*fdtd_aux.Hz(0,0,k);
-            fdtd.Ex(i,j2,k)+=C2y2*fdtd_aux.Hz(0,0,k);
-            
-            fdtd.mats[fdtd.matsgrid(i,j1,k)].coeffsZ(tmp1,tmp2,C2y1);
-            fdtd.mats[fdtd.matsgrid(i,j2,k)].coeffsZ(tmp1,tmp2,C2y2);
-            
-            fdtd.Ez(i,j1,k)+=C2y1*fdtd_aux.Hx(0,0,k);
-            fdtd.Ez(i,j2,k)-=C2y2*fdtd_aux.Hx(0,0,k);
-        }
+        // Fields update, the TFSF box corrections included
         
-        // X
-        if(!periodic_x) for(k=k1;k<k2;k++) for(j=j1;j<j2;j++)
-        {
-            fdtd.mats[fdtd.matsgrid(i1,j,k)].coeffsY(tmp1,C2x1,tmp2);
-            fdtd.mats[fdtd.matsgrid(i2,j,k)].coeffsY(tmp1,C2x2,tmp2);
-            
-            fdtd.Ey(i1,j,k)+=C2x1*fdtd_aux.Hz(0,0,k);
-            fdtd.Ey(i2,j,k)-=C2x2*fdtd_aux.Hz(0,0,k);
-            
-            fdtd.mats[fdtd.matsgrid(i1,j,k)].coeffsZ(tmp1,C2x1,tmp2);
-            fdtd.mats[fdtd.matsgrid(i2,j,k)].coeffsZ(tmp1,C2x2,tmp2);
-            
-            fdtd.Ez(i1,j,k)-=C2x1*fdtd_aux.Hy(0,0,k);
-            fdtd.Ez(i2,j,k)+=C2x2*fdtd_aux.Hy(0,0,k);
-        }
-        
-        fdtd.update_E_post();
-        fdtd_aux.update_E_post();
-        
-        // H-field
+        fdtd.update_E();
         fdtd.update_H();
-        fdtd_aux.update_H();
-        
-        // H-field injection
-        
-        tb=(t+0.5)*Dt;
-        double inj_Ex=inj_chp.Ex(0,0,(zs_e-1+5)*Dz,tb);
-        double inj_Ey=inj_chp.Ey(0,0,(zs_e-1+5)*Dz,tb);
-        
-        fdtd_aux.Hx(0,0,zs_e-1+5)+=fdtd.dtdmz*inj_Ey;
-        fdtd_aux.Hy(0,0,zs_e-1+5)-=fdtd.dtdmz*inj_Ex;
-        
-        // Z
-        for(i=i1;i<i2;i++) for(j=j1;j<j2;j++)
-        {
-            fdtd.Hx(i,j,k1-1)-=fdtd.dtdmz*fdtd_aux.Ey(0,0,k1);
-            fdtd.Hx(i,j,k2-1)+=fdtd.dtdmz*fdtd_aux.Ey(0,0,k2);
-            
-            fdtd.Hy(i,j,k1-1)+=fdtd.dtdmz*fdtd_aux.Ex(0,0,k1);
-            fdtd.Hy(i,j,k2-1)-=fdtd.dtdmz*fdtd_aux.Ex(0,0,k2);
-        }
-        
-        // Y
-        if(!periodic_y) for(i=i1;i<i2;i++) for(k=k1;k<k2;k++)
-        {
-            fdtd.Hx(i,j1-1,k)+=fdtd.dtdmy*fdtd_aux.Ez(0,0,k);
-            fdtd.Hx(i,j2-1,k)-=fdtd.dtdmy*fdtd_aux.Ez(0,0,k);
-            
-            fdtd.Hz(i,j1-1,k)-=fdtd.dtdmy*fdtd_aux.Ex(0,0,k);
-            fdtd.Hz(i,j2-1,k)+=fdtd.dtdmy*fdtd_aux.Ex(0,0,k);
-        }
-        
-        // X
-        if(!periodic_x) for(k=k1;k<k2;k++) for(j=j1;j<j2;j++)
-        {
-            fdtd.Hy(i1-1,j,k)-=fdtd.dtdmx*fdtd_aux.Ez(0,0,k);
-            fdtd.Hy(i2-1,j,k)+=fdtd.dtdmx*fdtd_aux.Ez(0,0,k);
-            
-            fdtd.Hz(i1-1,j,k)+=fdtd.dtdmx*fdtd_aux.Ey(0,0,k);
-            fdtd.Hz(i2-1,j,k)-=fdtd.dtdmx*fdtd_aux.Ey(0,0,k);
-        }
         
-        for(unsigned int i=0;i<sensors.size();i++)
-            sensors[i]->feed(fdtd);
+        feed_sensors(sensors,fdtd);
         
         if(t%N_disp==0)
         {
@@ -0,0 +1,551 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fieldblock_file.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <zlib.h>
+
+#if defined(unix) || defined(__unix__) || defined(__unix)
+#define UNIX_PLATFORM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const char fb_magic[8]={'A','F','B','L','O','C','K','S'};
+
+// Offset of the index offset in the header, patched once the tiles are written
+
+static const std::uint64_t fb_index_pos=8+5*sizeof(int)+sizeof(double)+6*sizeof(int)+3*sizeof(double);
+static const std::uint64_t fb_legacy_header=sizeof(double)+6*sizeof(int)+3*sizeof(double);
+static const std::uint64_t fb_legacy_record=6*sizeof(Imdouble)+sizeof(unsigned int);
+
+static int fb_value_size(int field) { return field==FB_MATS ? sizeof(unsigned int) : sizeof(Imdouble); }
+
+// Byte regrouping of the values before deflation, the complex fields
+// being treated as pairs of doubles
+
+static int fb_shuffle_size(int field) { return field==FB_MATS ? sizeof(unsigned int) : sizeof(double); }
+
+static void fb_shuffle(std::vector<char> const &in,std::vector<char> &out,int size)
+{
+    std::size_t n,N=in.size()/size;
+    
+    out.resize(in.size());
+    
+    for(int b=0;b<size;b++) for(n=0;n<N;n++)
+        out[b*N+n]=in[n*size+b];
+}
+
+static void fb_unshuffle(std::vector<char> const &in,std::vector<char> &out,int size)
+{
+    std::size_t n,N=in.size()/size;
+    
+    out.resize(in.size());
+    
+    for(int b=0;b<size;b++) for(n=0;n<N;n++)
+        out[n*size+b]=in[b*N+n];
+}
+
+//#######################
+//   FieldBlockHeader
+//#######################
+
+FieldBlockHeader::FieldBlockHeader()
+    :version(2), compression(FB_RAW),
+     tile_x(32), tile_y(32), tile_z(32),
+     lambda(0),
+     x1(0), Nx(0), y1(0), Ny(0), z1(0), Nz(0),
+     Dx(0), Dy(0), Dz(0)
+{
+}
+
+int FieldBlockHeader::tiles_x() const { return (Nx+tile_x-1)/tile_x; }
+int FieldBlockHeader::tiles_y() const { return (Ny+tile_y-1)/tile_y; }
+int FieldBlockHeader::tiles_z() const { return (Nz+tile_z-1)/tile_z; }
+
+//#######################
+//   FieldBlockWriter
+//#######################
+
+FieldBlockWriter::FieldBlockWriter(std::filesystem::path const &fname_,FieldBlockHeader const &header_,
+                                   Grid3<unsigned int> const &mats_,
+                                   Grid3<Imdouble> const &Ex,Grid3<Imdouble> const &Ey,Grid3<Imdouble> const &Ez,
+                                   Grid3<Imdouble> const &Hx,Grid3<Imdouble> const &Hy,Grid3<Imdouble> const &Hz)
+    :success(false),
+     fname(fname_),
+     header(header_),
+     mats(mats_),
+     thread(nullptr)
+{
+    header.version=2;
+    
+    fields[FB_EX]=&Ex; fields[FB_EY]=&Ey; fields[FB_EZ]=&Ez;
+    fields[FB_HX]=&Hx; fields[FB_HY]=&Hy; fields[FB_HZ]=&Hz;
+    
+    thread=new std::thread(&FieldBlockWriter::process,this);
+}
+
+FieldBlockWriter::~FieldBlockWriter()
+{
+    wait();
+}
+
+// Copies a tile in the Grid3 ordering, rows of x being contiguous
+
+void FieldBlockWriter::pack_tile(int field,int ti,int tj,int tk,std::vector<char> &buffer)
+{
+    int j,k;
+    
+    int i1=ti*header.tile_x,i2=std::min(i1+header.tile_x,header.Nx);
+    int j1=tj*header.tile_y,j2=std::min(j1+header.tile_y,header.Ny);
+    int k1=tk*header.tile_z,k2=std::min(k1+header.tile_z,header.Nz);
+    
+    std::size_t row=(i2-i1)*fb_value_size(field);
+    
+    buffer.resize(row*(j2-j1)*(k2-k1));
+    
+    char *out=buffer.data();
+    
+    for(k=k1;k<k2;k++) for(j=j1;j<j2;j++)
+    {
+        if(field==FB_MATS) std::memcpy(out,&mats(i1,j,k),row);
+        else std::memcpy(out,&(*fields[field])(i1,j,k),row);
+        
+        out+=row;
+    }
+}
+
+void FieldBlockWriter::process()
+{
+    int f,ti,tj,tk;
+    
+    std::ofstream file(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    
+    if(!file.is_open())
+    {
+        std::cerr<<"Could not write "<<fname.generic_string()<<std::endl;
+        return;
+    }
+    
+    std::uint64_t index_offset=0;
+    
+    file.write(fb_magic,8);
+    file.write(reinterpret_cast<char*>(&header.version),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.compression),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.tile_x),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.tile_y),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.tile_z),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.lambda),sizeof(double));
+    file.write(reinterpret_cast<char*>(&header.x1),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.Nx),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.y1),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.Ny),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.z1),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.Nz),sizeof(int));
+    file.write(reinterpret_cast<char*>(&header.Dx),sizeof(double));
+    file.write(reinterpret_cast<char*>(&header.Dy),sizeof(double));
+    file.write(reinterpret_cast<char*>(&header.Dz),sizeof(double));
+    file.write(reinterpret_cast<char*>(&index_offset),sizeof(std::uint64_t));
+    
+    int Ntiles=header.tiles_x()*header.tiles_y()*header.tiles_z();
+    
+    std::vector<std::uint64_t> index(2*FB_NFIELDS*Ntiles,0);
+    std::vector<char> raw,shuffled,packed;
+    
+    for(f=0;f<FB_NFIELDS;f++)
+    {
+        for(tk=0;tk<header.tiles_z();tk++)
+        for(tj=0;tj<header.tiles_y();tj++)
+        for(ti=0;ti<header.tiles_x();ti++)
+        {
+            pack_tile(f,ti,tj,tk,raw);
+            
+            char const *out=raw.data();
+            std::uint64_t out_size=raw.size();
+            
+            if(header.compression!=FB_RAW)
+            {
+                std::vector<char> const *source=&raw;
+                
+                if(header.compression==FB_SHUFFLE_DEFLATE)
+                {
+                    fb_shuffle(raw,shuffled,fb_shuffle_size(f));
+                    source=&shuffled;
+                }
+                
+                uLongf packed_size=compressBound(raw.size());
+                packed.resize(packed_size);
+                
+                if(compress2(reinterpret_cast<Bytef*>(packed.data()),&packed_size,
+                             reinterpret_cast<Bytef const*>(source->data()),raw.size(),Z_BEST_SPEED)!=Z_OK)
+                {
+                    std::cerr<<"Could not compress "<<fname.generic_string()<<std::endl;
+                    
+                    file.close();
+                    std::filesystem::remove(fname);
+                    
+                    return;
+                }
+                
+                out=packed.data();
+                out_size=packed_size;
+            }
+            
+            int n=f*Ntiles+ti+header.tiles_x()*(tj+header.tiles_y()*tk);
+            
+            index[2*n+0]=file.tellp();
+            index[2*n+1]=out_size;
+            
+            file.write(out,out_size);
+        }
+    }
+    
+    index_offset=file.tellp();
+    
+    file.write(reinterpret_cast<char*>(index.data()),index.size()*sizeof(std::uint64_t));
+    
+    file.seekp(fb_index_pos);
+    file.write(reinterpret_cast<char*>(&index_offset),sizeof(std::uint64_t));
+    
+    success=file.good();
+    
+    file.close();
+}
+
+bool FieldBlockWriter::wait()
+{
+    if(thread!=nullptr)
+    {
+        thread->join();
+        delete thread;
+        
+        thread=nullptr;
+    }
+    
+    return success;
+}
+
+//#######################
+//   FieldBlockReader
+//#######################
+
+FieldBlockReader::FieldBlockReader()
+    :legacy(false),
+     file_size(0),
+     map(nullptr),
+     cached_field(-1), cached_tile(-1)
+{
+}
+
+FieldBlockReader::~FieldBlockReader()
+{
+    close();
+}
+
+void FieldBlockReader::close()
+{
+    #ifdef UNIX_PLATFORM
+    if(map!=nullptr) munmap(const_cast<char*>(map),file_size);
+    #endif
+    
+    map=nullptr;
+    
+    if(file.is_open()) file.close();
+    
+    file_size=0;
+    cached_field=cached_tile=-1;
+    
+    tile_offset.clear();
+    tile_size.clear();
+}
+
+void FieldBlockReader::fetch(std::uint64_t offset,std::uint64_t size,char *out)
+{
+    if(offset+size>file_size)
+    {
+        std::cerr<<"Truncated fieldblock file"<<std::endl;
+        std::memset(out,0,size);
+        return;
+    }
+    
+    if(map!=nullptr) std::memcpy(out,map+offset,size);
+    else
+    {
+        file.seekg(offset);
+        file.read(out,size);
+    }
+}
+
+bool FieldBlockReader::open(std::filesystem::path const &fname)
+{
+    close();
+    
+    std::error_code err;
+    file_size=std::filesystem::file_size(fname,err);
+    
+    if(err || file_size<fb_legacy_header) return false;
+    
+    #ifdef UNIX_PLATFORM
+    int fd=::open(fname.c_str(),O_RDONLY);
+    
+    if(fd>=0)
+    {
+        void *ptr=mmap(nullptr,file_size,PROT_READ,MAP_PRIVATE,fd,0);
+        ::close(fd);
+        
+        if(ptr!=MAP_FAILED) map=static_cast<char const*>(ptr);
+    }
+    #endif
+    
+    if(map==nullptr)
+    {
+        file.open(fname,std::ios::in|std::ios::binary);
+        
+        if(!file.is_open()) return false;
+    }
+    
+    char magic[8];
+    std::uint64_t pos=0;
+    
+    fetch(0,8,magic);
+    
+    legacy=std::memcmp(magic,fb_magic,8)!=0;
+    
+    if(legacy)
+    {
+        header=FieldBlockHeader();
+        header.version=1;
+        
+        fetch_value(pos,header.lambda);
+        fetch_value(pos,header.x1); fetch_value(pos,header.Nx);
+        fetch_value(pos,header.y1); fetch_value(pos,header.Ny);
+        fetch_value(pos,header.z1); fetch_value(pos,header.Nz);
+        fetch_value(pos,header.Dx); fetch_value(pos,header.Dy); fetch_value(pos,header.Dz);
+        
+        if(header.Nx<=0 || header.Ny<=0 || header.Nz<=0)
+        {
+            close();
+            return false;
+        }
+        
+        std::uint64_t Nxyz=static_cast<std::uint64_t>(header.Nx)*header.Ny*header.Nz;
+        
+        if(fb_legacy_header+Nxyz*fb_legacy_record>file_size)
+        {
+            close();
+            return false;
+        }
+    }
+    else
+    {
+        std::uint64_t index_offset;
+        
+        pos=8;
+        
+        fetch_value(pos,header.version);
+        fetch_value(pos,header.compression);
+        fetch_value(pos,header.tile_x); fetch_value(pos,header.tile_y); fetch_value(pos,header.tile_z);
+        fetch_value(pos,header.lambda);
+        fetch_value(pos,header.x1); fetch_value(pos,header.Nx);
+        fetch_value(pos,header.y1); fetch_value(pos,header.Ny);
+        fetch_value(pos,header.z1); fetch_value(pos,header.Nz);
+        fetch_value(pos,header.Dx); fetch_value(pos,header.Dy); fetch_value(pos,header.Dz);
+        fetch_value(pos,index_offset);
+        
+        // Checked before anything divides by the tile sizes
+        
+        if(header.tile_x<=0 || header.tile_y<=0 || header.tile_z<=0 ||
+           header.Nx<=0 || header.Ny<=0 || header.Nz<=0 ||
+           header.compression<FB_RAW || header.compression>FB_SHUFFLE_DEFLATE)
+        {
+            close();
+            return false;
+        }
+        
+        std::uint64_t Nentries=static_cast<std::uint64_t>(FB_NFIELDS)
+                               *header.tiles_x()*header.tiles_y()*header.tiles_z();
+        
+        if(header.version!=2 || index_offset+2*Nentries*sizeof(std::uint64_t)>file_size)
+        {
+            close();
+            return false;
+        }
+        
+        tile_offset.resize(Nentries);
+        tile_size.resize(Nentries);
+        
+        for(std::uint64_t n=0;n<Nentries;n++)
+        {
+            fetch_value(index_offset,tile_offset[n]);
+            fetch_value(index_offset,tile_size[n]);
+        }
+    }
+    
+    return true;
+}
+
+// Decoded content of a tile, read in place for raw tiles of mapped files
+
+char const* FieldBlockReader::tile(int field,int t)
+{
+    int Ntiles=header.tiles_x()*header.tiles_y()*header.tiles_z();
+    int n=field*Ntiles+t;
+    
+    int ti=t%header.tiles_x();
+    int tj=(t/header.tiles_x())%header.tiles_y();
+    int tk=t/(header.tiles_x()*header.tiles_y());
+    
+    std::size_t raw_size=fb_value_size(field)
+                         *static_cast<std::size_t>(std::min(header.tile_x,header.Nx-ti*header.tile_x))
+                         *std::min(header.tile_y,header.Ny-tj*header.tile_y)
+                         *std::min(header.tile_z,header.Nz-tk*header.tile_z);
+    
+    if(header.compression==FB_RAW)
+    {
+        if(tile_size[n]!=raw_size || tile_offset[n]>file_size || tile_size[n]>file_size-tile_offset[n])
+        {
+            std::cerr<<"Corrupted fieldblock tile"<<std::endl;
+            return nullptr;
+        }
+        
+        if(map!=nullptr) return map+tile_offset[n];
+    }
+    
+    if(field==cached_field && t==cached_tile) return decoded.data();
+    
+    stored.resize(tile_size[n]);
+    fetch(tile_offset[n],tile_size[n],stored.data());
+    
+    if(header.compression==FB_RAW) decoded.swap(stored);
+    else
+    {
+        std::vector<char> &target=(header.compression==FB_SHUFFLE_DEFLATE) ? unpacked : decoded;
+        
+        uLongf size=raw_size;
+        target.resize(raw_size);
+        
+        if(uncompress(reinterpret_cast<Bytef*>(target.data()),&size,
+                      reinterpret_cast<Bytef const*>(stored.data()),stored.size())!=Z_OK || size!=raw_size)
+        {
+            std::cerr<<"Corrupted fieldblock tile"<<std::endl;
+            std::fill(target.begin(),target.end(),0);
+        }
+        
+        if(header.compression==FB_SHUFFLE_DEFLATE)
+            fb_unshuffle(unpacked,decoded,fb_shuffle_size(field));
+    }
+    
+    decoded.resize(raw_size);
+    
+    cached_field=field;
+    cached_tile=t;
+    
+    return decoded.data();
+}
+
+// Legacy files interleave the fields per voxel with z as the fastest index
+
+void FieldBlockReader::read_legacy(int field,int i1,int i2,int j1,int j2,int k1,int k2,char *out)
+{
+    int i,j,k;
+    int bx=i2-i1,by=j2-j1;
+    std::size_t size=fb_value_size(field);
+    std::uint64_t shift=(field==FB_MATS) ? 6*sizeof(Imdouble) : field*sizeof(Imdouble);
+    
+    stored.resize((k2-k1)*fb_legacy_record);
+    
+    for(i=i1;i<i2;i++) for(j=j1;j<j2;j++)
+    {
+        std::uint64_t offset=fb_legacy_header
+                             +((static_cast<std::uint64_t>(i)*header.Ny+j)*header.Nz+k1)*fb_legacy_record;
+        
+        fetch(offset,stored.size(),stored.data());
+        
+        for(k=k1;k<k2;k++)
+            std::memcpy(out+size*((i-i1)+bx*((j-j1)+static_cast<std::size_t>(by)*(k-k1))),
+                        stored.data()+(k-k1)*fb_legacy_record+shift,size);
+    }
+}
+
+void FieldBlockReader::read_tiles(int field,int i1,int i2,int j1,int j2,int k1,int k2,char *out)
+{
+    int j,k,ti,tj,tk;
+    int bx=i2-i1,by=j2-j1;
+    std::size_t size=fb_value_size(field);
+    
+    int TX=header.tile_x,TY=header.tile_y,TZ=header.tile_z;
+    
+    for(tk=k1/TZ;tk<=(k2-1)/TZ;tk++)
+    for(tj=j1/TY;tj<=(j2-1)/TY;tj++)
+    for(ti=i1/TX;ti<=(i2-1)/TX;ti++)
+    {
+        char const *data=tile(field,ti+header.tiles_x()*(tj+header.tiles_y()*tk));
+        
+        if(data==nullptr) continue;
+        
+        // Tile extent and its intersection with the box
+        
+        int tx=std::min(TX,header.Nx-ti*TX);
+        int ty=std::min(TY,header.Ny-tj*TY);
+        
+        int ia=std::max(i1,ti*TX),ib=std::min(i2,ti*TX+tx);
+        int ja=std::max(j1,tj*TY),jb=std::min(j2,tj*TY+ty);
+        int ka=std::max(k1,tk*TZ),kb=std::min(k2,tk*TZ+TZ);
+        
+        for(k=ka;k<kb;k++) for(j=ja;j<jb;j++)
+        {
+            std::size_t src=(ia-ti*TX)+tx*((j-tj*TY)+static_cast<std::size_t>(ty)*(k-tk*TZ));
+            std::size_t dst=(ia-i1)+bx*((j-j1)+static_cast<std::size_t>(by)*(k-k1));
+            
+            std::memcpy(out+size*dst,data+size*src,size*(ib-ia));
+        }
+    }
+}
+
+void FieldBlockReader::read_box(int field,int i1,int i2,int j1,int j2,int k1,int k2,Grid3<Imdouble> &G)
+{
+    i1=std::clamp(i1,0,header.Nx); i2=std::clamp(i2,i1,header.Nx);
+    j1=std::clamp(j1,0,header.Ny); j2=std::clamp(j2,j1,header.Ny);
+    k1=std::clamp(k1,0,header.Nz); k2=std::clamp(k2,k1,header.Nz);
+    
+    G.init(i2-i1,j2-j1,k2-k1,0);
+    
+    if(i1==i2 || j1==j2 || k1==k2) return;
+    
+    char *out=reinterpret_cast<char*>(&G(0,0,0));
+    
+    if(legacy) read_legacy(field,i1,i2,j1,j2,k1,k2,out);
+    else read_tiles(field,i1,i2,j1,j2,k1,k2,out);
+}
+
+void FieldBlockReader::read_box(int i1,int i2,int j1,int j2,int k1,int k2,Grid3<unsigned int> &G)
+{
+    i1=std::clamp(i1,0,header.Nx); i2=std::clamp(i2,i1,header.Nx);
+    j1=std::clamp(j1,0,header.Ny); j2=std::clamp(j2,j1,header.Ny);
+    k1=std::clamp(k1,0,header.Nz); k2=std::clamp(k2,k1,header.Nz);
+    
+    G.init(i2-i1,j2-j1,k2-k1,0);
+    
+    if(i1==i2 || j1==j2 || k1==k2) return;
+    
+    char *out=reinterpret_cast<char*>(&G(0,0,0));
+    
+    if(legacy) read_legacy(FB_MATS,i1,i2,j1,j2,k1,k2,out);
+    else read_tiles(FB_MATS,i1,i2,j1,j2,k1,k2,out);
+}
@@ -0,0 +1,152 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#ifndef FIELDBLOCK_FILE_H
+#define FIELDBLOCK_FILE_H
+
+#include <mathUT.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+//###############################
+//   Chunked .afblock format
+//###############################
+
+// Version 2 of the .afblock files: a header, then every field stored as
+// its own plane of 3D tiles, then the index of the tiles, each entry being
+// the offset and stored size of a tile. Inside a tile the values follow
+// the Grid3 ordering, x being the fastest. Tiles are stored raw, deflated,
+// or with the bytes of their values regrouped by significance before
+// being deflated, which compresses the exponents far better.
+// Legacy files, the values of all the fields being interleaved per voxel,
+// start with the wavelength instead of the magic string and stay readable.
+
+enum
+{
+    FB_EX=0,
+    FB_EY,
+    FB_EZ,
+    FB_HX,
+    FB_HY,
+    FB_HZ,
+    FB_MATS,
+    FB_NFIELDS
+};
+
+enum
+{
+    FB_RAW=0,
+    FB_DEFLATE,
+    FB_SHUFFLE_DEFLATE
+};
+
+class FieldBlockHeader
+{
+    public:
+        int version,compression;
+        int tile_x,tile_y,tile_z;
+        double lambda;
+        int x1,Nx,y1,Ny,z1,Nz;
+        double Dx,Dy,Dz;
+        
+        FieldBlockHeader();
+        
+        int tiles_x() const;
+        int tiles_y() const;
+        int tiles_z() const;
+};
+
+//#######################
+//   FieldBlockWriter
+//#######################
+
+// Writes a block from a background thread, the grids having to outlive
+// the writer. The destructor waits for the file to be complete.
+
+class FieldBlockWriter
+{
+    private:
+        bool success;
+        std::filesystem::path fname;
+        FieldBlockHeader header;
+        
+        Grid3<unsigned int> const &mats;
+        Grid3<Imdouble> const *fields[6];
+        
+        std::thread *thread;
+        
+        void pack_tile(int field,int ti,int tj,int tk,std::vector<char> &buffer);
+        void process();
+        
+    public:
+        FieldBlockWriter(std::filesystem::path const &fname,FieldBlockHeader const &header,
+                         Grid3<unsigned int> const &mats,
+                         Grid3<Imdouble> const &Ex,Grid3<Imdouble> const &Ey,Grid3<Imdouble> const &Ez,
+                         Grid3<Imdouble> const &Hx,Grid3<Imdouble> const &Hy,Grid3<Imdouble> const &Hz);
+        ~FieldBlockWriter();
+        
+        bool wait();
+};
+
+//#######################
+//   FieldBlockReader
+//#######################
+
+// Reads sub-boxes of a block without loading the whole file. The file is
+// memory-mapped where the platform allows it and read through a stream
+// otherwise, only the tiles touching the requested box being decoded.
+
+class FieldBlockReader
+{
+    private:
+        bool legacy;
+        std::uint64_t file_size;
+        char const *map;
+        std::ifstream file;
+        
+        std::vector<std::uint64_t> tile_offset,tile_size;
+        
+        int cached_field,cached_tile;
+        std::vector<char> stored,unpacked,decoded;
+        
+        void fetch(std::uint64_t offset,std::uint64_t size,char *out);
+        
+        template<typename T>
+        void fetch_value(std::uint64_t &offset,T &value)
+        {
+            fetch(offset,sizeof(T),reinterpret_cast<char*>(&value));
+            offset+=sizeof(T);
+        }
+        
+        char const* tile(int field,int t);
+        void read_legacy(int field,int i1,int i2,int j1,int j2,int k1,int k2,char *out);
+        void read_tiles(int field,int i1,int i2,int j1,int j2,int k1,int k2,char *out);
+        
+    public:
+        FieldBlockHeader header;
+        
+        FieldBlockReader();
+        ~FieldBlockReader();
+        
+        void close();
+        bool open(std::filesystem::path const &fname);
+        void read_box(int field,int i1,int i2,int j1,int j2,int k1,int k2,Grid3<Imdouble> &G);
+        void read_box(int i1,int i2,int j1,int j2,int k1,int k2,Grid3<unsigned int> &G);
+};
+
+#endif // FIELDBLOCK_FILE_H
@@ -14,7 +14,9 @@ limitations under the License.*/
 
 #include <fieldblock_holder.h>
 
+#include <algorithm>
 #include <fstream>
+#include <limits>
 
 std::string filename_filter(std::string fname)
 {
@@ -511,124 +513,85 @@ double FieldBlockHolder::integrate_poynting_plane(int direction,int i1,int i2,in
 
 bool FieldBlockHolder::load(std::string const &fname)
 {
-    int i,j,k;
-        
-    std::ifstream file(fname.c_str(),std::ios::in|std::ios::binary);
-    
-    file.read(reinterpret_cast<char*>(&lambda),sizeof(double));
-    file.read(reinterpret_cast<char*>(&x1),sizeof(int));
-    file.read(reinterpret_cast<char*>(&Nx),sizeof(int));
-    file.read(reinterpret_cast<char*>(&y1),sizeof(int));
-    file.read(reinterpret_cast<char*>(&Ny),sizeof(int));
-    file.read(reinterpret_cast<char*>(&z1),sizeof(int));
-    file.read(reinterpret_cast<char*>(&Nz),sizeof(int));
-    file.read(reinterpret_cast<char*>(&Dx),sizeof(double));
-    file.read(reinterpret_cast<char*>(&Dy),sizeof(double));
-    file.read(reinterpret_cast<char*>(&Dz),sizeof(double));
+    int N=std::numeric_limits<int>::max();
+    
+    if(!load_box(fname,0,N,0,N,0,N)) return false;
     
     std::cout<<lambda<<std::endl;
     std::cout<<x1<<" "<<y1<<" "<<z1<<std::endl;
     std::cout<<"Nx: "<<Nx<<" Ny: "<<Ny<<" Nz: "<<Nz<<std::endl;
     std::cout<<Dx<<" "<<Dy<<" "<<Dz<<std::endl;
-    std::cout<<file.tellg()<<std::endl;
     
-    mats.init(Nx,Ny,Nz,0);
+    return true;
+}
+
+// Loads the [i1,i2[ x [j1,j2[ x [k1,k2[ part of a block, the origin of the
+// holder being moved to the corner of the box
+
+bool FieldBlockHolder::load_box(std::string const &fname,int i1,int i2,int j1,int j2,int k1,int k2)
+{
+    FieldBlockReader reader;
     
-    Ex.init(Nx,Ny,Nz,0);
-    Ey.init(Nx,Ny,Nz,0);
-    Ez.init(Nx,Ny,Nz,0);
+    if(!reader.open(fname))
+    {
+        std::cerr<<"Could not read "<<fname<<std::endl;
+        return false;
+    }
     
-    Hx.init(Nx,Ny,Nz,0);
-    Hy.init(Nx,Ny,Nz,0);
-    Hz.init(Nx,Ny,Nz,0);
+    FieldBlockHeader const &header=reader.header;
     
-    double p_r,p_i;
+    i1=std::clamp(i1,0,header.Nx); i2=std::clamp(i2,i1,header.Nx);
+    j1=std::clamp(j1,0,header.Ny); j2=std::clamp(j2,j1,header.Ny);
+    k1=std::clamp(k1,0,header.Nz); k2=std::clamp(k2,k1,header.Nz);
     
-    for(i=0;i<Nx;i++) for(j=0;j<Ny;j++) for(k=0;k<Nz;k++)
-    {
-        file.read(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.read(reinterpret_cast<char*>(&p_i),sizeof(double));
-        Ex(i,j,k).real(p_r); Ex(i,j,k).imag(p_i);
-        
-        file.read(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.read(reinterpret_cast<char*>(&p_i),sizeof(double));
-        Ey(i,j,k).real(p_r); Ey(i,j,k).imag(p_i);
-        
-        file.read(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.read(reinterpret_cast<char*>(&p_i),sizeof(double));
-        Ez(i,j,k).real(p_r); Ez(i,j,k).imag(p_i);
-        
-        file.read(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.read(reinterpret_cast<char*>(&p_i),sizeof(double));
-        Hx(i,j,k).real(p_r); Hx(i,j,k).imag(p_i);
-        
-        file.read(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.read(reinterpret_cast<char*>(&p_i),sizeof(double));
-        Hy(i,j,k).real(p_r); Hy(i,j,k).imag(p_i);
-        
-        file.read(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.read(reinterpret_cast<char*>(&p_i),sizeof(double));
-        Hz(i,j,k).real(p_r); Hz(i,j,k).imag(p_i);
-        
-        file.read(reinterpret_cast<char*>(&mats(i,j,k)),sizeof(unsigned int));
-    }
+    lambda=header.lambda;
+    
+    x1=header.x1+i1; Nx=i2-i1;
+    y1=header.y1+j1; Ny=j2-j1;
+    z1=header.z1+k1; Nz=k2-k1;
+    
+    Dx=header.Dx;
+    Dy=header.Dy;
+    Dz=header.Dz;
+    
+    reader.read_box(i1,i2,j1,j2,k1,k2,mats);
+    
+    reader.read_box(FB_EX,i1,i2,j1,j2,k1,k2,Ex);
+    reader.read_box(FB_EY,i1,i2,j1,j2,k1,k2,Ey);
+    reader.read_box(FB_EZ,i1,i2,j1,j2,k1,k2,Ez);
+    
+    reader.read_box(FB_HX,i1,i2,j1,j2,k1,k2,Hx);
+    reader.read_box(FB_HY,i1,i2,j1,j2,k1,k2,Hy);
+    reader.read_box(FB_HZ,i1,i2,j1,j2,k1,k2,Hz);
     
     return true;
 }
 
-bool FieldBlockHolder::save(std::string const &fname)
+bool FieldBlockHolder::load_slice(std::string const &fname,int direction,int index)
 {
-    int i,j,k;
-    
-    std::ofstream file(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    int N=std::numeric_limits<int>::max();
     
-    if(!file.is_open()) return false;
+         if(direction==NORMAL_X) return load_box(fname,index,index+1,0,N,0,N);
+    else if(direction==NORMAL_Y) return load_box(fname,0,N,index,index+1,0,N);
+    else if(direction==NORMAL_Z) return load_box(fname,0,N,0,N,index,index+1);
     
-    file.write(reinterpret_cast<char*>(&lambda),sizeof(double));
-    file.write(reinterpret_cast<char*>(&x1),sizeof(int));
-    file.write(reinterpret_cast<char*>(&Nx),sizeof(int));
-    file.write(reinterpret_cast<char*>(&y1),sizeof(int));
-    file.write(reinterpret_cast<char*>(&Ny),sizeof(int));
-    file.write(reinterpret_cast<char*>(&z1),sizeof(int));
-    file.write(reinterpret_cast<char*>(&Nz),sizeof(int));
-    file.write(reinterpret_cast<char*>(&Dx),sizeof(double));
-    file.write(reinterpret_cast<char*>(&Dy),sizeof(double));
-    file.write(reinterpret_cast<char*>(&Dz),sizeof(double));
-    
-    double p_r,p_i;
+    return false;
+}
+
+bool FieldBlockHolder::save(std::string const &fname,int compression)
+{
+    FieldBlockHeader header;
     
-    for(i=0;i<Nx;i++) for(j=0;j<Ny;j++) for(k=0;k<Nz;k++)
-    {
-        p_r=std::real(Ex(i,j,k)); p_i=std::imag(Ex(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Ey(i,j,k)); p_i=std::imag(Ey(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Ez(i,j,k)); p_i=std::imag(Ez(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Hx(i,j,k)); p_i=std::imag(Hx(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Hy(i,j,k)); p_i=std::imag(Hy(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Hz(i,j,k)); p_i=std::imag(Hz(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        file.write(reinterpret_cast<char*>(&mats(i,j,k)),sizeof(unsigned int));
-    }
+    header.compression=compression;
+    header.lambda=lambda;
+    header.x1=x1; header.Nx=Nx;
+    header.y1=y1; header.Ny=Ny;
+    header.z1=z1; header.Nz=Nz;
+    header.Dx=Dx; header.Dy=Dy; header.Dz=Dz;
     
-    file.close();
+    FieldBlockWriter writer(fname,header,mats,Ex,Ey,Ez,Hx,Hy,Hz);
     
-    return true;
+    return writer.wait();
 }
 
 void FieldBlockHolder::save_matlab(int direction,int location,int field,std::string fname)
@@ -17,6 +17,7 @@ limitations under the License.*/
 
 #include <mathUT.h>
 #include <enum_constants.h>
+#include <fieldblock_file.h>
 
 #include <filesystem>
 
@@ -48,7 +49,9 @@ class FieldBlockHolder
         double integrate_poynting_box(int i1,int i2,int j1,int j2,int k1,int k2);
         double integrate_poynting_plane(int direction,int i1,int i2,int j1,int j2,int k1,int k2);
         bool load(std::string const &fname);
-        bool save(std::string const &fname);
+        bool load_box(std::string const &fname,int i1,int i2,int j1,int j2,int k1,int k2);
+        bool load_slice(std::string const &fname,int direction,int index);
+        bool save(std::string const &fname,int compression=FB_RAW);
         void save_matlab(int direction,int location,int field,std::string fname);
         void set_baseline(double baseline);
         void undo_baseline();
@@ -118,6 +118,7 @@ void Sensor_generator_create_metatable(lua_State *L)
     lua_wrapper<4,Sensor_generator,int>::bind(L,"skip",&Sensor_generator::set_skip);
     lua_wrapper<5,Sensor_generator,double,double,int>::bind(L,"spectrum",&Sensor_generator::set_spectrum);
     lua_wrapper<6,Sensor_generator,double>::bind(L,"wavelength",&Sensor_generator::set_wavelength);
+    lua_wrapper<7,Sensor_generator,std::string>::bind(L,"compression",&Sensor_generator::set_compression);
     
     metatable_add_func(L,"location_grid",sensor_set_location);
     metatable_add_func(L,"location",sensor_set_location_real);
@@ -36,6 +36,22 @@ CompletionSensor::CompletionSensor(double lambda_min_,double lambda_max_,double
 {
 }
 
+void CompletionSensor::checkpoint(Checkpoint &chk)
+{
+    Sensor::checkpoint(chk);
+    
+    chk.sync(energy_last);
+    chk.sync(energy_max);
+    
+    chk.sync(Ex_loc); chk.sync(Ey_loc); chk.sync(Ez_loc);
+    chk.sync(Ex_loc_r); chk.sync(Ex_loc_i);
+    chk.sync(Ey_loc_r); chk.sync(Ey_loc_i);
+    chk.sync(Ez_loc_r); chk.sync(Ez_loc_i);
+    
+    chk.sync(est_step);
+    chk.sync(est_ratio);
+}
+
 bool CompletionSensor::completion_check()
 {
     if(step<2*var_max(Nx,Ny,Nz)) return false;
@@ -52,6 +68,27 @@ bool CompletionSensor::completion_check()
         
         double avg_max=0;
         
+        // On a decomposed grid each point is only fed by the slab holding it
+        
+        Grid2<double> *loc_grids[6]={&Ex_loc_r,&Ey_loc_r,&Ez_loc_r,
+                                     &Ex_loc_i,&Ey_loc_i,&Ez_loc_i};
+        std::vector<Grid2<double>> loc_sum;
+        
+        if(domain!=nullptr)
+        {
+            loc_sum.reserve(6);
+            
+            for(i=0;i<6;i++)
+            {
+                loc_sum.push_back(*loc_grids[i]);
+                domain->sum(loc_sum[i]);
+                loc_grids[i]=&loc_sum[i];
+            }
+        }
+        
+        Grid2<double> &Exr=*loc_grids[0],&Eyr=*loc_grids[1],&Ezr=*loc_grids[2],
+                      &Exi=*loc_grids[3],&Eyi=*loc_grids[4],&Ezi=*loc_grids[5];
+        
         Grid1<bool> cpl_arr(Np,false);
         Grid2<double> *t_grid=nullptr;
         
@@ -61,13 +98,13 @@ bool CompletionSensor::completion_check()
         {
             for(j=0;j<N_avg;j++)
             {
-                Ex_avg_r+=Ex_loc_r(i,j);
-                Ey_avg_r+=Ey_loc_r(i,j);
-                Ez_avg_r+=Ez_loc_r(i,j);
+                Ex_avg_r+=Exr(i,j);
+                Ey_avg_r+=Eyr(i,j);
+                Ez_avg_r+=Ezr(i,j);
                 
-                Ex_avg_i+=Ex_loc_i(i,j);
-                Ey_avg_i+=Ey_loc_i(i,j);
-                Ez_avg_i+=Ez_loc_i(i,j);
+                Ex_avg_i+=Exi(i,j);
+                Ey_avg_i+=Eyi(i,j);
+                Ez_avg_i+=Ezi(i,j);
             }
             
             Ex_avg_r=std::abs(Ex_avg_r/(N_avg+0.0));
@@ -81,12 +118,12 @@ bool CompletionSensor::completion_check()
             avg_max=var_max(Ex_avg_r,Ey_avg_r,Ez_avg_r,
                           Ex_avg_i,Ey_avg_i,Ez_avg_i);
             
-                 if(avg_max==Ex_avg_r){ t_grid=&Ex_loc_r; }
-            else if(avg_max==Ey_avg_r){ t_grid=&Ey_loc_r; }
-            else if(avg_max==Ez_avg_r){ t_grid=&Ez_loc_r; }
-            else if(avg_max==Ex_avg_i){ t_grid=&Ex_loc_i; }
-            else if(avg_max==Ey_avg_i){ t_grid=&Ey_loc_i; }
-            else if(avg_max==Ez_avg_i){ t_grid=&Ez_loc_i; }
+                 if(avg_max==Ex_avg_r){ t_grid=&Exr; }
+            else if(avg_max==Ey_avg_r){ t_grid=&Eyr; }
+            else if(avg_max==Ez_avg_r){ t_grid=&Ezr; }
+            else if(avg_max==Ex_avg_i){ t_grid=&Exi; }
+            else if(avg_max==Ey_avg_i){ t_grid=&Eyi; }
+            else if(avg_max==Ez_avg_i){ t_grid=&Ezi; }
             
             double t_min=(*t_grid)(i,0);
             double t_max=(*t_grid)(i,0);
@@ -142,9 +179,11 @@ void CompletionSensor::deep_feed(FDTD const &fdtd)
                 
         for(i=0;i<Np;i++)
         {
+            if(!owns(k_loc[i])) continue;
+            
             int &i_=i_loc[i],
                 &j_=j_loc[i],
-                &k_=k_loc[i];
+                 k_=k_loc[i]-z_offset;
             
             Imdouble coeff=std::exp(w_loc[i]*step*Dt*Im);
             
@@ -163,19 +202,9 @@ void CompletionSensor::deep_feed(FDTD const &fdtd)
     }
     else
     {
-        int i,j,k;
-        
-        energy_last=0;
-        double Ex,Ey,Ez;
+        energy_last=fdtd.compute_energy_E(zd_s-z_offset,zd_e-z_offset);
         
-        for(k=0;k<Nz;k++) for(j=0;j<Ny;j++) for(i=0;i<Nx;i++)  
-        {
-            Ex=fdtd.Ex(i,j,k);
-            Ey=fdtd.Ey(i,j,k);
-            Ez=fdtd.Ez(i,j,k);
-            
-            energy_last+=Ex*Ex+Ey*Ey+Ez*Ez;
-        }
+        if(domain!=nullptr) domain->sum(energy_last);
         
         energy_max=std::max(energy_max,energy_last);
     }
@@ -374,12 +403,26 @@ void CompletionSensor::initialize()
             offset+=Np_zu;
         }
         
-        for(i=0;i<Np;i++)
+        for(i=0;i<Np;i++) lambda_loc[i]=randp(lambda_min,lambda_max);
+        
+        // All the slabs use the points drawn by the master
+        
+        if(domain!=nullptr)
         {
-            lambda_loc[i]=randp(lambda_min,lambda_max);
-            w_loc[i]=m_to_rad_Hz(lambda_loc[i]);
+            if(!domain->master()) for(i=0;i<Np;i++)
+            {
+                i_loc[i]=j_loc[i]=k_loc[i]=0;
+                lambda_loc[i]=0;
+            }
+            
+            domain->sum(i_loc);
+            domain->sum(j_loc);
+            domain->sum(k_loc);
+            domain->sum(lambda_loc);
         }
         
+        for(i=0;i<Np;i++) w_loc[i]=m_to_rad_Hz(lambda_loc[i]);
+        
         double T=std::max(lambda_min,lambda_max)/c_light;
         N_avg=static_cast<int>(T/Dt);
         
@@ -27,29 +27,17 @@ extern std::ofstream plog;
 
 FieldBlock::FieldBlock(int x1_,int x2_,
                        int y1_,int y2_,
-                       int z1_,int z2_)
+                       int z1_,int z2_,
+                       int compression_)
+    :compression(compression_),
+     writer(nullptr)
 {
     set_loc(x1_,x2_,y1_,y2_,z1_,z2_);
-    
-    for(unsigned int i=0;i<Nthreads;i++)
-    {
-        threads[i]=new std::thread(&FieldBlock::threaded_computation,this,i);
-        
-        while(!threads_ready[i])
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
 }
 
 FieldBlock::~FieldBlock()
 {
-    process_threads=false;
-    alternator.signal_threads();
-    
-    for(unsigned int i=0;i<Nthreads;i++)
-    {
-        threads[i]->join();
-        delete threads[i];
-    }
+    delete writer;
 }
 
 template<double (FDTD::*T)(int,int,int) const>
@@ -86,87 +74,104 @@ class thr_FB
         }
 };
 
-void FieldBlock::deep_feed(FDTD const &fdtd_)
+void FieldBlock::checkpoint(Checkpoint &chk)
 {
-    fdtd=&fdtd_;
+    Sensor::checkpoint(chk);
     
-    std::unique_lock<std::mutex> lock(alternator.get_main_mutex());
+    chk.sync(mats);
     
-    process_threads=true;
-    
-    alternator.signal_threads();
-    alternator.main_wait_threads(lock);
+    chk.sync(Ex); chk.sync(Ey); chk.sync(Ez);
+    chk.sync(Hx); chk.sync(Hy); chk.sync(Hz);
+}
+
+void FieldBlock::deep_feed(FDTD const &fdtd_)
+{
+    fdtd=&fdtd_;
     
-    process_threads=false;
+    shared_pool().submit(this,std::min(static_cast<int>(Nthreads),span1),pool_group);
     
     if(step==0)
     {    
         int i,j,k;
         
-        for(k=0;k<span3;k++){ for(j=0;j<span2;j++){ for(i=0;i<span1;i++)
+        for(k=held_z1()-z1;k<held_z2()-z1;k++){ for(j=0;j<span2;j++){ for(i=0;i<span1;i++)
         {
-            mats(i,j,k)=fdtd->matsgrid(x1+i,y1+j,z1+k);
+            mats(i,j,k)=fdtd->matsgrid(x1+i,y1+j,z1+k-z_offset);
         }}}
     }
 }
 
+void FieldBlock::deep_reduce()
+{
+    domain->sum(mats);
+    
+    domain->sum(Ex); domain->sum(Ey); domain->sum(Ez);
+    domain->sum(Hx); domain->sum(Hy); domain->sum(Hz);
+}
+
 void FieldBlock::FT_Ex(int i1,int i2,Imdouble const &tcoeff)
 {
     int i,j,k;
+    int k1=held_z1()-z1,k2=held_z2()-z1;
     
-    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=0;k<span3;k++)
+    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=k1;k<k2;k++)
     {
-        Ex(i,j,k)+=fdtd->local_Ex(i+x1,j+y1,k+z1)*tcoeff;
+        Ex(i,j,k)+=fdtd->local_Ex(i+x1,j+y1,k+z1-z_offset)*tcoeff;
     }
 }
 
 void FieldBlock::FT_Ey(int i1,int i2,Imdouble const &tcoeff)
 {
     int i,j,k;
+    int k1=held_z1()-z1,k2=held_z2()-z1;
     
-    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=0;k<span3;k++)
+    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=k1;k<k2;k++)
     {
-        Ey(i,j,k)+=fdtd->local_Ey(i+x1,j+y1,k+z1)*tcoeff;
+        Ey(i,j,k)+=fdtd->local_Ey(i+x1,j+y1,k+z1-z_offset)*tcoeff;
     }
 }
 
 void FieldBlock::FT_Ez(int i1,int i2,Imdouble const &tcoeff)
 {
     int i,j,k;
+    int k1=held_z1()-z1,k2=held_z2()-z1;
     
-    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=0;k<span3;k++)
+    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=k1;k<k2;k++)
     {
-        Ez(i,j,k)+=fdtd->local_Ez(i+x1,j+y1,k+z1)*tcoeff;
+        Ez(i,j,k)+=fdtd->local_Ez(i+x1,j+y1,k+z1-z_offset)*tcoeff;
     }
 }
 
 void FieldBlock::FT_Hx(int i1,int i2,Imdouble const &tcoeff)
 {
     int i,j,k;
+    int k1=held_z1()-z1,k2=held_z2()-z1;
     
-    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=0;k<span3;k++)
+    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=k1;k<k2;k++)
     {
-        Hx(i,j,k)+=fdtd->local_Hx(i+x1,j+y1,k+z1)*tcoeff;
+        Hx(i,j,k)+=fdtd->local_Hx(i+x1,j+y1,k+z1-z_offset)*tcoeff;
     }
 }
 
 void FieldBlock::FT_Hy(int i1,int i2,Imdouble const &tcoeff)
 {
     int i,j,k;
+    int k1=held_z1()-z1,k2=held_z2()-z1;
     
-    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=0;k<span3;k++)
+    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=k1;k<k2;k++)
     {
-        Hy(i,j,k)+=fdtd->local_Hy(i+x1,j+y1,k+z1)*tcoeff;
+        Hy(i,j,k)+=fdtd->local_Hy(i+x1,j+y1,k+z1-z_offset)*tcoeff;
     }
 }
 
 void FieldBlock::FT_Hz(int i1,int i2,Imdouble const &tcoeff)
 {
     int i,j,k;
+    int k1=held_z1()-z1,k2=held_z2()-z1;
     
-    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=0;k<span3;k++)
+    for(i=i1;i<i2;i++) for(j=0;j<span2;j++) for(k=k1;k<k2;k++)
     {
-        Hz(i,j,k)+=fdtd->local_Hz(i+x1,j+y1,k+z1)*tcoeff;
+        Hz(i,j,k)+=fdtd->local_Hz(i+x1,j+y1,k+z1-z_offset)*tcoeff;
     }
 }
 
@@ -186,100 +191,41 @@ void FieldBlock::initialize()
     Hz.init(span1,span2,span3,0);
 }
 
-void FieldBlock::threaded_computation(unsigned int ID)
+void FieldBlock::pool_run(int chunk,int Nchunks)
 {
-    std::unique_lock<std::mutex> lock(alternator.get_thread_mutex(ID));
+    int i1=(chunk*span1)/Nchunks;
+    int i2=((chunk+1)*span1)/Nchunks;
     
-    threads_ready[ID]=true;
+    double w=2.0*Pi*c_light/lambda[0];
     
-    alternator.thread_wait_ok(ID,lock);
+    Imdouble tcoeff=std::exp(w*step*Dt*Im);
+    Imdouble tcoeff2=std::exp(w*(step+0.5)*Dt*Im);
     
-    double w=2.0*Pi*c_light/lambda[0];
-        
-    while(process_threads)
-    {
-        Imdouble tcoeff=std::exp(w*step*Dt*Im);
-        Imdouble tcoeff2=std::exp(w*(step+0.5)*Dt*Im);
-        
-        if(span1>static_cast<int>(Nthreads))
-        {
-            FT_Ex((ID*span1)/Nthreads,((ID+1)*span1)/Nthreads,tcoeff);
-            FT_Ey((ID*span1)/Nthreads,((ID+1)*span1)/Nthreads,tcoeff);
-            FT_Ez((ID*span1)/Nthreads,((ID+1)*span1)/Nthreads,tcoeff);
-            
-            FT_Hx((ID*span1)/Nthreads,((ID+1)*span1)/Nthreads,tcoeff2);
-            FT_Hy((ID*span1)/Nthreads,((ID+1)*span1)/Nthreads,tcoeff2);
-            FT_Hz((ID*span1)/Nthreads,((ID+1)*span1)/Nthreads,tcoeff2);
-        }
-        else if(ID<Nthreads)
-        {
-            FT_Ex(ID,ID+1,tcoeff);
-            FT_Ey(ID,ID+1,tcoeff);
-            FT_Ez(ID,ID+1,tcoeff);
-            
-            FT_Hx(ID,ID+1,tcoeff2);
-            FT_Hy(ID,ID+1,tcoeff2);
-            FT_Hz(ID,ID+1,tcoeff2);
-        }
-        
-        alternator.signal_main(ID);
-        alternator.thread_wait_ok(ID,lock);
-    }
+    FT_Ex(i1,i2,tcoeff);
+    FT_Ey(i1,i2,tcoeff);
+    FT_Ez(i1,i2,tcoeff);
+    
+    FT_Hx(i1,i2,tcoeff2);
+    FT_Hy(i1,i2,tcoeff2);
+    FT_Hz(i1,i2,tcoeff2);
 }
 
 void FieldBlock::treat()
 {
-    int i,j,k;
-    
-    std::string fname;
-    fname=name;
-    fname.append(".afblock");
+    FieldBlockHeader header;
     
-    std::ofstream file(directory/fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    header.compression=compression;
+    header.lambda=lambda[0];
+    header.x1=x1; header.Nx=span1;
+    header.y1=y1; header.Ny=span2;
+    header.z1=z1; header.Nz=span3;
+    header.Dx=Dx; header.Dy=Dy; header.Dz=Dz;
     
-    file.write(reinterpret_cast<char*>(&lambda[0]),sizeof(double));
-    file.write(reinterpret_cast<char*>(&x1),sizeof(int));
-    file.write(reinterpret_cast<char*>(&span1),sizeof(int));
-    file.write(reinterpret_cast<char*>(&y1),sizeof(int));
-    file.write(reinterpret_cast<char*>(&span2),sizeof(int));
-    file.write(reinterpret_cast<char*>(&z1),sizeof(int));
-    file.write(reinterpret_cast<char*>(&span3),sizeof(int));
-    file.write(reinterpret_cast<char*>(&Dx),sizeof(double));
-    file.write(reinterpret_cast<char*>(&Dy),sizeof(double));
-    file.write(reinterpret_cast<char*>(&Dz),sizeof(double));
+    // The block is written in the background, the grids being left
+    // untouched until the sensor is destroyed
     
-    double p_r,p_i;
-    
-    for(i=0;i<span1;i++) for(j=0;j<span2;j++) for(k=0;k<span3;k++)
-    {
-        p_r=std::real(Ex(i,j,k)); p_i=std::imag(Ex(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Ey(i,j,k)); p_i=std::imag(Ey(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Ez(i,j,k)); p_i=std::imag(Ez(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Hx(i,j,k)); p_i=std::imag(Hx(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Hy(i,j,k)); p_i=std::imag(Hy(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        p_r=std::real(Hz(i,j,k)); p_i=std::imag(Hz(i,j,k));
-        file.write(reinterpret_cast<char*>(&p_r),sizeof(double));
-        file.write(reinterpret_cast<char*>(&p_i),sizeof(double));
-        
-        file.write(reinterpret_cast<char*>(&mats(i,j,k)),sizeof(unsigned int));
-    }
-    
-    file.close();
+    delete writer;
+    writer=new FieldBlockWriter(directory/(name+".afblock"),header,mats,Ex,Ey,Ez,Hx,Hy,Hz);
 }
 
 //###############
@@ -296,40 +242,23 @@ FieldMap::FieldMap(int type_,
 {
     set_type(type_);
     set_loc(x1_,x2_,y1_,y2_,z1_,z2_);
-    
-    for(unsigned int i=0;i<Nthreads;i++)
-    {
-        threads[i]=new std::thread(&FieldMap::threaded_computation,this,i);
-        
-        while(!threads_ready[i])
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
 }
 
-FieldMap::~FieldMap()
+void FieldMap::checkpoint(Checkpoint &chk)
 {
-    process_threads=false;
-    alternator.signal_threads();
+    Sensor::checkpoint(chk);
     
-    for(unsigned int i=0;i<Nthreads;i++)
-    {
-        threads[i]->join();
-        delete threads[i];
-    }
+    chk.sync(mats);
+    chk.sync(acc_Ex);
+    chk.sync(acc_Ey);
+    chk.sync(acc_Ez);
 }
 
 void FieldMap::deep_feed(FDTD const &fdtd)
 {
     fdtd_source=&fdtd;
     
-    std::unique_lock<std::mutex> lock(alternator.get_main_mutex());
-    
-    process_threads=true;
-    
-    alternator.signal_threads();
-    alternator.main_wait_threads(lock);
-    
-    process_threads=false;
+    shared_pool().submit(this,std::min(static_cast<int>(Nthreads),span2),pool_group);
     
     if(step==0)
     {    
@@ -344,11 +273,20 @@ void FieldMap::deep_feed(FDTD const &fdtd)
             else if(type==NORMAL_Y){ a=i; c=j; }
             else if(type==NORMAL_Z){ a=i; b=j; }
             
-            mats(i,j)=fdtd.matsgrid(x1+a,y1+b,z1+c);
+            if(owns(z1+c)) mats(i,j)=fdtd.matsgrid(x1+a,y1+b,z1+c-z_offset);
         }}
     }
 }
 
+void FieldMap::deep_reduce()
+{
+    domain->sum(mats);
+    
+    domain->sum(acc_Ex);
+    domain->sum(acc_Ey);
+    domain->sum(acc_Ez);
+}
+
 void FieldMap::FT_compute(int j1,int j2)
 {
     int i,j,k;
@@ -378,17 +316,19 @@ void FieldMap::FT_compute(int j1,int j2)
                 else if(type==NORMAL_Y){ a=i; b=k; c=j; }
                 else if(type==NORMAL_Z){ a=i; b=j; c=k; }
                 
+                if(!owns(z1+c)) continue;
+                
                 if(!mag_map)
                 {
-                    Sx+=fdtd_source->local_Ex(x1+a,y1+b,z1+c);
-                    Sy+=fdtd_source->local_Ey(x1+a,y1+b,z1+c);
-                    Sz+=fdtd_source->local_Ez(x1+a,y1+b,z1+c);
+                    Sx+=fdtd_source->local_Ex(x1+a,y1+b,z1+c-z_offset);
+                    Sy+=fdtd_source->local_Ey(x1+a,y1+b,z1+c-z_offset);
+                    Sz+=fdtd_source->local_Ez(x1+a,y1+b,z1+c-z_offset);
                 }
                 else
                 {
-                    Sx+=fdtd_source->local_Hx(x1+a,y1+b,z1+c);
-                    Sy+=fdtd_source->local_Hy(x1+a,y1+b,z1+c);
-                    Sz+=fdtd_source->local_Hz(x1+a,y1+b,z1+c);
+                    Sx+=fdtd_source->local_Hx(x1+a,y1+b,z1+c-z_offset);
+                    Sy+=fdtd_source->local_Hy(x1+a,y1+b,z1+c-z_offset);
+                    Sz+=fdtd_source->local_Hz(x1+a,y1+b,z1+c-z_offset);
                 }
             }
             
@@ -407,17 +347,19 @@ void FieldMap::FT_compute(int j1,int j2)
             else if(type==NORMAL_Y){ a=i; c=j; }
             else if(type==NORMAL_Z){ a=i; b=j; }
             
+            if(!owns(z1+c)) continue;
+            
             if(!mag_map)
             {
-                acc_Ex(i,j)+=tf_coeff*fdtd_source->local_Ex(x1+a,y1+b,z1+c);
-                acc_Ey(i,j)+=tf_coeff*fdtd_source->local_Ey(x1+a,y1+b,z1+c);
-                acc_Ez(i,j)+=tf_coeff*fdtd_source->local_Ez(x1+a,y1+b,z1+c);
+                acc_Ex(i,j)+=tf_coeff*fdtd_source->local_Ex(x1+a,y1+b,z1+c-z_offset);
+                acc_Ey(i,j)+=tf_coeff*fdtd_source->local_Ey(x1+a,y1+b,z1+c-z_offset);
+                acc_Ez(i,j)+=tf_coeff*fdtd_source->local_Ez(x1+a,y1+b,z1+c-z_offset);
             }
             else
             {
-                acc_Ex(i,j)+=tf_coeff*fdtd_source->local_Hx(x1+a,y1+b,z1+c);
-                acc_Ey(i,j)+=tf_coeff*fdtd_source->local_Hy(x1+a,y1+b,z1+c);
-                acc_Ez(i,j)+=tf_coeff*fdtd_source->local_Hz(x1+a,y1+b,z1+c);
+                acc_Ex(i,j)+=tf_coeff*fdtd_source->local_Hx(x1+a,y1+b,z1+c-z_offset);
+                acc_Ey(i,j)+=tf_coeff*fdtd_source->local_Hy(x1+a,y1+b,z1+c-z_offset);
+                acc_Ez(i,j)+=tf_coeff*fdtd_source->local_Hz(x1+a,y1+b,z1+c-z_offset);
             }
         }}
     }
@@ -439,27 +381,14 @@ void FieldMap::initialize()
     acc_Ez.init(span1,span2,0);
 }
 
-void FieldMap::set_cumulative(bool c) { cumulative=c; }
-void FieldMap::set_mag_map(bool c) { mag_map=c; }
-
-void FieldMap::threaded_computation(unsigned int ID)
+void FieldMap::pool_run(int chunk,int Nchunks)
 {
-    std::unique_lock<std::mutex> lock(alternator.get_thread_mutex(ID));
-    
-    threads_ready[ID]=true;
-    
-    alternator.thread_wait_ok(ID,lock);
-    
-    while(process_threads)
-    {
-        if(span2>int(Nthreads)) FT_compute((ID*span2)/Nthreads,((ID+1)*span2)/Nthreads);
-        else if(int(ID)<span2) FT_compute(ID,ID+1);
-        
-        alternator.signal_main(ID);
-        alternator.thread_wait_ok(ID,lock);
-    }
+    FT_compute((chunk*span2)/Nchunks,((chunk+1)*span2)/Nchunks);
 }
 
+void FieldMap::set_cumulative(bool c) { cumulative=c; }
+void FieldMap::set_mag_map(bool c) { mag_map=c; }
+
 void FieldMap::treat()
 {
     int i,j;
@@ -657,7 +586,8 @@ void FieldMap2::treat()
     {
         for(int k=z1;k<z2;k++)
         {
-            file<<(zs_s+k)*Dz;
+            if(z_coord.empty()) file<<(zs_s+k)*Dz;
+            else file<<z_coord[k]-z_coord[zs_s];
             if(k+1!=z2) file<<" ";
         }
         file<<"\n";
@@ -710,9 +640,11 @@ FieldPoint::~FieldPoint()
 
 void FieldPoint::deep_feed(FDTD const &fdtd)
 {
-    double Ex=fdtd.local_Ex(x1,y1,z1);
-    double Ey=fdtd.local_Ey(x1,y1,z1);
-    double Ez=fdtd.local_Ez(x1,y1,z1);
+    if(!owns(z1)) return;
+    
+    double Ex=fdtd.local_Ex(x1,y1,z1-z_offset);
+    double Ey=fdtd.local_Ey(x1,y1,z1-z_offset);
+    double Ez=fdtd.local_Ez(x1,y1,z1-z_offset);
     double E=std::sqrt(Ex*Ex+Ey*Ey+Ez*Ez);
     
     file<<step*Dt<<" "<<E<<" "<<Ex<<" "<<Ey<<" "<<Ez<<std::endl;
@@ -720,6 +652,10 @@ void FieldPoint::deep_feed(FDTD const &fdtd)
 
 void FieldPoint::initialize()
 {
+    // Only the process holding the point writes it
+    
+    if(!owns(z1)) return;
+    
     std::string fname(name);
     fname.append("_fieldpoint");
     
@@ -31,13 +31,21 @@ MovieSensor::MovieSensor(int type_,
     if(type==NORMAL_Y){ span1=x2-x1; span2=z2-z1; }
     if(type==NORMAL_Z){ span1=x2-x1; span2=y2-y1; }
     
-    image.set_size(span1,span2);
-        
     f_x.init(span1,span2,0);
     f_y.init(span1,span2,0);
     f_z.init(span1,span2,0);
 }
 
+// Field value at the global plane k, zero when the plane belongs to
+// another slab
+
+double MovieSensor::held_value(Grid3<double> const &F,int i,int j,int k) const
+{
+    if(!owns(k)) return 0;
+    
+    return F(i,j,k-z_offset);
+}
+
 void MovieSensor::deep_feed(FDTD const &fdtd)
 {
     Grid3<double> const &Ex=fdtd.Ex;
@@ -47,7 +55,7 @@ void MovieSensor::deep_feed(FDTD const &fdtd)
     if(step%skip==0)
     {
         int i,j,k;
-        double tmp_x,tmp_y,tmp_z,tmp;
+        double tmp_x,tmp_y,tmp_z;
         
         if(cumulative)
         {
@@ -61,9 +69,9 @@ void MovieSensor::deep_feed(FDTD const &fdtd)
                     
                     for(i=0;i<span_c;i++)
                     {
-                        tmp_x+=Ex(x1+i,y1+j,z1+k);
-                        tmp_y+=Ey(x1+i,y1+j,z1+k);
-                        tmp_z+=Ez(x1+i,y1+j,z1+k);
+                        tmp_x+=held_value(Ex,x1+i,y1+j,z1+k);
+                        tmp_y+=held_value(Ey,x1+i,y1+j,z1+k);
+                        tmp_z+=held_value(Ez,x1+i,y1+j,z1+k);
                     }
                     
                     tmp_x/=static_cast<double>(span_c);
@@ -81,9 +89,9 @@ void MovieSensor::deep_feed(FDTD const &fdtd)
                 
                 for(i=0;i<span1;i++){ for(k=0;k<span2;k++)
                 {
-                    f_x(i,k)=Ex(x1+i,y1+j,z1+k);
-                    f_y(i,k)=Ey(x1+i,y1+j,z1+k);
-                    f_z(i,k)=Ez(x1+i,y1+j,z1+k);
+                    f_x(i,k)=held_value(Ex,x1+i,y1+j,z1+k);
+                    f_y(i,k)=held_value(Ey,x1+i,y1+j,z1+k);
+                    f_z(i,k)=held_value(Ez,x1+i,y1+j,z1+k);
                 }}
             }
             else if(type==NORMAL_Z)
@@ -92,9 +100,9 @@ void MovieSensor::deep_feed(FDTD const &fdtd)
                 
                 for(i=0;i<span1;i++){ for(j=0;j<span2;j++)
                 {
-                    f_x(i,j)=Ex(x1+i,y1+j,z1+k);
-                    f_y(i,j)=Ey(x1+i,y1+j,z1+k);
-                    f_z(i,j)=Ez(x1+i,y1+j,z1+k);
+                    f_x(i,j)=held_value(Ex,x1+i,y1+j,z1+k);
+                    f_y(i,j)=held_value(Ey,x1+i,y1+j,z1+k);
+                    f_z(i,j)=held_value(Ez,x1+i,y1+j,z1+k);
                 }}
             }
         }
@@ -106,9 +114,9 @@ void MovieSensor::deep_feed(FDTD const &fdtd)
                 
                 for(j=0;j<span1;j++){ for(k=0;k<span2;k++)
                 {
-                    f_x(j,k)=Ex(x1+i,y1+j,z1+k);
-                    f_y(j,k)=Ey(x1+i,y1+j,z1+k);
-                    f_z(j,k)=Ez(x1+i,y1+j,z1+k);
+                    f_x(j,k)=held_value(Ex,x1+i,y1+j,z1+k);
+                    f_y(j,k)=held_value(Ey,x1+i,y1+j,z1+k);
+                    f_z(j,k)=held_value(Ez,x1+i,y1+j,z1+k);
                 }}
             }
             else if(type==NORMAL_Y)
@@ -117,9 +125,9 @@ void MovieSensor::deep_feed(FDTD const &fdtd)
                 
                 for(i=0;i<span1;i++){ for(k=0;k<span2;k++)
                 {
-                    f_x(i,k)=Ex(x1+i,y1+j,z1+k);
-                    f_y(i,k)=Ey(x1+i,y1+j,z1+k);
-                    f_z(i,k)=Ez(x1+i,y1+j,z1+k);
+                    f_x(i,k)=held_value(Ex,x1+i,y1+j,z1+k);
+                    f_y(i,k)=held_value(Ey,x1+i,y1+j,z1+k);
+                    f_z(i,k)=held_value(Ez,x1+i,y1+j,z1+k);
                 }}
             }
             else if(type==NORMAL_Z)
@@ -128,58 +136,35 @@ void MovieSensor::deep_feed(FDTD const &fdtd)
                 
                 for(i=0;i<span1;i++){ for(j=0;j<span2;j++)
                 {
-                    f_x(i,j)=Ex(x1+i,y1+j,z1+k);
-                    f_y(i,j)=Ey(x1+i,y1+j,z1+k);
-                    f_z(i,j)=Ez(x1+i,y1+j,z1+k);
+                    f_x(i,j)=held_value(Ex,x1+i,y1+j,z1+k);
+                    f_y(i,j)=held_value(Ey,x1+i,y1+j,z1+k);
+                    f_z(i,j)=held_value(Ez,x1+i,y1+j,z1+k);
                 }}
             }
         }
         
-        using std::exp;
-        using std::abs;
-        
-        for(i=0;i<span1;i++){ for(j=0;j<span2;j++)
-        {
-            tmp_x=1.0-exp(-exposure*abs(f_x(i,j)));
-            image.degra(i,j,tmp_x,0,1.0);
-        }}
-        
-        std::filesystem::path pEx=directory/(name+"_"+std::to_string(step/skip)+"_Ex.png");
-        std::filesystem::path pEy=directory/(name+"_"+std::to_string(step/skip)+"_Ey.png");
-        std::filesystem::path pEz=directory/(name+"_"+std::to_string(step/skip)+"_Ez.png");
-        std::filesystem::path pE=directory/(name+"_"+std::to_string(step/skip)+"_E.png");
+        // Frames are assembled from all the slabs and written once
         
-        image.write(pEx.generic_string());
-        
-        for(i=0;i<span1;i++){ for(j=0;j<span2;j++)
+        if(domain!=nullptr)
         {
-            tmp_y=1.0-exp(-exposure*abs(f_y(i,j)));
-            image.degra(i,j,tmp_y,0,1.0);
-        }}
-        
-        image.write(pEy.generic_string());
-        
-        for(i=0;i<span1;i++){ for(j=0;j<span2;j++)
-        {
-            tmp_z=1.0-exp(-exposure*abs(f_z(i,j)));
-            image.degra(i,j,tmp_z,0,1.0);
-        }}
+            domain->sum(f_x);
+            domain->sum(f_y);
+            domain->sum(f_z);
+            
+            if(!domain->master()) return;
+        }
         
-        image.write(pEz.generic_string());
+        // The images are encoded by the writer thread
         
-        for(i=0;i<span1;i++){ for(j=0;j<span2;j++)
-        {
-            tmp_x=std::abs(f_x(i,j));
-            tmp_y=std::abs(f_y(i,j));
-            tmp_z=std::abs(f_z(i,j));
-            tmp=std::sqrt(tmp_x*tmp_x+tmp_y*tmp_y+tmp_z*tmp_z);
-            
-            tmp=1.0-exp(-exposure*tmp);
-            
-            image.degra(i,j,tmp,0,1.0);
-        }}
+        Frame &frame=writer.acquire();
         
+        frame.type=Frame::FRAME_MOVIE;
+        frame.exposure=exposure;
+        frame.fname=directory/(name+"_"+std::to_string(step/skip));
+        frame.Fx=f_x;
+        frame.Fy=f_y;
+        frame.Fz=f_z;
         
-        image.write(pE.generic_string());
+        writer.submit(frame);
     }
 }
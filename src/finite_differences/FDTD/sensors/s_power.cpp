@@ -12,6 +12,7 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.*/
 
+#include <filehdl.h>
 #include <sensors.h>
 
 extern std::ofstream plog;
@@ -26,5 +27,37 @@ Box_Poynting::Box_Poynting(int x1_,int x2_,
 
 void Box_Poynting::deep_feed(FDTD const &fdtd)
 {
-    plog<<step<<" "<<fdtd.compute_poynting_box(x1,x2,y1,y2,z1,z2)<<" "<<fdtd.Ey.max()<<std::endl;
+    if(domain==nullptr)
+    {
+        std::unique_lock<std::mutex> lock(plog_mutex());
+        
+        plog<<step<<" "<<fdtd.compute_poynting_box(x1,x2,y1,y2,z1,z2)<<" "<<fdtd.Ey.max()<<std::endl;
+        return;
+    }
+    
+    // Each slab adds the parts of the faces it holds
+    
+    double P=0,Ey_max=fdtd.Ey.max();
+    int k1=held_z1()-z_offset,k2=held_z2()-z_offset;
+    
+    if(k1<k2)
+    {
+        P+=fdtd.compute_poynting_X(y1,y2,k1,k2,x1,-1);
+        P+=fdtd.compute_poynting_X(y1,y2,k1,k2,x2,1);
+        P+=fdtd.compute_poynting_Y(x1,x2,k1,k2,y1,-1);
+        P+=fdtd.compute_poynting_Y(x1,x2,k1,k2,y2,1);
+    }
+    
+    if(owns(z1)) P+=fdtd.compute_poynting_Z(x1,x2,y1,y2,z1-z_offset,-1);
+    if(owns(z2)) P+=fdtd.compute_poynting_Z(x1,x2,y1,y2,z2-z_offset,1);
+    
+    domain->sum(P);
+    domain->max(Ey_max);
+    
+    if(domain->master())
+    {
+        std::unique_lock<std::mutex> lock(plog_mutex());
+        
+        plog<<step<<" "<<P<<" "<<Ey_max<<std::endl;
+    }
 }
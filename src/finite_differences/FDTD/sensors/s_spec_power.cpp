@@ -56,6 +56,13 @@ void Spect_Poynting::treat()
     std::ofstream file;
     if(!silent) file.open(directory/fname_out,std::ios::out|std::ios::trunc);
     
+    // Relative heights of the z rows on a graded mesh
+    
+    std::vector<double> w(span2,1.0);
+    
+    if(!z_height.empty() && type!=NORMAL_Z && type!=NORMAL_ZM)
+        for(j=0;j<span2;j++) w[j]=z_height[z1+j]/Dz;
+    
     ProgDisp dsp(Nl,"Computing Poynting sensor results");
     
     for(l=0;l<Nl;l++)
@@ -74,12 +81,14 @@ void Spect_Poynting::treat()
         
         for(i=0;i<span1;i++){ for(j=0;j<span2;j++)
         {
-            Sx+=real(sp_Ey(i,j,l)*conj(sp_Hz(i,j,l))-sp_Ez(i,j,l)*conj(sp_Hy(i,j,l)));
-            Sy+=real(sp_Ez(i,j,l)*conj(sp_Hx(i,j,l))-sp_Ex(i,j,l)*conj(sp_Hz(i,j,l)));
-            Sz+=real(sp_Ex(i,j,l)*conj(sp_Hy(i,j,l))-sp_Ey(i,j,l)*conj(sp_Hx(i,j,l)));
+            Sx+=w[j]*real(sp_Ey(i,j,l)*conj(sp_Hz(i,j,l))-sp_Ez(i,j,l)*conj(sp_Hy(i,j,l)));
+            Sy+=w[j]*real(sp_Ez(i,j,l)*conj(sp_Hx(i,j,l))-sp_Ex(i,j,l)*conj(sp_Hz(i,j,l)));
+            Sz+=w[j]*real(sp_Ex(i,j,l)*conj(sp_Hy(i,j,l))-sp_Ey(i,j,l)*conj(sp_Hx(i,j,l)));
         }}
         
-        double area=span1*span2;
+        double area=0;
+        for(j=0;j<span2;j++) area+=w[j];
+        area*=span1;
         
         if(type==NORMAL_X || type==NORMAL_XM)
         {
@@ -134,14 +143,42 @@ Box_Spect_Poynting::Box_Spect_Poynting(int x1,int x2,
 {
 }
 
+void Box_Spect_Poynting::advance()
+{
+    if(!disable_xm) xm.advance();
+    if(!disable_xp) xp.advance();
+    if(!disable_ym) ym.advance();
+    if(!disable_yp) yp.advance();
+    if(!disable_zm) zm.advance();
+    if(!disable_zp) zp.advance();
+    
+    Sensor::advance();
+}
+
+void Box_Spect_Poynting::checkpoint(Checkpoint &chk)
+{
+    Sensor::checkpoint(chk);
+    
+    xm.checkpoint(chk); xp.checkpoint(chk);
+    ym.checkpoint(chk); yp.checkpoint(chk);
+    zm.checkpoint(chk); zp.checkpoint(chk);
+}
+
 void Box_Spect_Poynting::deep_feed(FDTD const &fdtd)
 {
-    if(!disable_xm) xm.feed(fdtd);
-    if(!disable_xp) xp.feed(fdtd);
-    if(!disable_ym) ym.feed(fdtd);
-    if(!disable_yp) yp.feed(fdtd);
-    if(!disable_zm) zm.feed(fdtd);
-    if(!disable_zp) zp.feed(fdtd);
+    if(!disable_xm) xm.deep_feed(fdtd);
+    if(!disable_xp) xp.deep_feed(fdtd);
+    if(!disable_ym) ym.deep_feed(fdtd);
+    if(!disable_yp) yp.deep_feed(fdtd);
+    if(!disable_zm) zm.deep_feed(fdtd);
+    if(!disable_zp) zp.deep_feed(fdtd);
+}
+
+void Box_Spect_Poynting::deep_reduce()
+{
+    xm.reduce(); xp.reduce();
+    ym.reduce(); yp.reduce();
+    zm.reduce(); zp.reduce();
 }
 
 void Box_Spect_Poynting::link(FDTD const &fdtd)
@@ -405,7 +442,12 @@ void Spect_Poynting_FFT::treat(std::string fname_out)
     fftw_plan p;
     
     signal=(fftw_complex*)fftw_malloc(Nfft*sizeof(fftw_complex));
-    p=fftw_plan_dft_1d(Nfft,signal,signal,FFTW_BACKWARD,FFTW_MEASURE);
+    
+    {
+        std::unique_lock<std::mutex> lock(fftw_planner_mutex());
+        
+        p=fftw_plan_dft_1d(Nfft,signal,signal,FFTW_BACKWARD,FFTW_MEASURE);
+    }
     
     Grid1<Imdouble> fft_result(Nfft,0);
     Grid1<double> fft_freq(Nfft,0);
@@ -573,7 +615,12 @@ void Spect_Poynting_FFT::treat(std::string fname_out)
     //   FFTW Cleanup
     //####################
     
-    fftw_destroy_plan(p);
+    {
+        std::unique_lock<std::mutex> lock(fftw_planner_mutex());
+        
+        fftw_destroy_plan(p);
+    }
+    
     fftw_free(signal);
     
     //####################
@@ -12,6 +12,8 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.*/
 
+#include <fdtd_profiler.h>
+#include <fieldblock_file.h>
 #include <sensors.h>
 #include <string_tools.h>
 
@@ -36,7 +38,7 @@ Sensor_generator::Sensor_generator()
      orientation(NORMAL_Z),
      Nfx(50), Nfy(50),
      Nl(481), lambda_min(470e-9), lambda_max(850e-9),
-     skip(1),
+     skip(1), compression(0),
      disable_xm(false), disable_xp(false),
      disable_ym(false), disable_yp(false),
      disable_zm(false), disable_zp(false)
@@ -54,7 +56,7 @@ Sensor_generator::Sensor_generator(Sensor_generator const &sens)
      location_real(sens.location_real),
      orientation(sens.orientation),
      Nl(sens.Nl), lambda_min(sens.lambda_min), lambda_max(sens.lambda_max),
-     skip(sens.skip),
+     skip(sens.skip), compression(sens.compression),
      disable_xm(sens.disable_xm), disable_xp(sens.disable_xp),
      disable_ym(sens.disable_ym), disable_yp(sens.disable_yp),
      disable_zm(sens.disable_zm), disable_zp(sens.disable_zp)
@@ -92,12 +94,27 @@ void Sensor_generator::operator = (Sensor_generator const &sens)
     lambda_max=sens.lambda_max;
     
     skip=sens.skip;
+    compression=sens.compression;
     
     disable_xm=sens.disable_xm; disable_xp=sens.disable_xp;
     disable_ym=sens.disable_ym; disable_yp=sens.disable_yp;
     disable_zm=sens.disable_zm; disable_zp=sens.disable_zp;
 }
 
+// Storage of the field blocks, see fieldblock_file.h
+
+void Sensor_generator::set_compression(std::string method)
+{
+         if(method=="none") compression=FB_RAW;
+    else if(method=="deflate") compression=FB_DEFLATE;
+    else if(method=="shuffle_deflate") compression=FB_SHUFFLE_DEFLATE;
+    else
+    {
+        std::cerr<<"Unknown compression method "<<method<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
 void Sensor_generator::set_name(std::string name_)
 {
     name=name_;
@@ -139,7 +156,7 @@ void Sensor_generator::set_wavelength(double lambda_)
     std::cout<<"Setting the analysis wavelength to "<<add_unit_u(lambda_min)<<std::endl;
 }
 
-void Sensor_generator::to_discrete(double Dx,double Dy,double Dz)
+void Sensor_generator::to_discrete(double Dx,double Dy,double Dz,std::vector<double> const &z_steps)
 {
     if(location_real)
     {
@@ -153,8 +170,8 @@ void Sensor_generator::to_discrete(double Dx,double Dy,double Dz)
         
         if(y2<=y1) y2=y1+1;
         
-        z1=nearest_integer(z1r/Dz);
-        z2=nearest_integer(z2r/Dz);
+        z1=nearest_z_plane(z1r,Dz,z_steps);
+        z2=nearest_z_plane(z2r,Dz,z_steps);
         
         if(z2<=z1) z2=z1+1;
     }
@@ -164,7 +181,7 @@ void Sensor_generator::to_discrete(double Dx,double Dy,double Dz)
 //   Sensor
 //############
 
-int Sensor::sensor_ID_next=0;
+std::atomic<int> Sensor::sensor_ID_next(0);
 
 Sensor::Sensor()
     :step(0),
@@ -176,19 +193,42 @@ Sensor::Sensor()
      disable_xm(false), disable_xp(false),
      disable_ym(false), disable_yp(false),
      disable_zm(false), disable_zp(false),
-     process_threads(false),
-     Nthreads(max_threads_number()),
-     alternator(Nthreads),
-     threads(Nthreads,nullptr), threads_ready(Nthreads,false)
+     domain(nullptr),
+     z_offset(0), zd_s(0), zd_e(0),
+     Nthreads(max_threads_number())
 {
-    sensor_ID=sensor_ID_next;
-    sensor_ID_next++;
+    sensor_ID=sensor_ID_next++;
 }
 
 Sensor::~Sensor()
 {
 }
 
+void Sensor::advance()
+{
+    if(step>=Nt-Ntap)
+    {
+        tapering_E=s_curve(step,Nt-1.0,Nt-Ntap);
+        tapering_H=s_curve(step+0.5,Nt-1.0,Nt-Ntap);
+    }
+        
+    step+=1;
+}
+
+void Sensor::checkpoint(Checkpoint &chk)
+{
+    chk.sync(step);
+    chk.sync(tapering_E);
+    chk.sync(tapering_H);
+}
+
+void Sensor::deep_reduce()
+{
+}
+
+int Sensor::held_z1() const { return std::max(z1,zd_s); }
+int Sensor::held_z2() const { return std::min(z2,zd_e); }
+
 void Sensor::initialize()
 {
 }
@@ -197,9 +237,14 @@ void Sensor::link(FDTD const &fdtd)
 {
     Nx=fdtd.Nx;
     Ny=fdtd.Ny;
-    Nz=fdtd.Nz;
+    Nz=fdtd.Nz_glob;
     Nt=fdtd.Nt;
     
+    domain=fdtd.domain;
+    z_offset=fdtd.z_offset;
+    zd_s=fdtd.zo_s+z_offset;
+    zd_e=fdtd.zo_e+z_offset;
+    
     Ntap=fdtd.Ntap;
     
     Dx=fdtd.Dx;
@@ -223,6 +268,21 @@ void Sensor::link(FDTD const &fdtd)
     z1=std::clamp(z1,0,Nz);
     z2=std::clamp(z2,0,Nz);
     
+    z_height.clear();
+    z_coord.clear();
+    
+    if(!fdtd.z_step.empty())
+    {
+        z_height.resize(Nz);
+        z_coord.resize(Nz);
+        
+        for(int k=0;k<Nz;k++)
+        {
+            z_height[k]=fdtd.z_dual(k);
+            z_coord[k]=(k==0)?0:z_coord[k-1]+fdtd.z_cell(k-1);
+        }
+    }
+    
     directory=fdtd.directory;
     Nthreads=fdtd.Nthreads;
     
@@ -232,20 +292,23 @@ void Sensor::link(FDTD const &fdtd)
 void Sensor::feed(FDTD const &fdtd)
 {
     deep_feed(fdtd);
-    
-    if(step>=Nt-Ntap)
-    {
-        tapering_E=s_curve(step,Nt-1.0,Nt-Ntap);
-        tapering_H=s_curve(step+0.5,Nt-1.0,Nt-Ntap);
-    }
-        
-    step+=1;
+    shared_pool().wait(pool_group);
+    advance();
 }
 
 void Sensor::deep_feed(FDTD const &fdtd)
 {
 }
 
+bool Sensor::owns(int k) const { return k>=zd_s && k<zd_e; }
+
+// Gathers the contributions of all the slabs before treat()
+
+void Sensor::reduce()
+{
+    if(domain!=nullptr) deep_reduce();
+}
+
 void Sensor::set_loc(int x1_,int x2_,
                      int y1_,int y2_,
                      int z1_,int z2_)
@@ -312,6 +375,25 @@ void Sensor::treat()
 {
 }
 
+// Feeds all the sensors before waiting on any of them, the transforms
+// of different sensors running concurrently
+
+void feed_sensors(std::vector<Sensor*> const &sensors,FDTD const &fdtd)
+{
+    FDTD_PROF_START(t_feed);
+    
+    for(unsigned int i=0;i<sensors.size();i++)
+        sensors[i]->deep_feed(fdtd);
+    
+    for(unsigned int i=0;i<sensors.size();i++)
+        shared_pool().wait(sensors[i]->pool_group);
+    
+    for(unsigned int i=0;i<sensors.size();i++)
+        sensors[i]->advance();
+    
+    FDTD_PROF_STOP(t_feed,FDTD_Profiler::PROF_SENSORS);
+}
+
 Sensor* generate_fdtd_sensor(Sensor_generator const &gen,FDTD const &fdtd)
 {
     Sensor *sens_out=0;
@@ -361,7 +443,8 @@ Sensor* generate_fdtd_sensor(Sensor_generator const &gen,FDTD const &fdtd)
     {
         sens_out=new FieldBlock(gen.x1,gen.x2,
                                 gen.y1,gen.y2,
-                                gen.z1,gen.z2);
+                                gen.z1,gen.z2,
+                                gen.compression);
                                 
         sens_out->set_spectrum(gen.lambda_min);
     }
@@ -429,26 +512,23 @@ SensorFieldHolder::SensorFieldHolder(int type_,
     
     set_type(type_);
     set_loc(x1_,x2_,y1_,y2_,z1_,z2_);
-    
-    for(unsigned int i=0;i<Nthreads;i++)
-    {
-        threads[i]=new std::thread(&SensorFieldHolder::threaded_computation,this,i);
-        
-        while(!threads_ready[i])
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
 }
 
-SensorFieldHolder::~SensorFieldHolder()
+void SensorFieldHolder::checkpoint(Checkpoint &chk)
 {
-    process_threads=false;
-    alternator.signal_threads();
+    Sensor::checkpoint(chk);
     
-    for(unsigned int i=0;i<Nthreads;i++)
-    {
-        threads[i]->join();
-        delete threads[i];
-    }
+    chk.sync(t_Ex); chk.sync(t_Ey); chk.sync(t_Ez);
+    chk.sync(t_Hx); chk.sync(t_Hy); chk.sync(t_Hz);
+    
+    chk.sync(sp_Ex); chk.sync(sp_Ey); chk.sync(sp_Ez);
+    chk.sync(sp_Hx); chk.sync(sp_Hy); chk.sync(sp_Hz);
+}
+
+void SensorFieldHolder::deep_reduce()
+{
+    domain->sum(sp_Ex); domain->sum(sp_Ey); domain->sum(sp_Ez);
+    domain->sum(sp_Hx); domain->sum(sp_Hy); domain->sum(sp_Hz);
 }
 
 void SensorFieldHolder::FT_comp(int l1,int l2)
@@ -478,17 +558,18 @@ void SensorFieldHolder::FT_comp(int l1,int l2)
 
 void SensorFieldHolder::deep_feed(FDTD const &fdtd)
 {
-    if(interpolate) update_t_interp(fdtd);
-    else update_t(fdtd);
+    // Nothing to accumulate outside of the slab
     
-    std::unique_lock<std::mutex> lock(alternator.get_main_mutex());
-    
-    process_threads=true;
+    if(type==NORMAL_Z || type==NORMAL_ZM)
+    {
+        if(!owns(z1)) return;
+    }
+    else if(held_z1()>=held_z2()) return;
     
-    alternator.signal_threads();
-    alternator.main_wait_threads(lock);
+    if(interpolate) update_t_interp(fdtd);
+    else update_t(fdtd);
     
-    process_threads=false;
+    shared_pool().submit(this,std::min(static_cast<int>(Nthreads),Nl),pool_group);
 }
 
 void SensorFieldHolder::initialize()
@@ -529,22 +610,9 @@ void SensorFieldHolder::link(FDTD const &fdtd)
     Sensor::link(fdtd);
 }
 
-void SensorFieldHolder::threaded_computation(unsigned int ID)
+void SensorFieldHolder::pool_run(int chunk,int Nchunks)
 {
-    std::unique_lock<std::mutex> lock(alternator.get_thread_mutex(ID));
-    
-    threads_ready[ID]=true;
-    
-    alternator.thread_wait_ok(ID,lock);
-    
-    while(process_threads)
-    {
-        if(Nl>int(Nthreads)) FT_comp((ID*Nl)/Nthreads,((ID+1)*Nl)/Nthreads);
-        else if(int(ID)<Nl) FT_comp(ID,ID+1);
-        
-        alternator.signal_main(ID);
-        alternator.thread_wait_ok(ID,lock);
-    }
+    FT_comp((chunk*Nl)/Nchunks,((chunk+1)*Nl)/Nchunks);
 }
 
 void SensorFieldHolder::treat()
@@ -557,41 +625,41 @@ void SensorFieldHolder::update_t(FDTD const &fdtd)
     
     if(type==NORMAL_X || type==NORMAL_XM)
     {
-        for(j=y1;j<y2;j++){ for(k=z1;k<z2;k++)
+        for(j=y1;j<y2;j++){ for(k=held_z1();k<held_z2();k++)
         {
-            t_Ex(j-y1,k-z1)=fdtd.Ex(x1,j,k);
-            t_Ey(j-y1,k-z1)=fdtd.Ey(x1,j,k);
-            t_Ez(j-y1,k-z1)=fdtd.Ez(x1,j,k);
+            t_Ex(j-y1,k-z1)=fdtd.Ex(x1,j,k-z_offset);
+            t_Ey(j-y1,k-z1)=fdtd.Ey(x1,j,k-z_offset);
+            t_Ez(j-y1,k-z1)=fdtd.Ez(x1,j,k-z_offset);
             
-            t_Hx(j-y1,k-z1)=fdtd.Hx(x1,j,k);
-            t_Hy(j-y1,k-z1)=fdtd.Hy(x1,j,k);
-            t_Hz(j-y1,k-z1)=fdtd.Hz(x1,j,k);
+            t_Hx(j-y1,k-z1)=fdtd.Hx(x1,j,k-z_offset);
+            t_Hy(j-y1,k-z1)=fdtd.Hy(x1,j,k-z_offset);
+            t_Hz(j-y1,k-z1)=fdtd.Hz(x1,j,k-z_offset);
         }}
     }
     else if(type==NORMAL_Y || type==NORMAL_YM)
     {
-        for(i=x1;i<x2;i++){ for(k=z1;k<z2;k++)
+        for(i=x1;i<x2;i++){ for(k=held_z1();k<held_z2();k++)
         {
-            t_Ex(i-x1,k-z1)=fdtd.Ex(i,y1,k);
-            t_Ey(i-x1,k-z1)=fdtd.Ey(i,y1,k);
-            t_Ez(i-x1,k-z1)=fdtd.Ez(i,y1,k);
+            t_Ex(i-x1,k-z1)=fdtd.Ex(i,y1,k-z_offset);
+            t_Ey(i-x1,k-z1)=fdtd.Ey(i,y1,k-z_offset);
+            t_Ez(i-x1,k-z1)=fdtd.Ez(i,y1,k-z_offset);
             
-            t_Hx(i-x1,k-z1)=fdtd.Hx(i,y1,k);
-            t_Hy(i-x1,k-z1)=fdtd.Hy(i,y1,k);
-            t_Hz(i-x1,k-z1)=fdtd.Hz(i,y1,k);
+            t_Hx(i-x1,k-z1)=fdtd.Hx(i,y1,k-z_offset);
+            t_Hy(i-x1,k-z1)=fdtd.Hy(i,y1,k-z_offset);
+            t_Hz(i-x1,k-z1)=fdtd.Hz(i,y1,k-z_offset);
         }}
     }
     else if(type==NORMAL_Z || type==NORMAL_ZM)
     {
         for(i=x1;i<x2;i++){ for(j=y1;j<y2;j++)
         {
-            t_Ex(i-x1,j-y1)=fdtd.Ex(i,j,z1);
-            t_Ey(i-x1,j-y1)=fdtd.Ey(i,j,z1);
-            t_Ez(i-x1,j-y1)=fdtd.Ez(i,j,z1);
+            t_Ex(i-x1,j-y1)=fdtd.Ex(i,j,z1-z_offset);
+            t_Ey(i-x1,j-y1)=fdtd.Ey(i,j,z1-z_offset);
+            t_Ez(i-x1,j-y1)=fdtd.Ez(i,j,z1-z_offset);
             
-            t_Hx(i-x1,j-y1)=fdtd.Hx(i,j,z1);
-            t_Hy(i-x1,j-y1)=fdtd.Hy(i,j,z1);
-            t_Hz(i-x1,j-y1)=fdtd.Hz(i,j,z1);
+            t_Hx(i-x1,j-y1)=fdtd.Hx(i,j,z1-z_offset);
+            t_Hy(i-x1,j-y1)=fdtd.Hy(i,j,z1-z_offset);
+            t_Hz(i-x1,j-y1)=fdtd.Hz(i,j,z1-z_offset);
         }}
     }
 }
@@ -602,41 +670,41 @@ void SensorFieldHolder::update_t_interp(FDTD const &fdtd)
     
     if(type==NORMAL_X || type==NORMAL_XM)
     {
-        for(j=y1;j<y2;j++){ for(k=z1;k<z2;k++)
+        for(j=y1;j<y2;j++){ for(k=held_z1();k<held_z2();k++)
         {
-            t_Ex(j-y1,k-z1)=fdtd.local_Ex(x1,j,k);
-            t_Ey(j-y1,k-z1)=fdtd.local_Ey(x1,j,k);
-            t_Ez(j-y1,k-z1)=fdtd.local_Ez(x1,j,k);
+            t_Ex(j-y1,k-z1)=fdtd.local_Ex(x1,j,k-z_offset);
+            t_Ey(j-y1,k-z1)=fdtd.local_Ey(x1,j,k-z_offset);
+            t_Ez(j-y1,k-z1)=fdtd.local_Ez(x1,j,k-z_offset);
             
-            t_Hx(j-y1,k-z1)=fdtd.local_Hx(x1,j,k);
-            t_Hy(j-y1,k-z1)=fdtd.local_Hy(x1,j,k);
-            t_Hz(j-y1,k-z1)=fdtd.local_Hz(x1,j,k);
+            t_Hx(j-y1,k-z1)=fdtd.local_Hx(x1,j,k-z_offset);
+            t_Hy(j-y1,k-z1)=fdtd.local_Hy(x1,j,k-z_offset);
+            t_Hz(j-y1,k-z1)=fdtd.local_Hz(x1,j,k-z_offset);
         }}
     }
     else if(type==NORMAL_Y || type==NORMAL_YM)
     {
-        for(i=x1;i<x2;i++){ for(k=z1;k<z2;k++)
+        for(i=x1;i<x2;i++){ for(k=held_z1();k<held_z2();k++)
         {
-            t_Ex(i-x1,k-z1)=fdtd.local_Ex(i,y1,k);
-            t_Ey(i-x1,k-z1)=fdtd.local_Ey(i,y1,k);
-            t_Ez(i-x1,k-z1)=fdtd.local_Ez(i,y1,k);
+            t_Ex(i-x1,k-z1)=fdtd.local_Ex(i,y1,k-z_offset);
+            t_Ey(i-x1,k-z1)=fdtd.local_Ey(i,y1,k-z_offset);
+            t_Ez(i-x1,k-z1)=fdtd.local_Ez(i,y1,k-z_offset);
             
-            t_Hx(i-x1,k-z1)=fdtd.local_Hx(i,y1,k);
-            t_Hy(i-x1,k-z1)=fdtd.local_Hy(i,y1,k);
-            t_Hz(i-x1,k-z1)=fdtd.local_Hz(i,y1,k);
+            t_Hx(i-x1,k-z1)=fdtd.local_Hx(i,y1,k-z_offset);
+            t_Hy(i-x1,k-z1)=fdtd.local_Hy(i,y1,k-z_offset);
+            t_Hz(i-x1,k-z1)=fdtd.local_Hz(i,y1,k-z_offset);
         }}
     }
     else if(type==NORMAL_Z || type==NORMAL_ZM)
     {
         for(i=x1;i<x2;i++){ for(j=y1;j<y2;j++)
         {
-            t_Ex(i-x1,j-y1)=fdtd.local_Ex(i,j,z1);
-            t_Ey(i-x1,j-y1)=fdtd.local_Ey(i,j,z1);
-            t_Ez(i-x1,j-y1)=fdtd.local_Ez(i,j,z1);
+            t_Ex(i-x1,j-y1)=fdtd.local_Ex(i,j,z1-z_offset);
+            t_Ey(i-x1,j-y1)=fdtd.local_Ey(i,j,z1-z_offset);
+            t_Ez(i-x1,j-y1)=fdtd.local_Ez(i,j,z1-z_offset);
             
-            t_Hx(i-x1,j-y1)=fdtd.local_Hx(i,j,z1);
-            t_Hy(i-x1,j-y1)=fdtd.local_Hy(i,j,z1);
-            t_Hz(i-x1,j-y1)=fdtd.local_Hz(i,j,z1);
+            t_Hx(i-x1,j-y1)=fdtd.local_Hx(i,j,z1-z_offset);
+            t_Hy(i-x1,j-y1)=fdtd.local_Hy(i,j,z1-z_offset);
+            t_Hz(i-x1,j-y1)=fdtd.local_Hz(i,j,z1-z_offset);
         }}
     }
 }
@@ -28,11 +28,23 @@ AFP_TFSF::~AFP_TFSF()
 {
 }
 
-void AFP_TFSF::deep_inject_E(FDTD &fdtd)
+void AFP_TFSF::checkpoint(Checkpoint &chk)
 {
-    int i,j,l;
+    Source::checkpoint(chk);
+    
+    chk.sync(Ex); chk.sync(Ey); chk.sync(Ez);
+    chk.sync(Hx); chk.sync(Hy); chk.sync(Hz);
+    
+    chk.sync(wave_E);
+    chk.sync(wave_H);
     
-    double t=(step+0.5-500)*Dt;
+    chk.sync(amp);
+    chk.sync(amp_H1);
+}
+
+void AFP_TFSF::deep_inject_E(FDTD &fdtd)
+{
+    int i,j;
     
     int i1=xs_s;
     int i2=xs_e;
@@ -43,22 +55,16 @@ void AFP_TFSF::deep_inject_E(FDTD &fdtd)
     int k1=Nz/5;
     int k2=3*Nz/4;
     
-    double inj_Hx=0;
-    double inj_Hy=0;
+    double inj_E[4],inj_H[4];
     
-    for(l=0;l<Nl;l++)
-    {
-        double lambda=lambda_min+(lambda_max-lambda_min)*l/(Nl-1.0);
-        
-        double w=2.0*Pi*c_light/lambda;
-        Imdouble coeff=gaussian_spectrum(w,lambda_min,lambda_max,0.001)*std::exp(-w*t*Im);
-        
-        inj_Hx+=std::real(Hx(k2-1,l)*coeff);
-        inj_Hy+=std::real(Hy(k2-1,l)*coeff);
-    }
+    if(step>=0 && step<wave_H.L2()) for(int n=0;n<4;n++) inj_H[n]=wave_H(n,step);
+    else wave_at(step,inj_E,inj_H);
+    
+    double inj_Hx=inj_H[0];
+    double inj_Hy=inj_H[1];
     
     // Z
-    for(i=i1;i<i2;i++) for(j=j1;j<j2;j++)
+    for(j=j1;j<j2;j++) for(i=i1;i<i2;i++)
     {
         fdtd.Ex(i,j,k2)-=fdtd.dtdex*inj_Hy
                          /fdtd.mats[fdtd.matsgrid(i,j,k2)].ei;
@@ -67,23 +73,11 @@ void AFP_TFSF::deep_inject_E(FDTD &fdtd)
                          /fdtd.mats[fdtd.matsgrid(i,j,k2)].ei;
     }
     
-    inj_Hx=inj_Hy=0;
-    
-    
-    for(l=0;l<Nl;l++)
-    {
-        double lambda=lambda_min+(lambda_max-lambda_min)*l/(Nl-1.0);
-        
-        double w=2.0*Pi*c_light/lambda;
-        Imdouble coeff=gaussian_spectrum(w,lambda_min,lambda_max,0.001)*std::exp(-w*t*Im);
-        
-        inj_Hx+=std::real(Hx(k1-1,l)*coeff);
-        inj_Hy+=std::real(Hy(k1-1,l)*coeff);
-    }
-    
+    inj_Hx=inj_H[2];
+    inj_Hy=inj_H[3];
     
     // Z
-    for(i=i1;i<i2;i++) for(j=j1;j<j2;j++)
+    for(j=j1;j<j2;j++) for(i=i1;i<i2;i++)
     {
         fdtd.Ex(i,j,k1)+=fdtd.dtdex*inj_Hy
                          /fdtd.mats[fdtd.matsgrid(i,j,k1)].ei;
@@ -143,9 +137,7 @@ void AFP_TFSF::deep_inject_H(FDTD &fdtd)
 {
     // H-field injection
     
-    int i,j,l;
-    
-    double t=(step+1-500)*Dt;
+    int i,j;
     
     int i1=xs_s;
     int i2=xs_e;
@@ -156,42 +148,26 @@ void AFP_TFSF::deep_inject_H(FDTD &fdtd)
     int k1=Nz/5;
     int k2=3*Nz/4;
     
-    double inj_Ex=0;
-    double inj_Ey=0;
+    double inj_E[4],inj_H[4];
     
-    for(l=0;l<Nl;l++)
-    {
-        double lambda=lambda_min+(lambda_max-lambda_min)*l/(Nl-1.0);
-        
-        double w=2.0*Pi*c_light/lambda;
-        Imdouble coeff=gaussian_spectrum(w,lambda_min,lambda_max,0.001)*std::exp(-w*t*Im);
-        
-        inj_Ex+=std::real(Ex(k2,l)*coeff);
-        inj_Ey+=std::real(Ey(k2,l)*coeff);
-    }
+    if(step>=0 && step<wave_E.L2()) for(int n=0;n<4;n++) inj_E[n]=wave_E(n,step);
+    else wave_at(step,inj_E,inj_H);
+    
+    double inj_Ex=inj_E[0];
+    double inj_Ey=inj_E[1];
     
     // Z
-    for(i=i1;i<i2;i++) for(j=j1;j<j2;j++)
+    for(j=j1;j<j2;j++) for(i=i1;i<i2;i++)
     {
         fdtd.Hx(i,j,k2-1)+=fdtd.dtdmx*inj_Ey;
         fdtd.Hy(i,j,k2-1)-=fdtd.dtdmx*inj_Ex;
     }
     
-    inj_Ex=inj_Ey=0;
+    inj_Ex=inj_E[2];
+    inj_Ey=inj_E[3];
     
-    for(l=0;l<Nl;l++)
-    {
-        double lambda=lambda_min+(lambda_max-lambda_min)*l/(Nl-1.0);
-        
-        double w=2.0*Pi*c_light/lambda;
-        Imdouble coeff=gaussian_spectrum(w,lambda_min,lambda_max,0.0001)*std::exp(-w*t*Im);
-        
-        inj_Ex+=std::real(Ex(k1,l)*coeff);
-        inj_Ey+=std::real(Ey(k1,l)*coeff);
-    }
-//    plog<<step<<" "<<inj_Ex<<std::endl;
     // Z
-    for(i=i1;i<i2;i++) for(j=j1;j<j2;j++)
+    for(j=j1;j<j2;j++) for(i=i1;i<i2;i++)
     {
         fdtd.Hx(i,j,k1-1)-=fdtd.dtdmx*inj_Ey;
         fdtd.Hy(i,j,k1-1)+=fdtd.dtdmx*inj_Ex;
@@ -283,6 +259,8 @@ void AFP_TFSF::initialize()
             Hz(k,l)=fdfd.get_Hz(0,0,k);
         }
     }
+    
+    tabulate();
 }
 
 void AFP_TFSF::set_matsgrid(Grid3<unsigned int> const &G)
@@ -292,3 +270,77 @@ void AFP_TFSF::set_matsgrid(Grid3<unsigned int> const &G)
     matsgrid.init(1,1,Nz,0);
     for(k=0;k<Nz;k++) matsgrid(0,0,k)=G(0,0,k);
 }
+
+// Sums the spectral components once for all the steps
+
+void AFP_TFSF::tabulate()
+{
+    int l,n,t;
+    
+    w.resize(Nl);
+    amp.resize(Nl);
+    amp_H1.resize(Nl);
+    
+    for(l=0;l<Nl;l++)
+    {
+        double lambda=lambda_min+(lambda_max-lambda_min)*l/(Nl-1.0);
+        
+        w[l]=2.0*Pi*c_light/lambda;
+        amp[l]=gaussian_spectrum(w[l],lambda_min,lambda_max,0.001);
+        amp_H1[l]=gaussian_spectrum(w[l],lambda_min,lambda_max,0.0001);
+    }
+    
+    wave_E.init(4,Nt,0);
+    wave_H.init(4,Nt,0);
+    
+    double inj_E[4],inj_H[4];
+    
+    for(t=0;t<Nt;t++)
+    {
+        wave_at(t,inj_E,inj_H);
+        
+        for(n=0;n<4;n++)
+        {
+            wave_E(n,t)=inj_E[n];
+            wave_H(n,t)=inj_H[n];
+        }
+    }
+}
+
+// Injected values for the step t: Hx and Hy below the upper then the lower
+// plane in inj_H, Ex and Ey on them in inj_E. The phase factor of a given
+// wavelength is shared by the two planes
+
+void AFP_TFSF::wave_at(int t,double *inj_E,double *inj_H) const
+{
+    int k1=Nz/5;
+    int k2=3*Nz/4;
+    
+    double t_E=(t+0.5-500)*Dt;
+    double t_H=(t+1-500)*Dt;
+    
+    for(int n=0;n<4;n++) inj_E[n]=inj_H[n]=0;
+    
+    for(int l=0;l<Nl;l++)
+    {
+        Imdouble phase_E=std::exp(-w[l]*t_E*Im);
+        Imdouble phase_H=std::exp(-w[l]*t_H*Im);
+        
+        Imdouble coeff=amp[l]*phase_E;
+        
+        inj_H[0]+=std::real(Hx(k2-1,l)*coeff);
+        inj_H[1]+=std::real(Hy(k2-1,l)*coeff);
+        inj_H[2]+=std::real(Hx(k1-1,l)*coeff);
+        inj_H[3]+=std::real(Hy(k1-1,l)*coeff);
+        
+        coeff=amp[l]*phase_H;
+        
+        inj_E[0]+=std::real(Ex(k2,l)*coeff);
+        inj_E[1]+=std::real(Ey(k2,l)*coeff);
+        
+        coeff=amp_H1[l]*phase_H;
+        
+        inj_E[2]+=std::real(Ex(k1,l)*coeff);
+        inj_E[3]+=std::real(Ey(k1,l)*coeff);
+    }
+}
@@ -15,11 +15,102 @@ limitations under the License.*/
 #include <sources.h>
 #include <phys_constants.h>
 #include <phys_tools.h>
+#include <thread_utils.h>
+
+#include <fftw3.h>
 
 
 extern const Imdouble Im;
 extern std::ofstream plog;
 
+// Evaluates out[n]=sum_l b[l]*exp(-theta*l*n*Im) for n in [0,N) with the
+// Bluestein decomposition l*n=(l^2+n^2-(n-l)^2)/2, which turns the sums
+// into a single convolution done with FFTs
+
+static void chirp_z(std::vector<Imdouble> &out,std::vector<Imdouble> const &b,double theta,int N)
+{
+    int l,n;
+    int L=b.size();
+    
+    int M=1;
+    while(M<L+N-1) M*=2;
+    
+    fftw_complex *U=(fftw_complex*)fftw_malloc(M*sizeof(fftw_complex));
+    fftw_complex *V=(fftw_complex*)fftw_malloc(M*sizeof(fftw_complex));
+    
+    fftw_plan pU,pV,pI;
+    
+    {
+        std::unique_lock<std::mutex> lock(fftw_planner_mutex());
+        
+        pU=fftw_plan_dft_1d(M,U,U,FFTW_FORWARD,FFTW_ESTIMATE);
+        pV=fftw_plan_dft_1d(M,V,V,FFTW_FORWARD,FFTW_ESTIMATE);
+        pI=fftw_plan_dft_1d(M,U,U,FFTW_BACKWARD,FFTW_ESTIMATE);
+    }
+    
+    for(n=0;n<M;n++)
+    {
+        U[n][0]=U[n][1]=0;
+        V[n][0]=V[n][1]=0;
+    }
+    
+    Imdouble tmp;
+    
+    for(l=0;l<L;l++)
+    {
+        tmp=b[l]*std::exp(-0.5*theta*(l*static_cast<double>(l))*Im);
+        
+        U[l][0]=tmp.real();
+        U[l][1]=tmp.imag();
+    }
+    
+    for(n=0;n<N;n++)
+    {
+        tmp=std::exp(0.5*theta*(n*static_cast<double>(n))*Im);
+        
+        V[n][0]=tmp.real();
+        V[n][1]=tmp.imag();
+    }
+    
+    for(l=1;l<L;l++)
+    {
+        tmp=std::exp(0.5*theta*(l*static_cast<double>(l))*Im);
+        
+        V[M-l][0]=tmp.real();
+        V[M-l][1]=tmp.imag();
+    }
+    
+    fftw_execute(pU);
+    fftw_execute(pV);
+    
+    for(n=0;n<M;n++)
+    {
+        tmp=Imdouble(U[n][0],U[n][1])*Imdouble(V[n][0],V[n][1]);
+        
+        U[n][0]=tmp.real();
+        U[n][1]=tmp.imag();
+    }
+    
+    fftw_execute(pI);
+    
+    out.resize(N);
+    
+    for(n=0;n<N;n++)
+        out[n]=Imdouble(U[n][0],U[n][1])/static_cast<double>(M)
+               *std::exp(-0.5*theta*(n*static_cast<double>(n))*Im);
+    
+    {
+        std::unique_lock<std::mutex> lock(fftw_planner_mutex());
+        
+        fftw_destroy_plan(pU);
+        fftw_destroy_plan(pV);
+        fftw_destroy_plan(pI);
+    }
+    
+    fftw_free(U);
+    fftw_free(V);
+}
+
 Bloch_Wideband::Bloch_Wideband(int x1_,int x2_,int y1_,int y2_,int z1_,int z2_,
                                double kx_,double ky_,AngleRad polar_)
     :Source(x1_,x2_,y1_,y2_,z1_,z2_),
@@ -35,6 +126,18 @@ Bloch_Wideband::~Bloch_Wideband()
 {
 }
 
+void Bloch_Wideband::checkpoint(Checkpoint &chk)
+{
+    Source::checkpoint(chk);
+    
+    chk.sync(t_offset);
+    
+    chk.sync(wave_Ex); chk.sync(wave_Ey);
+    chk.sync(wave_Hx); chk.sync(wave_Hy);
+    
+    chk.sync(phase_x); chk.sync(phase_y);
+}
+
 void Bloch_Wideband::deep_link(FDTD const &fdtd)
 {
     eps_inf=fdtd.mats[fdtd.matsgrid(x1,y1,z2)].ei;
@@ -196,6 +299,18 @@ void Bloch_Wideband::initialize()
     
     t_offset=-2*t_offset;
     
+    tabulate(wave_Hx,wave_Hy,H_base,(z2-0.5)*Dz,t_offset-0.5);
+    tabulate(wave_Ex,wave_Ey,E_base,z2*Dz,t_offset);
+    
+    phase_x.init(Nx,Ny);
+    phase_y.init(Nx,Ny);
+    
+    for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+    {
+        phase_x(i,j)=std::exp(((i+0.5)*Dx*kx+j*Dy*ky)*Im);
+        phase_y(i,j)=std::exp((i*Dx*kx+(j+0.5)*Dy*ky)*Im);
+    }
+    
 //    for(int t=0;t<15000;t++)
 //    {
 //        E=ImVector3(0,0,0);
@@ -215,30 +330,27 @@ void Bloch_Wideband::initialize()
 
 void Bloch_Wideband::inject_E(FDTD &real_fdtd,FDTD &imag_fdtd)
 {
-    int i,j,l;
+    int i,j;
     
-    Imdouble Hx=0,Hy=0;
+    Imdouble Hx,Hy;
     Imdouble Hx_inj,Hy_inj;
     
-    Imdouble im_arg;
-    
-    for(l=0;l<Nl;l++)
+    if(step>=0 && step<static_cast<int>(wave_Hx.size()))
     {
-        im_arg=std::exp(-(kz[l]*(z2-0.5)*Dz+w[l]*Dt*(step-0.5+t_offset))*Im);
-        
-        Hx+=H_base[l].x*im_arg;
-        Hy+=H_base[l].y*im_arg;
+        Hx=wave_Hx[step];
+        Hy=wave_Hy[step];
     }
+    else wave_at(Hx,Hy,H_base,(z2-0.5)*Dz,t_offset-0.5,step);
     
     double tmp1,tmp2,C2z;
     real_fdtd.mats[real_fdtd.matsgrid(0,0,z2)].coeffsX(tmp1,tmp2,C2z);
     
-    for(i=0;i<Nx;i++)
+    for(j=0;j<Ny;j++)
     {
-        for(j=0;j<Ny;j++)
+        for(i=0;i<Nx;i++)
         {
-            Hx_inj=Hx*std::exp((i*Dx*kx+(j+0.5)*Dy*ky)*Im);
-            Hy_inj=Hy*std::exp(((i+0.5)*Dx*kx+j*Dy*ky)*Im);
+            Hx_inj=Hx*phase_y(i,j);
+            Hy_inj=Hy*phase_x(i,j);
             
             real_fdtd.Ex(i,j,z2)-=C2z*Hy_inj.real();
             imag_fdtd.Ex(i,j,z2)-=C2z*Hy_inj.imag();
@@ -251,27 +363,24 @@ void Bloch_Wideband::inject_E(FDTD &real_fdtd,FDTD &imag_fdtd)
 
 void Bloch_Wideband::inject_H(FDTD &real_fdtd,FDTD &imag_fdtd)
 {
-    int i,j,l;
+    int i,j;
     
-    Imdouble Ex=0,Ey=0;
+    Imdouble Ex,Ey;
     Imdouble Ex_inj,Ey_inj;
     
-    Imdouble im_arg;
-    
-    for(l=0;l<Nl;l++)
+    if(step>=0 && step<static_cast<int>(wave_Ex.size()))
     {
-        im_arg=std::exp(-(kz[l]*(z2)*Dz+w[l]*Dt*(step+t_offset))*Im);
-        
-        Ex+=E_base[l].x*im_arg;
-        Ey+=E_base[l].y*im_arg;
+        Ex=wave_Ex[step];
+        Ey=wave_Ey[step];
     }
+    else wave_at(Ex,Ey,E_base,z2*Dz,t_offset,step);
     
-    for(i=0;i<Nx;i++)
+    for(j=0;j<Ny;j++)
     {
-        for(j=0;j<Ny;j++)
+        for(i=0;i<Nx;i++)
         {
-            Ex_inj=Ex*std::exp(((i+0.5)*Dx*kx+j*Dy*ky)*Im);
-            Ey_inj=Ey*std::exp((i*Dx*kx+(j+0.5)*Dy*ky)*Im);
+            Ex_inj=Ex*phase_x(i,j);
+            Ey_inj=Ey*phase_y(i,j);
             
             real_fdtd.Hx(i,j,z2-1)+=real_fdtd.dtdmz*Ey_inj.real();
             imag_fdtd.Hx(i,j,z2-1)+=imag_fdtd.dtdmz*Ey_inj.imag();
@@ -291,3 +400,54 @@ void Bloch_Wideband::set_cut_angle(AngleRad const &safe_angle_,AngleRad const &c
     
     if(safe_angle.degree()>cut_angle.degree()-1.0) safe_angle.degree(cut_angle.degree()-1.0);
 }
+
+// Waveforms at height z for the times (step+t_shift)*Dt of the run. The
+// frequencies being evenly spaced, w[l]=w[0]+l*dw, the spectral sums are
+// chirp-z transforms of the base amplitudes in step units.
+
+void Bloch_Wideband::tabulate(std::vector<Imdouble> &wave_x,std::vector<Imdouble> &wave_y,
+                              Grid1<Vector3> const &base,double z,double t_shift)
+{
+    int l,n;
+    
+    double dw=(w[Nl-1]-w[0])/(Nl-1.0);
+    double theta=dw*Dt;
+    
+    std::vector<Imdouble> bx(Nl),by(Nl);
+    
+    for(l=0;l<Nl;l++)
+    {
+        Imdouble coeff=std::exp(-(kz[l]*z+l*theta*t_shift)*Im);
+        
+        bx[l]=base[l].x*coeff;
+        by[l]=base[l].y*coeff;
+    }
+    
+    chirp_z(wave_x,bx,theta,Nt);
+    chirp_z(wave_y,by,theta,Nt);
+    
+    for(n=0;n<Nt;n++)
+    {
+        Imdouble coeff=std::exp(-w[0]*Dt*(n+t_shift)*Im);
+        
+        wave_x[n]*=coeff;
+        wave_y[n]*=coeff;
+    }
+}
+
+// Direct spectral sum of tabulate() for the step n, for the steps past the
+// tabulated ones
+
+void Bloch_Wideband::wave_at(Imdouble &wave_x,Imdouble &wave_y,
+                             Grid1<Vector3> const &base,double z,double t_shift,int n) const
+{
+    wave_x=wave_y=0;
+    
+    for(int l=0;l<Nl;l++)
+    {
+        Imdouble coeff=std::exp(-(kz[l]*z+w[l]*Dt*(n+t_shift))*Im);
+        
+        wave_x+=base[l].x*coeff;
+        wave_y+=base[l].y*coeff;
+    }
+}
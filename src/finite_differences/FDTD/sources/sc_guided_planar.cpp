@@ -12,6 +12,7 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.*/
 
+#include <filehdl.h>
 #include <multilayers.h>
 #include <phys_tools.h>
 #include <sources.h>
@@ -45,6 +46,19 @@ Guided_planar::~Guided_planar()
     }
 }
 
+void Guided_planar::checkpoint(Checkpoint &chk)
+{
+    Source::checkpoint(chk);
+    
+    chk.sync(tshift);
+    chk.sync(t_max);
+    chk.sync(scaling);
+    
+    chk.sync(precomp);
+    chk.sync(precomp_E);
+    chk.sync(precomp_H);
+}
+
 void Guided_planar::deep_inject_E(FDTD &fdtd)
 {
     if(step>=t_max) return;
@@ -67,18 +81,18 @@ void Guided_planar::deep_inject_E(FDTD &fdtd)
     
     if(polar==TE)
     {
-        for(int k=z1;k<z2;k++)
+        for(int k=local_z1();k<local_z2();k++)
         {
             fdtd.mats[fdtd.matsgrid(x1,y1,k)].coeffsY(tmp1,C2x,tmp2);
-            fdtd.Ey(x1,y1,k)+=C2x*precomp_H[k-z1].real();
+            fdtd.Ey(x1,y1,k)+=C2x*precomp_H[k+z_offset-z1].real();
         }
     }
     else
     {
-        for(int k=z1;k<z2;k++)
+        for(int k=local_z1();k<local_z2();k++)
         {
             fdtd.mats[fdtd.matsgrid(x1,y1,k)].coeffsZ(tmp1,C2x,tmp2);
-            fdtd.Ez(x1,y1,k)-=C2x*precomp_H[k-z1].real();
+            fdtd.Ez(x1,y1,k)-=C2x*precomp_H[k+z_offset-z1].real();
         }
     }
 }
@@ -101,13 +115,13 @@ void Guided_planar::deep_inject_H(FDTD &fdtd)
     
     if(polar==TE)
     {
-        for(int k=z1;k<z2;k++)
-            fdtd.Hz(x1-1,y1,k)+=fdtd.dtdmx*precomp_E[k-z1].real();
+        for(int k=local_z1();k<local_z2();k++)
+            fdtd.Hz(x1-1,y1,k)+=fdtd.dtdmx*precomp_E[k+z_offset-z1].real();
     }
     else
     {
-        for(int k=z1;k<z2;k++)
-            fdtd.Hy(x1-1,y1,k)-=fdtd.dtdmx*precomp_E[k-z1].real();
+        for(int k=local_z1();k<local_z2();k++)
+            fdtd.Hy(x1-1,y1,k)-=fdtd.dtdmx*precomp_E[k+z_offset-z1].real();
     }
 }
 
@@ -118,10 +132,18 @@ void Guided_planar::deep_link(FDTD const &fdtd)
     for(unsigned int i=0;i<mats.size();i++)
         mats[i]=&fdtd.mats[i];
     
-    matsgrid.resize(z2-z1);
+    matsgrid.resize(z2-z1,0);
+    
+    // Each slab fills the planes it owns
     
-    for(unsigned int i=0;i<matsgrid.size();i++)
-        matsgrid[i]=fdtd.matsgrid(x1,y1,i+z1);
+    for(int k=z1;k<z2;k++)
+    {
+        int kl=k-z_offset;
+        
+        if(kl>=fdtd.zo_s && kl<fdtd.zo_e) matsgrid[k-z1]=fdtd.matsgrid(x1,y1,kl);
+    }
+    
+    if(fdtd.domain!=nullptr) fdtd.domain->sum(matsgrid);
 }
 
 #include <fdfd.h>
@@ -243,6 +265,8 @@ void Guided_planar::initialize()
         
         Grid2<double> img(Nl,z2-z1);
         
+        std::unique_lock<std::mutex> lock(plog_mutex());
+        
         for(int l=0;l<Nl;l++)
         {
             plog<<lambda[l]<<" "<<n_eff[l].real()<<" "<<n_eff[l].imag()<<std::endl;
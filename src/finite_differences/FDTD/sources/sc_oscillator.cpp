@@ -31,6 +31,15 @@ Oscillator::~Oscillator()
 {
 }
 
+void Oscillator::checkpoint(Checkpoint &chk)
+{
+    Source::checkpoint(chk);
+    
+    chk.sync(tshift);
+    chk.sync(w0);
+    chk.sync(dw);
+}
+
 void Oscillator::deep_inject_E(FDTD &fdtd)
 {
     int i,j,k;
@@ -42,21 +51,21 @@ void Oscillator::deep_inject_E(FDTD &fdtd)
     
     if(type==NORMAL_X)
     {
-        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=z1;k<z2;k++) 
+        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=local_z1();k<local_z2();k++) 
         {
             fdtd.Ex(i,j,k)+=val;
         }
     }
     else if(type==NORMAL_Y)
     {
-        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=z1;k<z2;k++) 
+        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=local_z1();k<local_z2();k++) 
         {
             fdtd.Ey(i,j,k)+=val;
         }
     }
     else if(type==NORMAL_Z)
     {
-        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=z1;k<z2;k++) 
+        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=local_z1();k<local_z2();k++) 
         {
             fdtd.Ez(i,j,k)+=val;
         }
@@ -98,6 +107,15 @@ MR_Oscillator::~MR_Oscillator()
 {
 }
 
+void MR_Oscillator::checkpoint(Checkpoint &chk)
+{
+    Source::checkpoint(chk);
+    
+    chk.sync(tshift);
+    chk.sync(w0);
+    chk.sync(dw);
+}
+
 void MR_Oscillator::deep_inject_E(FDTD &fdtd)
 {
     int i,j,k;
@@ -107,21 +125,21 @@ void MR_Oscillator::deep_inject_E(FDTD &fdtd)
     
     if(type==NORMAL_X)
     {
-        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=z1;k<z2;k++) 
+        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=local_z1();k<local_z2();k++) 
         {
             fdtd.Ex(i,j,k)+=val;
         }
     }
     else if(type==NORMAL_Y)
     {
-        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=z1;k<z2;k++) 
+        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=local_z1();k<local_z2();k++) 
         {
             fdtd.Ey(i,j,k)+=val;
         }
     }
     else if(type==NORMAL_Z)
     {
-        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=z1;k<z2;k++) 
+        for(i=x1;i<x2;i++) for(j=y1;j<y2;j++)  for(k=local_z1();k<local_z2();k++) 
         {
             fdtd.Ez(i,j,k)+=val;
         }
@@ -81,7 +81,7 @@ void Source_generator::operator = (Source_generator const &src)
     ni_target=src.ni_target;
 }
 
-void Source_generator::to_discrete(double Dx,double Dy,double Dz)
+void Source_generator::to_discrete(double Dx,double Dy,double Dz,std::vector<double> const &z_steps)
 {
     if(location_real)
     {
@@ -95,8 +95,8 @@ void Source_generator::to_discrete(double Dx,double Dy,double Dz)
         
         if(y2<=y1) y2=y1+1;
         
-        z1=nearest_integer(z1r/Dz);
-        z2=nearest_integer(z2r/Dz);
+        z1=nearest_z_plane(z1r,Dz,z_steps);
+        z2=nearest_z_plane(z2r,Dz,z_steps);
         
         if(z2<=z1) z2=z1+1;
     }
@@ -158,6 +158,15 @@ Source::~Source()
 {
 }
 
+void Source::checkpoint(Checkpoint &chk)
+{
+    chk.sync(step);
+    
+    chk.sync(lambda);
+    chk.sync(w);
+    chk.sync(Sp);
+}
+
 void Source::deep_inject_E(FDTD &fdtd)
 {
 }
@@ -253,9 +262,13 @@ void Source::link(FDTD const &fdtd)
 {
     Nx=fdtd.Nx;
     Ny=fdtd.Ny;
-    Nz=fdtd.Nz;
+    Nz=fdtd.Nz_glob;
     Nt=fdtd.Nt;
     
+    z_offset=fdtd.z_offset;
+    zl_s=z_offset;
+    zl_e=z_offset+fdtd.Nz;
+    
     Dx=fdtd.Dx;
     Dy=fdtd.Dy;
     Dz=fdtd.Dz;
@@ -282,6 +295,11 @@ void Source::link(FDTD const &fdtd)
     initialize();
 }
 
+// Local bounds of the source planes held by the grid, including the halos
+
+int Source::local_z1() const { return std::max(z1,zl_s)-z_offset; }
+int Source::local_z2() const { return std::min(z2,zl_e)-z_offset; }
+
 void Source::set_loc(int x1_,int x2_,
                      int y1_,int y2_,
                      int z1_,int z2_)
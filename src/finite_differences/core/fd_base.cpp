@@ -49,6 +49,10 @@ FD_Base::FD_Base()
 {
 }
 
+FD_Base::~FD_Base()
+{
+}
+
 void FD_Base::extend_grid()
 {
     extend_grid_sub(matsgrid);
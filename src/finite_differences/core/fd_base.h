@@ -59,6 +59,7 @@ class FD_Base
         Grid3<unsigned int> matsgrid;
         
         FD_Base();
+        virtual ~FD_Base();
         
         void extend_grid();
         void extend_grid_sub(Grid3<unsigned int> &matsgrid);
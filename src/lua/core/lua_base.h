@@ -299,6 +299,8 @@ T* lua_get_metapointer(lua_State *L,int index)
 class base_mode
 {
     public:
+        virtual ~base_mode() {}
+        
         virtual bool interruption_type() { return false; }
         virtual void process() {}
 };
@@ -14,6 +14,7 @@ limitations under the License.*/
 
 #include <lua_material.h>
 #include <lua_multilayers.h>
+#include <math_optim.h>
 
 
 extern const Imdouble Im;
@@ -137,6 +138,78 @@ void script_multilayer(std::string const &name)
     file.close();
 }
 
+//#######################
+//   Berreman_Spectrum
+//#######################
+
+// The wavelengths are split in chunks run on the shared pool, each one on
+// its own stack since B_strat keeps its intermediate matrices as members.
+// The permittivities are evaluated beforehand on the calling thread
+
+class Berreman_Spectrum: public PoolTask
+{
+    public:
+        int N_layers,Nl;
+        double index_sup,index_sub;
+        AngleRad angle;
+        
+        std::vector<double> layer_h,lambda;
+        std::vector<Imdouble> eps;
+        std::vector<Imdouble> r_TE,r_TM,t_TE,t_TM;
+        
+        Berreman_Spectrum(int N_layers,int Nl);
+        
+        void compute();
+        void compute_chunk(int i1,int i2);
+        void pool_run(int chunk,int Nchunks);
+};
+
+Berreman_Spectrum::Berreman_Spectrum(int N_layers_,int Nl_)
+    :N_layers(N_layers_), Nl(Nl_),
+     index_sup(1.0), index_sub(1.0),
+     angle(0),
+     layer_h(N_layers,0), lambda(Nl,0),
+     eps(N_layers*Nl,1.0),
+     r_TE(Nl,0), r_TM(Nl,0), t_TE(Nl,0), t_TM(Nl,0)
+{
+}
+
+void Berreman_Spectrum::compute()
+{
+    int Nchunks=std::min(max_threads_number(),Nl/16);
+    
+    if(Nchunks<=1) compute_chunk(0,Nl);
+    else
+    {
+        PoolGroup group;
+        
+        shared_pool().submit(this,Nchunks,group);
+        shared_pool().wait(group);
+    }
+}
+
+void Berreman_Spectrum::compute_chunk(int i1,int i2)
+{
+    B_strat strat(N_layers,index_sup,index_sub);
+    
+    for(int i=i1;i<i2;i++)
+    {
+        for(int j=0;j<N_layers;j++)
+            strat.set_iso(j,layer_h[j],eps[i*N_layers+j],1.0);
+        
+        strat.compute(lambda[i],angle,r_TE[i],r_TM[i],t_TE[i],t_TM[i]);
+    }
+}
+
+void Berreman_Spectrum::pool_run(int chunk,int Nchunks)
+{
+    compute_chunk((chunk*Nl)/Nchunks,((chunk+1)*Nl)/Nchunks);
+}
+
+//##############################
+//   Multilayer_Berreman_mode
+//##############################
+
 void Multilayer_Berreman_mode::process()
 {
     int i,j;
@@ -145,8 +218,6 @@ void Multilayer_Berreman_mode::process()
     
     int N_layers=layer_h.size();
     
-    B_strat strat(N_layers,index_sup,index_sub);
-    
     lua_material::Loader loader;
     
     std::vector<Material> mats(N_layers);
@@ -155,17 +226,32 @@ void Multilayer_Berreman_mode::process()
         loader.load(&mats[i],layer_mat[i]);
     }
     
+    Berreman_Spectrum spectrum(N_layers,Nl);
+    
+    spectrum.index_sup=index_sup;
+    spectrum.index_sub=index_sub;
+    spectrum.angle=angle;
+    spectrum.layer_h=layer_h;
+    
     for(i=0;i<Nl;i++)
     {
         double lambda=lambda_min+(lambda_max-lambda_min)*i/(Nl-1.0);
         double w=2.0*Pi*c_light/lambda;
         
-        for(j=0;j<N_layers;j++)
-            strat.set_iso(j,layer_h[j],mats[j].get_eps(w),1.0);
+        spectrum.lambda[i]=lambda;
         
-        Imdouble r_TE,t_TE,r_TM,t_TM;
+        for(j=0;j<N_layers;j++)
+            spectrum.eps[i*N_layers+j]=mats[j].get_eps(w);
+    }
+    
+    spectrum.compute();
+    
+    for(i=0;i<Nl;i++)
+    {
+        double lambda=spectrum.lambda[i];
         
-        strat.compute(lambda,angle,r_TE,r_TM,t_TE,t_TM);
+        Imdouble r_TE=spectrum.r_TE[i],t_TE=spectrum.t_TE[i],
+                 r_TM=spectrum.r_TM[i],t_TM=spectrum.t_TM[i];
         
         using std::abs;
         using std::arg;
@@ -283,24 +369,27 @@ void Multilayer_mode::process()
         loader.load(&mats[i],layer_mat[i]);
     }
     
-    Multilayer mlt(N_layers);
-    
-    mlt.set_environment(index_sup,index_sub);
-    mlt.set_angle(angle);
+    Multilayer_TMM_Batch mlt(N_layers,Nl);
     
     for(i=0;i<Nl;i++)
     {
         double lambda=lambda_min+(lambda_max-lambda_min)*i/(Nl-1.0);
-        double w=2.0*Pi*c_light/lambda;
-        
-        mlt.set_lambda(lambda);
         
-        for(j=0;j<N_layers;j++)
-            mlt.set_layer(j,layer_h[j],mats[j].get_n(w));
-        
-        Imdouble r_TE,t_TE,r_TM,t_TM;
+        mlt.set_point(i,lambda,angle);
+        mlt.set_environment(i,index_sup,index_sub);
+    }
+    
+    for(j=0;j<N_layers;j++)
+        mlt.set_layer(j,layer_h[j],mats[j]);
+    
+    mlt.compute();
+    
+    for(i=0;i<Nl;i++)
+    {
+        double lambda=mlt.lambda[i];
         
-        mlt.compute(r_TE,r_TM,t_TE,t_TM);
+        Imdouble r_TE=mlt.r_TE[i],t_TE=mlt.t_TE[i],
+                 r_TM=mlt.r_TM[i],t_TM=mlt.t_TM[i];
         
         using std::abs;
         using std::arg;
@@ -388,14 +477,145 @@ int multilayer_mode_set_sup_index(lua_State *L)
     return 0;
 }
 
+//#######################
+//   Multilayer_Design
+//#######################
+
+// Weighted least-squares merit of a stack against its design goals, each
+// goal being averaged over its points. The indices of every point are
+// evaluated once, the variables being pointers to the layer thicknesses
+
+class Multilayer_Design: public OptimGradientTarget
+{
+    public:
+        int N_layers,Npts;
+        std::vector<double> &layer_h;
+        std::vector<Multilayer_TMM_goal> const &goals;
+        
+        std::vector<int> point_goal;
+        std::vector<double> point_lambda;
+        std::vector<AngleRad> point_angle;
+        std::vector<Imdouble> point_sup,point_sub,point_index;
+        
+        Multilayer_Design(std::vector<double> &layer_h,
+                          std::vector<Multilayer_TMM_goal> const &goals,
+                          std::vector<Material> &mats,Material &mat_sup,Material &mat_sub);
+        
+        double evaluate(std::vector<double*> const &variables,std::vector<double> &gradient);
+};
+
+// Value of the goal quantity and its derivatives with respect to the
+// thicknesses, the unpolarized case being the TE/TM average
+
+static double design_quantity(MLGradientHolder const &holder,Multilayer_TMM_goal const &goal,
+                              std::vector<double> &dQ)
+{
+    double w_TE=0.5,w_TM=0.5;
+    
+         if(goal.polar=="TE") { w_TE=1.0; w_TM=0; }
+    else if(goal.polar=="TM") { w_TE=0; w_TM=1.0; }
+    
+    double R=w_TE*holder.R_TE+w_TM*holder.R_TM;
+    double T=w_TE*holder.T_TE+w_TM*holder.T_TM;
+    
+    dQ.resize(holder.dR_TE_dh.size());
+    
+    for(std::size_t l=0;l<dQ.size();l++)
+    {
+        double dR=w_TE*holder.dR_TE_dh[l]+w_TM*holder.dR_TM_dh[l];
+        double dT=w_TE*holder.dT_TE_dh[l]+w_TM*holder.dT_TM_dh[l];
+        
+             if(goal.quantity=="R") dQ[l]=dR;
+        else if(goal.quantity=="T") dQ[l]=dT;
+        else dQ[l]=-dR-dT;
+    }
+    
+         if(goal.quantity=="R") return R;
+    else if(goal.quantity=="T") return T;
+    
+    return 1.0-R-T;
+}
+
+Multilayer_Design::Multilayer_Design(std::vector<double> &layer_h_,
+                                     std::vector<Multilayer_TMM_goal> const &goals_,
+                                     std::vector<Material> &mats,Material &mat_sup,Material &mat_sub)
+    :N_layers(layer_h_.size()), Npts(0),
+     layer_h(layer_h_),
+     goals(goals_)
+{
+    for(std::size_t g=0;g<goals.size();g++)
+    {
+        Multilayer_TMM_goal const &goal=goals[g];
+        
+        for(int i=0;i<goal.Nl;i++)
+        {
+            double lambda=goal.lambda_min;
+            if(goal.Nl>1) lambda+=(goal.lambda_max-goal.lambda_min)*i/(goal.Nl-1.0);
+            
+            double w=m_to_rad_Hz(lambda);
+            
+            point_goal.push_back(g);
+            point_lambda.push_back(lambda);
+            point_angle.push_back(Degree(goal.angle));
+            point_sup.push_back(mat_sup.get_n(w));
+            point_sub.push_back(mat_sub.get_n(w));
+            
+            for(int l=0;l<N_layers;l++)
+                point_index.push_back(mats[l].get_n(w));
+            
+            Npts++;
+        }
+    }
+}
+
+double Multilayer_Design::evaluate(std::vector<double*> const &variables,std::vector<double> &gradient)
+{
+    int l,p;
+    
+    Multilayer_TMM tmm(N_layers);
+    MLGradientHolder holder;
+    
+    std::vector<double> dQ,dF(N_layers,0);
+    
+    double F=0;
+    
+    for(p=0;p<Npts;p++)
+    {
+        Multilayer_TMM_goal const &goal=goals[point_goal[p]];
+        
+        tmm.set_lambda(point_lambda[p]);
+        tmm.set_angle(point_angle[p]);
+        tmm.set_environment(point_sup[p],point_sub[p]);
+        
+        for(l=0;l<N_layers;l++)
+            tmm.set_layer(l,layer_h[l],point_index[p*N_layers+l]);
+        
+        tmm.compute_gradient(holder);
+        
+        double Q=design_quantity(holder,goal,dQ);
+        double c=goal.weight/goal.Nl;
+        
+        F+=c*(Q-goal.value)*(Q-goal.value);
+        
+        for(l=0;l<N_layers;l++)
+            dF[l]+=2.0*c*(Q-goal.value)*dQ[l];
+    }
+    
+    for(std::size_t k=0;k<variables.size();k++)
+        gradient[k]=dF[variables[k]-layer_h.data()];
+    
+    return F;
+}
+
 //####################
 //   Multilayer TMM
 //####################
 
 Multilayer_TMM_mode::Multilayer_TMM_mode()
     :mode(MODE_NONE),
-     Nl(481),
+     Nl(481), Na(1),
      lambda_min(370e-9), lambda_max(850e-9),
+     angle_min(0), angle_max(0),
      angle(0),
      output("multilayer_out"), polar("TE")
 {
@@ -403,6 +623,33 @@ Multilayer_TMM_mode::Multilayer_TMM_mode()
 
 #include <phys_tools.h>
 
+// Quantity "R", "T" or "A" driven toward value over the given spectrum,
+// for the "TE" or "TM" polarization or their average otherwise
+
+void Multilayer_TMM_mode::add_design_target(std::string quantity,std::string polar,
+                                            double lambda_min_,double lambda_max_,int Nl_,
+                                            double angle_,double value,double weight)
+{
+    if(quantity!="R" && quantity!="T" && quantity!="A")
+    {
+        std::cerr<<"Error: unknown design quantity "<<quantity<<", expected R, T or A"<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    Multilayer_TMM_goal goal;
+    
+    goal.quantity=quantity;
+    goal.polar=polar;
+    goal.lambda_min=lambda_min_;
+    goal.lambda_max=lambda_max_;
+    goal.Nl=std::max(1,Nl_);
+    goal.angle=angle_;
+    goal.value=value;
+    goal.weight=weight;
+    
+    design_goals.push_back(goal);
+}
+
 void Multilayer_TMM_mode::add_layer(double h,std::string mat)
 {
     layer_h.push_back(h);
@@ -415,6 +662,16 @@ void Multilayer_TMM_mode::compute_angle(double angle_)
     mode=MODE_ANGLE;
 }
 
+// Whole (lambda,angle) map, the angles varying fastest
+
+void Multilayer_TMM_mode::compute_angles(double angle_min_,double angle_max_,int Na_)
+{
+    angle_min=angle_min_;
+    angle_max=angle_max_;
+    Na=std::max(1,Na_);
+    mode=MODE_ANGLES;
+}
+
 void Multilayer_TMM_mode::compute_guided(std::string polar_,
                                          double lambda_guess_,
                                          double nr_guess_,
@@ -427,6 +684,55 @@ void Multilayer_TMM_mode::compute_guided(std::string polar_,
     mode=MODE_GUIDED;
 }
 
+// Thicknesses optimization against the design goals, before any other
+// computation so that those use the optimized stack
+
+void Multilayer_TMM_mode::optimize_design(std::vector<Material> &mats,Material &mat_sup,Material &mat_sub)
+{
+    int N_layers=layer_h.size();
+    
+    OptimLBFGS optim;
+    
+    for(std::size_t k=0;k<design_layers.size();k++)
+    {
+        int l=design_layers[k];
+        
+        if(l<0 || l>=N_layers)
+        {
+            std::cerr<<"Error: optimize_thickness on layer "<<l<<", the stack has "<<N_layers<<" layers"<<std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        
+        OptimRule rule;
+        
+        rule.operation_type=OptimRule::Operation::ADD;
+        rule.delta_add=std::max(1e-9,0.05*(design_h_max[k]-design_h_min[k]));
+        rule.limit_type=OptimRule::Limit::BOTH;
+        rule.limit_down=design_h_min[k];
+        rule.limit_up=design_h_max[k];
+        
+        optim.register_variable(&layer_h[l],rule);
+    }
+    
+    Multilayer_Design design(layer_h,design_goals,mats,mat_sup,mat_sub);
+    
+    double score=optim.optimize(design);
+    
+    std::cout<<"Design score: "<<score<<"\n";
+    
+    for(std::size_t k=0;k<design_layers.size();k++)
+        std::cout<<"Layer "<<design_layers[k]<<": "<<layer_h[design_layers[k]]<<"\n";
+}
+
+// Layers are indexed from 0 in their add_layer order
+
+void Multilayer_TMM_mode::optimize_thickness(int layer,double h_min,double h_max)
+{
+    design_layers.push_back(layer);
+    design_h_min.push_back(std::min(h_min,h_max));
+    design_h_max.push_back(std::max(h_min,h_max));
+}
+
 void Multilayer_TMM_mode::set_output(std::string output_)
 {
     output=output_;
@@ -468,32 +774,53 @@ void Multilayer_TMM_mode::process()
         ld.load(&mats[i],layer_mat[i]);
     }
     
+    if(!design_goals.empty() && !design_layers.empty())
+        optimize_design(mats,mat_sup,mat_sub);
+    
     Multilayer_TMM mlt(N_layers);
         
-    if(mode==MODE_ANGLE)
+    if(mode==MODE_ANGLE || mode==MODE_ANGLES)
     {
         std::ofstream file(output,std::ios::out|std::ios::trunc);
         
-        mlt.set_angle(angle);
+        std::vector<double> lambda_list(Nl);
+        for(i=0;i<Nl;i++) lambda_list[i]=lambda_min+(lambda_max-lambda_min)*i/(Nl-1.0);
         
-        for(i=0;i<Nl;i++)
+        std::vector<AngleRad> angle_list(1,angle);
+        
+        if(mode==MODE_ANGLES)
         {
-            double lambda=lambda_min+(lambda_max-lambda_min)*i/(Nl-1.0);
-            double w=2.0*Pi*c_light/lambda;
-            
-            mlt.set_lambda(lambda);
+            angle_list.resize(Na);
             
-            mlt.set_environment(mat_sup.get_n(w),mat_sub.get_n(w));
-            
-            double index_sup=mat_sup.get_n(w).real();
-            double index_sub=mat_sub.get_n(w).real();
-            
-            for(j=0;j<N_layers;j++)
-                mlt.set_layer(j,layer_h[j],mats[j].get_n(w));
+            for(i=0;i<Na;i++)
+            {
+                if(Na>1) angle_list[i]=Degree(angle_min+(angle_max-angle_min)*i/(Na-1.0));
+                else angle_list[i]=Degree(angle_min);
+            }
+        }
+        
+        // Every (lambda,angle) point in a single batch
+        
+        Multilayer_TMM_Batch batch(N_layers,0);
+        
+        batch.set_spectrum(lambda_list,angle_list);
+        batch.set_environment(mat_sup,mat_sub);
+        
+        for(j=0;j<N_layers;j++)
+            batch.set_layer(j,layer_h[j],mats[j]);
+        
+        batch.compute();
+        
+        for(i=0;i<batch.Npts;i++)
+        {
+            double lambda=batch.lambda[i];
+            double ang=batch.angle[i];
             
-            Imdouble r_TE,t_TE,r_TM,t_TM;
+            double index_sup=batch.sup_re[i];
+            double index_sub=batch.sub_re[i];
             
-            mlt.compute(r_TE,r_TM,t_TE,t_TM);
+            Imdouble r_TE=batch.r_TE[i],t_TE=batch.t_TE[i],
+                     r_TM=batch.r_TM[i],t_TM=batch.t_TM[i];
             
             using std::abs;
             using std::arg;
@@ -501,14 +828,14 @@ void Multilayer_TMM_mode::process()
             using std::norm;
             
             double ang_ref=Pi/2.0;
-            double ang_ref_arg=index_sup/index_sub*std::sin(angle);
+            double ang_ref_arg=index_sup/index_sub*std::sin(ang);
             
             if(ang_ref_arg<=1.0) ang_ref=std::asin(ang_ref_arg);
             
-            double transm_coeff_TE=cos(ang_ref)/cos(angle)*index_sub/index_sup;
-            double transm_coeff_TM=cos(ang_ref)/cos(angle)*index_sup/index_sub;
+            double transm_coeff_TE=cos(ang_ref)/cos(ang)*index_sub/index_sup;
+            double transm_coeff_TM=cos(ang_ref)/cos(ang)*index_sup/index_sub;
             
-            file<<lambda<<" "<<angle.radian()<<" ";
+            file<<lambda<<" "<<ang<<" ";
             
             file<<abs(r_TE)<<" "<<arg(r_TE)<<" "<<norm(r_TE)<<" "
                 <<abs(r_TM)<<" "<<arg(r_TM)<<" "<<norm(r_TM)<<" "
@@ -518,7 +845,7 @@ void Multilayer_TMM_mode::process()
         
         file.close();
         
-        script_multilayer(output);
+        if(mode==MODE_ANGLE) script_multilayer(output);
     }
     else if(mode==MODE_GUIDED)
     {
@@ -627,9 +954,12 @@ void create_metatables_multilayers(lua_State *L)
     
     lua_wrapper<0,Multilayer_TMM_mode,double,std::string>::bind(L,"add_layer",&Multilayer_TMM_mode::add_layer);
     lua_wrapper<1,Multilayer_TMM_mode,double>::bind(L,"compute_angle",&Multilayer_TMM_mode::compute_angle);
+    lua_wrapper<7,Multilayer_TMM_mode,double,double,int>::bind(L,"compute_angles",&Multilayer_TMM_mode::compute_angles);
     lua_wrapper<2,Multilayer_TMM_mode,std::string,double,double,double>::bind(L,"compute_guided",&Multilayer_TMM_mode::compute_guided);
     lua_wrapper<3,Multilayer_TMM_mode,std::string>::bind(L,"output",&Multilayer_TMM_mode::set_output);
     lua_wrapper<4,Multilayer_TMM_mode,double,double,int>::bind(L,"spectrum",&Multilayer_TMM_mode::set_spectrum);
     lua_wrapper<5,Multilayer_TMM_mode,std::string>::bind(L,"substrate",&Multilayer_TMM_mode::set_substrate);
     lua_wrapper<6,Multilayer_TMM_mode,std::string>::bind(L,"superstrate",&Multilayer_TMM_mode::set_superstrate);
+    lua_wrapper<8,Multilayer_TMM_mode,std::string,std::string,double,double,int,double,double,double>::bind(L,"design_target",&Multilayer_TMM_mode::add_design_target);
+    lua_wrapper<9,Multilayer_TMM_mode,int,double,double>::bind(L,"optimize_thickness",&Multilayer_TMM_mode::optimize_thickness);
 }
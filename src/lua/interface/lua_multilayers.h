@@ -76,13 +76,25 @@ int multilayer_mode_set_sup_index(lua_State *L);
 //       Multilayer TMM
 //#########################
 
+// Design goal on R, T or A over a spectral range
+
+class Multilayer_TMM_goal
+{
+    public:
+        int Nl;
+        double lambda_min,lambda_max;
+        double angle,value,weight;
+        std::string quantity,polar;
+};
+
 class Multilayer_TMM_mode: public base_mode
 {
     public:
-        enum{MODE_NONE,MODE_ANGLE,MODE_GUIDED};
+        enum{MODE_NONE,MODE_ANGLE,MODE_ANGLES,MODE_GUIDED};
         
-        int mode,Nl;
+        int mode,Nl,Na;
         double lambda_min,lambda_max;
+        double angle_min,angle_max;
         double lambda_guess,nr_guess,ni_guess;
         AngleRad angle;
         std::string mat_sup_str,
@@ -92,14 +104,24 @@ class Multilayer_TMM_mode: public base_mode
         std::vector<double> layer_h;
         std::vector<std::string> layer_mat;
         
+        std::vector<Multilayer_TMM_goal> design_goals;
+        std::vector<int> design_layers;
+        std::vector<double> design_h_min,design_h_max;
+        
         Multilayer_TMM_mode();
         
+        void add_design_target(std::string quantity,std::string polar,
+                               double lambda_min,double lambda_max,int Nl,
+                               double angle,double value,double weight);
         void add_layer(double h,std::string mat);
         void compute_angle(double angle);
+        void compute_angles(double angle_min,double angle_max,int Na);
         void compute_guided(std::string polar,
                             double lambda_guess,
                             double nr_guess,
                             double ni_guess);
+        void optimize_design(std::vector<Material> &mats,Material &mat_sup,Material &mat_sub);
+        void optimize_thickness(int layer,double h_min,double h_max);
         void set_output(std::string output);
         void set_spectrum(double lambda_min,double lambda_max,int Nl);
         void set_substrate(std::string mat);
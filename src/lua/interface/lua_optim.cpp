@@ -22,8 +22,10 @@ void create_optimization_metatable(lua_State *L)
     create_obj_metatable(L,"metatable_optimization_engine");
     
     metatable_add_func(L,"add_target",&optimizer_add_target);
+    metatable_add_func(L,"generations",&optimizer_set_max_generations);
     metatable_add_func(L,"max_failures",&optimizer_set_max_failures);
     metatable_add_func(L,"optimize",&optimizer_add_variable);
+    metatable_add_func(L,"population",&optimizer_set_population);
 }
 
 
@@ -75,6 +77,26 @@ int optimizer_set_max_failures(lua_State *L)
 }
 
 
+int optimizer_set_max_generations(lua_State *L)
+{
+    OptimEngine *engine=lua_get_metapointer<OptimEngine>(L,1);
+    
+    engine->set_max_generations(lua_tointeger(L,2));
+    
+    return 0;
+}
+
+
+int optimizer_set_population(lua_State *L)
+{
+    OptimEngine *engine=lua_get_metapointer<OptimEngine>(L,1);
+    
+    engine->set_population(lua_tointeger(L,2));
+    
+    return 0;
+}
+
+
 std::string to_lua(OptimRule::Operation operation)
 {
     switch(operation)
@@ -12,6 +12,8 @@ void create_optimization_metatable(lua_State *L);
 int optimizer_add_target(lua_State *L);
 int optimizer_add_variable(lua_State *L);
 int optimizer_set_max_failures(lua_State *L);
+int optimizer_set_max_generations(lua_State *L);
+int optimizer_set_population(lua_State *L);
 
 std::string to_lua(OptimRule::Operation operation);
 std::string to_lua(OptimRule::Limit limit);
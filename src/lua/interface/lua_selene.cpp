@@ -14,8 +14,39 @@ limitations under the License.*/
 
 #include <lua_selene.h>
 
+//####################
+//   Selene_Context
+//####################
+
+Selene_Context::Selene_Context(Selene_Mode *mode_)
+    :mode(mode_)
+{
+}
+
+double Selene_Context::evaluate()
+{
+    for(std::size_t i=0;i<mode->objects.size();i++)
+    {
+        mode->objects[i]->update_geometry();
+    }
+    
+    mode->selene.render();
+    
+    double score=0;
+    
+    for(std::size_t i=0;i<targets.size();i++)
+        score+=targets[i]->evaluate();
+    
+    return score;
+}
+
+//#################
+//   Selene_Mode
+//#################
+
 Selene_Mode::Selene_Mode()
-    :rendered(false)
+    :rendered(false),
+     optim_context(this)
 {
 }
 
@@ -37,7 +68,13 @@ void Selene_Mode::process()
 }
 
 void Selene_Mode::optimize(OptimEngine *engine)
-{    
+{
+    if(engine->population_size>0)
+    {
+        optimize_population(engine);
+        return;
+    }
+    
     bool first_run=true;
     double best_score=std::numeric_limits<double>::max();
     
@@ -109,7 +146,84 @@ void Selene_Mode::optimize(OptimEngine *engine)
     }
 }
 
+// The population is spread over this scene and the replicas registered
+// with the engine, each one rendering into its own subdirectory
+
+void Selene_Mode::optimize_population(OptimEngine *engine)
+{
+    optim_context.variables=engine->variables;
+    optim_context.targets=engine->targets;
+    
+    std::vector<OptimContext*> contexts(1,&optim_context);
+    
+    std::filesystem::path output_directory=selene.get_output_directory();
+    
+    for(std::size_t i=0;i<engine->contexts.size();i++)
+    {
+        Selene_Context *context=dynamic_cast<Selene_Context*>(engine->contexts[i]);
+        
+        if(context!=nullptr && context!=&optim_context)
+        {
+            context->mode->selene.set_output_directory(output_directory / ("replica_"+std::to_string(i)));
+            contexts.push_back(context);
+        }
+    }
+    
+    std::cout<<"Population optimization over "<<contexts.size()<<" scene(s)"<<std::endl;
+    
+    double best_score=engine->optimize_population(contexts);
+    
+    // Final render with the best variables
+    
+    for(std::size_t i=0;i<objects.size();i++)
+    {
+        objects[i]->update_geometry();
+    }
+    
+    selene.render();
+    rendered=true;
+    
+    std::cout<<"Best score: "<<best_score<<std::endl;
+    std::cout<<"Optimization report\n\n";
+    
+    for(Sel::Object *object : objects)
+    {
+        std::cout<<object->name<<":\n";
+        
+        std::map<std::string,double*> &variables_map=object->variables_map;
+            
+        for(auto [key,var]:variables_map)
+        {
+            OptimRule rule;
+            bool known=engine->get_rule(var,rule);
+            
+            if(known) std::cout<<"   "<<key<<": "<<(*var)<<"\n";
+        }
+        
+        std::cout<<"\n";
+    }
+}
+
 void Selene_Mode::render() { selene.render(); rendered=true; }
+
+void Selene_Mode::replicate(OptimEngine *engine,std::vector<double*> const &variables,std::vector<OptimTarget*> const &targets)
+{
+    if(variables.size()!=engine->variables.size())
+    {
+        std::cerr<<"Error: Selene replica with "<<variables.size()
+                 <<" variables instead of "<<engine->variables.size()<<std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    
+    optim_context.variables=variables;
+    optim_context.targets=targets;
+    
+    engine->add_context(&optim_context);
+    
+    // Replicas are only rendered by the optimizer
+    rendered=true;
+}
+
 void Selene_Mode::set_max_ray_bounces(int max_ray_bounces) { selene.set_max_ray_bounces(max_ray_bounces); }
 void Selene_Mode::set_N_rays_disp(int Nr_disp) { selene.set_N_rays_disp(Nr_disp); }
 void Selene_Mode::set_N_rays_total(int Nr_tot) { selene.set_N_rays_total(Nr_tot); }
@@ -524,6 +638,7 @@ namespace LuaUI
         metatable_add_func(L,"optimize",&LuaUI::selene_mode_optimize);
         metatable_add_func(L,"output_directory",&LuaUI::selene_mode_output_directory);
         metatable_add_func(L,"render",&LuaUI::selene_mode_render);
+        metatable_add_func(L,"replicate",&LuaUI::selene_mode_replicate);
     }
     
     void Selene_create_light_metatable(lua_State *L)
@@ -723,6 +838,33 @@ namespace LuaUI
         return 0;
     }
     
+    int selene_mode_replicate(lua_State *L)
+    {
+        Selene_Mode *p_mode=lua_get_metapointer<Selene_Mode>(L,1);
+        OptimEngine *p_engine=lua_get_metapointer<OptimEngine>(L,2);
+        
+        std::vector<double*> variables(lua_rawlen(L,3));
+        std::vector<OptimTarget*> targets(lua_rawlen(L,4));
+        
+        for(std::size_t i=0;i<variables.size();i++)
+        {
+            lua_rawgeti(L,3,i+1);
+            variables[i]=static_cast<double*>(lua_touserdata(L,-1));
+            lua_pop(L,1);
+        }
+        
+        for(std::size_t i=0;i<targets.size();i++)
+        {
+            lua_rawgeti(L,4,i+1);
+            targets[i]=lua_get_metapointer<OptimTarget>(L,-1);
+            lua_pop(L,1);
+        }
+        
+        p_mode->replicate(p_engine,variables,targets);
+        
+        return 0;
+    }
+    
     int selene_mode_set_N_rays_total(lua_State *L)
     {
         Selene_Mode *p_mode=*(reinterpret_cast<Selene_Mode**>(lua_touserdata(L,1)));
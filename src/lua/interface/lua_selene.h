@@ -18,6 +18,21 @@ limitations under the License.*/
 #include <lua_base.h>
 #include <selene.h>
 
+class Selene_Mode;
+
+// Renders a scene for the population mode of OptimEngine
+
+class Selene_Context: public OptimContext
+{
+    public:
+        Selene_Mode *mode;
+        std::vector<OptimTarget*> targets;
+        
+        Selene_Context(Selene_Mode *mode);
+        
+        double evaluate() override;
+};
+
 class Selene_Mode: public base_mode
 {
     public:
@@ -25,6 +40,7 @@ class Selene_Mode: public base_mode
         std::vector<Sel::Light*> lights;
         std::vector<Sel::Object*> objects;
         Sel::Selene selene;
+        Selene_Context optim_context;
         
         Selene_Mode();
         
@@ -32,8 +48,10 @@ class Selene_Mode: public base_mode
         void add_light(Sel::Light *light);
         bool interruption_type() { return true; }
         void optimize(OptimEngine *engine);
+        void optimize_population(OptimEngine *engine);
         void process() override;
         void render();
+        void replicate(OptimEngine *engine,std::vector<double*> const &variables,std::vector<OptimTarget*> const &targets);
         void set_max_ray_bounces(int max_ray_bounces);
         void set_N_rays_disp(int Nr_disp);
         void set_N_rays_total(int Nr_tot);
@@ -147,6 +165,7 @@ namespace LuaUI
     int selene_mode_optimize(lua_State *L);
     int selene_mode_output_directory(lua_State *L);
     int selene_mode_render(lua_State *L);
+    int selene_mode_replicate(lua_State *L);
     int selene_mode_set_max_ray_bounces(lua_State *L);
     int selene_mode_set_N_rays_disp(lua_State *L);
     int selene_mode_set_N_rays_total(lua_State *L);
@@ -144,7 +144,7 @@ void Material::allocate_effective_materials(std::size_t Nm)
     }
 }
 
-bool Material::fdtd_compatible()
+bool Material::fdtd_compatible() const
 {
     if(is_effective_material) return false;
     else
@@ -662,6 +662,58 @@ void Material::set_const_n(double n)
     eps_inf=n*n;
 }
 
+// EffectiveModel::SUM mixing rule, written directly with the dielectric models of both
+// materials so that the result stays FDTD compatible
+// Returns false if one of the materials cannot be expressed that way
+bool Material::set_linear_mix(Material const &mat_1,Material const &mat_2,double weight_1)
+{
+    if(!mat_1.fdtd_compatible() || !mat_2.fdtd_compatible()) return false;
+    
+    std::size_t i;
+    double weight_2=1.0-weight_1;
+    
+    reset();
+    
+    eps_inf=weight_1*mat_1.eps_inf+weight_2*mat_2.eps_inf;
+    
+    lambda_valid_min=std::max(mat_1.lambda_valid_min,mat_2.lambda_valid_min);
+    lambda_valid_max=std::min(mat_1.lambda_valid_max,mat_2.lambda_valid_max);
+    
+    for(int m=0;m<2;m++)
+    {
+        Material const &mat=(m==0)?mat_1:mat_2;
+        double weight=(m==0)?weight_1:weight_2;
+        
+        for(i=0;i<mat.debye.size();i++)
+        {
+            debye.push_back(mat.debye[i]);
+            debye.back().ds*=weight;
+        }
+        
+        for(i=0;i<mat.drude.size();i++)
+        {
+            drude.push_back(mat.drude[i]);
+            drude.back().set(mat.drude[i].wd*std::sqrt(weight),mat.drude[i].g);
+        }
+        
+        for(i=0;i<mat.lorentz.size();i++)
+        {
+            lorentz.push_back(mat.lorentz[i]);
+            lorentz.back().A*=weight;
+        }
+        
+        for(i=0;i<mat.critpoint.size();i++)
+        {
+            critpoint.push_back(mat.critpoint[i]);
+            critpoint.back().A*=weight;
+        }
+    }
+    
+    name=mat_1.name+" / "+mat_2.name+" mix";
+    
+    return true;
+}
+
 //######################
 //   Effective Models
 //######################
@@ -79,7 +79,7 @@ class Material
                              std::vector<double> const &data_i,
                              bool type_index);
         virtual void allocate_effective_materials(std::size_t Nm);
-        bool fdtd_compatible();
+        bool fdtd_compatible() const;
         Imdouble get_eps(double w);
         std::string get_matlab(std::string const &fname) const;
         Imdouble get_n(double w);
@@ -90,6 +90,7 @@ class Material
         void reset();
         void set_const_eps(double eps);
         void set_const_n(double n);
+        bool set_linear_mix(Material const &mat_1,Material const &mat_2,double weight_1);
 };
 
 Imdouble effmodel_bruggeman(Imdouble eps_1,Imdouble eps_2,
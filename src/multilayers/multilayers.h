@@ -17,6 +17,7 @@ limitations under the License.*/
 
 #include <material.h>
 #include <mathUT.h>
+#include <thread_utils.h>
 
 #include <Eigen/Eigen>
 
@@ -301,6 +302,21 @@ class MLFieldHolder
         double& z(int l,int k) { return z_data[l][k]; }
 };
 
+// Derivatives of the powers computed by Multilayer_TMM with respect to the
+// layer thicknesses and indices. The index derivatives hold d/dRe(n) in
+// their real part and d/dIm(n) in their imaginary part
+
+class MLGradientHolder
+{
+    public:
+        double R_TE,T_TE,R_TM,T_TM;
+        
+        std::vector<double> dR_TE_dh,dT_TE_dh,dR_TM_dh,dT_TM_dh;
+        std::vector<Imdouble> dR_TE_dn,dT_TE_dn,dR_TM_dn,dT_TM_dn;
+        
+        void set_N_layers(int N_layers);
+};
+
 class Multilayer_TMM
 {
     public:
@@ -328,6 +344,7 @@ class Multilayer_TMM
                          double &t_TE,double &t_TM);
         Imdouble compute_chara_TE(Imdouble const &n_eff);
         Imdouble compute_chara_TM(Imdouble const &n_eff);
+        void compute_gradient(MLGradientHolder &holder);
         void compute_mode_TE(Imdouble const &n_eff,MLFieldHolder &holder,bool auto_z=true);
         void compute_mode_TM(Imdouble const &n_eff,MLFieldHolder &holder,bool auto_z=true);
         void compute_power(double &R_TE,double &T_TE,double &A_TE,
@@ -356,6 +373,43 @@ class Multilayer_TMM
         void set_N_layers(int N_layers);
 };
 
+// Isotropic stack evaluated at many (lambda,angle) points at once, with
+// the same conventions as Multilayer_TMM. The per-point data is stored in
+// separate real and imaginary arrays, the indices of layer l being at
+// l*Npts, and processed by blocks spread over the shared pool
+
+class Multilayer_TMM_Batch: public PoolTask
+{
+    public:
+        int N_layers,Npts;
+        
+        std::vector<double> h_layer;
+        std::vector<double> lambda,angle;
+        std::vector<double> sup_re,sup_im,sub_re,sub_im;
+        std::vector<double> index_re,index_im;
+        
+        std::vector<Imdouble> r_TE,r_TM,t_TE,t_TM;
+        std::vector<double> R_TE,R_TM,T_TE,T_TM;
+        
+        Multilayer_TMM_Batch();
+        Multilayer_TMM_Batch(int N_layers,int Npts);
+        
+        void compute();
+        void pool_run(int chunk,int Nchunks);
+        void set_environment(int p,Imdouble sup_ind,Imdouble sub_ind);
+        void set_environment(Material &sup_mat,Material &sub_mat);
+        void set_index(int l,int p,Imdouble n);
+        void set_layer(int l,double h);
+        void set_layer(int l,double h,Material &mat);
+        void set_N_layers(int N_layers);
+        void set_N_points(int Npts);
+        void set_point(int p,double lambda,AngleRad const &angle);
+        void set_spectrum(std::vector<double> const &lambda,std::vector<AngleRad> const &angle);
+        
+    private:
+        void compute_block(int p1,int p2);
+};
+
 class Multilayer_TMM_UD
 {
     public:
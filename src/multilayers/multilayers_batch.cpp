@@ -0,0 +1,379 @@
+/*Copyright 2008-2022 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <multilayers.h>
+#include <phys_tools.h>
+
+// Points handled together in the inner loops, small enough for the
+// working arrays to stay in cache
+static const int tmm_block=64;
+
+// Below this number of points per chunk the pool is not worth it
+static const int tmm_chunk_min=256;
+
+// Complex arithmetic on split real and imaginary parts, with the same
+// branch cuts as std::sqrt
+
+static void tmm_mul(double ar,double ai,double br,double bi,double &cr,double &ci)
+{
+    cr=ar*br-ai*bi;
+    ci=ar*bi+ai*br;
+}
+
+static void tmm_div(double ar,double ai,double br,double bi,double &cr,double &ci)
+{
+    double d=br*br+bi*bi;
+    
+    cr=(ar*br+ai*bi)/d;
+    ci=(ai*br-ar*bi)/d;
+}
+
+// The smaller part is obtained by division to avoid cancellations
+
+static void tmm_sqrt(double ar,double ai,double &cr,double &ci)
+{
+    double m=std::hypot(ar,ai);
+    
+    if(m==0)
+    {
+        cr=0;
+        ci=ai;
+    }
+    else if(ar>=0)
+    {
+        cr=std::sqrt(0.5*(m+ar));
+        ci=ai/(2.0*cr);
+    }
+    else
+    {
+        ci=std::copysign(std::sqrt(0.5*(m-ar)),ai);
+        cr=ai/(2.0*ci);
+    }
+}
+
+//##########################
+//   Multilayer_TMM_Batch
+//##########################
+
+Multilayer_TMM_Batch::Multilayer_TMM_Batch()
+    :N_layers(0), Npts(0)
+{
+}
+
+Multilayer_TMM_Batch::Multilayer_TMM_Batch(int N_layers_,int Npts_)
+    :N_layers(0), Npts(0)
+{
+    set_N_layers(N_layers_);
+    set_N_points(Npts_);
+}
+
+void Multilayer_TMM_Batch::compute()
+{
+    r_TE.resize(Npts); r_TM.resize(Npts);
+    t_TE.resize(Npts); t_TM.resize(Npts);
+    R_TE.resize(Npts); R_TM.resize(Npts);
+    T_TE.resize(Npts); T_TM.resize(Npts);
+    
+    int Nchunks=std::min(max_threads_number(),Npts/tmm_chunk_min);
+    
+    if(Nchunks<=1) compute_block(0,Npts);
+    else
+    {
+        PoolGroup group;
+        
+        shared_pool().submit(this,Nchunks,group);
+        shared_pool().wait(group);
+    }
+}
+
+// Same scheme as Multilayer_TMM::compute and compute_power, the interface
+// matrices being accumulated from the superstrate down to the substrate
+
+void Multilayer_TMM_Batch::compute_block(int p1,int p2)
+{
+    double k0[tmm_block],kpr[tmm_block],kpi[tmm_block];
+    double b1r[tmm_block],b1i[tmm_block],g1r[tmm_block],g1i[tmm_block];
+    double bsr[tmm_block],bsi[tmm_block];
+    
+    // TE and TM matrices, row major
+    
+    double Er[4][tmm_block],Ei[4][tmm_block];
+    double Mr[4][tmm_block],Mi[4][tmm_block];
+    
+    for(int q1=p1;q1<p2;q1+=tmm_block)
+    {
+        int Nb=std::min(tmm_block,p2-q1);
+        
+        // Superstrate
+        
+        for(int p=0;p<Nb;p++)
+        {
+            int P=q1+p;
+            
+            double nr=sup_re[P],ni=sup_im[P];
+            
+            k0[p]=2.0*Pi/lambda[P];
+            
+            double s=std::sin(angle[P]);
+            kpr[p]=nr*k0[p]*s;
+            kpi[p]=ni*k0[p]*s;
+            
+            double knr=k0[p]*nr,kni=k0[p]*ni;
+            double kn2r,kn2i,kp2r,kp2i;
+            
+            tmm_mul(knr,kni,knr,kni,kn2r,kn2i);
+            tmm_mul(kpr[p],kpi[p],kpr[p],kpi[p],kp2r,kp2i);
+            tmm_sqrt(kn2r-kp2r,kn2i-kp2i,b1r[p],b1i[p]);
+            
+            double er,ei;
+            tmm_mul(nr,ni,nr,ni,er,ei);
+            tmm_div(b1r[p],b1i[p],k0[p]*er,k0[p]*ei,g1r[p],g1i[p]);
+            
+            bsr[p]=b1r[p];
+            bsi[p]=b1i[p];
+        }
+        
+        // Interfaces, the last one being with the substrate
+        
+        for(int l=0;l<=N_layers;l++)
+        {
+            double const *n_re=(l<N_layers)?&index_re[l*Npts+q1]:&sub_re[q1];
+            double const *n_im=(l<N_layers)?&index_im[l*Npts+q1]:&sub_im[q1];
+            
+            double h=(l>0)?h_layer[l-1]:0;
+            
+            for(int p=0;p<Nb;p++)
+            {
+                double nr=n_re[p],ni=n_im[p];
+                
+                double knr=k0[p]*nr,kni=k0[p]*ni;
+                double kn2r,kn2i,kp2r,kp2i,b2r,b2i,er,ei,g2r,g2i;
+                
+                tmm_mul(knr,kni,knr,kni,kn2r,kn2i);
+                tmm_mul(kpr[p],kpi[p],kpr[p],kpi[p],kp2r,kp2i);
+                tmm_sqrt(kn2r-kp2r,kn2i-kp2i,b2r,b2i);
+                
+                tmm_mul(nr,ni,nr,ni,er,ei);
+                tmm_div(b2r,b2i,k0[p]*er,k0[p]*ei,g2r,g2i);
+                
+                double qEr,qEi,qMr,qMi;
+                
+                tmm_div(b1r[p],b1i[p],b2r,b2i,qEr,qEi);
+                tmm_div(g1r[p],g1i[p],g2r,g2i,qMr,qMi);
+                
+                // Propagation through the layer above the interface
+                
+                double ar=std::exp(-h*b1i[p]),ph=h*b1r[p];
+                double c=std::cos(ph),s=std::sin(ph);
+                
+                double epr=ar*c,epi=ar*s;
+                double emr=c/ar,emi=-s/ar;
+                
+                double L0r,L0i,L1r,L1i,L2r,L2i,L3r,L3i;
+                
+                tmm_mul(0.5*(1.0+qEr),0.5*qEi,epr,epi,L0r,L0i);
+                tmm_mul(0.5*(1.0-qEr),-0.5*qEi,emr,emi,L1r,L1i);
+                tmm_mul(0.5*(1.0-qEr),-0.5*qEi,epr,epi,L2r,L2i);
+                tmm_mul(0.5*(1.0+qEr),0.5*qEi,emr,emi,L3r,L3i);
+                
+                if(l==0)
+                {
+                    Er[0][p]=L0r; Ei[0][p]=L0i;
+                    Er[1][p]=L1r; Ei[1][p]=L1i;
+                    Er[2][p]=L2r; Ei[2][p]=L2i;
+                    Er[3][p]=L3r; Ei[3][p]=L3i;
+                }
+                else
+                {
+                    double Ar,Ai,Br,Bi,Cr,Ci,Dr,Di,xr,xi,yr,yi;
+                    
+                    tmm_mul(L0r,L0i,Er[0][p],Ei[0][p],xr,xi); tmm_mul(L1r,L1i,Er[2][p],Ei[2][p],yr,yi); Ar=xr+yr; Ai=xi+yi;
+                    tmm_mul(L0r,L0i,Er[1][p],Ei[1][p],xr,xi); tmm_mul(L1r,L1i,Er[3][p],Ei[3][p],yr,yi); Br=xr+yr; Bi=xi+yi;
+                    tmm_mul(L2r,L2i,Er[0][p],Ei[0][p],xr,xi); tmm_mul(L3r,L3i,Er[2][p],Ei[2][p],yr,yi); Cr=xr+yr; Ci=xi+yi;
+                    tmm_mul(L2r,L2i,Er[1][p],Ei[1][p],xr,xi); tmm_mul(L3r,L3i,Er[3][p],Ei[3][p],yr,yi); Dr=xr+yr; Di=xi+yi;
+                    
+                    Er[0][p]=Ar; Ei[0][p]=Ai;
+                    Er[1][p]=Br; Ei[1][p]=Bi;
+                    Er[2][p]=Cr; Ei[2][p]=Ci;
+                    Er[3][p]=Dr; Ei[3][p]=Di;
+                }
+                
+                tmm_mul(0.5*(1.0+qMr),0.5*qMi,epr,epi,L0r,L0i);
+                tmm_mul(0.5*(1.0-qMr),-0.5*qMi,emr,emi,L1r,L1i);
+                tmm_mul(0.5*(1.0-qMr),-0.5*qMi,epr,epi,L2r,L2i);
+                tmm_mul(0.5*(1.0+qMr),0.5*qMi,emr,emi,L3r,L3i);
+                
+                if(l==0)
+                {
+                    Mr[0][p]=L0r; Mi[0][p]=L0i;
+                    Mr[1][p]=L1r; Mi[1][p]=L1i;
+                    Mr[2][p]=L2r; Mi[2][p]=L2i;
+                    Mr[3][p]=L3r; Mi[3][p]=L3i;
+                }
+                else
+                {
+                    double Ar,Ai,Br,Bi,Cr,Ci,Dr,Di,xr,xi,yr,yi;
+                    
+                    tmm_mul(L0r,L0i,Mr[0][p],Mi[0][p],xr,xi); tmm_mul(L1r,L1i,Mr[2][p],Mi[2][p],yr,yi); Ar=xr+yr; Ai=xi+yi;
+                    tmm_mul(L0r,L0i,Mr[1][p],Mi[1][p],xr,xi); tmm_mul(L1r,L1i,Mr[3][p],Mi[3][p],yr,yi); Br=xr+yr; Bi=xi+yi;
+                    tmm_mul(L2r,L2i,Mr[0][p],Mi[0][p],xr,xi); tmm_mul(L3r,L3i,Mr[2][p],Mi[2][p],yr,yi); Cr=xr+yr; Ci=xi+yi;
+                    tmm_mul(L2r,L2i,Mr[1][p],Mi[1][p],xr,xi); tmm_mul(L3r,L3i,Mr[3][p],Mi[3][p],yr,yi); Dr=xr+yr; Di=xi+yi;
+                    
+                    Mr[0][p]=Ar; Mi[0][p]=Ai;
+                    Mr[1][p]=Br; Mi[1][p]=Bi;
+                    Mr[2][p]=Cr; Mi[2][p]=Ci;
+                    Mr[3][p]=Dr; Mi[3][p]=Di;
+                }
+                
+                b1r[p]=b2r; b1i[p]=b2i;
+                g1r[p]=g2r; g1i[p]=g2i;
+            }
+        }
+        
+        // Coefficients and powers, b1 now being the one of the substrate
+        
+        for(int p=0;p<Nb;p++)
+        {
+            int P=q1+p;
+            
+            double rr,ri,tr,ti,xr,xi;
+            
+            tmm_div(-Er[2][p],-Ei[2][p],Er[3][p],Ei[3][p],rr,ri);
+            tmm_mul(Er[1][p],Ei[1][p],rr,ri,xr,xi);
+            tr=Er[0][p]+xr; ti=Ei[0][p]+xi;
+            
+            r_TE[P]=Imdouble(rr,ri);
+            t_TE[P]=Imdouble(tr,ti);
+            
+            double kzr,kzi;
+            tmm_div(b1r[p],b1i[p],bsr[p],bsi[p],kzr,kzi);
+            
+            R_TE[P]=rr*rr+ri*ri;
+            T_TE[P]=(tr*tr+ti*ti)*std::hypot(kzr,kzi);
+            
+            tmm_div(-Mr[2][p],-Mi[2][p],Mr[3][p],Mi[3][p],rr,ri);
+            tmm_mul(Mr[1][p],Mi[1][p],rr,ri,xr,xi);
+            tr=Mr[0][p]+xr; ti=Mi[0][p]+xi;
+            
+            r_TM[P]=Imdouble(rr,ri);
+            t_TM[P]=Imdouble(tr,ti);
+            
+            double sur,sui,sbr,sbi,er,ei;
+            tmm_mul(sup_re[P],sup_im[P],sup_re[P],sup_im[P],sur,sui);
+            tmm_mul(sub_re[P],sub_im[P],sub_re[P],sub_im[P],sbr,sbi);
+            tmm_div(sur,sui,sbr,sbi,er,ei);
+            
+            R_TM[P]=rr*rr+ri*ri;
+            T_TM[P]=(tr*tr+ti*ti)*std::hypot(er,ei)*std::hypot(kzr,kzi);
+        }
+    }
+}
+
+void Multilayer_TMM_Batch::pool_run(int chunk,int Nchunks)
+{
+    compute_block((chunk*Npts)/Nchunks,((chunk+1)*Npts)/Nchunks);
+}
+
+void Multilayer_TMM_Batch::set_environment(int p,Imdouble sup_ind,Imdouble sub_ind)
+{
+    sup_re[p]=sup_ind.real(); sup_im[p]=sup_ind.imag();
+    sub_re[p]=sub_ind.real(); sub_im[p]=sub_ind.imag();
+}
+
+// The materials are evaluated once per run of points sharing a wavelength
+
+void Multilayer_TMM_Batch::set_environment(Material &sup_mat,Material &sub_mat)
+{
+    Imdouble sup_ind=0,sub_ind=0;
+    
+    for(int p=0;p<Npts;p++)
+    {
+        if(p==0 || lambda[p]!=lambda[p-1])
+        {
+            double w=m_to_rad_Hz(lambda[p]);
+            
+            sup_ind=sup_mat.get_n(w);
+            sub_ind=sub_mat.get_n(w);
+        }
+        
+        set_environment(p,sup_ind,sub_ind);
+    }
+}
+
+void Multilayer_TMM_Batch::set_layer(int l,double h)
+{
+    h_layer[l]=h;
+}
+
+void Multilayer_TMM_Batch::set_index(int l,int p,Imdouble n)
+{
+    index_re[l*Npts+p]=n.real();
+    index_im[l*Npts+p]=n.imag();
+}
+
+void Multilayer_TMM_Batch::set_layer(int l,double h,Material &mat)
+{
+    h_layer[l]=h;
+    
+    Imdouble n=1.0;
+    
+    for(int p=0;p<Npts;p++)
+    {
+        if(p==0 || lambda[p]!=lambda[p-1]) n=mat.get_n(m_to_rad_Hz(lambda[p]));
+        
+        set_index(l,p,n);
+    }
+}
+
+void Multilayer_TMM_Batch::set_N_layers(int N_layers_)
+{
+    N_layers=N_layers_;
+    
+    h_layer.assign(N_layers,0);
+    index_re.assign(N_layers*Npts,1.0);
+    index_im.assign(N_layers*Npts,0);
+}
+
+void Multilayer_TMM_Batch::set_N_points(int Npts_)
+{
+    Npts=Npts_;
+    
+    lambda.assign(Npts,500e-9);
+    angle.assign(Npts,0);
+    
+    sup_re.assign(Npts,1.0); sup_im.assign(Npts,0);
+    sub_re.assign(Npts,1.0); sub_im.assign(Npts,0);
+    
+    index_re.assign(N_layers*Npts,1.0);
+    index_im.assign(N_layers*Npts,0);
+}
+
+void Multilayer_TMM_Batch::set_point(int p,double lambda_,AngleRad const &angle_)
+{
+    lambda[p]=lambda_;
+    angle[p]=angle_.radian();
+}
+
+// All the angles for each wavelength, the angles varying fastest
+
+void Multilayer_TMM_Batch::set_spectrum(std::vector<double> const &lambda_,std::vector<AngleRad> const &angle_)
+{
+    int Nl=lambda_.size();
+    int Na=angle_.size();
+    
+    set_N_points(Nl*Na);
+    
+    for(int i=0;i<Nl;i++) for(int j=0;j<Na;j++)
+        set_point(j+i*Na,lambda_[i],angle_[j]);
+}
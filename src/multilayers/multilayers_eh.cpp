@@ -18,6 +18,21 @@ limitations under the License.*/
 
 extern const Imdouble Im;
 
+//#######################
+//   MLGradientHolder
+//#######################
+
+void MLGradientHolder::set_N_layers(int N_layers)
+{
+    R_TE=T_TE=R_TM=T_TM=0;
+    
+    dR_TE_dh.assign(N_layers,0); dT_TE_dh.assign(N_layers,0);
+    dR_TM_dh.assign(N_layers,0); dT_TM_dh.assign(N_layers,0);
+    
+    dR_TE_dn.assign(N_layers,0); dT_TE_dn.assign(N_layers,0);
+    dR_TM_dn.assign(N_layers,0); dT_TM_dn.assign(N_layers,0);
+}
+
 //#######################
 //   Multilayer_TMM
 //#######################
@@ -225,6 +240,179 @@ Imdouble Multilayer_TMM::compute_chara_TM(Imdouble const &n_eff)
            +g_sup/(w*eps_sup)*M(0,0)+g_sub/(w*eps_sub)*M(1,1))*e0;
 }
 
+// Derivatives of r and t for one polarization. q is the interface quantity
+// of each medium (b for TE, b/(k0*eps) for TM), the last entry being the
+// substrate, and dq its derivative with respect to the medium index. The
+// stack matrix is M=L[N-1]...L[0]*M0, so every derivative is obtained from
+// the prefix products A[l]=L[l-1]...M0 and the suffix products
+// S[l]=L[N-1]...L[l]
+
+static void tmm_polar_gradient(std::vector<Eigen::Matrix<Imdouble,2,2>> const &L,
+                               std::vector<double> const &h,
+                               Imdouble q_sup,
+                               std::vector<Imdouble> const &b,std::vector<Imdouble> const &db,
+                               std::vector<Imdouble> const &q,std::vector<Imdouble> const &dq,
+                               Imdouble &r,Imdouble &t,
+                               std::vector<Imdouble> &dr_dh,std::vector<Imdouble> &dt_dh,
+                               std::vector<Imdouble> &dr_dn,std::vector<Imdouble> &dt_dn)
+{
+    int l,N=L.size();
+    
+    typedef Eigen::Matrix<Imdouble,2,2> Mat2;
+    
+    Mat2 I,X;
+    
+    I(0,0)=1.0; I(0,1)=0.0;
+    I(1,0)=0.0; I(1,1)=1.0;
+    
+    // X holds the sign pattern of the interface ratio
+    
+    X(0,0)=+0.5; X(0,1)=-0.5;
+    X(1,0)=-0.5; X(1,1)=+0.5;
+    
+    Imdouble rho=q_sup/q[0];
+    
+    std::vector<Mat2> A(N+1),S(N+1);
+    
+    A[0](0,0)=0.5*(1.0+rho); A[0](0,1)=0.5*(1.0-rho);
+    A[0](1,0)=0.5*(1.0-rho); A[0](1,1)=0.5*(1.0+rho);
+    
+    for(l=0;l<N;l++) A[l+1]=L[l]*A[l];
+    
+    S[N]=I;
+    for(l=N-1;l>=0;l--) S[l]=S[l+1]*L[l];
+    
+    Mat2 const &M=A[N];
+    
+    r=-M(1,0)/M(1,1);
+    t=M(0,0)+M(0,1)*r;
+    
+    std::vector<Mat2> dM_dh(N),dM_dn(N);
+    
+    for(l=0;l<N;l++)
+    {
+        Imdouble exp_p=std::exp(+h[l]*b[l]*Im);
+        Imdouble exp_m=std::exp(-h[l]*b[l]*Im);
+        
+        Mat2 D,E;
+        
+        D(0,0)=+b[l]*Im; D(0,1)=0.0;
+        D(1,0)=0.0;      D(1,1)=-b[l]*Im;
+        
+        E=X;
+        E(0,0)*=exp_p; E(1,0)*=exp_p;
+        E(0,1)*=exp_m; E(1,1)*=exp_m;
+        
+        // Thickness: only the propagation phase of L[l] depends on h[l]
+        
+        dM_dh[l]=S[l]*D*A[l];
+        
+        // Index: L[l] through its ratio q[l]/q[l+1] and its phase, plus the
+        // interface below the layer
+        
+        Mat2 dL=(dq[l]/q[l+1])*E+L[l]*(h[l]*db[l]/b[l]*D);
+        
+        dM_dn[l]=S[l+1]*dL*A[l];
+        
+        if(l==0) dM_dn[l]+=S[0]*((-q_sup*dq[0]/(q[0]*q[0]))*X);
+        else
+        {
+            Imdouble exp_p_prev=std::exp(+h[l-1]*b[l-1]*Im);
+            Imdouble exp_m_prev=std::exp(-h[l-1]*b[l-1]*Im);
+            
+            Mat2 E_prev=X;
+            E_prev(0,0)*=exp_p_prev; E_prev(1,0)*=exp_p_prev;
+            E_prev(0,1)*=exp_m_prev; E_prev(1,1)*=exp_m_prev;
+            
+            dM_dn[l]+=S[l]*((-q[l-1]*dq[l]/(q[l]*q[l]))*E_prev)*A[l-1];
+        }
+    }
+    
+    for(l=0;l<N;l++)
+    {
+        Mat2 const &dMh=dM_dh[l];
+        Mat2 const &dMn=dM_dn[l];
+        
+        dr_dh[l]=-(dMh(1,0)+r*dMh(1,1))/M(1,1);
+        dt_dh[l]=dMh(0,0)+dMh(0,1)*r+M(0,1)*dr_dh[l];
+        
+        dr_dn[l]=-(dMn(1,0)+r*dMn(1,1))/M(1,1);
+        dt_dn[l]=dMn(0,0)+dMn(0,1)*r+M(0,1)*dr_dn[l];
+    }
+}
+
+void Multilayer_TMM::compute_gradient(MLGradientHolder &holder)
+{
+    int l;
+    
+    k0=2.0*Pi/lambda;
+    kp=sup_ind*k0*std::sin(angle);
+    
+    recompute_L();
+    
+    holder.set_N_layers(N_layers);
+    
+    // Per medium quantities, the last entry being the substrate
+    
+    std::vector<Imdouble> b(N_layers+1),db(N_layers+1),
+                          g(N_layers+1),dg(N_layers+1);
+    
+    for(l=0;l<=N_layers;l++)
+    {
+        Imdouble n=sub_ind;
+        if(l<N_layers) n=index_layer[l];
+        
+        Imdouble kn=k0*n;
+        
+        b[l]=std::sqrt(kn*kn-kp*kp);
+        db[l]=k0*kn/b[l];
+        
+        g[l]=b[l]/(k0*n*n);
+        dg[l]=g[l]*(db[l]/b[l]-2.0/n);
+    }
+    
+    Imdouble kn_sup=k0*sup_ind;
+    Imdouble b_sup=std::sqrt(kn_sup*kn_sup-kp*kp);
+    Imdouble g_sup=b_sup/(k0*sup_ind*sup_ind);
+    
+    // Same normalization as compute_power
+    
+    double c_TE=std::abs(b[N_layers]/b_sup);
+    double c_TM=std::abs(sup_ind*sup_ind*b[N_layers]/(sub_ind*sub_ind*b_sup));
+    
+    Imdouble r_TE,t_TE,r_TM,t_TM;
+    std::vector<Imdouble> dr_dh(N_layers),dt_dh(N_layers),dr_dn(N_layers),dt_dn(N_layers);
+    
+    // d|z|^2/dx=2Re(conj(z)dz/dx) for a real parameter, both parts of the
+    // complex index being packed as 2*z*conj(dz/dn)
+    
+    tmm_polar_gradient(L_mat_TE,h_layer,b_sup,b,db,b,db,r_TE,t_TE,dr_dh,dt_dh,dr_dn,dt_dn);
+    
+    holder.R_TE=std::norm(r_TE);
+    holder.T_TE=std::norm(t_TE)*c_TE;
+    
+    for(l=0;l<N_layers;l++)
+    {
+        holder.dR_TE_dh[l]=2.0*std::real(std::conj(r_TE)*dr_dh[l]);
+        holder.dT_TE_dh[l]=2.0*std::real(std::conj(t_TE)*dt_dh[l])*c_TE;
+        holder.dR_TE_dn[l]=2.0*r_TE*std::conj(dr_dn[l]);
+        holder.dT_TE_dn[l]=2.0*t_TE*std::conj(dt_dn[l])*c_TE;
+    }
+    
+    tmm_polar_gradient(L_mat_TM,h_layer,g_sup,b,db,g,dg,r_TM,t_TM,dr_dh,dt_dh,dr_dn,dt_dn);
+    
+    holder.R_TM=std::norm(r_TM);
+    holder.T_TM=std::norm(t_TM)*c_TM;
+    
+    for(l=0;l<N_layers;l++)
+    {
+        holder.dR_TM_dh[l]=2.0*std::real(std::conj(r_TM)*dr_dh[l]);
+        holder.dT_TM_dh[l]=2.0*std::real(std::conj(t_TM)*dt_dh[l])*c_TM;
+        holder.dR_TM_dn[l]=2.0*r_TM*std::conj(dr_dn[l]);
+        holder.dT_TM_dn[l]=2.0*t_TM*std::conj(dt_dn[l])*c_TM;
+    }
+}
+
 void Multilayer_TMM::compute_mode_TE(Imdouble const &n_eff,MLFieldHolder &holder,bool auto_z)
 {
     int k,l;
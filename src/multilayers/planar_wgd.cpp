@@ -12,6 +12,7 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.*/
 
+#include <filehdl.h>
 #include <planar_wgd.h>
 #include <string_tools.h>
 
@@ -152,6 +153,8 @@ void Slab_guide::compute_guiding_char_disc(double lambda_i,double Dz)
 //    eigval.print();
     for(int k=0;k<20;k++) std::cout<<std::sqrt(eigval[k]/k0/k0)<<std::endl;
     
+    std::unique_lock<std::mutex> lock(plog_mutex());
+    
     for(i=0;i<Ng;i++)
     {
 //        plog<<i*Dz<<" "<<std::real(eigvec(i,0))<<" "<<std::imag(eigvec(i,0))<<std::endl;
@@ -18,6 +18,7 @@ limitations under the License.*/
 #include <string_tools.h>
 #include <structure.h>
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
@@ -223,6 +224,7 @@ void create_structure_metatable(lua_State *L)
 {
     create_obj_metatable(L,"metatable_structure");
     
+    metatable_add_func(L,"cache",structure_set_cache);
     metatable_add_func(L,"finalize",structure_finalize);
     metatable_add_func(L,"parameter",structure_set_parameter);
     metatable_add_func(L,"print",structure_print);
@@ -239,6 +241,17 @@ int structure_finalize(lua_State *L)
     return 0;
 }
 
+int structure_set_cache(lua_State *L)
+{
+    Structure *p_struct=lua_get_metapointer<Structure>(L,1);
+    
+    std::filesystem::path directory=lua_tostring(L,2);
+    
+    p_struct->set_cache_directory(directory);
+    
+    return 0;
+}
+
 int structure_print(lua_State *L)
 {
     Structure *p_struct=lua_get_metapointer<Structure>(L,1);
@@ -420,7 +433,44 @@ int structure_add_layer(lua_State *L)
     return 0;
 }
 
-int structure_add_lua_def(lua_State *L)
+int structure_add_expression_def(lua_State *L)
+{
+    Structure *p_struct=get_structure_pointer(L);
+    
+    int N=lua_gettop(L);
+    
+    std::string expression=lua_tostring(L,1);
+    int index=lua_tointeger(L,N);
+    
+    std::vector<std::string> constants_names;
+    std::vector<double> constants_values;
+    
+    if(N>2 && lua_istable(L,2))
+    {
+        lua_pushnil(L);
+        while(lua_next(L,2)!=0)
+        {
+            constants_values.push_back(lua_tonumber(L,-1));
+            lua_pop(L,1);
+            
+            lua_pushvalue(L,-1);
+            constants_names.push_back(lua_tostring(L,-1));
+            lua_pop(L,1);
+        }
+    }
+    
+    expression.erase(std::remove_if(expression.begin(),expression.end(),::isspace),expression.end());
+    
+    std::cout<<"Adding the expression "<<expression<<" <= 0 with index "<<index<<std::endl;
+    for(std::size_t i=0;i<constants_names.size();i++)
+        std::cout<<"     with "<<constants_names[i]<<" = "<<constants_values[i]<<std::endl;
+    
+    p_struct->add_operation(new Add_Expression_Def(expression,constants_names,constants_values,index));
+    
+    return 0;
+}
+
+int structure_add_lua_def(lua_State *L,bool column)
 {
     int i;
     
@@ -447,11 +497,21 @@ int structure_add_lua_def(lua_State *L)
     lua_getglobal(L,"lua_mother_state");
     mom_state=reinterpret_cast<lua_State*>(lua_touserdata(L,-1));
     
-    p_struct->add_operation(new Add_Lua_Def(mom_state,fname,parameters,mat_index));
+    p_struct->add_operation(new Add_Lua_Def(mom_state,fname,parameters,mat_index,column));
     
     return 0;
 }
 
+int structure_add_lua_def(lua_State *L)
+{
+    return structure_add_lua_def(L,false);
+}
+
+int structure_add_lua_def_column(lua_State *L)
+{
+    return structure_add_lua_def(L,true);
+}
+
 int structure_add_mesh(lua_State *L)
 {
     Structure *p_struct=get_structure_pointer(L);
@@ -25,6 +25,7 @@ int allocate_structure(lua_State *L);
 void create_structure_metatable(lua_State *L);
 int structure_finalize(lua_State *L);
 int structure_print(lua_State *L);
+int structure_set_cache(lua_State *L);
 int structure_set_parameter(lua_State *L);
 
 int structure_add_block(lua_State *L);
@@ -32,8 +33,10 @@ int structure_add_coating(lua_State *L);
 int structure_add_cone(lua_State *L);
 int structure_add_cylinder(lua_State *L);
 int structure_add_ellipsoid(lua_State *L);
+int structure_add_expression_def(lua_State *L);
 int structure_add_layer(lua_State *L);
 int structure_add_lua_def(lua_State *L);
+int structure_add_lua_def_column(lua_State *L);
 int structure_add_mesh(lua_State *L);
 int structure_add_sin_layer(lua_State *L);
 int structure_add_sphere(lua_State *L);
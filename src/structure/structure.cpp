@@ -15,6 +15,16 @@ limitations under the License.*/
 #include <bitmap3.h>
 #include <lua_structure.h>
 #include <structure.h>
+#include <thread_utils.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
 
 //##################
 //   Structure_OP
@@ -36,11 +46,421 @@ Structure_OP::~Structure_OP()
 {
 }
 
+// Unbounded by default
+void Structure_OP::bounding_box(double &bx1,double &bx2,
+                                double &by1,double &by2,
+                                double &bz1,double &bz2)
+{
+    double inf=std::numeric_limits<double>::infinity();
+    
+    bx1=by1=bz1=-inf;
+    bx2=by2=bz2=inf;
+}
+
 int Structure_OP::index(double x,double y,double z)
 {
     return -1;
 }
 
+// The z coordinates are sorted in increasing order
+void Structure_OP::index_column(std::vector<int> &col_index,double x,double y,
+                                std::vector<double> const &z)
+{
+    col_index.resize(z.size());
+    
+    for(std::size_t k=0;k<z.size();k++)
+        col_index[k]=index(x,y,z[k]);
+}
+
+bool Structure_OP::thread_safe()
+{
+    return true;
+}
+
+//#################
+//   AxisSampler
+//#################
+
+class AxisSampler_compare
+{
+    public:
+        std::vector<double> const &coord;
+        
+        AxisSampler_compare(std::vector<double> const &coord_) :coord(coord_) {}
+        
+        bool operator () (int i1,int i2) const { return coord[i1]<coord[i2]; }
+};
+
+// Sampling coordinates of one axis once flipped and folded into the period,
+// as seen by Structure::index. The samples are also sorted so that any
+// interval of coordinates maps to a contiguous range of sorted samples.
+
+class AxisSampler
+{
+    public:
+        std::vector<double> coord,sorted_coord;
+        std::vector<int> order;
+        
+        AxisSampler(int N,double D,double l,bool flip,bool periodic)
+            :coord(N), sorted_coord(N), order(N)
+        {
+            for(int i=0;i<N;i++) coord[i]=i*D;
+            
+            fold(l,flip,periodic);
+        }
+        
+        AxisSampler(std::vector<double> const &x,double l,bool flip,bool periodic)
+            :coord(x), sorted_coord(x.size()), order(x.size())
+        {
+            fold(l,flip,periodic);
+        }
+        
+        void fold(double l,bool flip,bool periodic)
+        {
+            int N=coord.size();
+            
+            for(int i=0;i<N;i++)
+            {
+                double x=coord[i];
+                
+                if(flip) x=l-x;
+                if(periodic) x=modulus(x,l);
+                
+                coord[i]=x;
+                order[i]=i;
+            }
+            
+            AxisSampler_compare comp(coord);
+            std::stable_sort(order.begin(),order.end(),comp);
+            
+            for(int i=0;i<N;i++) sorted_coord[i]=coord[order[i]];
+        }
+        
+        void range(int &n1,int &n2,double a,double b) const
+        {
+            n1=std::lower_bound(sorted_coord.begin(),sorted_coord.end(),a)-sorted_coord.begin();
+            n2=std::upper_bound(sorted_coord.begin(),sorted_coord.end(),b)-sorted_coord.begin();
+        }
+};
+
+//#########################
+//   StructureRasterizer
+//#########################
+
+// Portion of the grid covered by one periodic image of an operation,
+// expressed as ranges of sorted samples
+
+class RasterSpan
+{
+    public:
+        Structure_OP *op;
+        double sx,sy,sz;
+        int x1,x2,y1,y2,z1,z2;
+};
+
+// Painter's algorithm: the operations are rasterized in stacking order over
+// the samples of their bounding boxes only, each one overwriting the previous
+// ones. This is equivalent to Structure::index, which returns the topmost hit.
+// The samples are processed by (x,y) columns so that operations can evaluate
+// a whole column at once.
+
+class StructureRasterizer
+{
+    public:
+        Grid3<unsigned int> &matgrid;
+        AxisSampler const &sx,&sy,&sz;
+        std::vector<RasterSpan> const &spans;
+        
+        StructureRasterizer(Grid3<unsigned int> &matgrid_,
+                            AxisSampler const &sx_,AxisSampler const &sy_,AxisSampler const &sz_,
+                            std::vector<RasterSpan> const &spans_)
+            :matgrid(matgrid_),
+             sx(sx_), sy(sy_), sz(sz_),
+             spans(spans_)
+        {
+        }
+        
+        // Processes the columns of the sorted y samples between j1 and j2
+        void rasterize_band(int j1,int j2)
+        {
+            std::vector<int> col_index;
+            std::vector<double> z;
+            
+            for(RasterSpan const &span:spans)
+            {
+                int ja=std::max(j1,span.y1);
+                int jb=std::min(j2,span.y2);
+                
+                if(ja>=jb) continue;
+                
+                z.resize(span.z2-span.z1);
+                
+                for(int k=span.z1;k<span.z2;k++)
+                    z[k-span.z1]=sz.sorted_coord[k]+span.sz;
+                
+                for(int j=ja;j<jb;j++)
+                {
+                    int vj=sy.order[j];
+                    double y=sy.coord[vj]+span.sy;
+                    
+                    for(int i=span.x1;i<span.x2;i++)
+                    {
+                        int vi=sx.order[i];
+                        double x=sx.coord[vi]+span.sx;
+                        
+                        span.op->index_column(col_index,x,y,z);
+                        
+                        for(int k=span.z1;k<span.z2;k++)
+                        {
+                            int local_index=col_index[k-span.z1];
+                            
+                            if(local_index!=-1) matgrid(vi,vj,sz.order[k])=local_index;
+                        }
+                    }
+                }
+            }
+        }
+};
+
+//####################
+//   SubcellSampler
+//####################
+
+// Materials found within the interface cells, through a regular sub-sampling
+class SubcellSampler
+{
+    public:
+        Structure &structure;
+        int Nx,Ny,Nsub;
+        double Dx,Dy;
+        std::vector<double> const &z_lo,&z_hi;
+        std::vector<int> const &cells;
+        std::vector<unsigned int> &mat_1,&mat_2;
+        std::vector<int> &count_1,&count_2;
+        
+        SubcellSampler(Structure &structure_,int Nx_,int Ny_,int Nsub_,
+                       double Dx_,double Dy_,
+                       std::vector<double> const &z_lo_,std::vector<double> const &z_hi_,
+                       std::vector<int> const &cells_,
+                       std::vector<unsigned int> &mat_1_,std::vector<unsigned int> &mat_2_,
+                       std::vector<int> &count_1_,std::vector<int> &count_2_)
+            :structure(structure_),
+             Nx(Nx_), Ny(Ny_), Nsub(Nsub_),
+             Dx(Dx_), Dy(Dy_),
+             z_lo(z_lo_), z_hi(z_hi_),
+             cells(cells_),
+             mat_1(mat_1_), mat_2(mat_2_),
+             count_1(count_1_), count_2(count_2_)
+        {
+        }
+        
+        // Keeps the two most represented materials of the cells between c1 and c2
+        void sample(int c1,int c2)
+        {
+            std::vector<unsigned int> mats;
+            std::vector<int> counts;
+            
+            for(int c=c1;c<c2;c++)
+            {
+                int i=cells[c]%Nx;
+                int j=(cells[c]/Nx)%Ny;
+                int k=cells[c]/(Nx*Ny);
+                
+                mats.clear();
+                counts.clear();
+                
+                for(int a=0;a<Nsub;a++)
+                for(int b=0;b<Nsub;b++)
+                for(int d=0;d<Nsub;d++)
+                {
+                    double x=(i+(a+0.5)/Nsub-0.5)*Dx;
+                    double y=(j+(b+0.5)/Nsub-0.5)*Dy;
+                    double z=z_lo[k]+(d+0.5)/Nsub*(z_hi[k]-z_lo[k]);
+                    
+                    unsigned int m=structure.index(x,y,z);
+                    
+                    std::size_t l=0;
+                    while(l<mats.size() && mats[l]!=m) l++;
+                    
+                    if(l==mats.size())
+                    {
+                        mats.push_back(m);
+                        counts.push_back(0);
+                    }
+                    
+                    counts[l]++;
+                }
+                
+                std::size_t l1=0;
+                for(std::size_t l=1;l<mats.size();l++)
+                    if(counts[l]>counts[l1]) l1=l;
+                
+                mat_1[c]=mats[l1];
+                count_1[c]=counts[l1];
+                
+                mat_2[c]=mats[l1];
+                count_2[c]=0;
+                
+                for(std::size_t l=0;l<mats.size();l++)
+                {
+                    if(l!=l1 && counts[l]>count_2[c])
+                    {
+                        mat_2[c]=mats[l];
+                        count_2[c]=counts[l];
+                    }
+                }
+            }
+        }
+};
+
+//###############
+//   CacheHash
+//###############
+
+// 64 bits FNV-1a
+class CacheHash
+{
+    public:
+        std::uint64_t value;
+        
+        CacheHash()
+            :value(14695981039346656037ULL)
+        {
+        }
+        
+        void add(void const *bytes,std::size_t N)
+        {
+            unsigned char const *c=reinterpret_cast<unsigned char const*>(bytes);
+            
+            for(std::size_t i=0;i<N;i++)
+            {
+                value^=c[i];
+                value*=1099511628211ULL;
+            }
+        }
+        
+        template<typename T>
+        void add(T const &val) { add(&val,sizeof(T)); }
+        
+        void add(std::string const &str)
+        {
+            add(str.size());
+            add(str.data(),str.size());
+        }
+};
+
+// Magic number and format version of the cache files
+static char const cache_magic[8]={'A','E','T','H','V','O','X','1'};
+
+//##############
+//   Z planes
+//##############
+
+// Sampling planes along z and the bounds of the cells centered on them
+
+static void z_planes_uniform(std::vector<double> &z,std::vector<double> &z_lo,std::vector<double> &z_hi,
+                             int Nz,double Dz)
+{
+    z.resize(Nz);
+    z_lo.resize(Nz);
+    z_hi.resize(Nz);
+    
+    for(int k=0;k<Nz;k++)
+    {
+        z[k]=k*Dz;
+        z_lo[k]=(k-0.5)*Dz;
+        z_hi[k]=(k+0.5)*Dz;
+    }
+}
+
+// z_steps[k] is the distance between the planes k and k+1, the last one wrapping around
+static void z_planes_graded(std::vector<double> &z,std::vector<double> &z_lo,std::vector<double> &z_hi,
+                            std::vector<double> const &z_steps)
+{
+    int Nz=z_steps.size();
+    
+    z.resize(Nz);
+    z_lo.resize(Nz);
+    z_hi.resize(Nz);
+    
+    double z_acc=0;
+    
+    for(int k=0;k<Nz;k++)
+    {
+        z[k]=z_acc;
+        z_lo[k]=z_acc-0.5*z_steps[(k+Nz-1)%Nz];
+        z_hi[k]=z_acc+0.5*z_steps[k];
+        
+        z_acc+=z_steps[k];
+    }
+}
+
+//####################
+//   Structure_Memo
+//####################
+
+// Grid3::operator= assumes matching sizes
+static void memo_copy(Grid3<unsigned int> &dst,Grid3<unsigned int> const &src)
+{
+    int Nx=src.L1(),Ny=src.L2(),Nz=src.L3();
+    
+    dst.init(Nx,Ny,Nz);
+    
+    for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+        dst(i,j,k)=src(i,j,k);
+}
+
+Structure_Memo::Structure_Memo()
+    :valid(false),
+     Nx(0), Ny(0), Nsub(0),
+     first_index(0),
+     Dx(0), Dy(0)
+{
+}
+
+bool Structure_Memo::match(int Nx_,int Ny_,double Dx_,double Dy_,
+                           std::vector<double> const &z_,
+                           std::vector<double> const &z_lo_,std::vector<double> const &z_hi_,
+                           int Nsub_,unsigned int first_index_) const
+{
+    return valid && Nx==Nx_ && Ny==Ny_ && Dx==Dx_ && Dy==Dy_
+                 && Nsub==Nsub_ && first_index==first_index_
+                 && z==z_ && z_lo==z_lo_ && z_hi==z_hi_;
+}
+
+// Drops the stored discretization along with its memory
+
+void Structure_Memo::clear()
+{
+    valid=false;
+    
+    z.clear(); z.shrink_to_fit();
+    z_lo.clear(); z_lo.shrink_to_fit();
+    z_hi.clear(); z_hi.shrink_to_fit();
+    
+    matgrid.init(0,0,0);
+    mixes.clear(); mixes.shrink_to_fit();
+}
+
+void Structure_Memo::store(Grid3<unsigned int> const &matgrid_,std::vector<Structure_Mix> const &mixes_,
+                           int Nx_,int Ny_,double Dx_,double Dy_,
+                           std::vector<double> const &z_,
+                           std::vector<double> const &z_lo_,std::vector<double> const &z_hi_,
+                           int Nsub_,unsigned int first_index_)
+{
+    valid=true;
+    
+    Nx=Nx_; Ny=Ny_;
+    Dx=Dx_; Dy=Dy_;
+    Nsub=Nsub_;
+    first_index=first_index_;
+    
+    z=z_; z_lo=z_lo_; z_hi=z_hi_;
+    
+    memo_copy(matgrid,matgrid_);
+    mixes=mixes_;
+}
+
 //###############
 //   Structure
 //###############
@@ -56,7 +476,8 @@ Structure::Structure()
      periodic_x(false),
      periodic_y(false),
      periodic_z(false),
-     L(nullptr)
+     L(nullptr),
+     shared(false)
 {
 }
 
@@ -71,7 +492,8 @@ Structure::Structure(std::filesystem::path const &script_path_)
      periodic_x(false),
      periodic_y(false),
      periodic_z(false),
-     L(nullptr), script_path(script_path_)
+     L(nullptr), script_path(script_path_),
+     shared(false)
 {
     set_script(script_path_);
 }
@@ -86,20 +508,410 @@ void Structure::add_operation(Structure_OP *operation)
     operations.push_back(operation);
 }
 
+// The discretized grid only depends on the script, its parameters and the sampling
+// The padding is added afterward by the solvers and is not part of the key
+std::filesystem::path Structure::cache_file(int Nx,int Ny,double Dx,double Dy,std::vector<double> const &z) const
+{
+    CacheHash hash;
+    
+    hash.add(script_content);
+    
+    hash.add(parameter_name.size());
+    for(std::size_t i=0;i<parameter_name.size();i++)
+    {
+        hash.add(parameter_name[i]);
+        hash.add(parameter_value[i]);
+    }
+    
+    hash.add(Nx); hash.add(Ny); hash.add(z.size());
+    hash.add(Dx); hash.add(Dy);
+    hash.add(z.data(),z.size()*sizeof(double));
+    
+    std::stringstream strm;
+    strm<<std::hex<<std::setw(16)<<std::setfill('0')<<hash.value<<".vox";
+    
+    return cache_directory/strm.str();
+}
+
 void Structure::discretize(Grid3<unsigned int> &matgrid,
                            int Nx,int Ny,int Nz,double Dx,double Dy,double Dz)
 {
-    matgrid.init(Nx,Ny,Nz,0);
+    std::vector<double> z,z_lo,z_hi;
+    z_planes_uniform(z,z_lo,z_hi,Nz,Dz);
     
-    for(int i=0;i<Nx;i++)
-    for(int j=0;j<Ny;j++)
-    for(int k=0;k<Nz;k++)
+    discretize_planes(matgrid,Nx,Ny,Dx,Dy,z,z_lo,z_hi);
+}
+
+// Graded z sampling, the number of planes being the size of z_steps
+void Structure::discretize(Grid3<unsigned int> &matgrid,
+                           int Nx,int Ny,double Dx,double Dy,std::vector<double> const &z_steps)
+{
+    std::vector<double> z,z_lo,z_hi;
+    z_planes_graded(z,z_lo,z_hi,z_steps);
+    
+    discretize_planes(matgrid,Nx,Ny,Dx,Dy,z,z_lo,z_hi);
+}
+
+// A shared structure keeps its last discretization in memory, so that the solvers
+// running concurrently on the same geometry only rasterize it once, the lock also
+// serializing the accesses to the Lua state of the operations
+void Structure::discretize_planes(Grid3<unsigned int> &matgrid,int Nx,int Ny,double Dx,double Dy,
+                                  std::vector<double> const &z,
+                                  std::vector<double> const &z_lo,std::vector<double> const &z_hi)
+{
+    if(!shared)
+    {
+        discretize_planes_cached(matgrid,Nx,Ny,Dx,Dy,z,z_lo,z_hi);
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    
+    if(memo.match(Nx,Ny,Dx,Dy,z,z_lo,z_hi,0,0))
     {
-        double x=i*Dx;
-        double y=j*Dy;
-        double z=k*Dz;
+        memo_copy(matgrid,memo.matgrid);
+        return;
+    }
+    
+    discretize_planes_cached(matgrid,Nx,Ny,Dx,Dy,z,z_lo,z_hi);
+    memo.store(matgrid,std::vector<Structure_Mix>(),Nx,Ny,Dx,Dy,z,z_lo,z_hi,0,0);
+}
+
+void Structure::discretize_planes_cached(Grid3<unsigned int> &matgrid,int Nx,int Ny,double Dx,double Dy,
+                                         std::vector<double> const &z,
+                                         std::vector<double> const &z_lo,std::vector<double> const &z_hi)
+{
+    int Nz=z.size();
+    
+    std::vector<double> x(Nx),y(Ny);
+    
+    for(int i=0;i<Nx;i++) x[i]=i*Dx;
+    for(int j=0;j<Ny;j++) y[j]=j*Dy;
+    
+    double Dz=0;
+    for(int k=0;k<Nz;k++) Dz=std::max(Dz,z_hi[k]-z_lo[k]);
+    
+    if(cache_directory.empty())
+    {
+        rasterize(matgrid,x,y,z,Dx,Dy,Dz);
+        return;
+    }
+    
+    std::filesystem::path fname=cache_file(Nx,Ny,Dx,Dy,z);
+    
+    if(load_cache(matgrid,fname,Nx,Ny,Nz))
+    {
+        std::cout<<"Discretized structure loaded from "<<fname<<std::endl;
+        return;
+    }
+    
+    rasterize(matgrid,x,y,z,Dx,Dy,Dz);
+    save_cache(matgrid,fname);
+}
+
+// Point-sampled discretization of a box of Nx*Ny*Nz cells, the first one being centered on (x0,y0,z0)
+// Used for the refined regions of the solvers, and never cached
+void Structure::discretize_box(Grid3<unsigned int> &matgrid,int Nx,int Ny,int Nz,
+                               double x0,double y0,double z0,double Dx,double Dy,double Dz)
+{
+    std::vector<double> x(Nx),y(Ny),z(Nz);
+    
+    for(int i=0;i<Nx;i++) x[i]=x0+i*Dx;
+    for(int j=0;j<Ny;j++) y[j]=y0+j*Dy;
+    for(int k=0;k<Nz;k++) z[k]=z0+k*Dz;
+    
+    std::unique_lock<std::mutex> lock(shared_mutex,std::defer_lock);
+    if(shared) lock.lock();
+    
+    rasterize(matgrid,x,y,z,Dx,Dy,Dz);
+}
+
+// Point-sampled discretization, followed by a sub-sampling of the cells lying on an interface
+// Partially filled cells are given new indices, starting from first_index and described by mixes,
+// the volume fractions being rounded to multiples of 1/Nsub^3
+void Structure::discretize_subcell(Grid3<unsigned int> &matgrid,std::vector<Structure_Mix> &mixes,
+                                   int Nx,int Ny,int Nz,double Dx,double Dy,double Dz,
+                                   int Nsub,unsigned int first_index)
+{
+    std::vector<double> z,z_lo,z_hi;
+    z_planes_uniform(z,z_lo,z_hi,Nz,Dz);
+    
+    discretize_subcell_planes(matgrid,mixes,Nx,Ny,Dx,Dy,z,z_lo,z_hi,Nsub,first_index);
+}
+
+void Structure::discretize_subcell(Grid3<unsigned int> &matgrid,std::vector<Structure_Mix> &mixes,
+                                   int Nx,int Ny,double Dx,double Dy,std::vector<double> const &z_steps,
+                                   int Nsub,unsigned int first_index)
+{
+    std::vector<double> z,z_lo,z_hi;
+    z_planes_graded(z,z_lo,z_hi,z_steps);
+    
+    discretize_subcell_planes(matgrid,mixes,Nx,Ny,Dx,Dy,z,z_lo,z_hi,Nsub,first_index);
+}
+
+void Structure::discretize_subcell_planes(Grid3<unsigned int> &matgrid,std::vector<Structure_Mix> &mixes,
+                                          int Nx,int Ny,double Dx,double Dy,
+                                          std::vector<double> const &z,
+                                          std::vector<double> const &z_lo,std::vector<double> const &z_hi,
+                                          int Nsub,unsigned int first_index)
+{
+    if(!shared)
+    {
+        discretize_subcell_sampled(matgrid,mixes,Nx,Ny,Dx,Dy,z,z_lo,z_hi,Nsub,first_index);
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    
+    if(memo.match(Nx,Ny,Dx,Dy,z,z_lo,z_hi,Nsub,first_index))
+    {
+        memo_copy(matgrid,memo.matgrid);
+        mixes=memo.mixes;
+        return;
+    }
+    
+    discretize_subcell_sampled(matgrid,mixes,Nx,Ny,Dx,Dy,z,z_lo,z_hi,Nsub,first_index);
+    memo.store(matgrid,mixes,Nx,Ny,Dx,Dy,z,z_lo,z_hi,Nsub,first_index);
+}
+
+void Structure::discretize_subcell_sampled(Grid3<unsigned int> &matgrid,std::vector<Structure_Mix> &mixes,
+                                           int Nx,int Ny,double Dx,double Dy,
+                                           std::vector<double> const &z,
+                                           std::vector<double> const &z_lo,std::vector<double> const &z_hi,
+                                           int Nsub,unsigned int first_index)
+{
+    int i,j,k;
+    int Nz=z.size();
+    
+    discretize_planes_cached(matgrid,Nx,Ny,Dx,Dy,z,z_lo,z_hi);
+    mixes.clear();
+    
+    if(Nsub<2) return;
+    
+    // Cells with a different neighbor
+    
+    std::vector<int> cells;
+    
+    for(k=0;k<Nz;k++) for(j=0;j<Ny;j++) for(i=0;i<Nx;i++)
+    {
+        unsigned int m=matgrid(i,j,k);
+        
+        first_index=std::max(first_index,m+1);
+        
+        if(   (i>0 && matgrid(i-1,j,k)!=m) || (i<Nx-1 && matgrid(i+1,j,k)!=m)
+           || (j>0 && matgrid(i,j-1,k)!=m) || (j<Ny-1 && matgrid(i,j+1,k)!=m)
+           || (k>0 && matgrid(i,j,k-1)!=m) || (k<Nz-1 && matgrid(i,j,k+1)!=m))
+        {
+            cells.push_back(i+j*Nx+k*Nx*Ny);
+        }
+    }
+    
+    int Ncells=cells.size();
+    
+    std::vector<unsigned int> mat_1(Ncells),mat_2(Ncells);
+    std::vector<int> count_1(Ncells),count_2(Ncells);
+    
+    SubcellSampler sampler(*this,Nx,Ny,Nsub,Dx,Dy,z_lo,z_hi,cells,mat_1,mat_2,count_1,count_2);
+    
+    bool parallel=true;
+    for(std::size_t l=0;l<operations.size();l++)
+        if(!operations[l]->thread_safe()) parallel=false;
+    
+    int Nthr=1;
+    if(parallel) Nthr=std::max(1,std::min(max_threads_number(),Ncells));
+    
+    if(Nthr==1) sampler.sample(0,Ncells);
+    else
+    {
+        std::vector<std::thread*> threads(Nthr);
         
-        matgrid(i,j,k)=index(x,y,z);
+        for(int t=0;t<Nthr;t++)
+            threads[t]=new std::thread(&SubcellSampler::sample,&sampler,(t*Ncells)/Nthr,((t+1)*Ncells)/Nthr);
+        
+        for(int t=0;t<Nthr;t++)
+        {
+            threads[t]->join();
+            delete threads[t];
+        }
+    }
+    
+    // Quantization of the volume fractions
+    
+    int Nlevels=Nsub*Nsub*Nsub;
+    std::map<std::tuple<unsigned int,unsigned int,int>,unsigned int> mixes_map;
+    
+    for(int c=0;c<Ncells;c++)
+    {
+        i=cells[c]%Nx;
+        j=(cells[c]/Nx)%Ny;
+        k=cells[c]/(Nx*Ny);
+        
+        int level=nearest_integer(Nlevels*count_1[c]/static_cast<double>(count_1[c]+count_2[c]));
+        
+        if(level>=Nlevels)
+        {
+            matgrid(i,j,k)=mat_1[c];
+            continue;
+        }
+        
+        unsigned int m1=mat_1[c];
+        unsigned int m2=mat_2[c];
+        
+        if(m1>m2)
+        {
+            std::swap(m1,m2);
+            level=Nlevels-level;
+        }
+        
+        std::tuple<unsigned int,unsigned int,int> key(m1,m2,level);
+        
+        if(mixes_map.find(key)==mixes_map.end())
+        {
+            Structure_Mix mix;
+            
+            mix.index=first_index+mixes.size();
+            mix.mat_1=m1;
+            mix.mat_2=m2;
+            mix.weight=level/static_cast<double>(Nlevels);
+            
+            mixes_map[key]=mix.index;
+            mixes.push_back(mix);
+        }
+        
+        matgrid(i,j,k)=mixes_map[key];
+    }
+    
+    std::cout<<"Sub-cell sampling: "<<Ncells<<" interface cells, "<<mixes.size()<<" mixed materials"<<std::endl;
+}
+
+bool Structure::load_cache(Grid3<unsigned int> &matgrid,std::filesystem::path const &fname,
+                           int Nx,int Ny,int Nz) const
+{
+    std::ifstream file(fname,std::ios::in|std::ios::binary);
+    
+    if(!file.is_open()) return false;
+    
+    char magic[8];
+    std::int32_t N[3];
+    std::uint64_t N_runs;
+    
+    file.read(magic,8);
+    file.read(reinterpret_cast<char*>(N),3*sizeof(std::int32_t));
+    file.read(reinterpret_cast<char*>(&N_runs),sizeof(std::uint64_t));
+    
+    if(!file || !std::equal(magic,magic+8,cache_magic) ||
+       N[0]!=Nx || N[1]!=Ny || N[2]!=Nz) return false;
+    
+    // Every run covers at least one cell, and the file holds exactly the announced runs
+    
+    std::uint64_t N_cells=static_cast<std::uint64_t>(Nx)*Ny*Nz;
+    std::uint64_t header_size=8+3*sizeof(std::int32_t)+sizeof(std::uint64_t);
+    
+    std::error_code err;
+    std::uint64_t file_size=std::filesystem::file_size(fname,err);
+    
+    if(err || N_runs==0 || N_runs>N_cells ||
+       file_size!=header_size+2*N_runs*sizeof(std::uint32_t)) return false;
+    
+    std::vector<std::uint32_t> runs(2*N_runs);
+    file.read(reinterpret_cast<char*>(runs.data()),2*N_runs*sizeof(std::uint32_t));
+    
+    if(!file) return false;
+    
+    // Run-length decoding, checking the total length before touching the grid
+    
+    std::uint64_t N_total=0;
+    
+    for(std::uint64_t r=0;r<N_runs;r++)
+    {
+        if(runs[2*r+1]==0) return false;
+        N_total+=runs[2*r+1];
+    }
+    
+    if(N_total!=N_cells) return false;
+    
+    matgrid.init(Nx,Ny,Nz);
+    
+    std::uint64_t r=0,count=0;
+    
+    for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+    {
+        while(count==runs[2*r+1]) { r++; count=0; }
+        
+        matgrid(i,j,k)=runs[2*r];
+        count++;
+    }
+    
+    return true;
+}
+
+// Point sampling at the given coordinates, Dx, Dy and Dz being the largest steps along each axis
+void Structure::rasterize(Grid3<unsigned int> &matgrid,
+                          std::vector<double> const &x,std::vector<double> const &y,std::vector<double> const &z,
+                          double Dx,double Dy,double Dz)
+{
+    int Ny=y.size();
+    
+    matgrid.init(x.size(),Ny,z.size(),default_material);
+    
+    AxisSampler sx(x,lx,flip_x,periodic_x);
+    AxisSampler sy(y,ly,flip_y,periodic_y);
+    AxisSampler sz(z,lz,flip_z,periodic_z);
+    
+    // Bounding boxes of every periodic image, padded against round-off
+    
+    bool parallel=true;
+    std::vector<RasterSpan> spans;
+    
+    for(std::size_t l=0;l<operations.size();l++)
+    {
+        Structure_OP *op=operations[l];
+        
+        if(!op->thread_safe()) parallel=false;
+        
+        double bx1,bx2,by1,by2,bz1,bz2;
+        op->bounding_box(bx1,bx2,by1,by2,bz1,bz2);
+        
+        for(int i=-periodic_x;i<=periodic_x;i++)
+        for(int j=-periodic_y;j<=periodic_y;j++)
+        for(int k=-periodic_z;k<=periodic_z;k++)
+        {
+            RasterSpan span;
+            
+            span.op=op;
+            span.sx=i*lx;
+            span.sy=j*ly;
+            span.sz=k*lz;
+            
+            sx.range(span.x1,span.x2,bx1-span.sx-0.5*Dx,bx2-span.sx+0.5*Dx);
+            sy.range(span.y1,span.y2,by1-span.sy-0.5*Dy,by2-span.sy+0.5*Dy);
+            sz.range(span.z1,span.z2,bz1-span.sz-0.5*Dz,bz2-span.sz+0.5*Dz);
+            
+            if(span.x1<span.x2 && span.y1<span.y2 && span.z1<span.z2)
+                spans.push_back(span);
+        }
+    }
+    
+    // Bands of sorted y samples, so that the threads never write the same columns
+    
+    StructureRasterizer rasterizer(matgrid,sx,sy,sz,spans);
+    
+    int Nthr=1;
+    if(parallel) Nthr=std::max(1,std::min(max_threads_number(),Ny));
+    
+    if(Nthr==1) rasterizer.rasterize_band(0,Ny);
+    else
+    {
+        std::vector<std::thread*> threads(Nthr);
+        
+        for(int t=0;t<Nthr;t++)
+            threads[t]=new std::thread(&StructureRasterizer::rasterize_band,&rasterizer,(t*Ny)/Nthr,((t+1)*Ny)/Nthr);
+        
+        for(int t=0;t<Nthr;t++)
+        {
+            threads[t]->join();
+            delete threads[t];
+        }
     }
 }
 
@@ -109,6 +921,17 @@ double Structure::get_lz() const
     return lz;
 }
 
+bool Structure::get_shared() const
+{
+    return shared;
+}
+
+
+std::filesystem::path const& Structure::get_cache_directory() const
+{
+    return cache_directory;
+}
+
 
 std::filesystem::path const& Structure::get_script_path() const
 {
@@ -120,6 +943,8 @@ void Structure::finalize()
 {
     if(L!=nullptr) lua_close(L);
     
+    memo.valid=false;
+    
     for(std::size_t i=0;i<operations.size();i++)
         delete operations[i];
     
@@ -148,9 +973,11 @@ void Structure::finalize()
     lua_register(L,"add_cone",LuaUI::structure_add_cone);
     lua_register(L,"add_cylinder",LuaUI::structure_add_cylinder);
     lua_register(L,"add_ellipsoid",LuaUI::structure_add_ellipsoid);
+    lua_register(L,"add_expression_def",LuaUI::structure_add_expression_def);
 //    lua_register(L,"add_height_map",lop_add_height_map);
     lua_register(L,"add_layer",LuaUI::structure_add_layer);
     lua_register(L,"add_lua_def",LuaUI::structure_add_lua_def);
+    lua_register(L,"add_lua_def_column",LuaUI::structure_add_lua_def_column);
     lua_register(L,"add_mesh",LuaUI::structure_add_mesh);
     lua_register(L,"add_sin_layer",LuaUI::structure_add_sin_layer);
     lua_register(L,"add_sphere",LuaUI::structure_add_sphere);
@@ -294,6 +1121,60 @@ void Structure::print(std::filesystem::path const &path,double Dx,double Dy,doub
 }
 
 
+// Material grids are mostly made of large uniform regions, so that a run-length
+// encoding of the flattened array is usually several orders of magnitude smaller
+void Structure::save_cache(Grid3<unsigned int> const &matgrid,std::filesystem::path const &fname) const
+{
+    int Nx=matgrid.L1();
+    int Ny=matgrid.L2();
+    int Nz=matgrid.L3();
+    
+    std::vector<std::uint32_t> runs;
+    
+    for(int k=0;k<Nz;k++) for(int j=0;j<Ny;j++) for(int i=0;i<Nx;i++)
+    {
+        if(runs.empty() || runs[runs.size()-2]!=matgrid(i,j,k) || runs.back()==0xFFFFFFFF)
+        {
+            runs.push_back(matgrid(i,j,k));
+            runs.push_back(1);
+        }
+        else runs.back()++;
+    }
+    
+    std::error_code err;
+    std::filesystem::create_directories(cache_directory,err);
+    
+    // Written under a temporary name first, so that concurrent runs never read a partial file
+    
+    std::filesystem::path tmp_fname=fname;
+    tmp_fname+=".tmp"+std::to_string(std::random_device()());
+    
+    std::ofstream file(tmp_fname,std::ios::out|std::ios::trunc|std::ios::binary);
+    
+    if(!file.is_open())
+    {
+        std::cout<<"Warning, could not write the structure cache file "<<fname<<std::endl;
+        return;
+    }
+    
+    std::int32_t N[3]={Nx,Ny,Nz};
+    std::uint64_t N_runs=runs.size()/2;
+    
+    file.write(cache_magic,8);
+    file.write(reinterpret_cast<char const*>(N),3*sizeof(std::int32_t));
+    file.write(reinterpret_cast<char const*>(&N_runs),sizeof(std::uint64_t));
+    file.write(reinterpret_cast<char const*>(runs.data()),runs.size()*sizeof(std::uint32_t));
+    file.close();
+    
+    std::filesystem::rename(tmp_fname,fname,err);
+    if(err) std::filesystem::remove(tmp_fname,err);
+}
+
+void Structure::set_cache_directory(std::filesystem::path const &directory)
+{
+    cache_directory=directory;
+}
+
 void Structure::set_default_material(int mat)
 {
     default_material=mat;
@@ -342,6 +1223,12 @@ void Structure::set_script(std::filesystem::path const &script_path_)
     }
 }
 
+void Structure::set_shared(bool shared_)
+{
+    shared=shared_;
+    memo.clear();
+}
+
 
 void Structure::retrieve_nominal_size(double &lx_,double &ly_,double &lz_) const
 {
@@ -16,11 +16,13 @@ limitations under the License.*/
 #define STRUCTURE_H_INCLUDED
 
 #include <lua_base.h>
+#include <math_sym.h>
 #include <mesh_base.h>
 
 #include <Eigen/Eigen>
 
 #include <filesystem>
+#include <mutex>
 #include <vector>
 
 class Structure;
@@ -37,7 +39,13 @@ class Structure_OP
                      double z1,double z2,int mat_index);
         virtual ~Structure_OP();
         
+        virtual void bounding_box(double &bx1,double &bx2,
+                                  double &by1,double &by2,
+                                  double &bz1,double &bz2);
         virtual int index(double x,double y,double z);
+        virtual void index_column(std::vector<int> &col_index,double x,double y,
+                                  std::vector<double> const &z);
+        virtual bool thread_safe();
 };
 
 class Add_Block: public Structure_OP
@@ -47,6 +55,9 @@ class Add_Block: public Structure_OP
                   double y1,double y2,
                   double z1,double z2,int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         int index(double x,double y,double z);
 };
 
@@ -73,6 +84,9 @@ class Add_Cone: public Structure_OP
                  double x2,double y2,double z2,
                  double r,int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         int index(double x,double y,double z);
 };
 
@@ -86,6 +100,9 @@ class Add_Cylinder: public Structure_OP
                      double x2,double y2,double z2,
                      double r,int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         int index(double x,double y,double z);
 };
 
@@ -96,9 +113,29 @@ class Add_Ellipsoid: public Structure_OP
         Add_Ellipsoid(double x1,double y1,double z1,
                       double rx,double ry,double rz,int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         int index(double x,double y,double z);
 };
 
+// Inside where the expression of x, y and z is negative or null
+class Add_Expression_Def: public Structure_OP
+{
+    public:
+        std::string expression;
+        SymProgram program;
+        
+        Add_Expression_Def(std::string const &expression,
+                           std::vector<std::string> const &constants_names,
+                           std::vector<double> const &constants_values,
+                           int mat_index);
+        
+        int index(double x,double y,double z);
+        void index_column(std::vector<int> &col_index,double x,double y,
+                          std::vector<double> const &z);
+};
+
 class Add_Layer: public Structure_OP
 {
     public:
@@ -106,12 +143,16 @@ class Add_Layer: public Structure_OP
         
         Add_Layer(int type,double z1,double z2,int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         int index(double x,double y,double z);
 };
 
 class Add_Lua_Def: public Structure_OP
 {
     public:
+        bool column;
         lua_State *L;
         std::string fname;
         std::vector<lua_tools::lua_type*> parameters;
@@ -119,9 +160,12 @@ class Add_Lua_Def: public Structure_OP
         Add_Lua_Def(lua_State *L,
                     std::string const &fname,
                     std::vector<lua_tools::lua_type*> const &parameters,
-                    int mat_index);
+                    int mat_index,bool column=false);
         
         int index(double x,double y,double z);
+        void index_column(std::vector<int> &col_index,double x,double y,
+                          std::vector<double> const &z);
+        bool thread_safe();
 };
 
 class Add_Mesh: public Structure_OP
@@ -137,10 +181,22 @@ class Add_Mesh: public Structure_OP
         double y_min,y_max;
         double z_min,z_max;
         
+        int Ncx,Ncy;
+        std::vector<std::vector<int>> cell_faces;
+        
         Add_Mesh(double x1,double y1,double z1,double scale,
                  std::filesystem::path fname,int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         int index(double x,double y,double z);
+        void index_column(std::vector<int> &col_index,double x,double y,
+                          std::vector<double> const &z);
+        void z_crossings(std::vector<double> &z_cross,double x,double y);
+    
+    private:
+        void cell_coordinates(int &i,int &j,double x,double y);
 };
 
 class Add_Sin_Layer: public Structure_OP
@@ -154,6 +210,9 @@ class Add_Sin_Layer: public Structure_OP
                       double px,double phi_x,double py,double phi_y,
                       int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         int index(double x,double y,double z);
 };
 
@@ -162,6 +221,9 @@ class Add_Sphere: public Structure_OP
     public:
         Add_Sphere(double x1,double y1,double z1,double r,int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         int index(double x,double y,double z);
 };
 
@@ -184,6 +246,9 @@ class Add_Vect_Block: public Structure_OP
                        double xB,double yB,double zB,
                        double xC,double yC,double zC,int mat_index);
         
+        void bounding_box(double &bx1,double &bx2,
+                          double &by1,double &by2,
+                          double &bz1,double &bz2);
         void get_abc(double &a,double &b,double &c,
                      double x,double y,double z);
         virtual int index(double x,double y,double z);
@@ -203,6 +268,41 @@ class Add_Vect_Tri: public Add_Vect_Block
         int index(double x,double y,double z);
 };
 
+// Cell shared by two materials, weight being the volume fraction of mat_1
+class Structure_Mix
+{
+    public:
+        unsigned int index;
+        unsigned int mat_1,mat_2;
+        double weight;
+};
+
+// Last discretization of a shared structure, keyed by its sampling
+class Structure_Memo
+{
+    public:
+        bool valid;
+        int Nx,Ny,Nsub;
+        unsigned int first_index;
+        double Dx,Dy;
+        std::vector<double> z,z_lo,z_hi;
+        Grid3<unsigned int> matgrid;
+        std::vector<Structure_Mix> mixes;
+        
+        Structure_Memo();
+        
+        void clear();
+        bool match(int Nx,int Ny,double Dx,double Dy,
+                   std::vector<double> const &z,
+                   std::vector<double> const &z_lo,std::vector<double> const &z_hi,
+                   int Nsub,unsigned int first_index) const;
+        void store(Grid3<unsigned int> const &matgrid,std::vector<Structure_Mix> const &mixes,
+                   int Nx,int Ny,double Dx,double Dy,
+                   std::vector<double> const &z,
+                   std::vector<double> const &z_lo,std::vector<double> const &z_hi,
+                   int Nsub,unsigned int first_index);
+};
+
 class Structure
 {
     public:
@@ -216,8 +316,20 @@ class Structure
         void add_operation(Structure_OP *operation);
         void discretize(Grid3<unsigned int> &matgrid,
                         int Nx,int Ny,int Nz,double Dx,double Dy,double Dz);
+        void discretize_subcell(Grid3<unsigned int> &matgrid,std::vector<Structure_Mix> &mixes,
+                                int Nx,int Ny,int Nz,double Dx,double Dy,double Dz,
+                                int Nsub,unsigned int first_index);
+        void discretize(Grid3<unsigned int> &matgrid,
+                        int Nx,int Ny,double Dx,double Dy,std::vector<double> const &z_steps);
+        void discretize_subcell(Grid3<unsigned int> &matgrid,std::vector<Structure_Mix> &mixes,
+                                int Nx,int Ny,double Dx,double Dy,std::vector<double> const &z_steps,
+                                int Nsub,unsigned int first_index);
+        void discretize_box(Grid3<unsigned int> &matgrid,int Nx,int Ny,int Nz,
+                            double x0,double y0,double z0,double Dx,double Dy,double Dz);
         void finalize();
+        std::filesystem::path const& get_cache_directory() const;
         double get_lz() const;
+        bool get_shared() const;
         std::filesystem::path const& get_script_path() const;
         int index(double x,double y,double z);
         int index(double x,double y,double z,int restrict_level);
@@ -225,7 +337,9 @@ class Structure
         void set_default_material(int mat);
         void set_flip(int x,int y,int z);
         void set_loop(int x,int y,int z);
+        void set_cache_directory(std::filesystem::path const &directory);
         void set_script(std::filesystem::path const &script_path);
+        void set_shared(bool shared);
         void retrieve_nominal_size(double &lx,double &ly,double &lz) const;
         void voxelize(double Dx,double Dy,double Dz);
 
@@ -238,8 +352,37 @@ class Structure
         lua_State *L;
         std::string script_content;
         std::filesystem::path script_path;
+        std::filesystem::path cache_directory;
+        
+        bool shared;
+        std::mutex shared_mutex;
+        Structure_Memo memo;
         
         std::vector<Structure_OP*> operations;
+        
+        std::filesystem::path cache_file(int Nx,int Ny,double Dx,double Dy,std::vector<double> const &z) const;
+        void discretize_planes(Grid3<unsigned int> &matgrid,int Nx,int Ny,double Dx,double Dy,
+                               std::vector<double> const &z,
+                               std::vector<double> const &z_lo,std::vector<double> const &z_hi);
+        void discretize_planes_cached(Grid3<unsigned int> &matgrid,int Nx,int Ny,double Dx,double Dy,
+                                      std::vector<double> const &z,
+                                      std::vector<double> const &z_lo,std::vector<double> const &z_hi);
+        void discretize_subcell_planes(Grid3<unsigned int> &matgrid,std::vector<Structure_Mix> &mixes,
+                                       int Nx,int Ny,double Dx,double Dy,
+                                       std::vector<double> const &z,
+                                       std::vector<double> const &z_lo,std::vector<double> const &z_hi,
+                                       int Nsub,unsigned int first_index);
+        void discretize_subcell_sampled(Grid3<unsigned int> &matgrid,std::vector<Structure_Mix> &mixes,
+                                        int Nx,int Ny,double Dx,double Dy,
+                                        std::vector<double> const &z,
+                                        std::vector<double> const &z_lo,std::vector<double> const &z_hi,
+                                        int Nsub,unsigned int first_index);
+        bool load_cache(Grid3<unsigned int> &matgrid,std::filesystem::path const &fname,
+                        int Nx,int Ny,int Nz) const;
+        void rasterize(Grid3<unsigned int> &matgrid,
+                       std::vector<double> const &x,std::vector<double> const &y,std::vector<double> const &z,
+                       double Dx,double Dy,double Dz);
+        void save_cache(Grid3<unsigned int> const &matgrid,std::filesystem::path const &fname) const;
 };
 
 #endif // STRUCTURE_H_INCLUDED
@@ -15,6 +15,11 @@ limitations under the License.*/
 #include <mesh_tools.h>
 #include <structure.h>
 
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
 
 
 //###############
@@ -31,6 +36,15 @@ Add_Block::Add_Block(double x1_,double x2_,
     if(z1>z2) std::swap(z1,z2);
 }
 
+void Add_Block::bounding_box(double &bx1,double &bx2,
+                             double &by1,double &by2,
+                             double &bz1,double &bz2)
+{
+    bx1=x1; bx2=x2;
+    by1=y1; by2=y2;
+    bz1=z1; bz2=z2;
+}
+
 int Add_Block::index(double x,double y,double z)
 {
     if(x<x1 || x>=x2 || y<y1 || y>=y2 || z<z1 || z>=z2) return -1;
@@ -109,6 +123,15 @@ Add_Cone::Add_Cone(double x1_,double y1_,double z1_,
     base_vec.normalize();
 }
 
+void Add_Cone::bounding_box(double &bx1,double &bx2,
+                            double &by1,double &by2,
+                            double &bz1,double &bz2)
+{
+    bx1=std::min(x1,x2)-r; bx2=std::max(x1,x2)+r;
+    by1=std::min(y1,y2)-r; by2=std::max(y1,y2)+r;
+    bz1=std::min(z1,z2)-r; bz2=std::max(z1,z2)+r;
+}
+
 int Add_Cone::index(double x,double y,double z)
 {
     if(x<std::min(x1,x2)-r || x>std::max(x1,x2)+r ||
@@ -148,6 +171,15 @@ Add_Cylinder::Add_Cylinder(double x1_,double y1_,double z1_,
     base_vec.normalize();
 }
 
+void Add_Cylinder::bounding_box(double &bx1,double &bx2,
+                                double &by1,double &by2,
+                                double &bz1,double &bz2)
+{
+    bx1=std::min(x1,x2)-r; bx2=std::max(x1,x2)+r;
+    by1=std::min(y1,y2)-r; by2=std::max(y1,y2)+r;
+    bz1=std::min(z1,z2)-r; bz2=std::max(z1,z2)+r;
+}
+
 int Add_Cylinder::index(double x,double y,double z)
 {
     if(x<std::min(x1,x2)-r || x>std::max(x1,x2)+r ||
@@ -180,6 +212,15 @@ Add_Ellipsoid::Add_Ellipsoid(double x1_,double y1_,double z1_,
 {
 }
 
+void Add_Ellipsoid::bounding_box(double &bx1,double &bx2,
+                                 double &by1,double &by2,
+                                 double &bz1,double &bz2)
+{
+    bx1=x1-rx; bx2=x1+rx;
+    by1=y1-ry; by2=y1+ry;
+    bz1=z1-rz; bz2=z1+rz;
+}
+
 int Add_Ellipsoid::index(double x,double y,double z)
 {
     if(x<x1-rx || x>x1+rx ||
@@ -195,6 +236,75 @@ int Add_Ellipsoid::index(double x,double y,double z)
     return -1;
 }
 
+//########################
+//   Add_Expression_Def
+//########################
+
+Add_Expression_Def::Add_Expression_Def(std::string const &expression_,
+                                       std::vector<std::string> const &constants_names,
+                                       std::vector<double> const &constants_values,
+                                       int mat_index_)
+    :Structure_OP(0,0,0,0,0,0,mat_index_),
+     expression(expression_)
+{
+    SymLib lib;
+    std::vector<SymNode*> constants(constants_names.size());
+    
+    for(std::size_t i=0;i<constants.size();i++)
+    {
+        std::stringstream strm;
+        strm<<constants_names[i]<<"="<<std::setprecision(17)<<constants_values[i];
+        
+        constants[i]=new SymNode(strm.str(),&lib);
+    }
+    
+    // The constants are folded into the program, the library is not needed afterward
+    
+    std::vector<std::string> unknowns;
+    
+    SymNode node(expression,&lib);
+    node.compile(program,{"x","y","z"},unknowns);
+    
+    for(std::size_t i=0;i<constants.size();i++) delete constants[i];
+    
+    if(!unknowns.empty())
+    {
+        std::cerr<<"Error: unknown symbol(s) in the structure expression "<<expression<<":";
+        for(std::string const &name : unknowns) std::cerr<<" "<<name;
+        std::cerr<<std::endl;
+        
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+int Add_Expression_Def::index(double x,double y,double z)
+{
+    // The rasterization calls this from several threads at once
+    thread_local std::vector<double> stack;
+    
+    double vars[3]={x,y,z};
+    
+    if(program.evaluate(vars,stack)<=0) return mat_index;
+    
+    return -1;
+}
+
+void Add_Expression_Def::index_column(std::vector<int> &col_index,double x,double y,
+                                      std::vector<double> const &z)
+{
+    col_index.assign(z.size(),-1);
+    
+    double vars[3]={x,y,0};
+    std::vector<double> stack(program.stack_size);
+    
+    for(std::size_t k=0;k<z.size();k++)
+    {
+        vars[2]=z[k];
+        
+        if(program.evaluate(vars,stack)<=0) col_index[k]=mat_index;
+    }
+}
+
 //###############
 //   Add_Layer
 //###############
@@ -205,6 +315,20 @@ Add_Layer::Add_Layer(int type_,double z1_,double z2_,int mat_index_)
 {
 }
 
+void Add_Layer::bounding_box(double &bx1,double &bx2,
+                             double &by1,double &by2,
+                             double &bz1,double &bz2)
+{
+    Structure_OP::bounding_box(bx1,bx2,by1,by2,bz1,bz2);
+    
+    switch(type)
+    {
+        case 0: bx1=z1; bx2=z2; break;
+        case 1: by1=z1; by2=z2; break;
+        case 2: bz1=z1; bz2=z2; break;
+    }
+}
+
 int Add_Layer::index(double x,double y,double z)
 {
     switch(type)
@@ -230,8 +354,9 @@ int Add_Layer::index(double x,double y,double z)
 Add_Lua_Def::Add_Lua_Def(lua_State *L_,
                          std::string const &fname_,
                          std::vector<lua_tools::lua_type*> const &parameters_,
-                         int mat_index_)
+                         int mat_index_,bool column_)
     :Structure_OP(0,0,0,0,0,0,mat_index_),
+     column(column_),
      L(L_),
      fname(fname_),
      parameters(parameters_)
@@ -240,6 +365,16 @@ Add_Lua_Def::Add_Lua_Def(lua_State *L_,
 
 int Add_Lua_Def::index(double x,double y,double z)
 {
+    if(column)
+    {
+        std::vector<int> col_index;
+        std::vector<double> z_col(1,z);
+        
+        index_column(col_index,x,y,z_col);
+        
+        return col_index[0];
+    }
+    
     int Narg=parameters.size();
     
     lua_getglobal(L,fname.c_str());
@@ -274,10 +409,101 @@ int Add_Lua_Def::index(double x,double y,double z)
     }
 }
 
+// In column mode, the Lua function receives the whole array of heights at once
+// and returns an array of booleans, which saves one Lua call per cell
+void Add_Lua_Def::index_column(std::vector<int> &col_index,double x,double y,
+                               std::vector<double> const &z)
+{
+    if(!column)
+    {
+        Structure_OP::index_column(col_index,x,y,z);
+        return;
+    }
+    
+    int Narg=parameters.size();
+    int Nz=z.size();
+    
+    col_index.assign(Nz,-1);
+    
+    lua_getglobal(L,fname.c_str());
+    
+    if(lua_isnil(L,-1))
+    {
+        std::cout<<"Error, unknown function: "<<fname<<std::endl;
+        std::cout<<"Ignoring operation"<<std::endl;
+        
+        lua_pop(L,1);
+        return;
+    }
+    
+    lua_pushnumber(L,x);
+    lua_pushnumber(L,y);
+    
+    lua_createtable(L,Nz,0);
+    for(int k=0;k<Nz;k++)
+    {
+        lua_pushnumber(L,z[k]);
+        lua_rawseti(L,-2,k+1);
+    }
+    
+    for(int l=0;l<Narg;l++)
+        parameters[l]->push_value(L);
+    
+    lua_call(L,3+Narg,1);
+    
+    for(int k=0;k<Nz;k++)
+    {
+        lua_rawgeti(L,-1,k+1);
+        
+        if(lua_toboolean(L,-1) && !(lua_isnumber(L,-1) && lua_tonumber(L,-1)==0))
+            col_index[k]=mat_index;
+        
+        lua_pop(L,1);
+    }
+    
+    lua_pop(L,1);
+}
+
+// All the calls go through the same Lua state
+bool Add_Lua_Def::thread_safe()
+{
+    return false;
+}
+
 //##############
 //   Add_Mesh
 //##############
 
+// Signed area test of (x,y) against the edge A->B, in the xy plane.
+// The edge is always evaluated from its lowest vertex so that the two faces
+// sharing it get exactly opposite values, and points lying on the edge are
+// attributed to a single side depending on the edge direction. A vertical
+// line going through a shared edge therefore crosses exactly one face.
+static bool mesh_edge_test(double &w,Vector3 const &A,Vector3 const &B,double x,double y)
+{
+    bool flip=(B.x<A.x) || (B.x==A.x && B.y<A.y);
+    
+    Vector3 const &P=flip?B:A;
+    Vector3 const &Q=flip?A:B;
+    
+    double dx=Q.x-P.x;
+    double dy=Q.y-P.y;
+    
+    w=dx*(y-P.y)-dy*(x-P.x);
+    
+    if(flip)
+    {
+        w=-w;
+        dx=-dx;
+        dy=-dy;
+    }
+    
+    if(w>0) return true;
+    if(w<0) return false;
+    
+    return dy>0 || (dy==0 && dx<0);
+}
+
 Add_Mesh::Add_Mesh(double x1_,double y1_,double z1_,
                    double scale_,std::filesystem::path fname_,int mat_index_)
     :Structure_OP(x1_,x1_,y1_,y1_,z1_,z1_,mat_index_),
@@ -308,6 +534,55 @@ Add_Mesh::Add_Mesh(double x1_,double y1_,double z1_,
         z_min=std::min(z_min,V_arr[i].loc.z);
         z_max=std::max(z_max,V_arr[i].loc.z);
     }
+    
+    // Binning of the faces projections on a 2D grid, about one face per cell
+    
+    double lx=x_max-x_min;
+    double ly=y_max-y_min;
+    
+    double cell_size=std::sqrt(lx*ly/std::max<std::size_t>(F_arr.size(),1));
+    
+    if(cell_size>0)
+    {
+        Ncx=std::clamp(static_cast<int>(lx/cell_size),1,1024);
+        Ncy=std::clamp(static_cast<int>(ly/cell_size),1,1024);
+    }
+    else Ncx=Ncy=1;
+    
+    cell_faces.resize(Ncx*Ncy);
+    
+    for(std::size_t f=0;f<F_arr.size();f++)
+    {
+        Vector3 const &A=V_arr[F_arr[f].V1].loc;
+        Vector3 const &B=V_arr[F_arr[f].V2].loc;
+        Vector3 const &C=V_arr[F_arr[f].V3].loc;
+        
+        int i1,i2,j1,j2;
+        
+        cell_coordinates(i1,j1,var_min(A.x,B.x,C.x),var_min(A.y,B.y,C.y));
+        cell_coordinates(i2,j2,var_max(A.x,B.x,C.x),var_max(A.y,B.y,C.y));
+        
+        for(int j=j1;j<=j2;j++)
+            for(int i=i1;i<=i2;i++)
+                cell_faces[i+j*Ncx].push_back(f);
+    }
+}
+
+void Add_Mesh::bounding_box(double &bx1,double &bx2,
+                            double &by1,double &by2,
+                            double &bz1,double &bz2)
+{
+    bx1=x_min; bx2=x_max;
+    by1=y_min; by2=y_max;
+    bz1=z_min; bz2=z_max;
+}
+
+void Add_Mesh::cell_coordinates(int &i,int &j,double x,double y)
+{
+    i=j=0;
+    
+    if(x_max>x_min) i=std::clamp(static_cast<int>(Ncx*(x-x_min)/(x_max-x_min)),0,Ncx-1);
+    if(y_max>y_min) j=std::clamp(static_cast<int>(Ncy*(y-y_min)/(y_max-y_min)),0,Ncy-1);
 }
 
 int Add_Mesh::index(double x,double y,double z)
@@ -316,17 +591,82 @@ int Add_Mesh::index(double x,double y,double z)
         || y<y_min || y>y_max
         || z<z_min || z>z_max) return -1;
     
-    Vector3 O(x,y,z);
-    Vector3 D;
+    std::vector<double> z_cross;
+    z_crossings(z_cross,x,y);
+    
+    // Parity of the crossings above the point
     
-    D.rand_sph();
+    std::size_t N_inter=z_cross.end()-std::lower_bound(z_cross.begin(),z_cross.end(),z);
     
-    int N_inter=ray_N_inter(V_arr,F_arr,-1,O,D);
     if(N_inter%2!=0) return mat_index;
     
     return -1;
 }
 
+void Add_Mesh::index_column(std::vector<int> &col_index,double x,double y,
+                            std::vector<double> const &z)
+{
+    col_index.assign(z.size(),-1);
+    
+    if(x<x_min || x>x_max || y<y_min || y>y_max) return;
+    
+    std::vector<double> z_cross;
+    z_crossings(z_cross,x,y);
+    
+    // Single sweep along the column, z being sorted
+    
+    std::size_t N_below=0;
+    
+    for(std::size_t k=0;k<z.size();k++)
+    {
+        while(N_below<z_cross.size() && z_cross[N_below]<z[k]) N_below++;
+        
+        if((z_cross.size()-N_below)%2!=0) col_index[k]=mat_index;
+    }
+}
+
+// Sorted heights at which the vertical line going through (x,y) crosses the mesh
+void Add_Mesh::z_crossings(std::vector<double> &z_cross,double x,double y)
+{
+    z_cross.clear();
+    
+    int i,j;
+    cell_coordinates(i,j,x,y);
+    
+    std::vector<int> const &faces=cell_faces[i+j*Ncx];
+    
+    for(std::size_t l=0;l<faces.size();l++)
+    {
+        Face const &F=F_arr[faces[l]];
+        
+        Vector3 const *A=&V_arr[F.V1].loc;
+        Vector3 const *B=&V_arr[F.V2].loc;
+        Vector3 const *C=&V_arr[F.V3].loc;
+        
+        // Counter-clockwise orientation in the xy plane
+        
+        double area=(B->x-A->x)*(C->y-A->y)-(B->y-A->y)*(C->x-A->x);
+        
+        if(area==0) continue;
+        else if(area<0)
+        {
+            std::swap(B,C);
+            area=-area;
+        }
+        
+        double wA,wB,wC;
+        
+        if(   mesh_edge_test(wA,*B,*C,x,y)
+           && mesh_edge_test(wB,*C,*A,x,y)
+           && mesh_edge_test(wC,*A,*B,x,y))
+        {
+            z_cross.push_back((wA*A->z+wB*B->z+wC*C->z)/area);
+        }
+    }
+    
+    std::sort(z_cross.begin(),z_cross.end());
+}
+
 //###################
 //   Add_Sin_Layer
 //###################
@@ -341,6 +681,16 @@ Add_Sin_Layer::Add_Sin_Layer(double z1_,double a1_,double z2_,double a2_,
 {
 }
 
+void Add_Sin_Layer::bounding_box(double &bx1,double &bx2,
+                                 double &by1,double &by2,
+                                 double &bz1,double &bz2)
+{
+    Structure_OP::bounding_box(bx1,bx2,by1,by2,bz1,bz2);
+    
+    bz1=z1-std::abs(a1);
+    bz2=z2+std::abs(a2);
+}
+
 int Add_Sin_Layer::index(double x,double y,double z)
 {
     double h1,h2,t;
@@ -372,6 +722,15 @@ Add_Sphere::Add_Sphere(double x1_,double y1_,double z1_,double r_,int mat_index_
     r=r_;
 }
 
+void Add_Sphere::bounding_box(double &bx1,double &bx2,
+                              double &by1,double &by2,
+                              double &bz1,double &bz2)
+{
+    bx1=x1-r; bx2=x1+r;
+    by1=y1-r; by2=y1+r;
+    bz1=z1-r; bz2=z1+r;
+}
+
 int Add_Sphere::index(double x,double y,double z)
 {
     x=x-x1;
@@ -434,6 +793,15 @@ void Add_Vect_Block::get_abc(double &a,double &b,double &c,
     c=coeff(2);
 }
 
+void Add_Vect_Block::bounding_box(double &bx1,double &bx2,
+                                  double &by1,double &by2,
+                                  double &bz1,double &bz2)
+{
+    bx1=x_min; bx2=x_max;
+    by1=y_min; by2=y_max;
+    bz1=z_min; bz2=z_max;
+}
+
 int Add_Vect_Block::index(double x,double y,double z)
 {
     if(    x<x_min || x>x_max
@@ -0,0 +1,108 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <math_optim.h>
+
+#include <cmath>
+#include <iostream>
+
+// Coupled quadratic bowl with its analytic gradient
+
+class CoupledBowl: public OptimGradientTarget
+{
+	public:
+		int Nevals;
+		
+		CoupledBowl()
+			:Nevals(0)
+		{
+		}
+		
+		double evaluate(std::vector<double*> const &variables,std::vector<double> &gradient) override
+		{
+			double x=*variables[0],y=*variables[1],z=*variables[2],w=*variables[3];
+			
+			Nevals++;
+			
+			gradient[0]=2.0*(x-2.0)+2.0*(x-y);
+			gradient[1]=20.0*(y-0.3)-2.0*(x-y);
+			gradient[2]=2.0*(z+1.0);
+			gradient[3]=2.0*(w-4.0);
+			
+			return (x-2.0)*(x-2.0)+10.0*(y-0.3)*(y-0.3)+(x-y)*(x-y)+(z+1.0)*(z+1.0)+(w-4.0)*(w-4.0);
+		}
+};
+
+// Checks that the bounded L-BFGS minimizer converges in a few tens of
+// iterations while honoring the rule limits and locks
+
+int optim_lbfgs(int argc,char *argv[])
+{
+	double x=0,y=1.0,z=0.5,w=0.5;
+	
+	OptimRule rule_x,rule_y,rule_z,rule_w;
+	
+	rule_x.operation_type=OptimRule::Operation::ADD;
+	rule_x.delta_add=0.1;
+	rule_x.limit_type=OptimRule::Limit::UP;
+	rule_x.limit_up=1.0;
+	
+	rule_y.operation_type=OptimRule::Operation::GROW;
+	rule_y.delta_grow=0.2;
+	
+	rule_z.lock=true;
+	
+	rule_w.operation_type=OptimRule::Operation::ADD;
+	rule_w.delta_add=0.5;
+	rule_w.limit_type=OptimRule::Limit::BOTH;
+	rule_w.limit_down=0;
+	rule_w.limit_up=3.0;
+	
+	OptimLBFGS optim;
+	
+	optim.register_variable(&x,rule_x);
+	optim.register_variable(&y,rule_y);
+	optim.register_variable(&z,rule_z);
+	optim.register_variable(&w,rule_w);
+	optim.set_max_iterations(30);
+	
+	CoupledBowl bowl;
+	
+	double score=optim.optimize(bowl);
+	
+	// x held by its upper limit, y then at 4/11, z locked, w held by its upper limit
+	
+	double y_opt=4.0/11.0;
+	double score_opt=1.0+10.0*(y_opt-0.3)*(y_opt-0.3)+(1.0-y_opt)*(1.0-y_opt)+2.25+1.0;
+	
+	if(x!=1.0 || std::abs(y-y_opt)>1e-6 || z!=0.5 || w!=3.0)
+	{
+		std::cout<<"Error, wrong optimum "<<x<<" "<<y<<" "<<z<<" "<<w<<"\n";
+		return 1;
+	}
+	
+	if(std::abs(score-score_opt)>1e-10)
+	{
+		std::cout<<"Error, wrong score "<<score<<" instead of "<<score_opt<<"\n";
+		return 1;
+	}
+	
+	if(bowl.Nevals>200)
+	{
+		std::cout<<"Error, "<<bowl.Nevals<<" evaluations to converge\n";
+		return 1;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <math_optim.h>
+
+#include <cmath>
+#include <iostream>
+
+// Shifted quadratic bowl, each context owning its own copy of the variables
+
+class Bowl: public OptimContext
+{
+	public:
+		double x,y,z;
+		
+		Bowl()
+			:x(0), y(0), z(0)
+		{
+			variables={&x,&y,&z};
+		}
+		
+		double evaluate() override
+		{
+			return (x-1.5)*(x-1.5)+(y-0.2)*(y-0.2)+(z+3.0)*(z+3.0);
+		}
+};
+
+// Context without any variable
+
+class Constant: public OptimContext
+{
+	public:
+		double evaluate() override { return 2.5; }
+};
+
+// Checks that the differential-evolution mode of OptimEngine converges with
+// concurrent contexts while honoring the rule limits and locks
+
+int optim_population(int argc,char *argv[])
+{
+	Bowl bowls[4];
+	
+	std::vector<OptimContext*> contexts(4);
+	for(int i=0;i<4;i++) contexts[i]=&bowls[i];
+	
+	bowls[0].x=0.5;
+	bowls[0].y=1.0;
+	bowls[0].z=-1.0;
+	
+	OptimEngine engine;
+	
+	OptimRule rule_x,rule_y,rule_z;
+	
+	rule_x.operation_type=OptimRule::Operation::ADD;
+	rule_x.delta_add=0.5;
+	rule_x.limit_type=OptimRule::Limit::BOTH;
+	rule_x.limit_down=0;
+	rule_x.limit_up=1.0;
+	
+	rule_y.operation_type=OptimRule::Operation::GROW;
+	rule_y.delta_grow=0.5;
+	rule_y.limit_type=OptimRule::Limit::BOTH;
+	rule_y.limit_down=0.01;
+	rule_y.limit_up=10.0;
+	
+	rule_z.lock=true;
+	
+	engine.register_variable(&bowls[0].x,rule_x);
+	engine.register_variable(&bowls[0].y,rule_y);
+	engine.register_variable(&bowls[0].z,rule_z);
+	
+	engine.set_population(20);
+	engine.set_max_generations(200);
+	engine.max_fails=200;
+	
+	double score=engine.optimize_population(contexts);
+	
+	// x is bounded by 1, y free to reach 0.2, z locked at -1
+	
+	if(std::abs(bowls[0].x-1.0)>1e-3 || std::abs(bowls[0].y-0.2)>1e-3 || bowls[0].z!=-1.0)
+	{
+		std::cout<<"Error, wrong optimum "<<bowls[0].x<<" "<<bowls[0].y<<" "<<bowls[0].z<<"\n";
+		return 1;
+	}
+	
+	if(std::abs(score-(0.25+4.0))>1e-5)
+	{
+		std::cout<<"Error, wrong score "<<score<<"\n";
+		return 1;
+	}
+	
+	// Nothing to evolve: the current state is returned as is
+	
+	OptimEngine engine_locked;
+	
+	engine_locked.register_variable(&bowls[0].x,rule_z);
+	engine_locked.register_variable(&bowls[0].y,rule_z);
+	engine_locked.register_variable(&bowls[0].z,rule_z);
+	engine_locked.set_population(20);
+	
+	bowls[0].x=0.5;
+	bowls[0].y=0.2;
+	bowls[0].z=-3.0;
+	
+	score=engine_locked.optimize_population(contexts);
+	
+	if(bowls[0].x!=0.5 || bowls[0].y!=0.2 || bowls[0].z!=-3.0 || std::abs(score-1.0)>1e-12)
+	{
+		std::cout<<"Error, locked variables moved or wrong score "<<score<<"\n";
+		return 1;
+	}
+	
+	Constant constant;
+	std::vector<OptimContext*> constant_contexts={&constant};
+	
+	OptimEngine engine_empty;
+	engine_empty.set_population(20);
+	
+	if(engine_empty.optimize_population(constant_contexts)!=2.5)
+	{
+		std::cout<<"Error, wrong score without variables\n";
+		return 1;
+	}
+	
+	return 0;
+}
@@ -300,10 +300,82 @@ bool functions()
     return true;
 }
 
+bool compiled_programs()
+{
+    SymLib lib;
+    
+    SymNode a("a=0.5",&lib);
+    SymNode b("b=-3",&lib);
+    SymNode x("x=0",&lib);
+    SymNode y("y=0",&lib);
+    
+    std::vector<std::string> frm={"x+y*a-b",
+                                  "x-y-a-b",
+                                  "x/y/a*b",
+                                  "2^x^a",
+                                  "-x^2+y^2*a",
+                                  "(x+y)*(x-y)/(a+b)",
+                                  "-cos(x*pi)+sin(-(y-a))",
+                                  "exp(-(x^2+y^2)/b^2)",
+                                  "x*-2+atan(y)/(1-a)",
+                                  "1e-1*x-2.5e2*y+unknown(x)"};
+    
+    SymNode expr(&lib);
+    SymProgram program;
+    
+    for(unsigned int i=0;i<frm.size();i++)
+    {
+        expr.set_expression(frm[i]);
+        expr.compile(program,{"x","y"});
+        
+        for(int j=0;j<10;j++)
+        {
+            double vars[2]={-1.3+0.31*j,0.7-0.17*j};
+            
+            x.set_expression("x="+std::to_string(vars[0]));
+            y.set_expression("y="+std::to_string(vars[1]));
+            
+            vars[0]=x.evaluate();
+            vars[1]=y.evaluate();
+            
+            if(!near(program.evaluate(vars),expr.evaluate(),1e-12))
+            {
+                std::cout<<"Compiled program failed on "<<frm[i]<<"\n";
+                return false;
+            }
+        }
+    }
+    
+    std::vector<std::string> unknowns;
+    
+    expr.set_expression("x*a+pi-c*y+c");
+    expr.compile(program,{"x","y"},unknowns);
+    
+    if(unknowns.size()!=1 || unknowns[0]!="c")
+    {
+        std::cout<<"Unknown symbols not reported\n";
+        return false;
+    }
+    
+    expr.set_expression("x*a+pi-b*y");
+    expr.compile(program,{"x","y"},unknowns);
+    
+    if(!unknowns.empty())
+    {
+        std::cout<<"Known symbols reported as unknown\n";
+        return false;
+    }
+    
+    std::cout<<"Compiled programs validated\n";
+    
+    return true;
+}
+
 int symbolic_math(int argc,char *argv[])
 {
     return !(   basic_operations()
              && sub_expressions()
              && special_values()
-             && functions());
+             && functions()
+             && compiled_programs());
 }
@@ -0,0 +1,155 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <thread_utils.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+// Inner task, submitted from the chunks of the outer one
+
+class Inner_Sum: public PoolTask
+{
+	public:
+		std::atomic<int> total;
+		
+		Inner_Sum()
+			:total(0)
+		{
+		}
+		
+		void pool_run(int chunk,int Nchunks) override
+		{
+			total+=chunk+1;
+		}
+};
+
+// Every chunk waits on its own nested submission, which has to complete
+// even when all the workers are busy with outer chunks
+
+class Outer_Sum: public PoolTask
+{
+	public:
+		std::atomic<int> failures;
+		
+		Outer_Sum()
+			:failures(0)
+		{
+		}
+		
+		void pool_run(int chunk,int Nchunks) override
+		{
+			Inner_Sum inner;
+			PoolGroup group;
+			
+			shared_pool().submit(&inner,10,group);
+			shared_pool().wait(group);
+			
+			if(inner.total!=55) failures++;
+		}
+};
+
+// Records how many of its chunks run at once, and the budget they see
+
+class Budget_Probe: public PoolTask
+{
+	public:
+		std::atomic<int> Nrunning,Nrunning_max,Nthreads_max,Nchunks_done;
+		
+		Budget_Probe()
+			:Nrunning(0), Nrunning_max(0), Nthreads_max(0), Nchunks_done(0)
+		{
+		}
+		
+		void pool_run(int chunk,int Nchunks) override
+		{
+			int N=++Nrunning;
+			
+			int N_max=Nrunning_max;
+			while(N>N_max && !Nrunning_max.compare_exchange_weak(N_max,N)) {}
+			
+			int T=max_threads_number();
+			int T_max=Nthreads_max;
+			while(T>T_max && !Nthreads_max.compare_exchange_weak(T_max,T)) {}
+			
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			
+			Nrunning--;
+			Nchunks_done++;
+		}
+};
+
+int tasks_pool(int argc,char *argv[])
+{
+	Outer_Sum outer;
+	PoolGroup group;
+	
+	int Nchunks=4*shared_pool().get_N_threads();
+	
+	shared_pool().submit(&outer,Nchunks,group);
+	shared_pool().wait(group);
+	
+	if(outer.failures!=0 || group.Npending!=0)
+	{
+		std::cout<<"Error, nested submissions not completed\n";
+		return 1;
+	}
+	
+	// Two groups waited on separately
+	
+	Inner_Sum a,b;
+	PoolGroup group_a,group_b;
+	
+	shared_pool().submit(&a,20,group_a);
+	shared_pool().submit(&b,30,group_b);
+	
+	shared_pool().wait(group_b);
+	
+	if(b.total!=465 || group_b.Npending!=0)
+	{
+		std::cout<<"Error, wrong result for the second group\n";
+		return 1;
+	}
+	
+	shared_pool().wait(group_a);
+	
+	if(a.total!=210)
+	{
+		std::cout<<"Error, wrong result for the first group\n";
+		return 1;
+	}
+	
+	// A budgeted submitter keeps its chunks within its share
+	
+	Budget_Probe probe;
+	PoolGroup group_probe;
+	
+	set_thread_budget(2);
+	
+	shared_pool().submit(&probe,40,group_probe);
+	shared_pool().wait(group_probe);
+	
+	set_thread_budget(0);
+	
+	if(probe.Nchunks_done!=40 || probe.Nrunning_max>2 || probe.Nthreads_max>2)
+	{
+		std::cout<<"Error, budget exceeded: "<<probe.Nrunning_max<<" chunks at once, "
+		         <<probe.Nthreads_max<<" threads seen\n";
+		return 1;
+	}
+	
+	return 0;
+}
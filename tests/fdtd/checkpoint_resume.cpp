@@ -0,0 +1,248 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <lua_fdtd.h>
+
+#include <filesystem>
+#include <iostream>
+
+static FDTD* checkpoint_fdtd()
+{
+	int N=24;
+	double D=10e-9;
+	double Dt=0.9*D/(c_light*std::sqrt(3.0));
+	
+	FDTD *fdtd=new FDTD(N,N,N,200,D,D,D,Dt,"CUSTOM",0,0,0,0,4,4);
+	
+	Grid3<unsigned int> matsgrid(N,N,N,0);
+	for(int i=0;i<N;i++) for(int j=0;j<N;j++) for(int k=10;k<14;k++) matsgrid(i,j,k)=1;
+	
+	Material vacuum,slab;
+	LorentzModel lorentz;
+	
+	slab.eps_inf=2.5;
+	lorentz.set(1.0,2e15,1e14);
+	slab.lorentz.push_back(lorentz);
+	
+	fdtd->set_matsgrid(matsgrid);
+	fdtd->set_material(0,vacuum);
+	fdtd->set_material(1,slab);
+	
+	fdtd->set_pml_zm(25,1,0.2);
+	fdtd->set_pml_zp(25,1,0.2);
+	fdtd->set_kx(0);
+	fdtd->set_ky(0);
+	
+	fdtd->bootstrap();
+	fdtd->reset_fields();
+	fdtd->tstep=0;
+	
+	return fdtd;
+}
+
+static void add_oscillator(std::vector<Source*> &sources,FDTD const &fdtd,int x)
+{
+	Source *src=new Oscillator(NORMAL_X,x,x+2,10,12,18,19);
+	
+	src->set_spectrum(400e-9,800e-9);
+	src->link(fdtd);
+	
+	sources.push_back(src);
+}
+
+static void add_completion(std::vector<Sensor*> &sensors,FDTD const &fdtd)
+{
+	Sensor *sens=new CompletionSensor(1e-4);
+	
+	sens->link(fdtd);
+	
+	sensors.push_back(sens);
+}
+
+static void run_steps(FDTD &fdtd,std::vector<Sensor*> &sensors,std::vector<Source*> &sources,int t1,int t2)
+{
+	for(int t=t1;t<t2;t++)
+	{
+		fdtd.update_E();
+		for(unsigned int i=0;i<sources.size();i++) sources[i]->inject_E(fdtd);
+		
+		fdtd.update_H();
+		feed_sensors(sensors,fdtd);
+		for(unsigned int i=0;i<sources.size();i++) sources[i]->inject_H(fdtd);
+	}
+}
+
+static bool same_fields(FDTD &A,FDTD &B)
+{
+	for(int i=0;i<A.Nx;i++) for(int j=0;j<A.Ny;j++) for(int k=0;k<A.Nz;k++)
+	{
+		if(A.Ex(i,j,k)!=B.Ex(i,j,k) || A.Ey(i,j,k)!=B.Ey(i,j,k) || A.Ez(i,j,k)!=B.Ez(i,j,k) ||
+		   A.Hx(i,j,k)!=B.Hx(i,j,k) || A.Hy(i,j,k)!=B.Hy(i,j,k) || A.Hz(i,j,k)!=B.Hz(i,j,k)) return false;
+	}
+	
+	return true;
+}
+
+static bool zero_fields(FDTD &A)
+{
+	for(int i=0;i<A.Nx;i++) for(int j=0;j<A.Ny;j++) for(int k=0;k<A.Nz;k++)
+	{
+		if(A.Ex(i,j,k)!=0 || A.Ey(i,j,k)!=0 || A.Ez(i,j,k)!=0 ||
+		   A.Hx(i,j,k)!=0 || A.Hy(i,j,k)!=0 || A.Hz(i,j,k)!=0) return false;
+	}
+	
+	return true;
+}
+
+static void clear_run(FDTD *fdtd,std::vector<Sensor*> &sensors,std::vector<Source*> &sources)
+{
+	for(unsigned int i=0;i<sensors.size();i++) delete sensors[i];
+	for(unsigned int i=0;i<sources.size();i++) delete sources[i];
+	
+	sensors.clear();
+	sources.clear();
+	
+	delete fdtd;
+}
+
+int checkpoint_resume(int argc,char *argv[])
+{
+	int Nt=60,Nt_half=30;
+	bool success=true;
+	
+	std::filesystem::path fname=std::filesystem::temp_directory_path()/"aether_checkpoint_resume.chk";
+	
+	// Uninterrupted reference
+	
+	std::vector<Sensor*> sensors_ref;
+	std::vector<Source*> sources_ref;
+	
+	FDTD *fdtd_ref=checkpoint_fdtd();
+	add_oscillator(sources_ref,*fdtd_ref,10);
+	add_completion(sensors_ref,*fdtd_ref);
+	
+	run_steps(*fdtd_ref,sensors_ref,sources_ref,0,Nt);
+	
+	// Interrupted halfway
+	
+	std::vector<Sensor*> sensors;
+	std::vector<Source*> sources;
+	
+	FDTD *fdtd=checkpoint_fdtd();
+	add_oscillator(sources,*fdtd,10);
+	add_completion(sensors,*fdtd);
+	
+	run_steps(*fdtd,sensors,sources,0,Nt_half);
+	
+	Checkpoint chk;
+	chk.start_saving();
+	default_fdtd_checkpoint(chk,*fdtd,sensors,sources);
+	chk.write(fname);
+	
+	clear_run(fdtd,sensors,sources);
+	
+	// Resumed run
+	
+	fdtd=checkpoint_fdtd();
+	add_oscillator(sources,*fdtd,10);
+	add_completion(sensors,*fdtd);
+	
+	if(!default_fdtd_resume(fname,*fdtd,sensors,sources) || fdtd->tstep!=Nt_half)
+	{
+		std::cerr<<"Could not resume from a valid checkpoint"<<std::endl;
+		success=false;
+	}
+	else
+	{
+		run_steps(*fdtd,sensors,sources,Nt_half,Nt);
+		
+		CompletionSensor *cpl=dynamic_cast<CompletionSensor*>(sensors[0]),
+		                 *cpl_ref=dynamic_cast<CompletionSensor*>(sensors_ref[0]);
+		
+		if(!same_fields(*fdtd,*fdtd_ref) || sources[0]->step!=sources_ref[0]->step
+		   || cpl->energy_last!=cpl_ref->energy_last || cpl->energy_max!=cpl_ref->energy_max)
+		{
+			std::cerr<<"Resumed run differs from the uninterrupted one"<<std::endl;
+			success=false;
+		}
+	}
+	
+	clear_run(fdtd,sensors,sources);
+	
+	// Different sources: rejected through the layout, nothing restored
+	
+	fdtd=checkpoint_fdtd();
+	add_oscillator(sources,*fdtd,10);
+	add_oscillator(sources,*fdtd,4);
+	add_completion(sensors,*fdtd);
+	
+	if(default_fdtd_resume(fname,*fdtd,sensors,sources) || fdtd->tstep!=0
+	   || sources[0]->step!=0 || !zero_fields(*fdtd))
+	{
+		std::cerr<<"Checkpoint of another layout was not rejected cleanly"<<std::endl;
+		success=false;
+	}
+	
+	clear_run(fdtd,sensors,sources);
+	
+	// Block failing halfway through: the fresh state must come back
+	
+	Checkpoint chk_bad;
+	chk_bad.load(fname);
+	
+	std::uint64_t N_field=sizeof(double)*fdtd_ref->Nx*fdtd_ref->Ny*fdtd_ref->Nz;
+	
+	for(std::size_t pos=64;pos+64<=chk_bad.buffer.size();)
+	{
+		std::uint64_t N;
+		std::memcpy(&N,chk_bad.buffer.data()+pos,sizeof(std::uint64_t));
+		
+		if(N==N_field)
+		{
+			N-=sizeof(double);
+			std::memcpy(chk_bad.buffer.data()+pos,&N,sizeof(std::uint64_t));
+			break;
+		}
+		
+		pos+=64+((N+63)/64)*64;
+	}
+	
+	chk_bad.offset=chk_bad.buffer.size();
+	chk_bad.write(fname);
+	
+	if(!chk_bad.load(fname))
+	{
+		std::cerr<<"Altered checkpoint should pass the file checks"<<std::endl;
+		success=false;
+	}
+	
+	fdtd=checkpoint_fdtd();
+	add_oscillator(sources,*fdtd,10);
+	add_completion(sensors,*fdtd);
+	
+	if(default_fdtd_resume(fname,*fdtd,sensors,sources) || fdtd->tstep!=0
+	   || sources[0]->step!=0 || !zero_fields(*fdtd))
+	{
+		std::cerr<<"Partially read checkpoint was not rolled back"<<std::endl;
+		success=false;
+	}
+	
+	clear_run(fdtd,sensors,sources);
+	clear_run(fdtd_ref,sensors_ref,sources_ref);
+	
+	std::filesystem::remove(fname);
+	
+	if(success) return 0;
+	else return 1;
+}
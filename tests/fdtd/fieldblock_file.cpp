@@ -0,0 +1,207 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fieldblock_file.h>
+#include <fieldblock_holder.h>
+
+#include <fstream>
+#include <iostream>
+
+static void fill_block(FieldBlockHolder &F)
+{
+	F.x1=3; F.Nx=37;
+	F.y1=4; F.Ny=20;
+	F.z1=5; F.Nz=45;
+	F.Dx=1e-9; F.Dy=2e-9; F.Dz=3e-9;
+	F.lambda=500e-9;
+	
+	F.mats.init(F.Nx,F.Ny,F.Nz,0);
+	F.Ex.init(F.Nx,F.Ny,F.Nz,0); F.Ey.init(F.Nx,F.Ny,F.Nz,0); F.Ez.init(F.Nx,F.Ny,F.Nz,0);
+	F.Hx.init(F.Nx,F.Ny,F.Nz,0); F.Hy.init(F.Nx,F.Ny,F.Nz,0); F.Hz.init(F.Nx,F.Ny,F.Nz,0);
+	
+	Grid3<Imdouble> *fields[6]={&F.Ex,&F.Ey,&F.Ez,&F.Hx,&F.Hy,&F.Hz};
+	
+	for(int i=0;i<F.Nx;i++) for(int j=0;j<F.Ny;j++) for(int k=0;k<F.Nz;k++)
+	{
+		F.mats(i,j,k)=(7*i+3*j+k)%5;
+		
+		for(int f=0;f<6;f++)
+			(*fields[f])(i,j,k)=Imdouble(std::sin(0.1*i+0.2*j+0.05*k+f),1e-3*std::cos(0.3*i-0.1*k+0.7*f));
+	}
+}
+
+// Checks that B holds the part of A starting at (i0,j0,k0)
+
+static bool same_block(FieldBlockHolder &A,FieldBlockHolder &B,int i0,int j0,int k0)
+{
+	if(B.x1!=A.x1+i0 || B.y1!=A.y1+j0 || B.z1!=A.z1+k0) return false;
+	if(B.lambda!=A.lambda || B.Dx!=A.Dx || B.Dy!=A.Dy || B.Dz!=A.Dz) return false;
+	
+	for(int i=0;i<B.Nx;i++) for(int j=0;j<B.Ny;j++) for(int k=0;k<B.Nz;k++)
+	{
+		if(B.mats(i,j,k)!=A.mats(i+i0,j+j0,k+k0)) return false;
+		
+		if(B.Ex(i,j,k)!=A.Ex(i+i0,j+j0,k+k0) || B.Ey(i,j,k)!=A.Ey(i+i0,j+j0,k+k0) ||
+		   B.Ez(i,j,k)!=A.Ez(i+i0,j+j0,k+k0) || B.Hx(i,j,k)!=A.Hx(i+i0,j+j0,k+k0) ||
+		   B.Hy(i,j,k)!=A.Hy(i+i0,j+j0,k+k0) || B.Hz(i,j,k)!=A.Hz(i+i0,j+j0,k+k0)) return false;
+	}
+	
+	return true;
+}
+
+// Former layout, the fields being interleaved per voxel
+
+static void save_legacy(FieldBlockHolder &F,std::string const &fname)
+{
+	std::ofstream file(fname,std::ios::out|std::ios::trunc|std::ios::binary);
+	
+	file.write(reinterpret_cast<char*>(&F.lambda),sizeof(double));
+	file.write(reinterpret_cast<char*>(&F.x1),sizeof(int));
+	file.write(reinterpret_cast<char*>(&F.Nx),sizeof(int));
+	file.write(reinterpret_cast<char*>(&F.y1),sizeof(int));
+	file.write(reinterpret_cast<char*>(&F.Ny),sizeof(int));
+	file.write(reinterpret_cast<char*>(&F.z1),sizeof(int));
+	file.write(reinterpret_cast<char*>(&F.Nz),sizeof(int));
+	file.write(reinterpret_cast<char*>(&F.Dx),sizeof(double));
+	file.write(reinterpret_cast<char*>(&F.Dy),sizeof(double));
+	file.write(reinterpret_cast<char*>(&F.Dz),sizeof(double));
+	
+	Grid3<Imdouble> *fields[6]={&F.Ex,&F.Ey,&F.Ez,&F.Hx,&F.Hy,&F.Hz};
+	
+	for(int i=0;i<F.Nx;i++) for(int j=0;j<F.Ny;j++) for(int k=0;k<F.Nz;k++)
+	{
+		for(int f=0;f<6;f++) file.write(reinterpret_cast<char*>(&(*fields[f])(i,j,k)),sizeof(Imdouble));
+		file.write(reinterpret_cast<char*>(&F.mats(i,j,k)),sizeof(unsigned int));
+	}
+}
+
+// Overwrites a value of a saved file in place
+
+template<class T>
+static void patch_file(std::string const &fname,std::uint64_t offset,T value)
+{
+	std::fstream file(fname,std::ios::in|std::ios::out|std::ios::binary);
+	
+	file.seekp(offset);
+	file.write(reinterpret_cast<char*>(&value),sizeof(T));
+}
+
+template<class T>
+static T peek_file(std::string const &fname,std::uint64_t offset)
+{
+	T value;
+	std::ifstream file(fname,std::ios::in|std::ios::binary);
+	
+	file.seekg(offset);
+	file.read(reinterpret_cast<char*>(&value),sizeof(T));
+	
+	return value;
+}
+
+int fieldblock_file(int argc,char *argv[])
+{
+	FieldBlockHolder F;
+	fill_block(F);
+	
+	for(int compression : {FB_RAW,FB_DEFLATE,FB_SHUFFLE_DEFLATE})
+	{
+		std::string fname="fieldblock_sample_"+std::to_string(compression)+".afblock";
+		
+		if(!F.save(fname,compression))
+		{
+			std::cout<<"Error, could not write "<<fname<<"\n";
+			return 1;
+		}
+		
+		FieldBlockHolder full,box,slice;
+		
+		full.load(fname);
+		box.load_box(fname,5,36,3,17,31,44);
+		slice.load_slice(fname,NORMAL_Y,11);
+		
+		if(!same_block(F,full,0,0,0) || full.Nx!=F.Nx || full.Ny!=F.Ny || full.Nz!=F.Nz)
+		{
+			std::cout<<"Error, full read mismatch with compression "<<compression<<"\n";
+			return 1;
+		}
+		
+		if(!same_block(F,box,5,3,31) || box.Nx!=31 || box.Ny!=14 || box.Nz!=13)
+		{
+			std::cout<<"Error, box read mismatch with compression "<<compression<<"\n";
+			return 1;
+		}
+		
+		if(!same_block(F,slice,0,11,0) || slice.Ny!=1)
+		{
+			std::cout<<"Error, slice read mismatch with compression "<<compression<<"\n";
+			return 1;
+		}
+	}
+	
+	save_legacy(F,"fieldblock_sample_legacy.afblock");
+	
+	FieldBlockHolder legacy;
+	legacy.load_box("fieldblock_sample_legacy.afblock",2,9,1,19,30,60);
+	
+	if(!same_block(F,legacy,2,1,30) || legacy.Nz!=15)
+	{
+		std::cout<<"Error, legacy read mismatch\n";
+		return 1;
+	}
+	
+	// Corrupted headers and index
+	
+	std::uint64_t const tile_x_pos=8+2*sizeof(int);
+	std::uint64_t const Nx_pos=8+5*sizeof(int)+sizeof(double)+sizeof(int);
+	std::uint64_t const index_pos=8+5*sizeof(int)+sizeof(double)+6*sizeof(int)+3*sizeof(double);
+	
+	std::string fname="fieldblock_sample_corrupted.afblock";
+	FieldBlockReader reader;
+	
+	F.save(fname,FB_RAW);
+	patch_file(fname,tile_x_pos,0);
+	
+	if(reader.open(fname))
+	{
+		std::cout<<"Error, zero tile size accepted\n";
+		return 1;
+	}
+	
+	F.save(fname,FB_RAW);
+	patch_file(fname,Nx_pos,-3);
+	
+	if(reader.open(fname))
+	{
+		std::cout<<"Error, negative block size accepted\n";
+		return 1;
+	}
+	
+	F.save(fname,FB_RAW);
+	
+	std::uint64_t index_offset=peek_file<std::uint64_t>(fname,index_pos);
+	std::uint64_t tile_size=peek_file<std::uint64_t>(fname,index_offset+sizeof(std::uint64_t));
+	
+	patch_file(fname,index_offset+sizeof(std::uint64_t),tile_size+64);
+	
+	FieldBlockHolder corrupted;
+	corrupted.load(fname);
+	
+	if(same_block(F,corrupted,0,0,0))
+	{
+		std::cout<<"Error, raw tile of the wrong size was read\n";
+		return 1;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_core.h>
+#include <phys_tools.h>
+#include <sources.h>
+
+#include <iostream>
+
+extern const Imdouble Im;
+
+static bool close_to(Imdouble const &a,Imdouble const &b,double scale)
+{
+	return std::abs(a-b)<=1e-9*scale;
+}
+
+// Bloch_Wideband: the chirp-z tables against the plain spectral sums, and
+// the direct evaluation used past the tables against longer ones
+
+static bool check_bloch()
+{
+	int N=12,Nz=60,Nt=1500;
+	double D=10e-9;
+	double Dt=0.99*D/(c_light*std::sqrt(3.0));
+	
+	FDTD fdtd(N,N,Nz,Nt,D,D,D,Dt,"CUSTOM",0,0,0,0,0,0);
+	
+	Grid3<unsigned int> matsgrid(fdtd.Nx,fdtd.Ny,fdtd.Nz,0);
+	Material vacuum;
+	
+	fdtd.set_matsgrid(matsgrid);
+	fdtd.set_material(0,vacuum);
+	fdtd.set_kx(0);
+	fdtd.set_ky(0);
+	fdtd.bootstrap();
+	
+	double kx=2.0*Pi/600e-9*std::sin(0.4),ky=2.0*Pi/600e-9*std::sin(0.2);
+	
+	Bloch_Wideband bloch(0,N,0,N,0,40,kx,ky,Degree(30));
+	bloch.set_spectrum(400e-9,800e-9);
+	bloch.link(fdtd);
+	
+	double z_E=bloch.z2*D;
+	
+	double scale=0;
+	for(int n=0;n<Nt;n++) scale=std::max({scale,std::abs(bloch.wave_Ex[n]),std::abs(bloch.wave_Ey[n])});
+	
+	for(int n=0;n<Nt;n+=37)
+	{
+		Imdouble Ex=0,Ey=0;
+		
+		for(int l=0;l<bloch.Nl;l++)
+		{
+			Imdouble coeff=std::exp(-(bloch.kz[l]*z_E+bloch.w[l]*Dt*(n+bloch.t_offset))*Im);
+			
+			Ex+=bloch.E_base[l].x*coeff;
+			Ey+=bloch.E_base[l].y*coeff;
+		}
+		
+		if(!close_to(bloch.wave_Ex[n],Ex,scale) || !close_to(bloch.wave_Ey[n],Ey,scale))
+		{
+			std::cout<<"Error, Bloch table mismatch at step "<<n<<"\n";
+			return false;
+		}
+	}
+	
+	std::vector<Imdouble> long_x,long_y;
+	
+	bloch.Nt=2*Nt;
+	bloch.tabulate(long_x,long_y,bloch.E_base,z_E,bloch.t_offset);
+	
+	for(int n=Nt;n<2*Nt;n+=41)
+	{
+		Imdouble Ex,Ey;
+		bloch.wave_at(Ex,Ey,bloch.E_base,z_E,bloch.t_offset,n);
+		
+		if(!close_to(long_x[n],Ex,scale) || !close_to(long_y[n],Ey,scale))
+		{
+			std::cout<<"Error, Bloch direct evaluation mismatch at step "<<n<<"\n";
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+// AFP_TFSF on synthetic profiles: the tables against the plain sums, and
+// the direct evaluation used past the tables against longer ones
+
+static bool check_afp()
+{
+	int Nz=50,Nl=300,Nt=1200;
+	
+	AFP_TFSF afp;
+	
+	afp.Nz=Nz;
+	afp.Nl=Nl;
+	afp.Nt=Nt;
+	afp.Dt=1.6e-17;
+	afp.lambda_min=400e-9;
+	afp.lambda_max=1000e-9;
+	
+	Grid2<Imdouble> *profiles[6]={&afp.Ex,&afp.Ey,&afp.Ez,&afp.Hx,&afp.Hy,&afp.Hz};
+	
+	for(int f=0;f<6;f++)
+	{
+		profiles[f]->init(Nz,Nl);
+		
+		for(int k=0;k<Nz;k++) for(int l=0;l<Nl;l++)
+			(*profiles[f])(k,l)=std::exp((0.13*k*(f+1)+0.01*l)*Im)*(1.0+0.1*f);
+	}
+	
+	afp.tabulate();
+	
+	int k1=Nz/5,k2=3*Nz/4;
+	
+	for(int t=0;t<Nt;t+=29)
+	{
+		double E[4]={0,0,0,0},H[4]={0,0,0,0};
+		
+		for(int l=0;l<Nl;l++)
+		{
+			double lambda=afp.lambda_min+(afp.lambda_max-afp.lambda_min)*l/(Nl-1.0);
+			double w=2.0*Pi*c_light/lambda;
+			
+			Imdouble cE=gaussian_spectrum(w,afp.lambda_min,afp.lambda_max,0.001)*std::exp(-w*(t+0.5-500)*afp.Dt*Im);
+			Imdouble cH=gaussian_spectrum(w,afp.lambda_min,afp.lambda_max,0.001)*std::exp(-w*(t+1-500)*afp.Dt*Im);
+			Imdouble cH1=gaussian_spectrum(w,afp.lambda_min,afp.lambda_max,0.0001)*std::exp(-w*(t+1-500)*afp.Dt*Im);
+			
+			H[0]+=std::real(afp.Hx(k2-1,l)*cE); H[1]+=std::real(afp.Hy(k2-1,l)*cE);
+			H[2]+=std::real(afp.Hx(k1-1,l)*cE); H[3]+=std::real(afp.Hy(k1-1,l)*cE);
+			
+			E[0]+=std::real(afp.Ex(k2,l)*cH); E[1]+=std::real(afp.Ey(k2,l)*cH);
+			E[2]+=std::real(afp.Ex(k1,l)*cH1); E[3]+=std::real(afp.Ey(k1,l)*cH1);
+		}
+		
+		for(int n=0;n<4;n++)
+		{
+			if(!close_to(afp.wave_E(n,t),E[n],1.0+std::abs(E[n])) || !close_to(afp.wave_H(n,t),H[n],1.0+std::abs(H[n])))
+			{
+				std::cout<<"Error, AFP table mismatch at step "<<t<<"\n";
+				return false;
+			}
+		}
+	}
+	
+	Grid2<double> wave_E=afp.wave_E,wave_H=afp.wave_H;
+	
+	afp.Nt=2*Nt;
+	afp.tabulate();
+	
+	for(int t=0;t<Nt;t++) for(int n=0;n<4;n++)
+	{
+		if(afp.wave_E(n,t)!=wave_E(n,t) || afp.wave_H(n,t)!=wave_H(n,t))
+		{
+			std::cout<<"Error, AFP table depends on its length\n";
+			return false;
+		}
+	}
+	
+	for(int t=Nt;t<2*Nt;t+=31)
+	{
+		double E[4],H[4];
+		afp.wave_at(t,E,H);
+		
+		for(int n=0;n<4;n++)
+		{
+			if(E[n]!=afp.wave_E(n,t) || H[n]!=afp.wave_H(n,t))
+			{
+				std::cout<<"Error, AFP direct evaluation mismatch at step "<<t<<"\n";
+				return false;
+			}
+		}
+	}
+	
+	return true;
+}
+
+int injection_tables(int argc,char *argv[])
+{
+	if(!check_bloch()) return 1;
+	if(!check_afp()) return 1;
+	
+	return 0;
+}
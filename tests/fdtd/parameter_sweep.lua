@@ -0,0 +1,42 @@
+structure=Structure("../../samples/fdtd/structures/basic_parametric.lua")
+
+Material_0=Material()
+Material_0:refractive_index(1)
+
+fdtd=MODE("fdtd")
+fdtd:structure(structure)
+fdtd:Dxyz(20e-9)
+fdtd:N_tsteps(10)
+fdtd:material(0,Material_0)
+
+sweep=MODE("fdtd_sweep")
+sweep:fdtd(fdtd)
+sweep:parameter("pz",{400e-9,500e-9})
+sweep:parameter("lambda",{500e-9,600e-9,700e-9})
+sweep:output_directory("sweep_test")
+
+calls=0
+
+sweep:compute(function(run,p,n)
+	calls=calls+1
+	
+	if run:Lz()~=p.pz then
+		print("Wrong geometry for run " .. n)
+		fail_test()
+	end
+	
+	run:spectrum(p.lambda-50e-9,p.lambda+50e-9,11)
+end)
+
+if calls~=6 then
+	print("Setup called " .. calls .. " times")
+	fail_test()
+end
+
+lines=0
+for line in io.lines("sweep_test/sweep.txt") do lines=lines+1 end
+
+if lines~=7 then
+	print("Incomplete results file")
+	fail_test()
+end
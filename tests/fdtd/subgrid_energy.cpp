@@ -0,0 +1,134 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <fdtd_subgrid.h>
+
+#include <cmath>
+#include <iostream>
+
+// Field energy over the cells [0,N-1) of the grid, the cells of the box
+// [i1,i2)x[j1,j2)x[k1,k2) excluded
+
+static double grid_energy(FDTD &fdtd,int i1,int i2,int j1,int j2,int k1,int k2)
+{
+	double W=0;
+	
+	for(int i=0;i<fdtd.Nx-1;i++) for(int j=0;j<fdtd.Ny-1;j++) for(int k=0;k<fdtd.Nz-1;k++)
+	{
+		if(i>=i1 && i<i2 && j>=j1 && j<j2 && k>=k1 && k<k2) continue;
+		
+		double eps=fdtd.mats[fdtd.matsgrid(i,j,k)].ei;
+		
+		W+=e0*eps*(fdtd.Ex(i,j,k)*fdtd.Ex(i,j,k)+fdtd.Ey(i,j,k)*fdtd.Ey(i,j,k)+fdtd.Ez(i,j,k)*fdtd.Ez(i,j,k))
+		  +mu0*(fdtd.Hx(i,j,k)*fdtd.Hx(i,j,k)+fdtd.Hy(i,j,k)*fdtd.Hy(i,j,k)+fdtd.Hz(i,j,k)*fdtd.Hz(i,j,k));
+	}
+	
+	return W*fdtd.Dx*fdtd.Dy*fdtd.Dz;
+}
+
+static double total_energy(FDTD &fdtd,FDTD_Subgrid &subgrid)
+{
+	int Lx=subgrid.i2-subgrid.i1;
+	int Ly=subgrid.j2-subgrid.j1;
+	int Lz=subgrid.k2-subgrid.k1;
+	
+	return grid_energy(fdtd,subgrid.i1-1,subgrid.i2+1,subgrid.j1-1,subgrid.j2+1,subgrid.k1-1,subgrid.k2+1)
+	      +grid_energy(*subgrid.buffer,1,Lx+1,1,Ly+1,1,Lz+1)
+	      +grid_energy(*subgrid.fine,0,0,0,0,0,0);
+}
+
+// Closed lossless grid holding a subgrid around a dielectric cube, run at
+// the Courant limit: the energy of the pulse has to stay put
+
+int subgrid_energy(int argc,char *argv[])
+{
+	int N=24,ratio=3,Nt=6000;
+	int b1=9,b2=15;
+	double D=20e-9;
+	double Dt=0.99*D/(c_light*std::sqrt(3.0));
+	
+	Material vacuum,cube;
+	cube.eps_inf=4.0;
+	
+	FDTD fdtd(N,N,N,Nt,D,D,D,Dt,"CUSTOM",0,0,0,0,0,0);
+	
+	Grid3<unsigned int> matsgrid(N,N,N,0);
+	
+	fdtd.set_matsgrid(matsgrid);
+	fdtd.set_material(0,vacuum);
+	fdtd.set_kx(0);
+	fdtd.set_ky(0);
+	fdtd.bootstrap();
+	fdtd.reset_fields();
+	
+	FDTD_Subgrid *subgrid=fdtd.add_subgrid(b1,b2,b1,b2,b1,b2,ratio);
+	FDTD &fine=*(subgrid->fine);
+	
+	Grid3<unsigned int> fine_grid(fine.Nx,fine.Ny,fine.Nz,0);
+	
+	for(int i=6;i<12;i++) for(int j=6;j<12;j++) for(int k=6;k<12;k++) fine_grid(i,j,k)=1;
+	
+	fine.set_matsgrid(fine_grid);
+	fine.set_material(0,vacuum);
+	fine.set_material(1,cube);
+	
+	// Pulse away from the subgrid, which wraps around the grid
+	
+	for(int i=0;i<N;i++) for(int j=0;j<N;j++) for(int k=0;k<N;k++)
+	{
+		double x=i-3.0,y=j-12.0,z=k-12.0;
+		
+		fdtd.Ez(i,j,k)=std::exp(-(x*x+y*y+z*z)/8.0);
+	}
+	
+	subgrid->bootstrap();
+	
+	double W0=total_energy(fdtd,*subgrid);
+	double W_min=W0,W_max=W0;
+	
+	for(int t=0;t<Nt;t++)
+	{
+		fdtd.update_E();
+		fdtd.update_H();
+		
+		if(t%50==0)
+		{
+			double W=total_energy(fdtd,*subgrid);
+			
+			W_min=std::min(W_min,W);
+			W_max=std::max(W_max,W);
+		}
+	}
+	
+	std::cout<<"Energy over "<<Nt<<" steps: "<<W_min/W0<<" to "<<W_max/W0<<" of the initial one"<<std::endl;
+	
+	if(!(W_max<1.2*W0 && W_min>0.8*W0))
+	{
+		std::cerr<<"Subgrid energy not conserved"<<std::endl;
+		return 1;
+	}
+	
+	// Cell updates per coarse step, against a grid refined everywhere
+	
+	double cells=static_cast<double>(N)*N*N
+	            +ratio*(static_cast<double>(subgrid->buffer->Nx)*subgrid->buffer->Ny*subgrid->buffer->Nz
+	                   +static_cast<double>(fine.Nx)*fine.Ny*fine.Nz);
+	double cells_uniform=ratio*std::pow(static_cast<double>(N*ratio),3.0);
+	
+	std::cout<<"Cell updates per coarse step: "<<cells<<" against "<<cells_uniform<<" when refined everywhere"<<std::endl;
+	
+	if(cells>=cells_uniform) return 1;
+	
+	return 0;
+}
@@ -0,0 +1,127 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <lua_fdtd.h>
+
+#include <cmath>
+#include <iostream>
+
+static FDTD* twin_fdtd()
+{
+	int N=20;
+	double D=10e-9;
+	double Dt=0.9*D/(c_light*std::sqrt(3.0));
+	
+	FDTD *fdtd=new FDTD(N,N,N,200,D,D,D,Dt,"CUSTOM",0,0,0,0,4,4);
+	
+	Grid3<unsigned int> matsgrid(N,N,N,0);
+	for(int i=0;i<N;i++) for(int j=0;j<N;j++) for(int k=8;k<12;k++) matsgrid(i,j,k)=1;
+	
+	Material vacuum,slab;
+	LorentzModel lorentz;
+	
+	slab.eps_inf=2.5;
+	lorentz.set(1.0,2e15,1e14);
+	slab.lorentz.push_back(lorentz);
+	
+	fdtd->set_matsgrid(matsgrid);
+	fdtd->set_material(0,vacuum);
+	fdtd->set_material(1,slab);
+	
+	fdtd->set_pml_zm(25,1,0.2);
+	fdtd->set_pml_zp(25,1,0.2);
+	fdtd->set_kx(0);
+	fdtd->set_ky(0);
+	
+	fdtd->bootstrap();
+	fdtd->reset_fields();
+	fdtd->tstep=0;
+	
+	return fdtd;
+}
+
+// Gaussian pulse centered on (x,y,z), different for every grid
+
+static void twin_pulse(FDTD &fdtd,double x,double y,double z)
+{
+	for(int i=0;i<fdtd.Nx;i++) for(int j=0;j<fdtd.Ny;j++) for(int k=0;k<fdtd.Nz;k++)
+	{
+		double r2=(i-x)*(i-x)+(j-y)*(j-y)+(k-z)*(k-z);
+		
+		fdtd.Ex(i,j,k)=std::exp(-r2/4.0);
+		fdtd.Hy(i,j,k)=0.5*std::exp(-r2/6.0);
+	}
+}
+
+static bool same_fields(FDTD &A,FDTD &B)
+{
+	for(int i=0;i<A.Nx;i++) for(int j=0;j<A.Ny;j++) for(int k=0;k<A.Nz;k++)
+	{
+		if(A.Ex(i,j,k)!=B.Ex(i,j,k) || A.Ey(i,j,k)!=B.Ey(i,j,k) || A.Ez(i,j,k)!=B.Ez(i,j,k) ||
+		   A.Hx(i,j,k)!=B.Hx(i,j,k) || A.Hy(i,j,k)!=B.Hy(i,j,k) || A.Hz(i,j,k)!=B.Hz(i,j,k)) return false;
+	}
+	
+	return true;
+}
+
+// Grids advanced as twins of a lead, in the cell loops of the lead, have
+// to follow the very same steps as when advanced on their own
+
+int twin_batch(int argc,char *argv[])
+{
+	int Nt=80,Nb=3;
+	bool success=true;
+	
+	std::vector<FDTD*> batch(Nb),single(Nb);
+	
+	for(int n=0;n<Nb;n++)
+	{
+		batch[n]=twin_fdtd();
+		single[n]=twin_fdtd();
+		
+		twin_pulse(*batch[n],6+3*n,10,5+n);
+		twin_pulse(*single[n],6+3*n,10,5+n);
+		
+		if(n>0) batch[0]->link_twin(*batch[n]);
+	}
+	
+	for(int t=0;t<Nt;t++)
+	{
+		batch[0]->update_E();
+		batch[0]->update_H();
+		
+		for(int n=0;n<Nb;n++)
+		{
+			single[n]->update_E();
+			single[n]->update_H();
+		}
+	}
+	
+	for(int n=0;n<Nb;n++)
+	{
+		if(!same_fields(*batch[n],*single[n]) || batch[n]->tstep!=Nt)
+		{
+			std::cerr<<"Twin "<<n<<" differs from its standalone run"<<std::endl;
+			success=false;
+		}
+	}
+	
+	for(int n=0;n<Nb;n++)
+	{
+		delete batch[n];
+		delete single[n];
+	}
+	
+	return success ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <multilayers.h>
+
+#include <iostream>
+
+static bool close_to(double a,double b)
+{
+	return std::abs(a-b)<=1e-9*(1.0+std::abs(b));
+}
+
+static bool close_to(Imdouble const &a,Imdouble const &b)
+{
+	return std::abs(a-b)<=1e-9*(1.0+std::abs(b));
+}
+
+// Checks Multilayer_TMM_Batch against Multilayer_TMM, point by point, over
+// absorbing stacks and substrates, oblique incidence and total internal
+// reflection. The number of points is large enough for the pool to be used
+
+int tmm_batch(int argc,char *argv[])
+{
+	int N=5;
+	int Npts=2048;
+	
+	Multilayer_TMM_Batch batch(N,Npts);
+	
+	std::vector<Imdouble> sup(Npts),sub(Npts);
+	std::vector<double> angle(Npts);
+	
+	for(int p=0;p<Npts;p++)
+	{
+		int c=p%4;
+		
+		     if(c==0) { sup[p]=1.0; sub[p]=Imdouble(1.5,0.02); angle[p]=0; }
+		else if(c==1) { sup[p]=1.0; sub[p]=Imdouble(1.5,0.02); angle[p]=50.0*Pi/180.0; }
+		else if(c==2) { sup[p]=1.8; sub[p]=1.0; angle[p]=60.0*Pi/180.0; }
+		else          { sup[p]=1.33; sub[p]=Imdouble(0.2,3.0); angle[p]=30.0*Pi/180.0; }
+		
+		batch.set_point(p,(400.0+0.2*p)*1e-9,AngleRad(angle[p]));
+		batch.set_environment(p,sup[p],sub[p]);
+		
+		for(int l=0;l<N;l++)
+			batch.set_index(l,p,Imdouble(1.4+0.3*((l+p)%3),0.01*(l%2)+0.001*(p%7)));
+	}
+	
+	for(int l=0;l<N;l++) batch.set_layer(l,(70+23*l)*1e-9);
+	
+	batch.compute();
+	
+	for(int p=0;p<Npts;p++)
+	{
+		Multilayer_TMM tmm(N);
+		
+		tmm.set_environment(sup[p],sub[p]);
+		tmm.set_lambda((400.0+0.2*p)*1e-9);
+		tmm.set_angle(AngleRad(angle[p]));
+		
+		for(int l=0;l<N;l++)
+			tmm.set_layer(l,(70+23*l)*1e-9,Imdouble(1.4+0.3*((l+p)%3),0.01*(l%2)+0.001*(p%7)));
+		
+		Imdouble r_TE,r_TM,t_TE,t_TM;
+		double R_TE,T_TE,A_TE,R_TM,T_TM,A_TM;
+		
+		tmm.compute(r_TE,r_TM,t_TE,t_TM);
+		tmm.compute_power(R_TE,T_TE,A_TE,R_TM,T_TM,A_TM);
+		
+		if(!close_to(batch.r_TE[p],r_TE) || !close_to(batch.r_TM[p],r_TM) ||
+		   !close_to(batch.t_TE[p],t_TE) || !close_to(batch.t_TM[p],t_TM))
+		{
+			std::cout<<"Error, amplitudes mismatch at point "<<p<<" (case "<<p%4<<")\n";
+			return 1;
+		}
+		
+		if(!close_to(batch.R_TE[p],R_TE) || !close_to(batch.R_TM[p],R_TM) ||
+		   !close_to(batch.T_TE[p],T_TE) || !close_to(batch.T_TM[p],T_TM))
+		{
+			std::cout<<"Error, powers mismatch at point "<<p<<" (case "<<p%4<<")\n";
+			return 1;
+		}
+	}
+	
+	return 0;
+}
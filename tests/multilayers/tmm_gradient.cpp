@@ -0,0 +1,113 @@
+/*Copyright 2008-2024 - Loc Le Cunff
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.*/
+
+#include <multilayers.h>
+
+#include <iostream>
+
+static void powers(Multilayer_TMM &tmm,double *P)
+{
+	double A_TE,A_TM;
+	
+	tmm.compute_power(P[0],P[1],A_TE,P[2],P[3],A_TM);
+}
+
+static bool close_to(double a,double b)
+{
+	return std::abs(a-b)<=1e-6*(1.0+std::abs(b));
+}
+
+// Checks the analytic derivatives of Multilayer_TMM against central differences
+
+int tmm_gradient(int argc,char *argv[])
+{
+	int N=7;
+	double angles[3]={0,0.6,1.0};
+	
+	for(int c=0;c<3;c++)
+	{
+		Multilayer_TMM tmm(N);
+		
+		tmm.set_environment(c==2 ? 1.8 : 1.0,Imdouble(1.5,0.01));
+		tmm.set_lambda(550e-9);
+		tmm.set_angle(AngleRad(angles[c]));
+		
+		for(int l=0;l<N;l++)
+			tmm.set_layer(l,(60+17*l)*1e-9,Imdouble(1.4+0.3*(l%3),0.02*(l%2)));
+		
+		MLGradientHolder holder;
+		tmm.compute_gradient(holder);
+		
+		double P[4],Pp[4],Pm[4];
+		powers(tmm,P);
+		
+		if(!close_to(holder.R_TE,P[0]) || !close_to(holder.T_TE,P[1]) ||
+		   !close_to(holder.R_TM,P[2]) || !close_to(holder.T_TM,P[3]))
+		{
+			std::cout<<"Error, powers mismatch in case "<<c<<"\n";
+			return 1;
+		}
+		
+		for(int l=0;l<N;l++)
+		{
+			double dh=1e-12;
+			
+			Multilayer_TMM tmm_p(tmm),tmm_m(tmm);
+			tmm_p.h_layer[l]+=dh;
+			tmm_m.h_layer[l]-=dh;
+			
+			powers(tmm_p,Pp);
+			powers(tmm_m,Pm);
+			
+			double dP_dh[4]={holder.dR_TE_dh[l],holder.dT_TE_dh[l],holder.dR_TM_dh[l],holder.dT_TM_dh[l]};
+			
+			for(int k=0;k<4;k++)
+			{
+				if(!close_to((Pp[k]-Pm[k])/(2.0*dh),dP_dh[k]))
+				{
+					std::cout<<"Error, thickness derivative mismatch in case "<<c<<" for layer "<<l<<"\n";
+					return 1;
+				}
+			}
+			
+			Imdouble dP_dn[4]={holder.dR_TE_dn[l],holder.dT_TE_dn[l],holder.dR_TM_dn[l],holder.dT_TM_dn[l]};
+			
+			for(int part=0;part<2;part++)
+			{
+				double dn=1e-7;
+				Imdouble delta=(part==0) ? Imdouble(dn,0) : Imdouble(0,dn);
+				
+				Multilayer_TMM tmm_np(tmm),tmm_nm(tmm);
+				tmm_np.index_layer[l]+=delta;
+				tmm_nm.index_layer[l]-=delta;
+				
+				powers(tmm_np,Pp);
+				powers(tmm_nm,Pm);
+				
+				for(int k=0;k<4;k++)
+				{
+					double analytic=(part==0) ? dP_dn[k].real() : dP_dn[k].imag();
+					
+					if(!close_to((Pp[k]-Pm[k])/(2.0*dn),analytic))
+					{
+						std::cout<<"Error, index derivative mismatch in case "<<c<<" for layer "<<l<<"\n";
+						return 1;
+					}
+				}
+			}
+		}
+	}
+	
+	return 0;
+}